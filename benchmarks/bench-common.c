@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bench-common.h"
+
+#include <wayland-client.h>
+#include <wayland-egl.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+
+/*
+ * Arguments
+ */
+
+void benchParseArgs(BenchArgs *args, int argc, char *const *argv)
+{
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) || !strchr(argv[i], '=')) {
+            fprintf(stderr, "usage: %s [--<option>=<value>...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    args->argc = argc;
+    args->argv = argv;
+}
+
+const char *benchArgString(const BenchArgs *args, const char *name,
+                           const char *defaultValue)
+{
+    size_t len = strlen(name);
+    int i;
+
+    /* The last one wins, so options can be overridden */
+    for (i = args->argc - 1; i > 0; i--) {
+        const char *arg = args->argv[i] + 2;
+
+        if (!strncmp(arg, name, len) && arg[len] == '=') {
+            return arg + len + 1;
+        }
+    }
+    return defaultValue;
+}
+
+uint64_t benchArgU64(const BenchArgs *args, const char *name,
+                     uint64_t defaultValue)
+{
+    const char *str = benchArgString(args, name, NULL);
+
+    return str ? strtoull(str, NULL, 10) : defaultValue;
+}
+
+double benchArgDouble(const BenchArgs *args, const char *name,
+                      double defaultValue)
+{
+    const char *str = benchArgString(args, name, NULL);
+
+    return str ? strtod(str, NULL) : defaultValue;
+}
+
+int benchScenarioEnabled(const BenchArgs *args, const char *name)
+{
+    const char *list = benchArgString(args, "scenario", NULL);
+    size_t len = strlen(name);
+    const char *str;
+
+    if (!list) {
+        return 1;
+    }
+
+    for (str = list; (str = strstr(str, name)) != NULL; str += len) {
+        if ((str == list || str[-1] == ',') &&
+            (str[len] == '\0' || str[len] == ',')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Samples
+ */
+
+void benchSamplesInit(BenchSamples *samples)
+{
+    memset(samples, 0, sizeof(*samples));
+}
+
+void benchSamplesAdd(BenchSamples *samples, uint64_t value)
+{
+    if (samples->count == samples->size) {
+        samples->size = samples->size ? samples->size * 2 : 1024;
+        samples->values = realloc(samples->values,
+                                  samples->size * sizeof(uint64_t));
+        BENCH_CHECK(samples->values != NULL);
+    }
+    samples->values[samples->count++] = value;
+    samples->sorted = 0;
+}
+
+static int compareU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void sortSamples(BenchSamples *samples)
+{
+    if (!samples->sorted) {
+        qsort(samples->values, samples->count, sizeof(uint64_t), compareU64);
+        samples->sorted = 1;
+    }
+}
+
+/* Nearest rank */
+uint64_t benchSamplesPercentile(BenchSamples *samples, double percentile)
+{
+    size_t rank;
+
+    if (samples->count == 0) {
+        return 0;
+    }
+    sortSamples(samples);
+
+    rank = (size_t)(percentile * samples->count);
+    if (rank < percentile * samples->count || rank == 0) {
+        rank++;
+    }
+    if (rank > samples->count) {
+        rank = samples->count;
+    }
+    return samples->values[rank - 1];
+}
+
+uint64_t benchSamplesMax(BenchSamples *samples)
+{
+    if (samples->count == 0) {
+        return 0;
+    }
+    sortSamples(samples);
+
+    return samples->values[samples->count - 1];
+}
+
+void benchSamplesFree(BenchSamples *samples)
+{
+    free(samples->values);
+    benchSamplesInit(samples);
+}
+
+uint64_t benchGetTimeNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void benchSleepUntilNs(uint64_t timeNs)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = timeNs / 1000000000ull;
+    ts.tv_nsec = timeNs % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/*
+ * JSON output
+ */
+
+static void jsonString(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static void jsonPrefix(BenchJson *json, const char *key)
+{
+    if (json->count[json->depth]++) {
+        fputc(',', json->out);
+    }
+    if (key) {
+        jsonString(json->out, key);
+        fputc(':', json->out);
+    }
+}
+
+static void jsonBegin(BenchJson *json, const char *key, char open)
+{
+    BENCH_CHECK(json->depth + 1 < BENCH_JSON_MAX_DEPTH);
+
+    jsonPrefix(json, key);
+    fputc(open, json->out);
+    json->count[++json->depth] = 0;
+}
+
+void benchJsonOpen(BenchJson *json, const BenchArgs *args)
+{
+    const char *path = benchArgString(args, "output", NULL);
+
+    memset(json, 0, sizeof(*json));
+    json->out = path ? fopen(path, "w") : stdout;
+    BENCH_CHECK(json->out != NULL);
+
+    fputc('{', json->out);
+}
+
+void benchJsonClose(BenchJson *json)
+{
+    BENCH_CHECK(json->depth == 0);
+
+    fputs("}\n", json->out);
+    if (json->out != stdout) {
+        fclose(json->out);
+    } else {
+        fflush(json->out);
+    }
+}
+
+void benchJsonBeginObject(BenchJson *json, const char *key)
+{
+    jsonBegin(json, key, '{');
+}
+
+void benchJsonBeginArray(BenchJson *json, const char *key)
+{
+    jsonBegin(json, key, '[');
+}
+
+void benchJsonEnd(BenchJson *json, char close)
+{
+    BENCH_CHECK(json->depth > 0);
+
+    fputc(close, json->out);
+    json->depth--;
+}
+
+void benchJsonString(BenchJson *json, const char *key, const char *value)
+{
+    jsonPrefix(json, key);
+    jsonString(json->out, value);
+}
+
+void benchJsonU64(BenchJson *json, const char *key, uint64_t value)
+{
+    jsonPrefix(json, key);
+    fprintf(json->out, "%llu", (unsigned long long)value);
+}
+
+void benchJsonDouble(BenchJson *json, const char *key, double value)
+{
+    jsonPrefix(json, key);
+    fprintf(json->out, "%.3f", value);
+}
+
+void benchJsonBool(BenchJson *json, const char *key, int value)
+{
+    jsonPrefix(json, key);
+    fputs(value ? "true" : "false", json->out);
+}
+
+void benchJsonRaw(BenchJson *json, const char *key, const char *value)
+{
+    jsonPrefix(json, key);
+    fputs(value, json->out);
+}
+
+void benchJsonSamples(BenchJson *json, const char *key, BenchSamples *samples)
+{
+    benchJsonBeginObject(json, key);
+    benchJsonU64(json, "count", samples->count);
+    benchJsonDouble(json, "p50_us",
+                    benchSamplesPercentile(samples, 0.50) / 1000.0);
+    benchJsonDouble(json, "p99_us",
+                    benchSamplesPercentile(samples, 0.99) / 1000.0);
+    benchJsonDouble(json, "p999_us",
+                    benchSamplesPercentile(samples, 0.999) / 1000.0);
+    benchJsonDouble(json, "max_us", benchSamplesMax(samples) / 1000.0);
+    benchJsonEndObject(json);
+}
+
+/*
+ * Per-stage swap statistics
+ */
+
+void benchSwapStatsOpen(BenchSwapStats *stats)
+{
+    int fd;
+
+    snprintf(stats->path, sizeof(stats->path), "/tmp/bench-swap-stats-XXXXXX");
+    stats->offset = 0;
+
+    fd = mkstemp(stats->path);
+    BENCH_CHECK(fd >= 0);
+    close(fd);
+
+    /* The platform reads this once, before the first surface is created */
+    setenv("__NV_WAYLAND_SWAP_STATS", stats->path, 1);
+}
+
+void benchSwapStatsClose(BenchSwapStats *stats)
+{
+    unlink(stats->path);
+}
+
+void benchJsonSwapStats(BenchJson *json, const char *key,
+                        BenchSwapStats *stats)
+{
+    char line[8192];
+    FILE *f;
+
+    f = fopen(stats->path, "r");
+    BENCH_CHECK(f != NULL);
+    BENCH_CHECK(fseek(f, stats->offset, SEEK_SET) == 0);
+
+    benchJsonBeginArray(json, key);
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0]) {
+            benchJsonRaw(json, NULL, line);
+        }
+    }
+    benchJsonEndArray(json);
+
+    stats->offset = ftell(f);
+    fclose(f);
+}
+
+/*
+ * Process usage
+ */
+
+/* Reads "<name> <value>" lines, as in /proc/self/status and /proc/self/io */
+static uint64_t readProcValue(const char *path, const char *name)
+{
+    char line[256];
+    size_t len = strlen(name);
+    uint64_t value = 0;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, name, len)) {
+            value = strtoull(line + len, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+
+    return value;
+}
+
+static uint64_t countFds(void)
+{
+    struct dirent *entry;
+    uint64_t count = 0;
+    DIR *dir;
+
+    dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+
+    /* Minus the one opendir() used */
+    return count ? count - 1 : 0;
+}
+
+void benchGetUsage(BenchUsage *usage)
+{
+    struct rusage ru;
+
+    usage->fds           = countFds();
+    usage->threads       = readProcValue("/proc/self/status", "Threads:");
+    usage->rssKb         = readProcValue("/proc/self/status", "VmRSS:");
+    usage->peakRssKb     = readProcValue("/proc/self/status", "VmHWM:");
+    usage->syscallsRead  = readProcValue("/proc/self/io", "syscr:");
+    usage->syscallsWrite = readProcValue("/proc/self/io", "syscw:");
+
+    getrusage(RUSAGE_SELF, &ru);
+    usage->ctxSwitches = ru.ru_nvcsw;
+}
+
+/*
+ * Platform setup
+ */
+
+void benchLoadPlatform(MockEgl *platform)
+{
+    MockEglOptions options;
+
+    mockEglGetDefaultOptions(&options);
+    BENCH_CHECK(mockEglLoad(platform, &options));
+}
+
+void benchUnloadPlatform(MockEgl *platform)
+{
+    PFNEGLTERMINATEPROC terminate;
+
+    /* EGLStream compositors initialize the device display */
+    terminate = (PFNEGLTERMINATEPROC)mockEglGetProcAddress("eglTerminate");
+    terminate(mockEglGetDeviceDisplay());
+
+    mockEglUnload(platform);
+}
+
+void benchGetCompositorOptions(const BenchArgs *args,
+                               MockCompositorOptions *options)
+{
+    mockCompositorGetDefaultOptions(options);
+    options->refreshMhz = benchArgU64(args, "refresh", 1000) * 1000;
+}
+
+static void registryGlobal(void *data, struct wl_registry *registry,
+                           uint32_t name, const char *interface,
+                           uint32_t version)
+{
+    BenchClient *client = data;
+
+    (void) version;
+
+    if (!strcmp(interface, wl_compositor_interface.name)) {
+        client->wlCompositor = wl_registry_bind(registry, name,
+                                                &wl_compositor_interface, 4);
+    }
+}
+
+static void registryGlobalRemove(void *data, struct wl_registry *registry,
+                                 uint32_t name)
+{
+    (void) data;
+    (void) registry;
+    (void) name;
+}
+
+static const struct wl_registry_listener registryListener = {
+    registryGlobal,
+    registryGlobalRemove,
+};
+
+void benchClientConnectWayland(BenchClient *client, MockEgl *platform,
+                               MockCompositor *comp)
+{
+    struct wl_registry *registry;
+
+    memset(client, 0, sizeof(*client));
+    client->platform = platform;
+
+    client->wlDpy = mockCompositorConnect(comp);
+    BENCH_CHECK(client->wlDpy != NULL);
+
+    registry = wl_display_get_registry(client->wlDpy);
+    BENCH_CHECK(registry != NULL);
+    wl_registry_add_listener(registry, &registryListener, client);
+    BENCH_CHECK(wl_display_roundtrip(client->wlDpy) >= 0);
+    wl_registry_destroy(registry);
+    BENCH_CHECK(client->wlCompositor != NULL);
+}
+
+void benchClientChooseConfig(BenchClient *client)
+{
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_ALPHA_SIZE,   8,
+        EGL_NONE,
+    };
+    EGLint numConfigs;
+
+    BENCH_CHECK(client->platform->chooseConfig(client->dpy, configAttribs,
+                                               &client->config, 1,
+                                               &numConfigs));
+    BENCH_CHECK(numConfigs == 1);
+}
+
+void benchClientConnect(BenchClient *client, MockEgl *platform,
+                        MockCompositor *comp)
+{
+    benchClientConnectWayland(client, platform, comp);
+
+    client->dpy = mockEglGetDisplay(platform, client->wlDpy, NULL);
+    BENCH_CHECK(client->dpy != EGL_NO_DISPLAY);
+    BENCH_CHECK(platform->initialize(client->dpy, NULL, NULL));
+    benchClientChooseConfig(client);
+}
+
+void benchClientDisconnect(BenchClient *client)
+{
+    BENCH_CHECK(client->platform->terminate(client->dpy));
+    wl_compositor_destroy(client->wlCompositor);
+    wl_display_disconnect(client->wlDpy);
+}
+
+void benchSurfaceCreate(BenchSurface *surface, BenchClient *client,
+                        int width, int height)
+{
+    memset(surface, 0, sizeof(*surface));
+    surface->client = client;
+
+    surface->wlSurface = wl_compositor_create_surface(client->wlCompositor);
+    BENCH_CHECK(surface->wlSurface != NULL);
+    surface->window = wl_egl_window_create(surface->wlSurface, width, height);
+    BENCH_CHECK(surface->window != NULL);
+
+    surface->surface =
+        client->platform->createPlatformWindowSurface(client->dpy,
+                                                      client->config,
+                                                      surface->window,
+                                                      NULL);
+    BENCH_CHECK(surface->surface != EGL_NO_SURFACE);
+}
+
+void benchSurfaceDestroy(BenchSurface *surface)
+{
+    BenchClient *client = surface->client;
+
+    BENCH_CHECK(client->platform->destroySurface(client->dpy,
+                                                 surface->surface));
+    wl_egl_window_destroy(surface->window);
+    wl_surface_destroy(surface->wlSurface);
+}
+
+void benchSurfaceMakeCurrent(BenchSurface *surface, EGLint swapInterval)
+{
+    BenchClient *client = surface->client;
+
+    BENCH_CHECK(mockEglMakeCurrent(client->dpy, surface->surface,
+                                   surface->surface, MOCK_EGL_CONTEXT));
+    BENCH_CHECK(client->platform->swapInterval(client->dpy, swapInterval));
+}
+
+void benchSurfaceReleaseCurrent(BenchSurface *surface)
+{
+    BENCH_CHECK(mockEglMakeCurrent(surface->client->dpy, EGL_NO_SURFACE,
+                                   EGL_NO_SURFACE, EGL_NO_CONTEXT));
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <EGL/egl.h>
+
+#include "mock-egl-driver.h"
+#include "mock-compositor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Helpers shared by the benchmarks
+ *
+ * Every benchmark loads the platform on the mock driver, runs clients
+ * against the mock compositor and writes one JSON object with its results,
+ * to stdout or to --output=<file>. The driver and compositor are configured
+ * from the MOCK_EGL_* and MOCK_COMPOSITOR_* environment variables, except
+ * for the refresh rate, which is --refresh=<Hz> and defaults to 1000 so the
+ * runs are short. A refresh rate of 0 shows every commit right away.
+ */
+
+#define BENCH_CHECK(_COND_)                                             \
+    do {                                                                \
+        if (!(_COND_)) {                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #_COND_);                       \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+/*
+ * Arguments
+ */
+
+typedef struct BenchArgsRec {
+    int          argc;
+    char *const *argv;
+} BenchArgs;
+
+void benchParseArgs(BenchArgs *args, int argc, char *const *argv);
+
+/* Value of --<name>=<value>, or defaultValue */
+const char *benchArgString(const BenchArgs *args, const char *name,
+                           const char *defaultValue);
+uint64_t benchArgU64(const BenchArgs *args, const char *name,
+                     uint64_t defaultValue);
+double benchArgDouble(const BenchArgs *args, const char *name,
+                      double defaultValue);
+
+/* True when --scenario is unset or lists name, separated by commas */
+int benchScenarioEnabled(const BenchArgs *args, const char *name);
+
+/*
+ * Samples
+ */
+
+typedef struct BenchSamplesRec {
+    uint64_t *values;
+    size_t    count;
+    size_t    size;
+    int       sorted;
+} BenchSamples;
+
+void benchSamplesInit(BenchSamples *samples);
+void benchSamplesAdd(BenchSamples *samples, uint64_t value);
+uint64_t benchSamplesPercentile(BenchSamples *samples, double percentile);
+uint64_t benchSamplesMax(BenchSamples *samples);
+void benchSamplesFree(BenchSamples *samples);
+
+uint64_t benchGetTimeNs(void);
+void benchSleepUntilNs(uint64_t timeNs);
+
+/*
+ * JSON output
+ *
+ * Objects and arrays nest; every value written into an object is given a
+ * key, values written into an array are given NULL.
+ */
+
+#define BENCH_JSON_MAX_DEPTH 8
+
+typedef struct BenchJsonRec {
+    FILE *out;
+    int   depth;
+    int   count[BENCH_JSON_MAX_DEPTH];
+} BenchJson;
+
+void benchJsonOpen(BenchJson *json, const BenchArgs *args);
+void benchJsonClose(BenchJson *json);
+
+void benchJsonBeginObject(BenchJson *json, const char *key);
+void benchJsonBeginArray(BenchJson *json, const char *key);
+void benchJsonEnd(BenchJson *json, char close);
+void benchJsonString(BenchJson *json, const char *key, const char *value);
+void benchJsonU64(BenchJson *json, const char *key, uint64_t value);
+void benchJsonDouble(BenchJson *json, const char *key, double value);
+void benchJsonBool(BenchJson *json, const char *key, int value);
+/* Writes value, which must already be valid JSON */
+void benchJsonRaw(BenchJson *json, const char *key, const char *value);
+/* count, p50_us, p99_us, p999_us and max_us of samples in nanoseconds */
+void benchJsonSamples(BenchJson *json, const char *key, BenchSamples *samples);
+
+#define benchJsonEndObject(_JSON_) benchJsonEnd((_JSON_), '}')
+#define benchJsonEndArray(_JSON_)  benchJsonEnd((_JSON_), ']')
+
+/*
+ * Per-stage swap statistics
+ *
+ * benchSwapStatsOpen() points __NV_WAYLAND_SWAP_STATS at a temporary file,
+ * so it must be called before the platform is loaded. Every surface appends
+ * its report when it is destroyed; benchJsonSwapStats() writes the reports
+ * appended since its last call as an array.
+ */
+
+typedef struct BenchSwapStatsRec {
+    char path[64];
+    long offset;
+} BenchSwapStats;
+
+void benchSwapStatsOpen(BenchSwapStats *stats);
+void benchSwapStatsClose(BenchSwapStats *stats);
+void benchJsonSwapStats(BenchJson *json, const char *key,
+                        BenchSwapStats *stats);
+
+/*
+ * Process usage, from /proc/self
+ */
+
+typedef struct BenchUsageRec {
+    uint64_t fds;
+    uint64_t threads;
+    uint64_t rssKb;
+    uint64_t peakRssKb;
+    uint64_t syscallsRead;   /* syscr: read(2)-like calls */
+    uint64_t syscallsWrite;  /* syscw: write(2)-like calls */
+    uint64_t ctxSwitches;    /* Voluntary context switches */
+} BenchUsage;
+
+void benchGetUsage(BenchUsage *usage);
+
+/*
+ * Platform setup
+ */
+
+/* Loads the platform on the mock driver configured from the environment */
+void benchLoadPlatform(MockEgl *platform);
+void benchUnloadPlatform(MockEgl *platform);
+
+/* Compositor options from the environment and --refresh */
+void benchGetCompositorOptions(const BenchArgs *args,
+                               MockCompositorOptions *options);
+
+typedef struct BenchClientRec {
+    MockEgl              *platform;
+    struct wl_display    *wlDpy;
+    struct wl_compositor *wlCompositor;
+    EGLDisplay            dpy;
+    EGLConfig             config;
+} BenchClient;
+
+typedef struct BenchSurfaceRec {
+    BenchClient          *client;
+    struct wl_surface    *wlSurface;
+    struct wl_egl_window *window;
+    EGLSurface            surface;
+} BenchSurface;
+
+/* Connects to comp and initializes an EGLDisplay on the connection */
+void benchClientConnect(BenchClient *client, MockEgl *platform,
+                        MockCompositor *comp);
+/* The steps of benchClientConnect(): connecting and binding wl_compositor */
+void benchClientConnectWayland(BenchClient *client, MockEgl *platform,
+                               MockCompositor *comp);
+/* and, once client->dpy is initialized, picking the config */
+void benchClientChooseConfig(BenchClient *client);
+void benchClientDisconnect(BenchClient *client);
+
+void benchSurfaceCreate(BenchSurface *surface, BenchClient *client,
+                        int width, int height);
+void benchSurfaceDestroy(BenchSurface *surface);
+
+/* Makes the surface current on the calling thread, with swapInterval */
+void benchSurfaceMakeCurrent(BenchSurface *surface, EGLint swapInterval);
+void benchSurfaceReleaseCurrent(BenchSurface *surface);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
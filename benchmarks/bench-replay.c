@@ -0,0 +1,727 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Offline replay of a __NV_WAYLAND_RECORD trace
+ *
+ * Reads a recording made with __NV_WAYLAND_RECORD (see wayland-egltrace.h)
+ * and plays the app's side of it back on the mock driver and compositor: one
+ * render thread per recorded surface swaps with the recorded timing, and the
+ * compositor runs at the refresh rate and release delay the trace shows.
+ * The recorded and replayed stage times are reported side by side, so a
+ * stutter captured in the field can be reproduced and a fix checked against
+ * it.
+ *
+ * Every frame is swapped with its recorded swap interval, and the window is
+ * resized to the recorded size before the frames that reallocated for it.
+ * The compositor side only shows in the trace through the tracepoints, so it
+ * is inferred:
+ *
+ *  - The refresh rate is the median interval between frame callbacks, and
+ *    the release delay the median time from a commit to the release of the
+ *    buffer it replaced, minus one refresh.
+ *  - The compositor uses explicit sync if the surfaces waited on release
+ *    points, and EGLStream if they never committed dma-bufs themselves.
+ *  - dma-buf feedback the compositor sent while the app was presenting is
+ *    sent again at the same time.
+ *
+ * Options:
+ *   --trace=<file>        The recording to replay
+ *   --timing=<mode>       gaps: keep the recorded time between a swap
+ *                         returning and the next one (default)
+ *                         absolute: start every swap at its recorded time
+ *   --refresh=<Hz>        Compositor refresh rate, instead of the trace's
+ *   --release-delay-us=<n> Compositor release delay, instead of the trace's
+ *   --width=<n>           Window width if the trace lost the surface's
+ *                         creation, 640 by default
+ *   --height=<n>          Window height if the trace lost the surface's
+ *                         creation, 480 by default
+ *   --output=<file>       Where the JSON goes, stdout by default
+ */
+
+#include "bench-common.h"
+#include "wayland-egltrace.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <wayland-egl.h>
+
+/*
+ * Trace
+ */
+
+typedef enum {
+    STAGE_SWAP,
+    STAGE_FRAME_SYNC_WAIT,
+    STAGE_DRIVER_SWAP,
+    STAGE_ACQUIRE_IMAGE,
+    STAGE_RELEASE_POINTS_WAIT,
+    STAGE_REALLOC,
+    STAGE_COUNT,
+} StageType;
+
+/* Recorded as <name>_begin and <name>_end */
+static const char *stageNames[STAGE_COUNT] = {
+    "swap",
+    "frame_sync_wait",
+    "driver_swap",
+    "acquire_image",
+    "release_points_wait",
+    "realloc",
+};
+
+typedef enum {
+    EVENT_OTHER,
+    EVENT_STAGE_BEGIN,
+    EVENT_STAGE_END,
+    EVENT_WINDOW_CREATE,
+    EVENT_FRAME_DONE,
+    EVENT_COMMIT,
+    EVENT_BUFFER_RELEASE,
+    EVENT_FEEDBACK_DONE,
+    EVENT_DAMAGE_THREAD,
+} EventType;
+
+typedef struct TraceEventRec {
+    EventType type;
+    StageType stage;
+} TraceEvent;
+
+typedef struct TraceRec {
+    WlEglTraceFileHeader header;
+    TraceEvent          *events;    /* Indexed by name */
+    WlEglTraceRecord    *records;
+} Trace;
+
+static TraceEvent classifyName(const char *name)
+{
+    static const struct {
+        const char *name;
+        EventType   type;
+    } events[] = {
+        { "window_surface_create", EVENT_WINDOW_CREATE },
+        { "frame_done",           EVENT_FRAME_DONE },
+        { "commit",               EVENT_COMMIT },
+        { "buffer_release",       EVENT_BUFFER_RELEASE },
+        { "dmabuf_feedback_done", EVENT_FEEDBACK_DONE },
+        { "damage_thread_wake",   EVENT_DAMAGE_THREAD },
+        { "damage_thread_submit", EVENT_DAMAGE_THREAD },
+    };
+    TraceEvent event = { EVENT_OTHER, STAGE_SWAP };
+    size_t len, i;
+    int s;
+
+    for (i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+        if (!strcmp(name, events[i].name)) {
+            event.type = events[i].type;
+            return event;
+        }
+    }
+
+    for (s = 0; s < STAGE_COUNT; s++) {
+        len = strlen(stageNames[s]);
+        if (strncmp(name, stageNames[s], len)) {
+            continue;
+        }
+        if (!strcmp(name + len, "_begin")) {
+            event.type = EVENT_STAGE_BEGIN;
+        } else if (!strcmp(name + len, "_end")) {
+            event.type = EVENT_STAGE_END;
+        } else {
+            continue;
+        }
+        event.stage = s;
+        break;
+    }
+
+    return event;
+}
+
+static int compareRecords(const void *a, const void *b)
+{
+    const WlEglTraceRecord *ra = a;
+    const WlEglTraceRecord *rb = b;
+
+    return ra->timestamp < rb->timestamp ? -1 : ra->timestamp > rb->timestamp;
+}
+
+static void loadTrace(Trace *trace, const char *path)
+{
+    char     name[256];
+    uint16_t len;
+    uint32_t i;
+    FILE    *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Can't open %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    BENCH_CHECK(fread(&trace->header, sizeof(trace->header), 1, f) == 1);
+    if (memcmp(trace->header.magic, WL_EGL_TRACE_FILE_MAGIC,
+               sizeof(trace->header.magic)) ||
+        trace->header.version != WL_EGL_TRACE_FILE_VERSION ||
+        trace->header.recordSize != sizeof(WlEglTraceRecord)) {
+        fprintf(stderr, "%s is not a version %d recording\n", path,
+                WL_EGL_TRACE_FILE_VERSION);
+        exit(EXIT_FAILURE);
+    }
+
+    trace->events = calloc(trace->header.nameCount, sizeof(*trace->events));
+    BENCH_CHECK(trace->header.nameCount == 0 || trace->events != NULL);
+    for (i = 0; i < trace->header.nameCount; i++) {
+        BENCH_CHECK(fread(&len, sizeof(len), 1, f) == 1);
+        BENCH_CHECK(len < sizeof(name));
+        BENCH_CHECK(fread(name, 1, len, f) == len);
+        name[len] = '\0';
+        trace->events[i] = classifyName(name);
+    }
+
+    trace->records = calloc(trace->header.recordCount,
+                            sizeof(*trace->records));
+    BENCH_CHECK(trace->header.recordCount == 0 || trace->records != NULL);
+    BENCH_CHECK(fread(trace->records, sizeof(*trace->records),
+                      trace->header.recordCount, f) ==
+                trace->header.recordCount);
+    fclose(f);
+
+    /* Records written concurrently can land slightly out of order */
+    qsort(trace->records, trace->header.recordCount,
+          sizeof(*trace->records), compareRecords);
+}
+
+static void freeTrace(Trace *trace)
+{
+    free(trace->events);
+    free(trace->records);
+}
+
+/*
+ * Workload
+ */
+
+typedef struct ReplayFrameRec {
+    uint64_t begin;         /* Relative to the first swap in the trace */
+    uint64_t end;
+    EGLint   swapInterval;
+    int      width;         /* Resize the window to this before the frame, */
+    int      height;        /* unless 0 */
+} ReplayFrame;
+
+typedef struct ReplaySurfaceRec {
+    uint64_t      id;
+    int           createWidth;      /* 0 if the creation wasn't recorded */
+    int           createHeight;
+    ReplayFrame  *frames;
+    size_t        numFrames;
+    size_t        size;
+    uint64_t      resizes;
+    uint64_t      swapIntervalChanges;
+
+    /* While reading the trace */
+    uint64_t      stageBegin[STAGE_COUNT];
+    uint64_t      lastCommit;
+    uint64_t      lastFrameDone;
+    int           width;
+    int           height;
+    int           resizePending;    /* Resized between two swaps */
+
+    BenchSamples  recorded[STAGE_COUNT];
+
+    /* While replaying */
+    const BenchArgs *args;
+    BenchSurface  surface;
+    BenchSamples  swaps;
+    BenchSamples  lag;
+    uint64_t      start;
+    pthread_t     thread;
+} ReplaySurface;
+
+typedef struct WorkloadRec {
+    ReplaySurface *surfaces;
+    int            numSurfaces;
+    uint64_t      *feedbacks;       /* Relative to the first swap */
+    size_t         numFeedbacks;
+    uint64_t       start;           /* First swap in the trace */
+
+    BenchSamples   frameIntervals;
+    BenchSamples   releaseLatencies;
+    EGLBoolean     explicitSync;
+    EGLBoolean     committed;
+    EGLBoolean     damageThread;
+} Workload;
+
+static ReplaySurface *getSurface(Workload *workload, uint64_t id)
+{
+    ReplaySurface *surface;
+    int i;
+
+    for (i = 0; i < workload->numSurfaces; i++) {
+        if (workload->surfaces[i].id == id) {
+            return &workload->surfaces[i];
+        }
+    }
+
+    workload->surfaces = realloc(workload->surfaces,
+                                 (workload->numSurfaces + 1) *
+                                 sizeof(*workload->surfaces));
+    BENCH_CHECK(workload->surfaces != NULL);
+
+    surface = &workload->surfaces[workload->numSurfaces++];
+    memset(surface, 0, sizeof(*surface));
+    surface->id = id;
+    for (i = 0; i < STAGE_COUNT; i++) {
+        benchSamplesInit(&surface->recorded[i]);
+    }
+
+    return surface;
+}
+
+static void addFrame(ReplaySurface *surface, uint64_t begin,
+                     EGLint swapInterval)
+{
+    ReplayFrame *frame;
+
+    if (surface->numFrames == surface->size) {
+        surface->size = surface->size ? surface->size * 2 : 256;
+        surface->frames = realloc(surface->frames,
+                                  surface->size * sizeof(*surface->frames));
+        BENCH_CHECK(surface->frames != NULL);
+    }
+
+    frame = &surface->frames[surface->numFrames];
+    frame->begin        = begin;
+    frame->end          = begin;
+    frame->swapInterval = swapInterval;
+    frame->width        = 0;
+    frame->height       = 0;
+    if (surface->resizePending) {
+        frame->width  = surface->width;
+        frame->height = surface->height;
+        surface->resizePending = 0;
+    }
+    if (surface->numFrames > 0 &&
+        surface->frames[surface->numFrames - 1].swapInterval != swapInterval) {
+        surface->swapIntervalChanges++;
+    }
+    surface->numFrames++;
+}
+
+/*
+ * A reallocation for a new window size happens in the swap that first
+ * presents at that size, or right away if the window of the current surface
+ * is resized between two swaps.
+ */
+static void reallocEnd(ReplaySurface *surface, uint64_t size)
+{
+    int width  = (int)(size >> 32);
+    int height = (int)(size & 0xffffffff);
+
+    if (width == surface->width && height == surface->height) {
+        return;
+    }
+    surface->width  = width;
+    surface->height = height;
+
+    if (surface->stageBegin[STAGE_SWAP] != 0 && surface->numFrames > 0) {
+        surface->frames[surface->numFrames - 1].width  = width;
+        surface->frames[surface->numFrames - 1].height = height;
+    } else {
+        surface->resizePending = 1;
+    }
+    surface->resizes++;
+}
+
+static void buildWorkload(Workload *workload, const Trace *trace)
+{
+    const WlEglTraceRecord *record;
+    const TraceEvent *event;
+    ReplaySurface *surface;
+    uint64_t i, time;
+    int s;
+
+    memset(workload, 0, sizeof(*workload));
+    benchSamplesInit(&workload->frameIntervals);
+    benchSamplesInit(&workload->releaseLatencies);
+
+    for (i = 0; i < trace->header.recordCount; i++) {
+        record = &trace->records[i];
+        if (record->name >= trace->header.nameCount) {
+            continue;
+        }
+        event = &trace->events[record->name];
+        if (event->type == EVENT_OTHER) {
+            continue;
+        }
+
+        if (event->type == EVENT_STAGE_BEGIN &&
+            event->stage == STAGE_SWAP && workload->start == 0) {
+            workload->start = record->timestamp;
+        }
+
+        /* Feedback objects aren't surfaces */
+        if (event->type == EVENT_FEEDBACK_DONE) {
+            if (workload->start != 0) {
+                workload->feedbacks =
+                    realloc(workload->feedbacks,
+                            (workload->numFeedbacks + 1) *
+                            sizeof(*workload->feedbacks));
+                BENCH_CHECK(workload->feedbacks != NULL);
+                workload->feedbacks[workload->numFeedbacks++] =
+                    record->timestamp - workload->start;
+            }
+            continue;
+        }
+
+        /* Surfaces usually are created before the first swap */
+        if (event->type == EVENT_WINDOW_CREATE) {
+            surface = getSurface(workload, record->surface);
+            surface->createWidth  = (int)(record->frame >> 32);
+            surface->createHeight = (int)(record->frame & 0xffffffff);
+            surface->width        = surface->createWidth;
+            surface->height       = surface->createHeight;
+            continue;
+        }
+
+        /* Nothing before the first swap is replayed */
+        if (workload->start == 0) {
+            continue;
+        }
+        time = record->timestamp - workload->start;
+        surface = getSurface(workload, record->surface);
+
+        switch (event->type) {
+        case EVENT_STAGE_BEGIN:
+            surface->stageBegin[event->stage] = record->timestamp;
+            if (event->stage == STAGE_SWAP) {
+                addFrame(surface, time, record->arg);
+            } else if (event->stage == STAGE_RELEASE_POINTS_WAIT) {
+                workload->explicitSync = EGL_TRUE;
+            }
+            break;
+        case EVENT_STAGE_END:
+            /* realloc_end carries the window size it reallocated for */
+            if (event->stage == STAGE_REALLOC) {
+                reallocEnd(surface, record->frame);
+            }
+            if (surface->stageBegin[event->stage] == 0) {
+                break;
+            }
+            benchSamplesAdd(&surface->recorded[event->stage],
+                            record->timestamp -
+                            surface->stageBegin[event->stage]);
+            surface->stageBegin[event->stage] = 0;
+            if (event->stage == STAGE_SWAP && surface->numFrames > 0) {
+                surface->frames[surface->numFrames - 1].end = time;
+            }
+            break;
+        case EVENT_FRAME_DONE:
+            if (surface->lastFrameDone) {
+                benchSamplesAdd(&workload->frameIntervals,
+                                record->timestamp - surface->lastFrameDone);
+            }
+            surface->lastFrameDone = record->timestamp;
+            break;
+        case EVENT_COMMIT:
+            workload->committed = EGL_TRUE;
+            surface->lastCommit = record->timestamp;
+            break;
+        case EVENT_BUFFER_RELEASE:
+            if (surface->lastCommit) {
+                benchSamplesAdd(&workload->releaseLatencies,
+                                record->timestamp - surface->lastCommit);
+            }
+            break;
+        case EVENT_DAMAGE_THREAD:
+            workload->damageThread = EGL_TRUE;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* Drop what isn't a window surface presenting frames */
+    for (i = 0; i < (uint64_t)workload->numSurfaces; ) {
+        surface = &workload->surfaces[i];
+        if (surface->numFrames > 0) {
+            i++;
+            continue;
+        }
+        for (s = 0; s < STAGE_COUNT; s++) {
+            benchSamplesFree(&surface->recorded[s]);
+        }
+        free(surface->frames);
+        *surface = workload->surfaces[--workload->numSurfaces];
+    }
+}
+
+static void freeWorkload(Workload *workload)
+{
+    int i, s;
+
+    for (i = 0; i < workload->numSurfaces; i++) {
+        for (s = 0; s < STAGE_COUNT; s++) {
+            benchSamplesFree(&workload->surfaces[i].recorded[s]);
+        }
+        free(workload->surfaces[i].frames);
+    }
+    free(workload->surfaces);
+    free(workload->feedbacks);
+    benchSamplesFree(&workload->frameIntervals);
+    benchSamplesFree(&workload->releaseLatencies);
+}
+
+static void getCompositorOptions(const BenchArgs *args, Workload *workload,
+                                 MockCompositorOptions *options)
+{
+    uint64_t period = 0, latency;
+
+    benchGetCompositorOptions(args, options);
+
+    if (!benchArgString(args, "refresh", NULL)) {
+        options->refreshMhz = 60000;
+        if (workload->frameIntervals.count > 0) {
+            period = benchSamplesPercentile(&workload->frameIntervals, 0.50);
+            options->refreshMhz = 1000000000000ull / period;
+        }
+    }
+    if (period == 0 && options->refreshMhz) {
+        period = 1000000000000ull / options->refreshMhz;
+    }
+
+    if (benchArgString(args, "release-delay-us", NULL)) {
+        options->releaseDelayUs = benchArgU64(args, "release-delay-us", 0);
+    } else if (workload->releaseLatencies.count > 0) {
+        latency = benchSamplesPercentile(&workload->releaseLatencies, 0.50);
+        options->releaseDelayUs = latency > period ?
+                                  (latency - period) / 1000 : 0;
+    }
+
+    options->explicitSync = workload->explicitSync;
+    if (workload->damageThread || !workload->committed) {
+        options->eglstream     = EGL_TRUE;
+        options->dmabufVersion = 0;
+    }
+}
+
+/*
+ * Replay
+ */
+
+static void *renderThread(void *data)
+{
+    ReplaySurface *rs = data;
+    MockEgl *platform = rs->surface.client->platform;
+    int absolute = !strcmp(benchArgString(rs->args, "timing", "gaps"),
+                           "absolute");
+    EGLint swapInterval = rs->frames[0].swapInterval;
+    uint64_t due, begin, recorded, end = rs->start;
+    size_t i;
+
+    benchSurfaceMakeCurrent(&rs->surface, swapInterval);
+
+    for (i = 0; i < rs->numFrames; i++) {
+        recorded = rs->start + rs->frames[i].begin;
+        if (absolute || i == 0) {
+            due = recorded;
+        } else if (rs->frames[i].begin > rs->frames[i - 1].end) {
+            due = end + (rs->frames[i].begin - rs->frames[i - 1].end);
+        } else {
+            due = end;
+        }
+        benchSleepUntilNs(due);
+
+        if (rs->frames[i].width > 0 && rs->frames[i].height > 0) {
+            wl_egl_window_resize(rs->surface.window, rs->frames[i].width,
+                                 rs->frames[i].height, 0, 0);
+        }
+        if (rs->frames[i].swapInterval != swapInterval) {
+            swapInterval = rs->frames[i].swapInterval;
+            BENCH_CHECK(platform->swapInterval(rs->surface.client->dpy,
+                                               swapInterval));
+        }
+
+        begin = benchGetTimeNs();
+        BENCH_CHECK(platform->swapBuffers(rs->surface.client->dpy,
+                                          rs->surface.surface));
+        end = benchGetTimeNs();
+
+        benchSamplesAdd(&rs->swaps, end - begin);
+        benchSamplesAdd(&rs->lag, begin > recorded ? begin - recorded : 0);
+    }
+
+    benchSurfaceReleaseCurrent(&rs->surface);
+
+    return NULL;
+}
+
+static void writeSurface(BenchJson *json, ReplaySurface *rs)
+{
+    char id[32];
+    int s;
+
+    snprintf(id, sizeof(id), "0x%" PRIx64, rs->id);
+
+    benchJsonBeginObject(json, NULL);
+    benchJsonString(json, "id", id);
+    benchJsonU64(json, "frames", rs->numFrames);
+    benchJsonU64(json, "swap_interval", rs->frames[0].swapInterval);
+    benchJsonU64(json, "swap_interval_changes", rs->swapIntervalChanges);
+    benchJsonU64(json, "resizes", rs->resizes);
+
+    benchJsonBeginObject(json, "recorded");
+    for (s = 0; s < STAGE_COUNT; s++) {
+        if (rs->recorded[s].count > 0) {
+            benchJsonSamples(json, stageNames[s], &rs->recorded[s]);
+        }
+    }
+    benchJsonEndObject(json);
+
+    benchJsonBeginObject(json, "replayed");
+    benchJsonSamples(json, "swap", &rs->swaps);
+    /* How much later than recorded, from the start, each swap began */
+    benchJsonSamples(json, "start_lag", &rs->lag);
+    benchJsonEndObject(json);
+
+    benchJsonEndObject(json);
+}
+
+int main(int argc, char **argv)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   compStats;
+    MockCompositor       *comp;
+    BenchSwapStats        swapStats;
+    BenchClient           client;
+    BenchArgs             args;
+    BenchJson             json;
+    MockEgl               platform;
+    Workload              workload;
+    Trace                 trace;
+    const char           *path;
+    uint64_t              start;
+    size_t                f;
+    int                   i;
+
+    benchParseArgs(&args, argc, argv);
+    path = benchArgString(&args, "trace", NULL);
+    if (!path) {
+        fprintf(stderr, "Usage: %s --trace=<file> [--timing=gaps|absolute] "
+                "[--output=<file>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    loadTrace(&trace, path);
+    buildWorkload(&workload, &trace);
+    if (workload.numSurfaces == 0) {
+        fprintf(stderr, "%s has no frames to replay\n", path);
+        return EXIT_FAILURE;
+    }
+
+    benchSwapStatsOpen(&swapStats);
+    benchLoadPlatform(&platform);
+
+    getCompositorOptions(&args, &workload, &options);
+    comp = mockCompositorCreate(&options, &platform);
+    BENCH_CHECK(comp != NULL);
+    benchClientConnect(&client, &platform, comp);
+
+    for (i = 0; i < workload.numSurfaces; i++) {
+        ReplaySurface *rs = &workload.surfaces[i];
+
+        rs->args = &args;
+        benchSurfaceCreate(&rs->surface, &client,
+                           rs->createWidth > 0 ? rs->createWidth :
+                               (int)benchArgU64(&args, "width", 640),
+                           rs->createHeight > 0 ? rs->createHeight :
+                               (int)benchArgU64(&args, "height", 480));
+        benchSamplesInit(&rs->swaps);
+        benchSamplesInit(&rs->lag);
+    }
+
+    /* The render threads all start from the same point in time */
+    start = benchGetTimeNs();
+    for (i = 0; i < workload.numSurfaces; i++) {
+        workload.surfaces[i].start = start;
+        BENCH_CHECK(pthread_create(&workload.surfaces[i].thread, NULL,
+                                   renderThread, &workload.surfaces[i]) == 0);
+    }
+
+    if (!options.eglstream) {
+        for (f = 0; f < workload.numFeedbacks; f++) {
+            benchSleepUntilNs(start + workload.feedbacks[f]);
+            mockCompositorResendFeedback(comp);
+        }
+    }
+
+    for (i = 0; i < workload.numSurfaces; i++) {
+        pthread_join(workload.surfaces[i].thread, NULL);
+    }
+    mockCompositorGetStats(comp, &compStats);
+
+    benchJsonOpen(&json, &args);
+    benchJsonString(&json, "benchmark", "replay");
+    benchJsonString(&json, "trace", path);
+    benchJsonU64(&json, "pid", trace.header.pid);
+    benchJsonU64(&json, "records", trace.header.recordCount);
+    benchJsonU64(&json, "dropped", trace.header.dropped);
+    benchJsonString(&json, "timing", benchArgString(&args, "timing", "gaps"));
+
+    benchJsonBeginObject(&json, "compositor");
+    benchJsonU64(&json, "refresh_mhz", options.refreshMhz);
+    benchJsonU64(&json, "release_delay_us", options.releaseDelayUs);
+    benchJsonBool(&json, "explicit_sync", options.explicitSync);
+    benchJsonBool(&json, "eglstream", options.eglstream);
+    benchJsonU64(&json, "feedback_resends",
+                 options.eglstream ? 0 : workload.numFeedbacks);
+    benchJsonU64(&json, "frames_presented", compStats.framesPresented);
+    benchJsonU64(&json, "frames_discarded", compStats.framesDiscarded);
+    benchJsonU64(&json, "protocol_errors", compStats.protocolErrors);
+    benchJsonEndObject(&json);
+
+    benchJsonBeginArray(&json, "surfaces");
+    for (i = 0; i < workload.numSurfaces; i++) {
+        writeSurface(&json, &workload.surfaces[i]);
+    }
+    benchJsonEndArray(&json);
+
+    /* Destroying the surfaces writes their replayed stage reports */
+    for (i = 0; i < workload.numSurfaces; i++) {
+        benchSurfaceDestroy(&workload.surfaces[i].surface);
+        benchSamplesFree(&workload.surfaces[i].swaps);
+        benchSamplesFree(&workload.surfaces[i].lag);
+    }
+    benchJsonSwapStats(&json, "stages", &swapStats);
+    benchJsonClose(&json);
+
+    benchClientDisconnect(&client);
+    mockCompositorDestroy(comp);
+    benchUnloadPlatform(&platform);
+    benchSwapStatsClose(&swapStats);
+
+    freeWorkload(&workload);
+    freeTrace(&trace);
+
+    return compStats.protocolErrors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
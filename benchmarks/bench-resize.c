@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Resize stress benchmark
+ *
+ * Presents frames back to back while resizing the window at a fixed rate,
+ * the way an interactive resize does: the size changes right before the
+ * frame that should show it. For every resize rate and buffer path it
+ * reports the frames dropped, the time spent reallocating the stream, the
+ * buffers held by the compositor and the peak memory of both sides.
+ *
+ * Options:
+ *   --scenario=<a,b,...>  eglstream, dmabuf-implicit and dmabuf-explicit,
+ *                         all by default
+ *   --rates=<a,b,...>     Resizes per second, 60,120,240 by default
+ *   --duration-ms=<n>     How long each run presents, 1000 by default
+ *   --size=<n>            Smallest window width and height, 256 by default
+ *   --refresh=<Hz>        Compositor refresh rate, 1000 by default
+ *   --output=<file>       Where the JSON goes, stdout by default
+ */
+
+#include "bench-common.h"
+#include "wayland-eglsurface.h"
+
+#include <string.h>
+#include <wayland-egl.h>
+
+typedef struct ResizeVariantRec {
+    const char *name;
+    EGLBoolean  eglstream;
+    EGLBoolean  explicitSync;
+} ResizeVariant;
+
+static const ResizeVariant resizeVariants[] = {
+    { "eglstream",       EGL_TRUE,  EGL_FALSE },
+    { "dmabuf-implicit", EGL_FALSE, EGL_FALSE },
+    { "dmabuf-explicit", EGL_FALSE, EGL_TRUE  },
+};
+
+#define NUM_VARIANTS (sizeof(resizeVariants) / sizeof(resizeVariants[0]))
+
+/* Resizes cycle through this many sizes, growing by 16 pixels each step */
+#define RESIZE_STEPS 8
+
+static void getCounters(BenchSurface *surface, WlEglSurfaceCounters *counters)
+{
+    BENCH_CHECK(wlEglQuerySurfaceCountersExport((WlEglSurface *)surface->surface,
+                                                counters,
+                                                sizeof(*counters)) == 0);
+}
+
+static void runResize(BenchJson *json, const BenchArgs *args,
+                      MockEgl *platform, const ResizeVariant *variant,
+                      uint64_t rate)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   compStats;
+    MockEglStats          eglStats, eglBefore;
+    WlEglSurfaceCounters  before, after, counters;
+    MockCompositor       *comp;
+    BenchClient           client;
+    BenchSurface          surface;
+    BenchSamples          swaps, resizeSwaps;
+    uint64_t              durationNs = benchArgU64(args, "duration-ms", 1000) *
+                                       1000000;
+    uint64_t              periodNs, start, now, nextResize, swapStart;
+    uint64_t              resizes = 0, maxHeld = 0, sumHeld = 0;
+    uint64_t              peakImageBytes = 0;
+    int                   size = benchArgU64(args, "size", 256);
+    int                   resized, step;
+
+    BENCH_CHECK(rate > 0 && size > 0 && durationNs > 0);
+    periodNs = 1000000000ull / rate;
+
+    benchGetCompositorOptions(args, &options);
+    options.explicitSync = variant->explicitSync;
+    options.eglstream    = variant->eglstream;
+    if (variant->eglstream) {
+        options.dmabufVersion = 0;
+    }
+
+    comp = mockCompositorCreate(&options, platform);
+    BENCH_CHECK(comp != NULL);
+    benchClientConnect(&client, platform, comp);
+    benchSurfaceCreate(&surface, &client, size, size);
+    benchSurfaceMakeCurrent(&surface, 1);
+
+    /* The first frame allocates, it is not part of the run */
+    BENCH_CHECK(platform->swapBuffers(client.dpy, surface.surface));
+
+    getCounters(&surface, &before);
+    mockEglGetStats(&eglBefore);
+    benchSamplesInit(&swaps);
+    benchSamplesInit(&resizeSwaps);
+
+    start = benchGetTimeNs();
+    nextResize = start;
+    for (now = start; now - start < durationNs; now = benchGetTimeNs()) {
+        resized = now >= nextResize;
+        if (resized) {
+            step = ++resizes % RESIZE_STEPS;
+            wl_egl_window_resize(surface.window, size + step * 16,
+                                 size + step * 16, 0, 0);
+            nextResize += periodNs;
+        }
+
+        swapStart = benchGetTimeNs();
+        BENCH_CHECK(platform->swapBuffers(client.dpy, surface.surface));
+        benchSamplesAdd(resized ? &resizeSwaps : &swaps,
+                        benchGetTimeNs() - swapStart);
+
+        getCounters(&surface, &counters);
+        sumHeld += counters.buffersHeld;
+        if (counters.buffersHeld > maxHeld) {
+            maxHeld = counters.buffersHeld;
+        }
+        mockEglGetStats(&eglStats);
+        if (eglStats.imageBytes > peakImageBytes) {
+            peakImageBytes = eglStats.imageBytes;
+        }
+    }
+
+    getCounters(&surface, &after);
+    mockCompositorGetStats(comp, &compStats);
+
+    benchSurfaceReleaseCurrent(&surface);
+    benchSurfaceDestroy(&surface);
+    benchClientDisconnect(&client);
+    mockCompositorDestroy(comp);
+
+    benchJsonBeginObject(json, NULL);
+    benchJsonString(json, "variant", variant->name);
+    benchJsonU64(json, "rate_hz", rate);
+    benchJsonU64(json, "resizes", resizes);
+    benchJsonU64(json, "frames", swaps.count + resizeSwaps.count);
+    benchJsonSamples(json, "swap", &swaps);
+    benchJsonSamples(json, "swap_after_resize", &resizeSwaps);
+
+    benchJsonBeginObject(json, "frames_dropped");
+    benchJsonU64(json, "platform",
+                 after.framesDropped - before.framesDropped);
+    benchJsonU64(json, "driver",
+                 eglStats.framesDropped - eglBefore.framesDropped);
+    benchJsonU64(json, "compositor", compStats.framesDiscarded);
+    benchJsonEndObject(json);
+
+    benchJsonBeginObject(json, "realloc");
+    benchJsonU64(json, "resize", after.reallocsResize - before.reallocsResize);
+    benchJsonU64(json, "skipped",
+                 after.reallocsSkipped - before.reallocsSkipped);
+    benchJsonU64(json, "count", after.realloc.count - before.realloc.count);
+    benchJsonDouble(json, "total_ms",
+                    (after.realloc.totalNs - before.realloc.totalNs) / 1e6);
+    /* Percentiles cover the whole life of the surface */
+    benchJsonDouble(json, "p50_us", after.realloc.p50Ns / 1000.0);
+    benchJsonDouble(json, "p99_us", after.realloc.p99Ns / 1000.0);
+    benchJsonDouble(json, "max_us", after.realloc.maxNs / 1000.0);
+    benchJsonEndObject(json);
+
+    benchJsonBeginObject(json, "buffers_held");
+    benchJsonDouble(json, "mean",
+                    (double)sumHeld / (swaps.count + resizeSwaps.count));
+    benchJsonU64(json, "max", maxHeld);
+    benchJsonEndObject(json);
+
+    benchJsonU64(json, "peak_image_bytes", peakImageBytes);
+    benchJsonU64(json, "peak_buffer_bytes", compStats.peakBufferBytes);
+    benchJsonU64(json, "buffers_created", compStats.buffersCreated);
+    benchJsonU64(json, "protocol_errors", compStats.protocolErrors);
+    benchJsonEndObject(json);
+
+    benchSamplesFree(&swaps);
+    benchSamplesFree(&resizeSwaps);
+    BENCH_CHECK(compStats.protocolErrors == 0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *rates;
+    char       *end;
+    BenchArgs   args;
+    BenchJson   json;
+    BenchUsage  usage;
+    MockEgl     platform;
+    uint64_t    rate;
+    size_t      i;
+
+    benchParseArgs(&args, argc, argv);
+
+    benchLoadPlatform(&platform);
+
+    benchJsonOpen(&json, &args);
+    benchJsonString(&json, "benchmark", "resize");
+    benchJsonBeginArray(&json, "runs");
+    for (i = 0; i < NUM_VARIANTS; i++) {
+        if (!benchScenarioEnabled(&args, resizeVariants[i].name)) {
+            continue;
+        }
+        rates = benchArgString(&args, "rates", "60,120,240");
+        while (*rates) {
+            rate = strtoull(rates, &end, 10);
+            BENCH_CHECK(end != rates);
+            runResize(&json, &args, &platform, &resizeVariants[i], rate);
+            rates = *end == ',' ? end + 1 : end;
+        }
+    }
+    benchJsonEndArray(&json);
+
+    benchGetUsage(&usage);
+    benchJsonU64(&json, "peak_rss_kb", usage.peakRssKb);
+    benchJsonClose(&json);
+
+    benchUnloadPlatform(&platform);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Startup latency benchmark
+ *
+ * Times what an app goes through before its first frame is up:
+ * eglGetPlatformDisplay(), eglInitialize(), eglChooseConfig(), creating the
+ * first window surface and the first eglSwapBuffers(). Each phase reports
+ * its wall time, the roundtrips and requests it made to the compositor, and
+ * the syscalls it made on the calling thread. The compositor delays every
+ * roundtrip by each of the --delays-us in turn, so the cost of a roundtrip
+ * on a loaded or remote compositor shows.
+ *
+ * Syscalls are counted by wrapping the libc calls the platform and
+ * libwayland-client use: read, write, poll, recvmsg, sendmsg, ioctl, open,
+ * openat and close. Calls libc makes internally are not seen.
+ *
+ * Options:
+ *   --iterations=<n>      Startups per delay, 20 by default
+ *   --delays-us=<a,b,...> Roundtrip delays, 0,1000,10000 by default
+ *   --refresh=<Hz>        Compositor refresh rate, 1000 by default
+ *   --output=<file>       Where the JSON goes, stdout by default
+ */
+
+/* The wrappers below replace the libc functions, which must not be inlined */
+#undef _FORTIFY_SOURCE
+
+#include "bench-common.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <wayland-util.h>
+
+/*
+ * Syscall counting
+ */
+
+typedef enum {
+    SYSCALL_READ,
+    SYSCALL_WRITE,
+    SYSCALL_POLL,
+    SYSCALL_RECVMSG,
+    SYSCALL_SENDMSG,
+    SYSCALL_IOCTL,
+    SYSCALL_OPEN,
+    SYSCALL_CLOSE,
+    SYSCALL_COUNT,
+} SyscallType;
+
+static const char *syscallNames[SYSCALL_COUNT] = {
+    "read", "write", "poll", "recvmsg", "sendmsg", "ioctl", "open", "close",
+};
+
+typedef struct SyscallCountsRec {
+    uint64_t count[SYSCALL_COUNT];
+} SyscallCounts;
+
+/* Only the calling thread's, the compositor thread makes plenty of its own */
+static __thread SyscallCounts threadSyscalls;
+
+#define REAL_CALL(_TYPE_, _NAME_, _ARGS_)                               \
+    do {                                                                \
+        static __typeof__(&_NAME_) real;                                \
+        if (!real) {                                                    \
+            real = (__typeof__(&_NAME_))dlsym(RTLD_NEXT, #_NAME_);      \
+        }                                                               \
+        threadSyscalls.count[_TYPE_]++;                                 \
+        return real _ARGS_;                                             \
+    } while (0)
+
+WL_EXPORT ssize_t read(int fd, void *buf, size_t count)
+{
+    REAL_CALL(SYSCALL_READ, read, (fd, buf, count));
+}
+
+WL_EXPORT ssize_t write(int fd, const void *buf, size_t count)
+{
+    REAL_CALL(SYSCALL_WRITE, write, (fd, buf, count));
+}
+
+WL_EXPORT int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    REAL_CALL(SYSCALL_POLL, poll, (fds, nfds, timeout));
+}
+
+WL_EXPORT ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+    REAL_CALL(SYSCALL_RECVMSG, recvmsg, (fd, msg, flags));
+}
+
+WL_EXPORT ssize_t sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    REAL_CALL(SYSCALL_SENDMSG, sendmsg, (fd, msg, flags));
+}
+
+WL_EXPORT int ioctl(int fd, unsigned long request, ...)
+{
+    va_list args;
+    void *arg;
+
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+
+    REAL_CALL(SYSCALL_IOCTL, ioctl, (fd, request, arg));
+}
+
+WL_EXPORT int open(const char *path, int flags, ...)
+{
+    va_list args;
+    mode_t mode = 0;
+
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+
+    REAL_CALL(SYSCALL_OPEN, open, (path, flags, mode));
+}
+
+WL_EXPORT int openat(int dirfd, const char *path, int flags, ...)
+{
+    va_list args;
+    mode_t mode = 0;
+
+    if (flags & (O_CREAT | O_TMPFILE)) {
+        va_start(args, flags);
+        mode = va_arg(args, int);
+        va_end(args);
+    }
+
+    REAL_CALL(SYSCALL_OPEN, openat, (dirfd, path, flags, mode));
+}
+
+WL_EXPORT int close(int fd)
+{
+    REAL_CALL(SYSCALL_CLOSE, close, (fd));
+}
+
+/*
+ * Phases
+ */
+
+typedef enum {
+    PHASE_GET_DISPLAY,
+    PHASE_INITIALIZE,
+    PHASE_CHOOSE_CONFIG,
+    PHASE_CREATE_SURFACE,
+    PHASE_FIRST_SWAP,
+    PHASE_COUNT,
+} PhaseType;
+
+static const char *phaseNames[PHASE_COUNT] = {
+    "get_display", "initialize", "choose_config", "create_surface",
+    "first_swap",
+};
+
+typedef struct PhaseResultsRec {
+    BenchSamples  time;
+    uint64_t      roundtrips;
+    uint64_t      requests;
+    uint64_t      events;
+    uint64_t      ctxSwitches;
+    SyscallCounts syscalls;
+} PhaseResults;
+
+typedef struct PhaseRec {
+    MockCompositor     *comp;
+    PhaseResults       *results;
+    MockCompositorStats stats;
+    SyscallCounts       syscalls;
+    struct rusage       usage;
+    uint64_t            start;
+} Phase;
+
+static void beginPhase(Phase *phase)
+{
+    phase->syscalls = threadSyscalls;
+    getrusage(RUSAGE_THREAD, &phase->usage);
+    phase->start = benchGetTimeNs();
+}
+
+/* Asks the compositor for its stats only once the phase is measured */
+static void endPhase(Phase *phase, PhaseType type)
+{
+    PhaseResults *results = &phase->results[type];
+    MockCompositorStats stats;
+    SyscallCounts syscalls;
+    struct rusage usage;
+    uint64_t end;
+    int i;
+
+    end = benchGetTimeNs();
+    syscalls = threadSyscalls;
+    getrusage(RUSAGE_THREAD, &usage);
+    mockCompositorGetStats(phase->comp, &stats);
+
+    benchSamplesAdd(&results->time, end - phase->start);
+    results->roundtrips  += stats.roundtrips - phase->stats.roundtrips;
+    results->requests    += stats.requests - phase->stats.requests;
+    results->events      += stats.events - phase->stats.events;
+    results->ctxSwitches += (usage.ru_nvcsw + usage.ru_nivcsw) -
+                            (phase->usage.ru_nvcsw + phase->usage.ru_nivcsw);
+    for (i = 0; i < SYSCALL_COUNT; i++) {
+        results->syscalls.count[i] += syscalls.count[i] -
+                                      phase->syscalls.count[i];
+    }
+
+    phase->stats = stats;
+}
+
+static void startup(const BenchArgs *args, MockEgl *platform,
+                    uint64_t delayUs, PhaseResults *results)
+{
+    MockCompositorOptions options;
+    BenchClient           client;
+    BenchSurface          surface;
+    Phase                 phase;
+
+    benchGetCompositorOptions(args, &options);
+    options.roundtripDelayUs = delayUs;
+
+    phase.comp = mockCompositorCreate(&options, platform);
+    BENCH_CHECK(phase.comp != NULL);
+    phase.results = results;
+
+    /* Connecting and binding globals is up to the app */
+    benchClientConnectWayland(&client, platform, phase.comp);
+    mockCompositorGetStats(phase.comp, &phase.stats);
+
+    beginPhase(&phase);
+    client.dpy = mockEglGetDisplay(platform, client.wlDpy, NULL);
+    BENCH_CHECK(client.dpy != EGL_NO_DISPLAY);
+    endPhase(&phase, PHASE_GET_DISPLAY);
+
+    beginPhase(&phase);
+    BENCH_CHECK(platform->initialize(client.dpy, NULL, NULL));
+    endPhase(&phase, PHASE_INITIALIZE);
+
+    beginPhase(&phase);
+    benchClientChooseConfig(&client);
+    endPhase(&phase, PHASE_CHOOSE_CONFIG);
+
+    beginPhase(&phase);
+    benchSurfaceCreate(&surface, &client, 640, 480);
+    endPhase(&phase, PHASE_CREATE_SURFACE);
+
+    benchSurfaceMakeCurrent(&surface, 1);
+    beginPhase(&phase);
+    BENCH_CHECK(platform->swapBuffers(client.dpy, surface.surface));
+    endPhase(&phase, PHASE_FIRST_SWAP);
+
+    BENCH_CHECK(phase.stats.protocolErrors == 0);
+
+    benchSurfaceReleaseCurrent(&surface);
+    benchSurfaceDestroy(&surface);
+    benchClientDisconnect(&client);
+    mockCompositorDestroy(phase.comp);
+}
+
+static void runDelay(BenchJson *json, const BenchArgs *args,
+                     MockEgl *platform, uint64_t delayUs)
+{
+    PhaseResults results[PHASE_COUNT];
+    BenchSamples total;
+    uint64_t     iterations = benchArgU64(args, "iterations", 20);
+    uint64_t     i, sum;
+    int          p, s;
+
+    BENCH_CHECK(iterations > 0);
+
+    memset(results, 0, sizeof(results));
+    for (p = 0; p < PHASE_COUNT; p++) {
+        benchSamplesInit(&results[p].time);
+    }
+
+    for (i = 0; i < iterations; i++) {
+        startup(args, platform, delayUs, results);
+    }
+
+    benchSamplesInit(&total);
+    for (i = 0; i < iterations; i++) {
+        for (sum = 0, p = 0; p < PHASE_COUNT; p++) {
+            sum += results[p].time.values[i];
+        }
+        benchSamplesAdd(&total, sum);
+    }
+
+    benchJsonBeginObject(json, NULL);
+    benchJsonU64(json, "roundtrip_delay_us", delayUs);
+    benchJsonU64(json, "iterations", iterations);
+    benchJsonSamples(json, "total", &total);
+
+    /* Counts are per startup */
+    benchJsonBeginObject(json, "phases");
+    for (p = 0; p < PHASE_COUNT; p++) {
+        benchJsonBeginObject(json, phaseNames[p]);
+        benchJsonSamples(json, "time", &results[p].time);
+        benchJsonDouble(json, "roundtrips",
+                        (double)results[p].roundtrips / iterations);
+        benchJsonDouble(json, "requests",
+                        (double)results[p].requests / iterations);
+        benchJsonDouble(json, "events",
+                        (double)results[p].events / iterations);
+        benchJsonDouble(json, "context_switches",
+                        (double)results[p].ctxSwitches / iterations);
+        benchJsonBeginObject(json, "syscalls");
+        for (s = 0; s < SYSCALL_COUNT; s++) {
+            benchJsonDouble(json, syscallNames[s],
+                            (double)results[p].syscalls.count[s] / iterations);
+        }
+        benchJsonEndObject(json);
+        benchJsonEndObject(json);
+        benchSamplesFree(&results[p].time);
+    }
+    benchJsonEndObject(json);
+    benchJsonEndObject(json);
+
+    benchSamplesFree(&total);
+}
+
+int main(int argc, char **argv)
+{
+    const char *delays;
+    char       *end;
+    BenchArgs   args;
+    BenchJson   json;
+    MockEgl     platform;
+    uint64_t    delayUs;
+
+    benchParseArgs(&args, argc, argv);
+
+    benchLoadPlatform(&platform);
+
+    benchJsonOpen(&json, &args);
+    benchJsonString(&json, "benchmark", "startup");
+    benchJsonBeginArray(&json, "runs");
+    delays = benchArgString(&args, "delays-us", "0,1000,10000");
+    while (*delays) {
+        delayUs = strtoull(delays, &end, 10);
+        BENCH_CHECK(end != delays);
+        runDelay(&json, &args, &platform, delayUs);
+        delays = *end == ',' ? end + 1 : end;
+    }
+    benchJsonEndArray(&json);
+    benchJsonClose(&json);
+
+    benchUnloadPlatform(&platform);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Surface count scalability benchmark
+ *
+ * Creates N window surfaces on one display and swaps them from a few render
+ * threads, each going round its share of the surfaces. For each N it
+ * reports the creation time, the steady-state swap cost, and the fds,
+ * threads and RSS each surface adds once it has swapped. The compositor
+ * runs in the same process, so its end of every connection and buffer is
+ * counted too.
+ *
+ * The run fails when a per-surface cost goes over its budget; a budget of 0
+ * is not checked.
+ *
+ * Options:
+ *   --counts=<a,b,...>             Surface counts, 1,10,100,1000 by default
+ *   --threads=<n>                  Render threads, 4 by default
+ *   --frames=<n>                   Swaps per surface, 100 by default
+ *   --swap-interval=<n>            1 by default
+ *   --size=<n>                     Window width and height, 64 by default
+ *   --max-fds-per-surface=<n>      16 by default
+ *   --max-threads-per-surface=<n>  1 by default
+ *   --max-rss-kb-per-surface=<n>   1024 by default
+ *   --refresh=<Hz>                 Compositor refresh rate, 1000 by default
+ *   --output=<file>                Where the JSON goes, stdout by default
+ */
+
+#include "bench-common.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+
+typedef struct RenderThreadRec {
+    BenchSurface *surfaces;
+    int           first;
+    int           count;
+    int           stride;
+    EGLint        swapInterval;
+    uint64_t      frames;
+    BenchSamples  samples;
+    pthread_t     thread;
+} RenderThread;
+
+typedef struct BudgetRec {
+    const char *name;
+    double      limit;
+    double      value;
+} Budget;
+
+static void *renderThread(void *data)
+{
+    RenderThread *rt = data;
+    BenchSurface *surface;
+    uint64_t frame, start;
+    int i;
+
+    for (frame = 0; frame < rt->frames; frame++) {
+        for (i = 0; i < rt->count; i++) {
+            surface = &rt->surfaces[rt->first + i * rt->stride];
+
+            benchSurfaceMakeCurrent(surface, rt->swapInterval);
+            start = benchGetTimeNs();
+            BENCH_CHECK(surface->client->platform->swapBuffers(
+                            surface->client->dpy, surface->surface));
+            benchSamplesAdd(&rt->samples, benchGetTimeNs() - start);
+        }
+    }
+
+    if (rt->count > 0) {
+        benchSurfaceReleaseCurrent(&rt->surfaces[rt->first]);
+    }
+
+    return NULL;
+}
+
+static void writeUsage(BenchJson *json, const char *key,
+                       const BenchUsage *usage, const BenchUsage *base)
+{
+    benchJsonBeginObject(json, key);
+    benchJsonU64(json, "fds", usage->fds - base->fds);
+    benchJsonU64(json, "threads", usage->threads - base->threads);
+    benchJsonU64(json, "rss_kb",
+                 usage->rssKb > base->rssKb ? usage->rssKb - base->rssKb : 0);
+    benchJsonEndObject(json);
+}
+
+/* Returns whether every per-surface cost is within its budget */
+static int runCount(BenchJson *json, const BenchArgs *args,
+                    MockEgl *platform, int count)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   compStats;
+    MockCompositor       *comp;
+    BenchClient           client;
+    BenchSurface         *surfaces;
+    RenderThread         *threads;
+    BenchSamples          creates, swaps;
+    BenchUsage            base, created, swapped;
+    int                   numThreads = benchArgU64(args, "threads", 4);
+    int                   size = benchArgU64(args, "size", 64);
+    uint64_t              start, createStart, createNs, swapNs;
+    Budget                budgets[3];
+    int                   ok = 1;
+    int                   i;
+    size_t                j;
+
+    BENCH_CHECK(numThreads > 0 && size > 0);
+    if (numThreads > count) {
+        numThreads = count;
+    }
+
+    benchGetCompositorOptions(args, &options);
+    comp = mockCompositorCreate(&options, platform);
+    BENCH_CHECK(comp != NULL);
+    benchClientConnect(&client, platform, comp);
+
+    surfaces = calloc(count, sizeof(*surfaces));
+    threads = calloc(numThreads, sizeof(*threads));
+    BENCH_CHECK(surfaces != NULL && threads != NULL);
+
+    benchGetUsage(&base);
+
+    benchSamplesInit(&creates);
+    start = benchGetTimeNs();
+    for (i = 0; i < count; i++) {
+        createStart = benchGetTimeNs();
+        benchSurfaceCreate(&surfaces[i], &client, size, size);
+        benchSamplesAdd(&creates, benchGetTimeNs() - createStart);
+    }
+    createNs = benchGetTimeNs() - start;
+    benchGetUsage(&created);
+
+    /* Surfaces are dealt round robin, so each thread gets every Nth one */
+    for (i = 0; i < numThreads; i++) {
+        threads[i].surfaces     = surfaces;
+        threads[i].first        = i;
+        threads[i].stride       = numThreads;
+        threads[i].count        = (count - i + numThreads - 1) / numThreads;
+        threads[i].swapInterval = benchArgU64(args, "swap-interval", 1);
+        threads[i].frames       = benchArgU64(args, "frames", 100);
+        benchSamplesInit(&threads[i].samples);
+    }
+
+    start = benchGetTimeNs();
+    for (i = 0; i < numThreads; i++) {
+        BENCH_CHECK(pthread_create(&threads[i].thread, NULL, renderThread,
+                                   &threads[i]) == 0);
+    }
+    for (i = 0; i < numThreads; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    swapNs = benchGetTimeNs() - start;
+
+    /* The render threads are gone, so they don't count against surfaces */
+    benchGetUsage(&swapped);
+    mockCompositorGetStats(comp, &compStats);
+
+    benchSamplesInit(&swaps);
+    for (i = 0; i < numThreads; i++) {
+        for (j = 0; j < threads[i].samples.count; j++) {
+            benchSamplesAdd(&swaps, threads[i].samples.values[j]);
+        }
+        benchSamplesFree(&threads[i].samples);
+    }
+
+    for (i = 0; i < count; i++) {
+        benchSurfaceDestroy(&surfaces[i]);
+    }
+    free(threads);
+    free(surfaces);
+    benchClientDisconnect(&client);
+    mockCompositorDestroy(comp);
+
+    budgets[0].name  = "fds";
+    budgets[0].limit = benchArgDouble(args, "max-fds-per-surface", 16);
+    budgets[0].value = ((double)swapped.fds - base.fds) / count;
+    budgets[1].name  = "threads";
+    budgets[1].limit = benchArgDouble(args, "max-threads-per-surface", 1);
+    budgets[1].value = ((double)swapped.threads - base.threads) / count;
+    budgets[2].name  = "rss_kb";
+    budgets[2].limit = benchArgDouble(args, "max-rss-kb-per-surface", 1024);
+    budgets[2].value = ((double)swapped.rssKb - base.rssKb) / count;
+
+    benchJsonBeginObject(json, NULL);
+    benchJsonU64(json, "surfaces", count);
+    benchJsonU64(json, "render_threads", numThreads);
+    benchJsonDouble(json, "create_total_ms", createNs / 1e6);
+    benchJsonSamples(json, "create", &creates);
+    benchJsonSamples(json, "swap", &swaps);
+    benchJsonDouble(json, "swaps_per_second", swaps.count * 1e9 / swapNs);
+    benchJsonU64(json, "frames_presented", compStats.framesPresented);
+    benchJsonU64(json, "protocol_errors", compStats.protocolErrors);
+    writeUsage(json, "after_create", &created, &base);
+    writeUsage(json, "after_swap", &swapped, &base);
+
+    benchJsonBeginObject(json, "per_surface");
+    for (i = 0; i < 3; i++) {
+        benchJsonDouble(json, budgets[i].name, budgets[i].value);
+    }
+    benchJsonEndObject(json);
+
+    benchJsonBeginArray(json, "over_budget");
+    for (i = 0; i < 3; i++) {
+        if (budgets[i].limit > 0 && budgets[i].value > budgets[i].limit) {
+            fprintf(stderr, "%d surfaces: %.2f %s per surface, budget %.2f\n",
+                    count, budgets[i].value, budgets[i].name,
+                    budgets[i].limit);
+            benchJsonString(json, NULL, budgets[i].name);
+            ok = 0;
+        }
+    }
+    benchJsonEndArray(json);
+    benchJsonEndObject(json);
+
+    benchSamplesFree(&creates);
+    benchSamplesFree(&swaps);
+    BENCH_CHECK(compStats.protocolErrors == 0);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    const char   *counts;
+    char         *end;
+    struct rlimit limit;
+    BenchArgs     args;
+    BenchJson     json;
+    MockEgl       platform;
+    long          count;
+    int           ok = 1;
+
+    benchParseArgs(&args, argc, argv);
+    counts = benchArgString(&args, "counts", "1,10,100,1000");
+
+    /* A thousand surfaces go well past the usual soft limit of 1024 fds */
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    benchLoadPlatform(&platform);
+
+    benchJsonOpen(&json, &args);
+    benchJsonString(&json, "benchmark", "surfaces");
+    benchJsonBeginArray(&json, "runs");
+    while (*counts) {
+        count = strtol(counts, &end, 10);
+        BENCH_CHECK(end != counts && count > 0);
+        if (!runCount(&json, &args, &platform, count)) {
+            ok = 0;
+        }
+        counts = *end == ',' ? end + 1 : end;
+    }
+    benchJsonEndArray(&json);
+    benchJsonBool(&json, "within_budget", ok);
+    benchJsonClose(&json);
+
+    benchUnloadPlatform(&platform);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
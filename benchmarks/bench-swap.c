@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Swap path microbenchmark
+ *
+ * Swaps window surfaces in a loop, one render thread per surface, and
+ * reports the eglSwapBuffers() latency along with the per-stage breakdown
+ * the platform collects with __NV_WAYLAND_SWAP_STATS: display acquire,
+ * frame-sync wait, driver swap, stream flush, image events, explicit sync,
+ * commit and roundtrip, and release points.
+ *
+ * Options:
+ *   --frames=<n>          Swaps per surface, 1000 by default
+ *   --scenario=<a,b,...>  fifo, mailbox, explicit-sync, damage-thread and
+ *                         multi-surface, all by default
+ *   --refresh=<Hz>        Compositor refresh rate, 1000 by default
+ *   --output=<file>       Where the JSON goes, stdout by default
+ */
+
+#include "bench-common.h"
+
+#include <pthread.h>
+
+typedef struct SwapScenarioRec {
+    const char *name;
+    EGLint      swapInterval;
+    EGLBoolean  explicitSync;
+    EGLBoolean  eglstream;      /* With a FIFO synchronous driver, this gets
+                                   the damage thread */
+    int         numSurfaces;
+} SwapScenario;
+
+static const SwapScenario swapScenarios[] = {
+    { "fifo",          1, EGL_FALSE, EGL_FALSE, 1 },
+    { "mailbox",       0, EGL_FALSE, EGL_FALSE, 1 },
+    { "explicit-sync", 1, EGL_TRUE,  EGL_FALSE, 1 },
+    { "damage-thread", 1, EGL_FALSE, EGL_TRUE,  1 },
+    { "multi-surface", 1, EGL_TRUE,  EGL_FALSE, 4 },
+};
+
+#define NUM_SCENARIOS (sizeof(swapScenarios) / sizeof(swapScenarios[0]))
+
+typedef struct RenderThreadRec {
+    BenchSurface surface;
+    EGLint       swapInterval;
+    uint64_t     frames;
+    BenchSamples samples;
+    pthread_t    thread;
+} RenderThread;
+
+static void *renderThread(void *data)
+{
+    RenderThread *rt = data;
+    MockEgl *platform = rt->surface.client->platform;
+    uint64_t i, start;
+
+    benchSurfaceMakeCurrent(&rt->surface, rt->swapInterval);
+
+    for (i = 0; i < rt->frames; i++) {
+        start = benchGetTimeNs();
+        BENCH_CHECK(platform->swapBuffers(rt->surface.client->dpy,
+                                          rt->surface.surface));
+        benchSamplesAdd(&rt->samples, benchGetTimeNs() - start);
+    }
+
+    benchSurfaceReleaseCurrent(&rt->surface);
+
+    return NULL;
+}
+
+static void runScenario(BenchJson *json, const BenchArgs *args,
+                        MockEgl *platform, const SwapScenario *scenario,
+                        BenchSwapStats *swapStats)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   compStats;
+    MockEglStats          eglBefore, eglAfter;
+    MockCompositor       *comp;
+    BenchClient           client;
+    RenderThread         *threads;
+    BenchSamples          swaps;
+    uint64_t              frames = benchArgU64(args, "frames", 1000);
+    uint64_t              start, elapsed;
+    int                   i;
+    size_t                j;
+
+    benchGetCompositorOptions(args, &options);
+    options.explicitSync = scenario->explicitSync;
+    options.eglstream    = scenario->eglstream;
+    if (scenario->eglstream) {
+        options.dmabufVersion = 0;
+    }
+
+    comp = mockCompositorCreate(&options, platform);
+    BENCH_CHECK(comp != NULL);
+    benchClientConnect(&client, platform, comp);
+
+    threads = calloc(scenario->numSurfaces, sizeof(*threads));
+    BENCH_CHECK(threads != NULL);
+    for (i = 0; i < scenario->numSurfaces; i++) {
+        benchSurfaceCreate(&threads[i].surface, &client, 640, 480);
+        threads[i].swapInterval = scenario->swapInterval;
+        threads[i].frames = frames;
+        benchSamplesInit(&threads[i].samples);
+    }
+
+    mockEglGetStats(&eglBefore);
+    start = benchGetTimeNs();
+    for (i = 0; i < scenario->numSurfaces; i++) {
+        BENCH_CHECK(pthread_create(&threads[i].thread, NULL, renderThread,
+                                   &threads[i]) == 0);
+    }
+    for (i = 0; i < scenario->numSurfaces; i++) {
+        pthread_join(threads[i].thread, NULL);
+    }
+    elapsed = benchGetTimeNs() - start;
+    mockEglGetStats(&eglAfter);
+    mockCompositorGetStats(comp, &compStats);
+
+    /* Destroying the surfaces writes their stage reports */
+    benchSamplesInit(&swaps);
+    for (i = 0; i < scenario->numSurfaces; i++) {
+        for (j = 0; j < threads[i].samples.count; j++) {
+            benchSamplesAdd(&swaps, threads[i].samples.values[j]);
+        }
+        benchSamplesFree(&threads[i].samples);
+        benchSurfaceDestroy(&threads[i].surface);
+    }
+    free(threads);
+    benchClientDisconnect(&client);
+    mockCompositorDestroy(comp);
+
+    benchJsonBeginObject(json, NULL);
+    benchJsonString(json, "name", scenario->name);
+    benchJsonU64(json, "surfaces_count", scenario->numSurfaces);
+    benchJsonU64(json, "frames", swaps.count);
+    benchJsonDouble(json, "fps", swaps.count * 1e9 / elapsed);
+    benchJsonSamples(json, "swap", &swaps);
+    benchJsonU64(json, "frames_presented", compStats.framesPresented);
+    benchJsonU64(json, "frames_discarded", compStats.framesDiscarded);
+    benchJsonU64(json, "driver_frames_dropped",
+                 eglAfter.framesDropped - eglBefore.framesDropped);
+    benchJsonU64(json, "protocol_errors", compStats.protocolErrors);
+    benchJsonSwapStats(json, "surfaces", swapStats);
+    benchJsonEndObject(json);
+
+    benchSamplesFree(&swaps);
+    BENCH_CHECK(compStats.protocolErrors == 0);
+}
+
+int main(int argc, char **argv)
+{
+    BenchSwapStats swapStats;
+    BenchArgs      args;
+    BenchJson      json;
+    MockEgl        platform;
+    size_t         i;
+
+    benchParseArgs(&args, argc, argv);
+
+    benchSwapStatsOpen(&swapStats);
+    benchLoadPlatform(&platform);
+
+    benchJsonOpen(&json, &args);
+    benchJsonString(&json, "benchmark", "swap");
+    benchJsonBeginArray(&json, "scenarios");
+    for (i = 0; i < NUM_SCENARIOS; i++) {
+        if (benchScenarioEnabled(&args, swapScenarios[i].name)) {
+            runScenario(&json, &args, &platform, &swapScenarios[i],
+                        &swapStats);
+        }
+    }
+    benchJsonEndArray(&json);
+    benchJsonClose(&json);
+
+    benchUnloadPlatform(&platform);
+    benchSwapStatsClose(&swapStats);
+
+    return EXIT_SUCCESS;
+}
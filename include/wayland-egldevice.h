@@ -70,6 +70,18 @@ typedef struct WlEglDeviceDpyRec {
         unsigned int image_dma_buf_export       : 1;
     } exts;
 
+    /*
+     * Driver capabilities probed on the first eglInitialize() of a display on
+     * this device. The loaded driver can't change, so later displays reuse the
+     * results instead of probing again.
+     */
+    struct {
+        unsigned int probed               : 1;
+        unsigned int native_fence_sync    : 1;
+        unsigned int explicit_sync_probed : 1;
+        unsigned int explicit_sync        : 1;
+    } caps;
+
     struct wl_list link;
 } WlEglDeviceDpy;
 
@@ -31,6 +31,7 @@
 #include "wayland-external-exports.h"
 #include "wayland-eglhandle.h"
 #include "wayland-egldevice.h"
+#include "wayland-eglutils.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -136,6 +137,9 @@ typedef struct WlEglDisplayRec {
     struct wp_linux_drm_syncobj_manager_v1 *wlDrmSyncobj;
     unsigned int                    wlStreamCtlVer;
     struct wp_presentation         *wpPresentation;
+    struct wp_viewporter           *wpViewporter;
+    struct wp_fractional_scale_manager_v1 *wpFractionalScale;
+    struct wp_content_type_manager_v1 *wpContentType;
     struct wl_event_queue          *wlEventQueue;
     struct {
         unsigned int stream_fd     : 1;
@@ -171,6 +175,15 @@ typedef struct WlEglDisplayRec {
 
     struct wl_list wlEglSurfaceList;
 
+    /*
+     * Same surfaces as wlEglSurfaceList, used to validate surface handles
+     * without walking the list. If it couldn't be grown, surfaceSetComplete
+     * is false and validation falls back to the list until the next surface
+     * creation manages to rebuild it.
+     */
+    WlEglPointerSet surfaceSet;
+    EGLBoolean      surfaceSetComplete;
+
     struct wl_list link;
 
     /* The formats given to us by the linux_dmabuf.modifiers event */
@@ -182,6 +195,17 @@ typedef struct WlEglDisplayRec {
     WlEglDmaBufFeedback defaultFeedback;
 
     EGLBoolean primeRenderOffload;
+
+    /*
+     * Optional thread reading the display fd, enabled with
+     * __NV_WAYLAND_IO_THREAD=1 on Linux. Frame callbacks are delivered on
+     * ioQueue, which only that thread dispatches, with ioMutex held.
+     */
+    struct wl_event_queue *ioQueue;
+    pthread_t              ioThreadId;
+    pthread_mutex_t        ioMutex;
+    int                    ioThreadPipe[2];
+    uint32_t               ioThreadExited;
 } WlEglDisplay;
 
 typedef struct WlEventQueueRec {
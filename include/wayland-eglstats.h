@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef WAYLAND_EGLSTATS_H
+#define WAYLAND_EGLSTATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stages of wlEglSwapBuffersWithDamageHook() that are timed when swap
+ * statistics are enabled.
+ */
+typedef enum {
+    WL_EGL_SWAP_STAGE_ACQUIRE_DISPLAY = 0,
+    WL_EGL_SWAP_STAGE_FRAME_SYNC_WAIT,
+    WL_EGL_SWAP_STAGE_DRIVER_SWAP,
+    WL_EGL_SWAP_STAGE_STREAM_FLUSH,
+    WL_EGL_SWAP_STAGE_IMAGE_EVENTS,
+    WL_EGL_SWAP_STAGE_EXPLICIT_SYNC,
+    WL_EGL_SWAP_STAGE_COMMIT,
+    WL_EGL_SWAP_STAGE_RELEASE_POINTS,
+    WL_EGL_SWAP_STAGE_COUNT
+} WlEglSwapStage;
+
+/*
+ * Log-linear latency histogram in nanoseconds. Bucket 0 holds everything
+ * below 256ns, then every power of two is split into 4 buckets, which gives
+ * percentiles within ~25% of the real value up to several minutes.
+ */
+#define WL_EGL_HISTOGRAM_BUCKETS 128
+
+typedef struct WlEglHistogramRec {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[WL_EGL_HISTOGRAM_BUCKETS];
+} WlEglHistogram;
+
+typedef struct WlEglSwapStatsRec {
+    uint64_t       frames;
+    WlEglHistogram stages[WL_EGL_SWAP_STAGE_COUNT];
+} WlEglSwapStats;
+
+/*
+ * Always-on per-surface counters. They are updated from the app thread as
+ * well as the damage and buffer release threads, so only touch them through
+ * WL_EGL_COUNTER_ADD() and wlEglHistogramAddAtomic().
+ */
+typedef struct WlEglPerfCountersRec {
+    uint64_t       framesPresented;
+    uint64_t       framesDropped;
+    uint64_t       reallocsResize;
+    uint64_t       reallocsFeedback;
+    uint64_t       explicitSyncIoctls;
+    uint64_t       reallocsSkipped;
+    uint64_t       reallocsTrim;
+    uint64_t       buffersTrimmed;
+    WlEglHistogram frameCallbackWait;
+    WlEglHistogram releaseWait;
+    WlEglHistogram roundtrip;
+    WlEglHistogram realloc;
+} WlEglPerfCounters;
+
+#define WL_EGL_COUNTER_ADD(counter, n) \
+    ((void) __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED))
+
+#define WL_EGL_COUNTER_READ(counter) \
+    __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+/*
+ * wlEglSwapStatsEnabled()
+ *
+ * Returns true if per-stage swap statistics were requested with the
+ * __NV_WAYLAND_SWAP_STATS environment variable. "1" reports to stderr, any
+ * other value (except "0") is used as a file to append the reports to.
+ */
+bool wlEglSwapStatsEnabled(void);
+
+uint64_t wlEglGetTimeNs(void);
+
+void wlEglHistogramAdd(WlEglHistogram *hist, uint64_t value);
+void wlEglHistogramAddAtomic(WlEglHistogram *hist, uint64_t value);
+void wlEglHistogramSnapshot(WlEglHistogram *dst, const WlEglHistogram *src);
+/* Adds a snapshot of src to dst, which must not be updated concurrently */
+void wlEglHistogramMerge(WlEglHistogram *dst, const WlEglHistogram *src);
+uint64_t wlEglHistogramPercentile(const WlEglHistogram *hist, double percentile);
+
+/*
+ * wlEglSwapStatsCreate()
+ *
+ * Allocates a zeroed statistics block, or returns NULL if statistics are
+ * disabled. All other functions accept a NULL block and do nothing.
+ */
+WlEglSwapStats *wlEglSwapStatsCreate(void);
+void wlEglSwapStatsDestroy(WlEglSwapStats *stats);
+
+/*
+ * wlEglSwapStatsReport()
+ *
+ * Writes a single-line JSON report with p50/p99/p99.9 latencies of every
+ * stage, tagged with the presentation mode the surface was using.
+ */
+void wlEglSwapStatsReport(const WlEglSwapStats *stats,
+                          const void *surface,
+                          int fifoLength,
+                          int swapInterval,
+                          bool dmaBuf,
+                          bool explicitSync,
+                          bool damageThread);
+
+static inline uint64_t
+wlEglSwapStatsBegin(const WlEglSwapStats *stats)
+{
+    return stats ? wlEglGetTimeNs() : 0;
+}
+
+static inline void
+wlEglSwapStatsEnd(WlEglSwapStats *stats, WlEglSwapStage stage, uint64_t start)
+{
+    if (stats) {
+        wlEglHistogramAdd(&stats->stages[stage], wlEglGetTimeNs() - start);
+    }
+}
+
+static inline void
+wlEglSwapStatsAdd(WlEglSwapStats *stats, WlEglSwapStage stage, uint64_t value)
+{
+    if (stats) {
+        wlEglHistogramAdd(&stats->stages[stage], value);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -30,6 +30,9 @@
 #include "wayland-egldisplay.h"
 #include "wayland-eglutils.h"
 #include "wayland-eglsurface.h"
+#include "wayland-eglstats.h"
+
+#define MAX_IMAGES 4 /* The swapchain image count */
 
 #ifdef __cplusplus
 extern "C" {
@@ -77,6 +80,18 @@ typedef struct WlEglSurfaceCtxRec {
     EGLuint64KHR framesFinished;
     EGLuint64KHR framesProcessed;
 
+    /*
+     * Optional thread handling local stream consumer events, see
+     * image_consumer_thread(). consumerSeq is bumped (and futex-woken) every
+     * time consumerFrame or consumerExited change.
+     */
+    pthread_t    consumerThreadId;
+    int          consumerShutdown;
+    int          consumerExited;
+    EGLint       consumerError;
+    EGLuint64KHR consumerFrame;
+    uint32_t     consumerSeq;
+
     /*
      * Use an individual mutex to guard access to streamImages. This helps us
      * to avoid sharing the surface lock between the app and buffer release
@@ -89,6 +104,10 @@ typedef struct WlEglSurfaceCtxRec {
     struct wl_list          acquiredImages;
     struct wl_buffer       *currentBuffer;
 
+    /* Only set while the context is waiting in the surface's oldCtxList */
+    struct WlEglSurfaceRec *surface;
+    size_t                  deferredBytes;
+
     struct wl_list link;
 } WlEglSurfaceCtx;
 
@@ -97,6 +116,8 @@ struct WlEglSurfaceRec {
     EGLConfig     eglConfig;
     EGLint       *attribs;
     EGLBoolean    pendingSwapIntervalUpdate;
+    /* wl_display.sync following an override sent by wlEglTryPrePresentExport() */
+    struct wl_callback *swapIntervalSync;
 
     struct wl_egl_window *wlEglWin;
     long int              wlEglWinVer;
@@ -106,6 +127,11 @@ struct WlEglSurfaceRec {
 
     WlEglSurfaceCtx ctx;
     struct wl_list  oldCtxList;
+    unsigned int    oldCtxCount;
+    size_t          oldCtxBytes;
+    /* Caps on the above, read once when the surface is created. 0 is none */
+    unsigned long   oldCtxMaxCount;
+    size_t          oldCtxMaxBytes;
 
     EGLint swapInterval;
     EGLint fifoLength;
@@ -117,6 +143,23 @@ struct WlEglSurfaceRec {
 
     struct wl_callback    *throttleCallback;
     struct wl_event_queue *wlEventQueue;
+    /* Non-zero while a frame callback on the display's ioQueue is pending */
+    uint32_t               frameSyncPending;
+    /*
+     * Idle trimming, see trim_surface_stream(). trimIdleMs is how late a frame
+     * callback or how far apart two swaps may be before the surface counts
+     * as idle, 0 if disabled. The flags are protected by mutexLock.
+     */
+    uint32_t               trimIdleMs;
+    uint64_t               lastSwapNs;
+    /* The stream is to be trimmed at the end of the next swap */
+    EGLBoolean             trimPending;
+    /* Trimmed since the surface last presented at a steady rate */
+    EGLBoolean             trimmed;
+    /* The frame being swapped was dropped along with the old stream */
+    EGLBoolean             trimDroppedFrame;
+    /* eventfd from wlEglGetSurfaceReadyFdExport(), -1 until requested */
+    int                    readyFd;
 
     /* Asynchronous wl_buffer.release event processing */
     struct {
@@ -125,6 +168,20 @@ struct WlEglSurfaceRec {
         int                     bufferReleaseThreadPipe[2];
     };
 
+    /*
+     * Thread that signals readyFd for events the app has yet to dispatch and
+     * for release points it can't have the kernel signal readyFd for. The
+     * release points are protected by mutexFrameSync.
+     */
+    struct {
+        struct wl_event_queue  *readyThreadQueue;
+        pthread_t               readyThreadId;
+        int                     readyThreadPipe[2];
+        uint32_t                releaseWakeupCount;
+        uint32_t                releaseWakeupSyncobjs[MAX_IMAGES];
+        uint64_t                releaseWakeupPoints[MAX_IMAGES];
+    };
+
     struct wl_list link;
 
     EGLBoolean isSurfaceProducer;
@@ -148,6 +205,32 @@ struct WlEglSurfaceRec {
     /* True when the EGL_PRESENT_OPAQUE_EXT surface attrib is set by the app */
     EGLBoolean presentOpaque;
 
+    /*
+     * Render scale from __NV_WAYLAND_RENDER_SCALE, in thousandths. While the
+     * buffers are allocated at width x height, which differs from the window
+     * size windowWidth x windowHeight, wpViewport scales them back to the
+     * window size.
+     */
+    EGLint              renderScale;
+    int                 windowWidth;
+    int                 windowHeight;
+    struct wp_viewport *wpViewport;
+
+    /*
+     * Set with __NV_WAYLAND_FRACTIONAL_SCALE=1. preferredScale is in 1/120
+     * units as sent by the compositor, 0 until the first event.
+     */
+    EGLBoolean                     fractionalScale;
+    struct wp_fractional_scale_v1 *wpFractionalScale;
+    uint32_t                       preferredScale;
+
+    /*
+     * wp_content_type_v1 type from __NV_WAYLAND_CONTENT_TYPE and the object
+     * it was sent through
+     */
+    uint32_t                   contentType;
+    struct wp_content_type_v1 *wpContentType;
+
     /* This pair of mutex and conditional variable is used
      * for sychronization between eglSwapBuffers() and damage
      * thread on creating frame sync and waiting for it.
@@ -168,8 +251,26 @@ struct WlEglSurfaceRec {
     uint32_t drmSyncobjHandle;
     /* Last acquire point used. This starts at 1, zero means invalid.  */
     uint64_t syncPoint;
+
+    /* Per-stage swap latencies, NULL unless __NV_WAYLAND_SWAP_STATS is set */
+    WlEglSwapStats *swapStats;
+
+    /*
+     * Number of eglSwapBuffers() calls, reported by the tracepoints. The
+     * helper threads read it too, use wlEglSurfaceFrameNumber().
+     */
+    uint64_t frameNumber;
+
+    /* Exported through wlEglQuerySurfaceCountersExport() */
+    WlEglPerfCounters counters;
 };
 
+static inline uint64_t
+wlEglSurfaceFrameNumber(const WlEglSurface *surface)
+{
+    return __atomic_load_n(&surface->frameNumber, __ATOMIC_RELAXED);
+}
+
 void wlEglReallocSurface(WlEglDisplay *display,
                          WlEglPlatformData *pData,
                          WlEglSurface *surface);
@@ -195,6 +296,17 @@ EGLBoolean wlEglDestroyAllSurfaces(WlEglDisplay *display);
 EGLBoolean wlEglIsWaylandWindowValid(struct wl_egl_window *window);
 EGLBoolean wlEglIsWlEglSurfaceForDisplay(WlEglDisplay *display, WlEglSurface *wlEglSurface);
 
+/*
+ * Finds the display an untrusted surface handle belongs to. Returns it
+ * referenced and with its lock held, which keeps the surface alive, or NULL
+ * if the handle isn't a live surface. Undo with wlEglMutexUnlock() and
+ * wlEglReleaseDisplay().
+ *
+ * The API lock is never held while waiting for a display lock: displays
+ * locked by another thread are polled until they are released.
+ */
+WlEglDisplay *wlEglAcquireSurfaceDisplay(WlEglSurface *surface);
+
 EGLBoolean wlEglQuerySurfaceHook(EGLDisplay dpy, EGLSurface eglSurface, EGLint attribute, EGLint *value);
 
 EGLBoolean wlEglQueryNativeResourceHook(EGLDisplay dpy,
@@ -205,14 +317,47 @@ EGLBoolean wlEglQueryNativeResourceHook(EGLDisplay dpy,
 EGLBoolean
 wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface);
 
+/*
+ * Returns EGL_FALSE if wlEglSurfaceCheckReleasePoints() would block waiting
+ * for the compositor to release a buffer. The surface's ready fd is signalled
+ * once it wouldn't anymore. Must be called with the surface lock held.
+ */
+EGLBoolean
+wlEglSurfaceReleasePointsReady(WlEglDisplay *display, WlEglSurface *surface);
+
 EGLBoolean wlEglSendDamageEvent(WlEglSurface *surface,
                                 struct wl_event_queue *queue,
                                 EGLint *rects,
                                 EGLint n_rects);
 
 void wlEglCreateFrameSync(WlEglSurface *surface);
+
+/*
+ * Waits for the frame callback of the previous frame. A callback late by the
+ * surface's trimIdleMs trims it, which may drop the frame being swapped: see
+ * trimDroppedFrame.
+ */
 EGLint wlEglWaitFrameSync(WlEglSurface *surface);
 
+/*
+ * Non-blocking version of wlEglWaitFrameSync(). Returns EGL_TRUE if the
+ * frame callback has arrived, i.e. wlEglWaitFrameSync() would not block.
+ */
+EGLBoolean wlEglPollFrameSync(WlEglSurface *surface);
+
+/*
+ * Trims the stream of a surface that presents rarely, or whose trim was
+ * deferred, once the frame is committed. idle says the surface was held back
+ * for trimIdleMs, either by the application, as the swap came that long after
+ * the previous one, or by the compositor, as the frame callback came that
+ * late. Must be called with the surface lock held, at the end of a swap.
+ */
+void wlEglTrimSurfaceAfterSwap(WlEglDisplay *display, WlEglSurface *surface,
+                               EGLBoolean idle);
+
+/* Wakes up whoever polls the surface's ready fd, if there is one */
+void wlEglSignalSurfaceReady(WlEglSurface *surface);
+
 EGLBoolean wlEglSurfaceRef(WlEglDisplay *display, WlEglSurface *surface);
 void wlEglSurfaceUnref(WlEglSurface *surface);
 
@@ -36,6 +36,48 @@ extern "C" {
 
 typedef struct WlEglSurfaceRec WlEglSurface;
 
+typedef struct WlEglLatencySummaryRec {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t p50Ns;
+    uint64_t p99Ns;
+    uint64_t maxNs;
+} WlEglLatencySummary;
+
+/*
+ * Snapshot of a surface's performance counters as returned by
+ * wlEglQuerySurfaceCountersExport(). New fields are only ever appended, so
+ * callers built against an older layout keep working.
+ */
+typedef struct WlEglSurfaceCountersRec {
+    /* Frames committed to the compositor */
+    uint64_t framesPresented;
+    /* Frames the driver produced that never reached the compositor */
+    uint64_t framesDropped;
+    /* Stream reallocations caused by window resizes */
+    uint64_t reallocsResize;
+    /* Stream reallocations caused by new dma-buf feedback */
+    uint64_t reallocsFeedback;
+    /* Buffers currently held by the compositor */
+    uint64_t buffersHeld;
+    /* DRM syncobj ioctls issued for explicit sync */
+    uint64_t explicitSyncIoctls;
+
+    WlEglLatencySummary frameCallbackWait;
+    WlEglLatencySummary releaseWait;
+    WlEglLatencySummary roundtrip;
+
+    /* Resizes that only moved the surface and needed no new buffers */
+    uint64_t reallocsSkipped;
+    /* Time spent in each stream reallocation */
+    WlEglLatencySummary realloc;
+
+    /* Stream reallocations caused by trimming */
+    uint64_t reallocsTrim;
+    /* wl_buffers released to the compositor by trimming */
+    uint64_t buffersTrimmed;
+} WlEglSurfaceCounters;
+
 WL_EXPORT
 EGLStreamKHR wlEglGetSurfaceStreamExport(WlEglSurface *surface);
 
@@ -61,6 +103,60 @@ int wlEglWaitAllPresentationFeedbacksExport(WlEglSurface *surface);
 WL_EXPORT
 int wlEglProcessPresentationFeedbacksExport(WlEglSurface *surface);
 
+/*
+ * wlEglQuerySurfaceCountersExport()
+ *
+ * Copies up to size bytes of the surface's counters into counters. This
+ * does not take the surface lock and may be called from any thread. It only
+ * holds the API and display locks for the copy itself and never blocks other
+ * threads while it waits: if a swap holds the display lock, for example
+ * across a roundtrip, this returns once that swap lets go of it. Returns 0 on
+ * success, -1 on invalid arguments, including a surface that was already
+ * destroyed.
+ */
+WL_EXPORT
+int wlEglQuerySurfaceCountersExport(WlEglSurface *surface,
+                                    WlEglSurfaceCounters *counters,
+                                    size_t size);
+
+/*
+ * wlEglGetSurfaceReadyFdExport()
+ *
+ * Returns an eventfd that becomes readable whenever presenting on the surface
+ * may have stopped blocking: a frame callback arrived, the damage thread
+ * submitted a frame or the compositor released a buffer. Read it to reset it,
+ * then call wlEglTryPrePresentExport() to find out whether the surface is
+ * actually ready, as wakeups can be spurious. The fd is enough to wait on by
+ * itself: requesting it starts a helper thread that reads the wl_display on
+ * the app's behalf and watches the release points of explicitly synced
+ * buffers. The fd is owned by the surface and stays valid until it is
+ * destroyed. Returns -1 on failure.
+ */
+WL_EXPORT
+int wlEglGetSurfaceReadyFdExport(WlEglSurface *surface);
+
+/*
+ * wlEglTrimSurfaceExport()
+ *
+ * Releases the memory an idle surface doesn't need, e.g. in response to a
+ * memory pressure signal. The wl_buffers of images the compositor isn't
+ * holding are destroyed and recreated on their next use. The stream of a
+ * window surface is also reallocated, so the driver frees all images but the
+ * ones still on screen and allocates them again as frames are rendered. That
+ * replaces the producer surface, which must happen on the thread the surface
+ * is current on: from any other thread, or while the surface isn't current,
+ * it is done at the end of the next swap. Returns the number of wl_buffers
+ * released, or -1 on invalid arguments.
+ *
+ * With __NV_WAYLAND_TRIM_IDLE_MS=<ms>, window surfaces are also trimmed
+ * automatically: when eglSwapBuffers() waits that long for a frame callback,
+ * as compositors stop sending them to hidden surfaces, and after a swap that
+ * comes that long after the previous one. The frame that waited is dropped.
+ * Either happens once until the surface presents steadily again.
+ */
+WL_EXPORT
+int wlEglTrimSurfaceExport(WlEglSurface *surface);
+
 #ifdef __cplusplus
 }
 #endif
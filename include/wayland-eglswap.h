@@ -46,6 +46,26 @@ EGLint wlEglStreamSwapIntervalCallback(WlEglPlatformData *data,
 WL_EXPORT
 EGLBoolean wlEglPrePresentExport(WlEglSurface *surface);
 
+/*
+ * wlEglTryPrePresentExport()
+ *
+ * Non-blocking wlEglPrePresentExport(). Unlike the other present functions
+ * this doesn't return an EGLBoolean, but one of:
+ *
+ *   EGL_CONDITION_SATISFIED_KHR  the surface is ready to present
+ *   EGL_TIMEOUT_EXPIRED_KHR      presenting would have blocked, try again
+ *                                later
+ *   EGL_FALSE (0)                error: surface isn't a live window surface,
+ *                                or the connection to the compositor failed
+ *
+ * Besides the frame callback and the damage thread, this accounts for a swap
+ * interval update waiting for the compositor's answer and for
+ * wlEglPostPresentExport2() having to wait for a buffer release. See
+ * wlEglGetSurfaceReadyFdExport() for waiting until it's worth trying again.
+ */
+WL_EXPORT
+EGLint wlEglTryPrePresentExport(WlEglSurface *surface);
+
 WL_EXPORT
 EGLBoolean wlEglPostPresentExport(WlEglSurface *surface);
 
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef WAYLAND_EGLTRACE_H
+#define WAYLAND_EGLTRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static tracepoints on the presentation pipeline.
+ *
+ * Every tracepoint carries the WlEglSurface pointer as the surface ID and the
+ * surface's frame number. A few carry more:
+ *
+ *  - swap_begin: the swap interval the frame is presented with, as its arg.
+ *  - window_surface_create and realloc_end: the window size, as
+ *    WL_EGL_TRACE_SIZE(width, height), in place of the frame number.
+ *
+ * When sys/sdt.h is available at build time each tracepoint is also a USDT
+ * probe in the "egl_wayland" provider, taking the surface, frame and arg,
+ * which compiles to a single nop until bpftrace/perf attach to it, e.g.:
+ *
+ *   bpftrace -e 'usdt:libnvidia-egl-wayland.so.1:egl_wayland:* { ... }'
+ *
+ * Setting __NV_WAYLAND_TRACE_MARKER=1 additionally writes every tracepoint to
+ * the ftrace trace_marker file so they show up in Perfetto/trace-cmd
+ * captures.
+ *
+ * Setting __NV_WAYLAND_RECORD=<path> keeps the most recent tracepoints in an
+ * in-memory ring of fixed-size binary records (__NV_WAYLAND_RECORD_SIZE
+ * entries, 65536 by default and at most 2^26). The ring is written to <path>
+ * when the library is unloaded, and also whenever the signal number given in
+ * __NV_WAYLAND_RECORD_SIGNAL is received, so a stutter can be captured from
+ * a running process and analyzed offline. Only the tracepoints placed in the
+ * code are recorded: the EGL hooks (eglSwapBuffers as its swap stages), the
+ * attach/commit/frame/release traffic of the presentation path, dma-buf
+ * feedback, and the driver swap, flush and image acquisition calls. The
+ * wlEgl*Export entry points, other protocol messages and other driver calls
+ * leave no trace. See WlEglTraceFileHeader for the file layout.
+ *
+ * When neither sink is on a tracepoint only costs a predicted branch.
+ */
+#if defined(HAVE_SYS_SDT_H)
+#include <sys/sdt.h>
+#define WL_EGL_TRACE_USDT(name, surface, frame, arg)                        \
+    DTRACE_PROBE3(egl_wayland, name, (uintptr_t)(surface), (uint64_t)(frame), \
+                  (uint16_t)(arg))
+#else
+#define WL_EGL_TRACE_USDT(name, surface, frame, arg) do { } while (0)
+#endif
+
+#define WL_EGL_TRACE_ARG(name, surface, frame, arg)                         \
+    do {                                                                    \
+        WL_EGL_TRACE_USDT(name, surface, frame, arg);                       \
+        if (__builtin_expect(wlEglTraceSinks != 0, 0)) {                    \
+            static int wlEglTraceNameId = -1;                               \
+            wlEglTraceEmit(&wlEglTraceNameId, #name,                        \
+                           (surface), (uint64_t)(frame), (uint16_t)(arg));  \
+        }                                                                   \
+    } while (0)
+
+#define WL_EGL_TRACE(name, surface, frame)                                  \
+    WL_EGL_TRACE_ARG(name, surface, frame, 0)
+
+/* The window size as carried by window_surface_create and realloc_end */
+#define WL_EGL_TRACE_SIZE(width, height) \
+    (((uint64_t)(uint32_t)(width) << 32) | (uint32_t)(height))
+
+#define WL_EGL_TRACE_SINK_MARKER   (1 << 0)
+#define WL_EGL_TRACE_SINK_RECORDER (1 << 1)
+
+/* Mask of WL_EGL_TRACE_SINK_* that were enabled through the environment */
+extern int wlEglTraceSinks;
+
+/*
+ * Recording file layout: a WlEglTraceFileHeader, then nameCount names, each
+ * a uint16_t length followed by that many bytes without a terminator, then
+ * recordCount WlEglTraceRecords from oldest to newest. All values are in
+ * host byte order. Records older than the ring size are lost and counted in
+ * the header's dropped field.
+ */
+#define WL_EGL_TRACE_FILE_MAGIC   "WLEGLREC"
+#define WL_EGL_TRACE_FILE_VERSION 2
+
+typedef struct WlEglTraceFileHeaderRec {
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t nameCount;
+    uint32_t pid;
+    uint64_t recordCount;
+    uint64_t dropped;
+} WlEglTraceFileHeader;
+
+typedef struct WlEglTraceRecordRec {
+    uint64_t timestamp;     /* CLOCK_MONOTONIC, in nanoseconds */
+    uint64_t surface;       /* Surface, display or proxy ID */
+    uint64_t frame;
+    uint32_t tid;
+    uint16_t name;          /* Index into the file's name table */
+    uint16_t arg;           /* Tracepoint specific value, 0 if none */
+} WlEglTraceRecord;
+
+/*
+ * wlEglTraceInit()
+ *
+ * Enables the trace sinks requested through the environment. Safe to call
+ * more than once.
+ */
+void wlEglTraceInit(void);
+
+void wlEglTraceEmit(int *nameId, const char *name,
+                    const void *surface, uint64_t frame, uint16_t arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
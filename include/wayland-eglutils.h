@@ -25,8 +25,10 @@
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include <stdint.h>
 #include "wayland-external-exports.h"
 #include "wayland-eglhandle.h"
+#include <wayland-client.h>
 
 #ifdef NDEBUG
 #define wlEglSetError(data, err) \
@@ -49,6 +51,46 @@
 extern "C" {
 #endif
 
+/*
+ * Open-addressed set of pointers, used to validate handles in O(1) instead of
+ * walking a list. A zero-initialized set is empty and ready to use.
+ */
+typedef struct WlEglPointerSetRec {
+    void     **slots;
+    uint32_t   capacity;
+    uint32_t   count;
+} WlEglPointerSet;
+
+EGLBoolean wlEglPointerSetInsert(WlEglPointerSet *set, void *ptr);
+void wlEglPointerSetRemove(WlEglPointerSet *set, const void *ptr);
+EGLBoolean wlEglPointerSetContains(const WlEglPointerSet *set, const void *ptr);
+void wlEglPointerSetFree(WlEglPointerSet *set);
+
+/*
+ * Thin futex wrappers. wlEglFutexWait() blocks while *addr == val, for at
+ * most timeoutMs milliseconds (or forever if negative), and may return early.
+ * Off Linux it only sleeps briefly, so callers must check again in a loop.
+ */
+void wlEglFutexWait(uint32_t *addr, uint32_t val, int timeoutMs);
+void wlEglFutexWakeAll(uint32_t *addr);
+
+/*
+ * Reads the events already on the wire without blocking and dispatches the
+ * given queue. Returns the number of dispatched events, or -1 on a display
+ * error.
+ */
+int wlEglDispatchQueueNonBlocking(struct wl_display *dpy,
+                                  struct wl_event_queue *queue);
+
+/*
+ * wl_display_dispatch_queue() that gives up after timeoutMs milliseconds.
+ * Returns the number of dispatched events, 0 if none came in time, or -1 on
+ * a display error.
+ */
+int wlEglDispatchQueueTimeout(struct wl_display *dpy,
+                              struct wl_event_queue *queue,
+                              int timeoutMs);
+
 EGLBoolean wlEglFindExtension(const char *extension, const char *extensions);
 EGLBoolean wlEglMemoryIsReadable(const void *p, size_t len);
 EGLBoolean wlEglCheckInterfaceType(struct wl_object *obj, const char *ifname);
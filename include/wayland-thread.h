@@ -26,6 +26,93 @@
 #include <wayland-client.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Cleanup at library unload: a destructor function where the toolchain
+ * supports it, otherwise WL_EGL_ATEXIT() registers it. WL_EGL_ATEXIT()
+ * returns non-zero on failure.
+ */
+#if defined(__QNX__)
+#define WL_EGL_ATTRIBUTE_DESTRUCTOR
+#define WL_EGL_ATEXIT(func) atexit(func)
+#else
+#define WL_EGL_ATTRIBUTE_DESTRUCTOR __attribute__((destructor))
+#define WL_EGL_ATEXIT(func) 0
+#endif
+
+/*
+ * Lock profiling
+ *
+ * When built with WL_EGL_LOCK_PROFILING (meson -Dlock-profiling=true or
+ * configure --enable-lock-profiling), every acquisition of the locks below
+ * records its wait and hold time, reported per call site and per lock class. The
+ * report is written at exit, or whenever the signal number given in
+ * __NV_WAYLAND_LOCK_PROFILE_SIGNAL is received, to the file named by
+ * __NV_WAYLAND_LOCK_PROFILE (stderr by default).
+ *
+ * In regular builds wlEglMutexLock()/wlEglMutexTryLock()/wlEglMutexUnlock()
+ * are plain pthread_mutex_lock()/pthread_mutex_trylock()/
+ * pthread_mutex_unlock() calls.
+ */
+typedef enum {
+    WL_EGL_LOCK_API = 0,        /* wlExternalApiLock() */
+    WL_EGL_LOCK_DISPLAY,        /* WlEglDisplay::mutex */
+    WL_EGL_LOCK_SURFACE,        /* WlEglSurface::mutexLock */
+    WL_EGL_LOCK_STREAM_IMAGES,  /* WlEglSurfaceCtx::streamImagesMutex */
+    WL_EGL_LOCK_CLASS_COUNT
+} WlEglLockClass;
+
+#if defined(WL_EGL_LOCK_PROFILING)
+
+#include "wayland-eglstats.h"
+
+/*
+ * The per class figures are merged from the call sites when the report is
+ * written, so every site keeps full wait and hold time histograms.
+ */
+typedef struct WlEglLockSiteRec {
+    const char              *file;
+    int                      line;
+    WlEglLockClass           lockClass;
+    int                      registered;
+    struct WlEglLockSiteRec *next;
+
+    uint64_t                 contended;
+    WlEglHistogram           wait;
+    WlEglHistogram           hold;
+} WlEglLockSite;
+
+/* Statically allocated, lazily registered descriptor of the calling line */
+#define WL_EGL_LOCK_SITE(cls)                                               \
+    ({                                                                      \
+        static WlEglLockSite wlEglLockSite_ = {                             \
+            .file = __FILE__, .line = __LINE__, .lockClass = (cls),         \
+        };                                                                  \
+        &wlEglLockSite_;                                                    \
+    })
+
+int wlEglProfiledMutexLock(pthread_mutex_t *mutex, WlEglLockSite *site);
+int wlEglProfiledMutexTryLock(pthread_mutex_t *mutex, WlEglLockSite *site);
+int wlEglProfiledMutexUnlock(pthread_mutex_t *mutex);
+int wlExternalApiLockAt(WlEglLockSite *site);
+
+#define wlEglMutexLock(mutex, lockClass) \
+    wlEglProfiledMutexLock((mutex), WL_EGL_LOCK_SITE(lockClass))
+#define wlEglMutexTryLock(mutex, lockClass) \
+    wlEglProfiledMutexTryLock((mutex), WL_EGL_LOCK_SITE(lockClass))
+#define wlEglMutexUnlock(mutex, lockClass) \
+    wlEglProfiledMutexUnlock(mutex)
+#define wlExternalApiLock() \
+    wlExternalApiLockAt(WL_EGL_LOCK_SITE(WL_EGL_LOCK_API))
+
+#else
+
+#define wlEglMutexLock(mutex, lockClass)    pthread_mutex_lock(mutex)
+#define wlEglMutexTryLock(mutex, lockClass) pthread_mutex_trylock(mutex)
+#define wlEglMutexUnlock(mutex, lockClass)  pthread_mutex_unlock(mutex)
+
+#endif
 
 /*
  * wlExternalApiLock()
@@ -41,7 +128,9 @@
  *
  * Returns 0 upon success; otherwise returns -1.
  */
+#if !defined(WL_EGL_LOCK_PROFILING)
 int wlExternalApiLock(void);
+#endif
 
 /*
  * wlExternalApiUnlock()
@@ -77,4 +166,30 @@ bool wlEglInitializeMutex(pthread_mutex_t *mutex);
  */
 void wlEglMutexDestroy(pthread_mutex_t *mutex);
 
+/*
+ * wlEglCreateHelperThread()
+ *
+ * Creates one of the platform's helper threads (damage, buffer release, I/O
+ * and image consumer) and names it "nvwl-<name>". Its scheduling can be
+ * tuned through the environment:
+ *
+ *   __NV_WAYLAND_THREAD_SCHED     "fifo:<prio>", "rr:<prio>" or "nice:<n>"
+ *   __NV_WAYLAND_THREAD_AFFINITY  "inherit" (default) keeps the affinity of
+ *                                 the creating thread, "near" pins the thread
+ *                                 next to the CPU the creating thread is
+ *                                 running on (its SMT siblings, or else the
+ *                                 CPUs sharing its last level cache, never
+ *                                 that CPU itself), anything else is a CPU
+ *                                 list like "2,4-6"
+ *   __NV_WAYLAND_THREAD_STACK_KB  stack size in KiB
+ *
+ * Attributes that can't be applied, e.g. a realtime policy without the
+ * privileges for it, are ignored and the thread is created with the default
+ * ones. Returns 0 upon success, like pthread_create().
+ */
+int wlEglCreateHelperThread(pthread_t *thread,
+                            const char *name,
+                            void *(*func)(void *),
+                            void *arg);
+
 #endif
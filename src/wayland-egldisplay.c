@@ -29,10 +29,14 @@
 #include "wayland-eglsurface-internal.h"
 #include "wayland-eglhandle.h"
 #include "wayland-eglutils.h"
+#include "wayland-egltrace.h"
 #include "wayland-drm-client-protocol.h"
 #include "wayland-drm.h"
 #include "presentation-time-client-protocol.h"
 #include "linux-drm-syncobj-v1-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "content-type-v1-client-protocol.h"
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -41,12 +45,21 @@
 #include <sys/mman.h>
 #include <xf86drm.h>
 #include <dlfcn.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <sys/sysmacros.h>
+#include <sys/stat.h>
+#include <time.h>
 
 typedef struct WlServerProtocolsRec {
     EGLBoolean hasEglStream;
     EGLBoolean hasDmaBuf;
     struct zwp_linux_dmabuf_v1 *wlDmaBuf;
+    struct zwp_linux_dmabuf_feedback_v1 *wlDmaBufFeedback;
     dev_t devId;
+    /* Render node of the dma-buf main device, preferred over wl_drm's */
+    char *feedback_drm_name;
 
     struct wl_drm *wlDrm;
     char *drm_name;
@@ -86,6 +99,8 @@ EGLBoolean wlEglBindDisplaysHook(void *data, EGLDisplay dpy, void *nativeDpy)
                *dev_name = wl_drm_get_dev_name(data, dpy);
     EGLBoolean res = EGL_FALSE;
 
+    WL_EGL_TRACE(hook_eglBindWaylandDisplayWL, dpy, 0);
+
     wlExternalApiLock();
 
     res = wl_eglstream_display_bind((WlEglPlatformData *)data,
@@ -102,6 +117,8 @@ EGLBoolean wlEglUnbindDisplaysHook(EGLDisplay dpy, void *nativeDpy)
     struct wl_eglstream_display *wlStreamDpy;
     EGLBoolean res = EGL_FALSE;
 
+    WL_EGL_TRACE(hook_eglUnbindWaylandDisplayWL, dpy, 0);
+
     wlExternalApiLock();
 
     wlStreamDpy = wl_eglstream_display_get(dpy);
@@ -371,6 +388,8 @@ dmabuf_feedback_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *dmabuf_fee
     WlEglDmaBufFeedback *feedback = data;
     (void) dmabuf_feedback;
 
+    WL_EGL_TRACE(dmabuf_feedback_done, feedback, 0);
+
     feedback->feedbackDone = feedback->unprocessedFeedback = true;
 }
 
@@ -386,6 +405,17 @@ dmabuf_feedback_format_table(void *data,
     (void) dmabuf_feedback;
 
     assert(size % sizeof(WlEglDmaBufFormatTableEntry) == 0);
+
+    /*
+     * The compositor may send a new format table whenever the feedback
+     * changes. Unmap the previous one so re-sends don't leak mappings.
+     */
+    if (feedback->formatTable.entry &&
+        feedback->formatTable.entry != MAP_FAILED) {
+        munmap((pointer_t)feedback->formatTable.entry,
+               sizeof(feedback->formatTable.entry[0]) * feedback->formatTable.len);
+    }
+
     feedback->formatTable.len = size / sizeof(WlEglDmaBufFormatTableEntry);
 
     feedback->formatTable.entry =
@@ -437,7 +467,7 @@ registry_handle_global(void *data,
                                                 name,
                                                 &wl_eglstream_controller_interface,
                                                 version > 1 ? 2 : 1);
-        display->wlStreamCtlVer = version;
+        display->wlStreamCtlVer = version > 1 ? 2 : 1;
     } else if (strcmp(interface, "zwp_linux_dmabuf_v1") == 0) {
         /*
          * Version 3 added format modifier support, which the dmabuf
@@ -448,13 +478,37 @@ registry_handle_global(void *data,
                                                  name,
                                                  &zwp_linux_dmabuf_v1_interface,
                                                  version > 3 ? 4 : 3);
+            display->dmaBufProtocolVersion = version > 3 ? 4 : 3;
+        } else {
+            display->dmaBufProtocolVersion = version;
         }
-        display->dmaBufProtocolVersion = version;
     } else if (strcmp(interface, "wp_presentation") == 0) {
-        display->wpPresentation = wl_registry_bind(registry,
-                                                   name,
-                                                   &wp_presentation_interface,
-                                                   version);
+        /*
+         * Never bind a newer version than the one we were built against, or
+         * the compositor may send events we have no handlers for.
+         */
+        display->wpPresentation =
+            wl_registry_bind(registry,
+                             name,
+                             &wp_presentation_interface,
+                             version < wp_presentation_interface.version ?
+                                 version : wp_presentation_interface.version);
+    } else if (strcmp(interface, "wp_viewporter") == 0) {
+        display->wpViewporter = wl_registry_bind(registry,
+                                                 name,
+                                                 &wp_viewporter_interface,
+                                                 1);
+    } else if (strcmp(interface, "wp_fractional_scale_manager_v1") == 0) {
+        display->wpFractionalScale =
+            wl_registry_bind(registry,
+                             name,
+                             &wp_fractional_scale_manager_v1_interface,
+                             1);
+    } else if (strcmp(interface, "wp_content_type_manager_v1") == 0) {
+        display->wpContentType = wl_registry_bind(registry,
+                                                  name,
+                                                  &wp_content_type_manager_v1_interface,
+                                                  1);
     } else if (strcmp(interface, "wp_linux_drm_syncobj_manager_v1") == 0 &&
                display->supports_native_fence_sync &&
                display->supports_explicit_sync) {
@@ -576,8 +630,9 @@ dmabuf_feedback_check_done(void *data, struct zwp_linux_dmabuf_feedback_v1 *dmab
     assert(getDeviceFromDevId);
     if (getDeviceFromDevId(protocols->devId, 0, &drm_device) == 0) {
         if (drm_device->available_nodes & (1 << DRM_NODE_RENDER)) {
-            free(protocols->drm_name);
-            protocols->drm_name = strdup(drm_device->nodes[DRM_NODE_RENDER]);
+            free(protocols->feedback_drm_name);
+            protocols->feedback_drm_name =
+                strdup(drm_device->nodes[DRM_NODE_RENDER]);
         }
 
         drmFreeDevice(&drm_device);
@@ -591,8 +646,10 @@ dmabuf_feedback_check_format_table(void *data,
 {
     (void) data;
     (void) dmabuf_feedback;
-    (void) fd;
     (void) size;
+
+    /* The table itself is not needed here, but we own the fd */
+    close(fd);
 }
 
 static const struct zwp_linux_dmabuf_feedback_v1_listener dmabuf_feedback_check_listener = {
@@ -626,9 +683,20 @@ registry_handle_global_check_protocols(
     if ((strcmp(interface, "zwp_linux_dmabuf_v1") == 0) &&
         (version >= 3)) {
         protocols->hasDmaBuf = EGL_TRUE;
-        /* Version 4 introduced default_feedback which allows us to determine the device used by the compositor */
-        if (version >= 4) {
+        /*
+         * Version 4 introduced default_feedback which allows us to determine
+         * the device used by the compositor. Request it right away so its
+         * events arrive in the same roundtrip as the wl_drm ones.
+         */
+        if (version >= 4 && getDeviceFromDevId && !protocols->wlDmaBuf) {
             protocols->wlDmaBuf = wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, 4);
+            protocols->wlDmaBufFeedback =
+                zwp_linux_dmabuf_v1_get_default_feedback(protocols->wlDmaBuf);
+            if (protocols->wlDmaBufFeedback) {
+                zwp_linux_dmabuf_feedback_v1_add_listener(protocols->wlDmaBufFeedback,
+                                                          &dmabuf_feedback_check_listener,
+                                                          protocols);
+            }
         }
     }
 
@@ -689,6 +757,151 @@ static const struct wl_eglstream_display_listener eglstream_display_listener = {
     eglstream_display_handle_swapinterval_override,
 };
 
+static void *io_thread(void *args)
+{
+    WlEglDisplay      *display = (WlEglDisplay *)args;
+    struct wl_display *wlDpy   = display->nativeDpy;
+    struct pollfd      pfds[2];
+    int                res;
+
+    while (1) {
+        /* Deliver events that have already been read */
+        pthread_mutex_lock(&display->ioMutex);
+        res = wl_display_dispatch_queue_pending(wlDpy, display->ioQueue);
+        pthread_mutex_unlock(&display->ioMutex);
+        if (res < 0) {
+            break;
+        }
+
+        if (wl_display_prepare_read_queue(wlDpy, display->ioQueue) < 0) {
+            if (errno == EAGAIN) {
+                continue;
+            }
+            break;
+        }
+
+        /*
+         * Read on behalf of every queue. App threads dispatching their own
+         * queues then find their events already read instead of competing
+         * for the socket.
+         */
+        memset(&pfds, 0, sizeof(pfds));
+        pfds[0].fd = wl_display_get_fd(wlDpy);
+        pfds[0].events = POLLIN;
+        pfds[1].fd = display->ioThreadPipe[0];
+        pfds[1].events = POLLIN;
+        res = poll(&pfds[0], sizeof(pfds) / sizeof(pfds[0]), -1);
+
+        if (res < 0 || (pfds[1].revents & POLLIN)) {
+            wl_display_cancel_read(wlDpy);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            if (wl_display_read_events(wlDpy) < 0) {
+                break;
+            }
+        } else {
+            wl_display_cancel_read(wlDpy);
+            if (pfds[0].revents & (POLLERR | POLLHUP)) {
+                break;
+            }
+        }
+    }
+
+    /* Let frame sync waiters stop waiting for events that won't come */
+    __atomic_store_n(&display->ioThreadExited, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static void setupIoThread(WlEglDisplay *display)
+{
+    /* Swaps wait for the frame callbacks it delivers on a futex */
+#if defined(__linux__)
+    const char *str = getenv("__NV_WAYLAND_IO_THREAD");
+#else
+    const char *str = NULL;
+#endif
+
+    if (!str || strcmp(str, "1")) {
+        return;
+    }
+
+    if (pipe(display->ioThreadPipe)) {
+        display->ioThreadPipe[0] = display->ioThreadPipe[1] = -1;
+        return;
+    }
+
+    display->ioQueue = wl_display_create_queue(display->nativeDpy);
+    display->ioThreadExited = 0;
+
+    /* Not fatal, frame callbacks are then dispatched by the app thread */
+    if (!display->ioQueue || !wlEglInitializeMutex(&display->ioMutex)) {
+        goto fail;
+    }
+
+    if (wlEglCreateHelperThread(&display->ioThreadId, "io", io_thread,
+                                display)) {
+        wlEglMutexDestroy(&display->ioMutex);
+        goto fail;
+    }
+
+    return;
+
+fail:
+    if (display->ioQueue) {
+        wl_event_queue_destroy(display->ioQueue);
+        display->ioQueue = NULL;
+    }
+    close(display->ioThreadPipe[0]);
+    close(display->ioThreadPipe[1]);
+    display->ioThreadPipe[0] = display->ioThreadPipe[1] = -1;
+}
+
+/*
+ * Must be called after all surfaces are destroyed, since their frame
+ * callbacks may be using the queue.
+ *
+ * With detach, the thread is only told to stop and left to exit on its own:
+ * at global teardown, the app may have disconnected its wl_display already
+ * and the thread may never get to read the pipe. Whatever it uses is then
+ * leaked, the display included, as it may still be running when the display
+ * would be freed. Must be called with the external API lock held then.
+ */
+static void finishIoThread(WlEglDisplay *display, EGLBoolean detach)
+{
+    uint8_t cmd = 0;
+
+    if (!display->ioQueue) {
+        return;
+    }
+
+    if (write(display->ioThreadPipe[1], &cmd, sizeof(cmd)) != sizeof(cmd)) {
+        pthread_cancel(display->ioThreadId);
+    }
+
+    if (detach) {
+        pthread_detach(display->ioThreadId);
+        display->refCount++;
+        display->ioQueue = NULL;
+        return;
+    }
+
+    pthread_join(display->ioThreadId, NULL);
+
+    close(display->ioThreadPipe[0]);
+    close(display->ioThreadPipe[1]);
+    display->ioThreadPipe[0] = display->ioThreadPipe[1] = -1;
+
+    wlEglMutexDestroy(&display->ioMutex);
+    wl_event_queue_destroy(display->ioQueue);
+    display->ioQueue = NULL;
+}
+
 /* On wayland, when a wl_display backed EGLDisplay is created and then
  * wl_display is destroyed without terminating EGLDisplay first, some
  * driver allocated resources associated with wl_display could not be
@@ -729,6 +942,9 @@ static EGLBoolean terminateDisplay(WlEglDisplay *display, EGLBoolean globalTeard
      * destroy the display connection itself */
     wlEglDestroyAllSurfaces(display);
 
+    /* The app's wl_display may be gone by global teardown, see above */
+    finishIoThread(display, globalTeardown && !display->ownNativeDpy);
+
     wlEglDestroyFormatSet(&display->formatSet);
     wlEglDestroyFeedback(&display->defaultFeedback);
 
@@ -749,6 +965,18 @@ static EGLBoolean terminateDisplay(WlEglDisplay *display, EGLBoolean globalTeard
             wp_presentation_destroy(display->wpPresentation);
             display->wpPresentation = NULL;
         }
+        if (display->wpViewporter) {
+            wp_viewporter_destroy(display->wpViewporter);
+            display->wpViewporter = NULL;
+        }
+        if (display->wpFractionalScale) {
+            wp_fractional_scale_manager_v1_destroy(display->wpFractionalScale);
+            display->wpFractionalScale = NULL;
+        }
+        if (display->wpContentType) {
+            wp_content_type_manager_v1_destroy(display->wpContentType);
+            display->wpContentType = NULL;
+        }
         if (display->wlDrmSyncobj) {
             wp_linux_drm_syncobj_manager_v1_destroy(display->wlDrmSyncobj);
             display->wlDrmSyncobj = NULL;
@@ -772,12 +1000,14 @@ EGLBoolean wlEglTerminateHook(EGLDisplay dpy)
     WlEglDisplay *display = wlEglAcquireDisplay(dpy);
     EGLBoolean res;
 
+    WL_EGL_TRACE(hook_eglTerminate, dpy, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     res = terminateDisplay(display, EGL_FALSE);
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return res;
@@ -813,37 +1043,41 @@ static bool getServerProtocolsInfo(struct wl_display *nativeDpy,
     if (wlRegistry == NULL) {
         goto done;
     }
+    if (!getDeviceFromDevIdInitialised) {
+        getDeviceFromDevId = dlsym(RTLD_DEFAULT, "drmGetDeviceFromDevId");
+        getDeviceFromDevIdInitialised = true;
+    }
+
     ret = wl_registry_add_listener(wlRegistry,
                                    &registryListener,
                                    protocols);
     if (ret == 0) {
         wl_display_roundtrip_queue(nativeDpy, queue);
-        /* use a second roundtrip to handle any wl_drm events triggered by binding the protocol */
-        wl_display_roundtrip_queue(nativeDpy, queue);
-
-        if (!getDeviceFromDevIdInitialised) {
-            getDeviceFromDevId = dlsym(RTLD_DEFAULT, "drmGetDeviceFromDevId");
-            getDeviceFromDevIdInitialised = true;
+        /*
+         * Use a second roundtrip to handle the wl_drm and dma-buf feedback
+         * events triggered by binding the protocols, if any were bound.
+         */
+        if (protocols->wlDrm || protocols->wlDmaBufFeedback) {
+            wl_display_roundtrip_queue(nativeDpy, queue);
         }
 
         /*
-         * if dmabuf feedback is available then use that. This will potentially
-         * replace the drm_name provided by wl_drm, assuming the feedback provides
-         * a valid dev_t.
+         * if dmabuf feedback is available then use that. This replaces the
+         * drm_name provided by wl_drm, assuming the feedback provided a valid
+         * dev_t.
          */
-        if (protocols->wlDmaBuf && getDeviceFromDevId) {
-            struct zwp_linux_dmabuf_feedback_v1 *default_feedback
-                    = zwp_linux_dmabuf_v1_get_default_feedback(protocols->wlDmaBuf);
-            if (default_feedback) {
-                zwp_linux_dmabuf_feedback_v1_add_listener(default_feedback, &dmabuf_feedback_check_listener, protocols);
-                wl_display_roundtrip_queue(nativeDpy, queue);
-                zwp_linux_dmabuf_feedback_v1_destroy(default_feedback);
-            }
+        if (protocols->feedback_drm_name) {
+            free(protocols->drm_name);
+            protocols->drm_name = protocols->feedback_drm_name;
+            protocols->feedback_drm_name = NULL;
         }
 
         /* Check that one of our two protocols provided the device name */
         result = protocols->drm_name != NULL;
 
+        if (protocols->wlDmaBufFeedback) {
+            zwp_linux_dmabuf_feedback_v1_destroy(protocols->wlDmaBufFeedback);
+        }
         if (protocols->wlDmaBuf) {
             zwp_linux_dmabuf_v1_destroy(protocols->wlDmaBuf);
         }
@@ -1189,17 +1423,19 @@ EGLDisplay wlEglGetPlatformDisplayExport(void *data,
     }
     display->refCount = 1;
     WL_LIST_INIT(&display->wlEglSurfaceList);
+    display->surfaceSetComplete = EGL_TRUE;
 
-    /* Get the DRM device in use */
+    /*
+     * Get the DRM device in use. The DRM fd is only needed for explicit sync,
+     * so if the device node can't be opened (e.g. sandboxed clients, or
+     * drivers that don't expose a DRM node) carry on with drmFd = -1 and let
+     * wlEglCheckDriverSyncSupport() leave explicit sync disabled.
+     */
+    display->drmFd = -1;
     drmName = display->data->egl.queryDeviceString(display->devDpy->eglDevice,
                                                    EGL_DRM_DEVICE_FILE_EXT);
-    if (!drmName) {
-        goto fail;
-    }
-
-    display->drmFd = open(drmName, O_RDWR | O_CLOEXEC);
-    if (display->drmFd < 0) {
-        goto fail;
+    if (drmName) {
+        display->drmFd = open(drmName, O_RDWR | O_CLOEXEC);
     }
 
     // The newly created WlEglDisplay has been set up properly, insert it
@@ -1231,27 +1467,136 @@ fail:
     return EGL_NO_DISPLAY;
 }
 
-static void wlEglCheckDriverSyncSupport(WlEglDisplay *display)
+/*
+ * The explicit sync probe below costs a syncobj, a sync fd and a failing
+ * eglCreateSync() round through the driver. Besides caching the result per
+ * device, it can be kept across processes in the file named by
+ * __NV_WAYLAND_PROBE_CACHE. Every line holds a key identifying the driver
+ * build and device followed by the probe result, so a driver update simply
+ * misses the cache and probes again.
+ */
+#define WL_EGL_PROBE_CACHE_KEY_SIZE 1024
+
+/*
+ * EGL_VERSION doesn't change between driver releases, so the build is
+ * identified by the kernel DRM driver version and the file the EGL driver
+ * was loaded from. Returns false if that can't be determined, in which case
+ * the on-disk cache must not be used.
+ */
+static bool getProbeCacheKey(WlEglDisplay *display, char *key, size_t size)
 {
-    EGLSyncKHR  eglSync = EGL_NO_SYNC_KHR;
-    int         syncFd  = -1;
     EGLDisplay  dpy     = display->devDpy->eglDisplay;
-    EGLint      attribs[5];
-    uint32_t    tmpSyncobj;
-    const char *disableExplicitSyncStr = getenv("__NV_DISABLE_EXPLICIT_SYNC");
+    const char *vendor  = display->data->egl.queryString(dpy, EGL_VENDOR);
+    const char *version = display->data->egl.queryString(dpy, EGL_VERSION);
+    dev_t       dev     = display->devDpy->dev;
+    drmVersion *drmVer;
+    Dl_info     info;
+    struct stat st;
+    char       *c;
+    int         len;
+
+    if (!dladdr((void *)display->data->egl.createSync, &info) ||
+        !info.dli_fname || stat(info.dli_fname, &st)) {
+        return false;
+    }
+
+    drmVer = drmGetVersion(display->drmFd);
+    if (!drmVer) {
+        return false;
+    }
+
+    len = snprintf(key, size, "%s|%s|%s %d.%d.%d %s|%s %lu:%lu %lld.%09ld %lld|%u:%u",
+                   vendor ? vendor : "", version ? version : "",
+                   drmVer->name ? drmVer->name : "",
+                   drmVer->version_major, drmVer->version_minor,
+                   drmVer->version_patchlevel,
+                   drmVer->date ? drmVer->date : "",
+                   info.dli_fname,
+                   (unsigned long)st.st_dev, (unsigned long)st.st_ino,
+                   (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+                   (long long)st.st_size,
+                   major(dev), minor(dev));
+
+    drmFreeVersion(drmVer);
+
+    if (len < 0 || (size_t)len >= size) {
+        return false;
+    }
+
+    /* Tabs and newlines separate the cache fields */
+    for (c = key; *c; c++) {
+        if (*c == '\t' || *c == '\n') {
+            *c = ' ';
+        }
+    }
+
+    return true;
+}
+
+static int readProbeCache(const char *path, const char *key)
+{
+    char  line[WL_EGL_PROBE_CACHE_KEY_SIZE + 16];
+    FILE *file   = fopen(path, "re");
+    int   result = -1;
+
+    if (!file) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char *sep = strchr(line, '\t');
+
+        if (!sep) {
+            continue;
+        }
+        *sep = '\0';
+        if (!strcmp(line, key)) {
+            /* Later entries win, in case two processes raced on the probe */
+            result = (sep[1] == '1');
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+static void writeProbeCache(const char *path, const char *key, int supported)
+{
+    char    line[WL_EGL_PROBE_CACHE_KEY_SIZE + 16];
+    int     len;
+    int     fd;
+
+    len = snprintf(line, sizeof(line), "%s\t%d\n", key, supported ? 1 : 0);
+    if (len <= 0 || len >= (int)sizeof(line)) {
+        return;
+    }
 
     /*
-     * Don't enable explicit sync if requested by the user or if we do not have
-     * the necessary EGL extensions.
+     * A single O_APPEND write keeps concurrent writers from interleaving
+     * their lines.
      */
-    if ((disableExplicitSyncStr && !strcmp(disableExplicitSyncStr, "1")) ||
-        !display->supports_native_fence_sync) {
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
         return;
     }
+    if (write(fd, line, len) != len) {
+        /* The cache is only an optimization, ignore short writes */
+    }
+    close(fd);
+}
+
+static EGLBoolean wlEglProbeDriverSyncSupport(WlEglDisplay *display)
+{
+    EGLSyncKHR  eglSync   = EGL_NO_SYNC_KHR;
+    int         syncFd    = -1;
+    EGLDisplay  dpy       = display->devDpy->eglDisplay;
+    EGLBoolean  supported = EGL_FALSE;
+    EGLint      attribs[5];
+    uint32_t    tmpSyncobj;
 
     /* make a dummy fd to pass in */
     if (drmSyncobjCreate(display->drmFd, 0, &tmpSyncobj) != 0) {
-        return;
+        return EGL_FALSE;
     }
 
     if (drmSyncobjHandleToFD(display->drmFd, tmpSyncobj, &syncFd)) {
@@ -1276,7 +1621,7 @@ static void wlEglCheckDriverSyncSupport(WlEglDisplay *display)
     /* If the call failed then the driver version is recent enough */
     if (eglSync == EGL_NO_SYNC_KHR &&
         display->data->egl.getError() == EGL_BAD_ATTRIBUTE) {
-        display->supports_explicit_sync = true;
+        supported = EGL_TRUE;
     }
 
 destroy:
@@ -1284,6 +1629,48 @@ destroy:
         display->data->egl.destroySync(dpy, eglSync);
     }
     drmSyncobjDestroy(display->drmFd, tmpSyncobj);
+
+    return supported;
+}
+
+static void wlEglCheckDriverSyncSupport(WlEglDisplay *display)
+{
+    WlEglDeviceDpy *devDpy = display->devDpy;
+    const char *disableExplicitSyncStr = getenv("__NV_DISABLE_EXPLICIT_SYNC");
+    const char *cachePath = getenv("__NV_WAYLAND_PROBE_CACHE");
+    char        key[WL_EGL_PROBE_CACHE_KEY_SIZE];
+    int         cached = -1;
+
+    /*
+     * Don't enable explicit sync if requested by the user or if we do not have
+     * the necessary EGL extensions.
+     */
+    if ((disableExplicitSyncStr && !strcmp(disableExplicitSyncStr, "1")) ||
+        !display->supports_native_fence_sync || display->drmFd < 0) {
+        return;
+    }
+
+    if (!devDpy->caps.explicit_sync_probed) {
+        if (cachePath && cachePath[0] &&
+            !getProbeCacheKey(display, key, sizeof(key))) {
+            cachePath = NULL;
+        }
+        if (cachePath && cachePath[0]) {
+            cached = readProbeCache(cachePath, key);
+        }
+
+        if (cached >= 0) {
+            devDpy->caps.explicit_sync = cached;
+        } else {
+            devDpy->caps.explicit_sync = wlEglProbeDriverSyncSupport(display);
+            if (cachePath && cachePath[0]) {
+                writeProbeCache(cachePath, key, devDpy->caps.explicit_sync);
+            }
+        }
+        devDpy->caps.explicit_sync_probed = 1;
+    }
+
+    display->supports_explicit_sync = devDpy->caps.explicit_sync;
 }
 
 EGLBoolean wlEglInitializeHook(EGLDisplay dpy, EGLint *major, EGLint *minor)
@@ -1295,10 +1682,12 @@ EGLBoolean wlEglInitializeHook(EGLDisplay dpy, EGLint *major, EGLint *minor)
     int                ret     = 0;
     const char *dev_exts = NULL;
 
+    WL_EGL_TRACE(hook_eglInitialize, dpy, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -1313,21 +1702,27 @@ EGLBoolean wlEglInitializeHook(EGLDisplay dpy, EGLint *major, EGLint *minor)
         if (display->useInitRefCount) {
             display->initCount++;
         }
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_TRUE;
     }
 
     if (!wlInternalInitialize(display->devDpy)) {
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_FALSE;
     }
 
-    dev_exts = display->data->egl.queryString(display->devDpy->eglDisplay, EGL_EXTENSIONS);
-    if (dev_exts && wlEglFindExtension("EGL_ANDROID_native_fence_sync", dev_exts)) {
-        display->supports_native_fence_sync = true;
+    if (!display->devDpy->caps.probed) {
+        dev_exts = display->data->egl.queryString(display->devDpy->eglDisplay,
+                                                  EGL_EXTENSIONS);
+        display->devDpy->caps.native_fence_sync =
+            dev_exts &&
+            wlEglFindExtension("EGL_ANDROID_native_fence_sync", dev_exts);
+        display->devDpy->caps.probed = 1;
     }
+    display->supports_native_fence_sync =
+        display->devDpy->caps.native_fence_sync;
 
     /* Check if we support explicit sync */
     wlEglCheckDriverSyncSupport(display);
@@ -1401,6 +1796,8 @@ EGLBoolean wlEglInitializeHook(EGLDisplay dpy, EGLint *major, EGLint *minor)
     /* We haven't created any surfaces yet, so no need to reallocate. */
     display->defaultFeedback.unprocessedFeedback = false;
 
+    setupIoThread(display);
+
     if (major != NULL) {
         *major = display->devDpy->major;
     }
@@ -1408,7 +1805,7 @@ EGLBoolean wlEglInitializeHook(EGLDisplay dpy, EGLint *major, EGLint *minor)
         *minor = display->devDpy->minor;
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     return EGL_TRUE;
 
@@ -1417,7 +1814,7 @@ fail:
     if (err != EGL_SUCCESS) {
         wlEglSetError(data, err);
     }
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     return EGL_FALSE;
 }
@@ -1447,10 +1844,53 @@ WlEglDisplay *wlEglAcquireDisplay(EGLDisplay dpy) {
     return display;
 }
 
+/* How long wlEglAcquireSurfaceDisplay() sleeps before retrying busy displays */
+#define WL_EGL_SURFACE_DISPLAY_RETRY_NS 100000
+
+WlEglDisplay *wlEglAcquireSurfaceDisplay(WlEglSurface *surface) {
+    const struct timespec retry = { 0, WL_EGL_SURFACE_DISPLAY_RETRY_NS };
+    WlEglDisplay *display;
+    EGLBoolean    busy;
+
+    /*
+     * Hooks may hold a display lock across a roundtrip, so waiting for one
+     * here would also block every thread that wants the API lock. Displays
+     * that are busy are skipped instead, and retried once both locks are
+     * dropped.
+     */
+    do {
+        busy = EGL_FALSE;
+
+        wlExternalApiLock();
+        wl_list_for_each(display, &wlEglDisplayList, link) {
+            if (wlEglMutexTryLock(&display->mutex, WL_EGL_LOCK_DISPLAY)) {
+                busy = EGL_TRUE;
+                continue;
+            }
+            if (wlEglIsWlEglSurfaceForDisplay(display, surface)) {
+                ++display->refCount;
+                wlExternalApiUnlock();
+                return display;
+            }
+            wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+        }
+        wlExternalApiUnlock();
+
+        if (busy) {
+            nanosleep(&retry, NULL);
+        }
+    } while (busy);
+
+    return NULL;
+}
+
 static void wlEglUnrefDisplay(WlEglDisplay *display) {
     if (--display->refCount == 0) {
         wlEglMutexDestroy(&display->mutex);
-        close(display->drmFd);
+        if (display->drmFd >= 0) {
+            close(display->drmFd);
+        }
+        wlEglPointerSetFree(&display->surfaceSet);
         free(display);
     }
 }
@@ -1476,6 +1916,8 @@ EGLBoolean wlEglChooseConfigHook(EGLDisplay dpy,
     EGLint             err           = EGL_SUCCESS;
     EGLBoolean         ret;
 
+    WL_EGL_TRACE(hook_eglChooseConfig, dpy, 0);
+
     /* Save the internal EGLDisplay handle, as it's needed by the actual
      * eglChooseConfig() call */
     dpy = display->devDpy->eglDisplay;
@@ -1549,6 +1991,8 @@ EGLBoolean wlEglGetConfigAttribHook(EGLDisplay dpy,
     WlEglPlatformData *data    = display->data;
     EGLBoolean         ret     = EGL_FALSE;
 
+    WL_EGL_TRACE(hook_eglGetConfigAttrib, dpy, 0);
+
     /* Save the internal EGLDisplay handle, as it's needed by the actual
      * eglGetConfigAttrib() call */
     dpy = display->devDpy->eglDisplay;
@@ -1574,23 +2018,25 @@ EGLBoolean wlEglQueryDisplayAttribHook(EGLDisplay dpy,
     WlEglPlatformData *data = NULL;
     EGLBoolean ret = EGL_TRUE;
 
+    WL_EGL_TRACE(hook_eglQueryDisplayAttribKHR, dpy, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
     if (value == NULL) {
         wlEglSetError(data, EGL_BAD_PARAMETER);
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_FALSE;
     }
 
     if (display->initCount == 0) {
         wlEglSetError(data, EGL_NOT_INITIALIZED);
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_FALSE;
     }
@@ -1607,7 +2053,7 @@ EGLBoolean wlEglQueryDisplayAttribHook(EGLDisplay dpy,
         break;
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     return ret;
 }
@@ -1622,13 +2068,13 @@ EGLBoolean wlEglDestroyAllDisplays(WlEglPlatformData *data)
 
     wl_list_for_each_safe(display, next, &wlEglDisplayList, link) {
         if (display->data == data) {
-            pthread_mutex_lock(&display->mutex);
+            wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
             res = terminateDisplay(display, EGL_TRUE) && res;
             if (display->ownNativeDpy) {
                 wl_display_disconnect(display->nativeDpy);
             }
             display->devDpy = NULL;
-            pthread_mutex_unlock(&display->mutex);
+            wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
             wl_list_remove(&display->link);
             /* Unref the external display */
             wlEglUnrefDisplay(display);
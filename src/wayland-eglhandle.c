@@ -175,11 +175,11 @@ void* wlEglGetInternalHandleExport(EGLDisplay dpy, EGLenum type, void *handle)
     } else if (type == EGL_OBJECT_SURFACE_KHR) {
         display = wlEglAcquireDisplay(dpy);
         if (display) {
-            pthread_mutex_lock(&display->mutex);
+            wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
             if (wlEglIsWlEglSurfaceForDisplay(display, (WlEglSurface *)handle)) {
                 handle = (void *)(((WlEglSurface *)handle)->ctx.eglSurface);
             }
-            pthread_mutex_unlock(&display->mutex);
+            wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
             wlEglReleaseDisplay(dpy);
         }
     }
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "wayland-eglstats.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WL_EGL_HISTOGRAM_MIN_SHIFT 8
+
+static const char *wlEglSwapStageNames[WL_EGL_SWAP_STAGE_COUNT] = {
+    [WL_EGL_SWAP_STAGE_ACQUIRE_DISPLAY] = "display_acquire",
+    [WL_EGL_SWAP_STAGE_FRAME_SYNC_WAIT] = "frame_sync_wait",
+    [WL_EGL_SWAP_STAGE_DRIVER_SWAP]     = "driver_swap",
+    [WL_EGL_SWAP_STAGE_STREAM_FLUSH]    = "stream_flush",
+    [WL_EGL_SWAP_STAGE_IMAGE_EVENTS]    = "image_events",
+    [WL_EGL_SWAP_STAGE_EXPLICIT_SYNC]   = "explicit_sync",
+    [WL_EGL_SWAP_STAGE_COMMIT]          = "commit_roundtrip",
+    [WL_EGL_SWAP_STAGE_RELEASE_POINTS]  = "release_points",
+};
+
+static pthread_once_t  statsOnceControl = PTHREAD_ONCE_INIT;
+static pthread_mutex_t statsOutputMutex = PTHREAD_MUTEX_INITIALIZER;
+static const char     *statsOutputPath  = NULL;
+static bool            statsEnabled     = false;
+
+static void wlEglSwapStatsInitialize(void)
+{
+    const char *str = getenv("__NV_WAYLAND_SWAP_STATS");
+
+    if (!str || !str[0] || !strcmp(str, "0")) {
+        return;
+    }
+
+    if (strcmp(str, "1")) {
+        statsOutputPath = str;
+    }
+    statsEnabled = true;
+}
+
+bool wlEglSwapStatsEnabled(void)
+{
+    pthread_once(&statsOnceControl, wlEglSwapStatsInitialize);
+    return statsEnabled;
+}
+
+uint64_t wlEglGetTimeNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int histogramBucket(uint64_t value)
+{
+    unsigned int msb;
+    unsigned int index;
+
+    if (value < (1ull << WL_EGL_HISTOGRAM_MIN_SHIFT)) {
+        return 0;
+    }
+
+    msb = 63 - __builtin_clzll(value);
+    index = 1 + (msb - WL_EGL_HISTOGRAM_MIN_SHIFT) * 4 +
+            ((value >> (msb - 2)) & 3);
+
+    return index < WL_EGL_HISTOGRAM_BUCKETS ?
+           index : WL_EGL_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint64_t histogramBucketLimit(unsigned int index)
+{
+    unsigned int msb;
+    unsigned int sub;
+
+    if (index == 0) {
+        return 1ull << WL_EGL_HISTOGRAM_MIN_SHIFT;
+    }
+
+    msb = WL_EGL_HISTOGRAM_MIN_SHIFT + (index - 1) / 4;
+    sub = (index - 1) % 4;
+
+    return (1ull << msb) + (uint64_t)(sub + 1) * (1ull << (msb - 2));
+}
+
+void wlEglHistogramAdd(WlEglHistogram *hist, uint64_t value)
+{
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->buckets[histogramBucket(value)]++;
+}
+
+void wlEglHistogramAddAtomic(WlEglHistogram *hist, uint64_t value)
+{
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->buckets[histogramBucket(value)], 1,
+                       __ATOMIC_RELAXED);
+
+    while (value > max &&
+           !__atomic_compare_exchange_n(&hist->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void wlEglHistogramSnapshot(WlEglHistogram *dst, const WlEglHistogram *src)
+{
+    unsigned int i;
+
+    dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum   = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    dst->max   = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    for (i = 0; i < WL_EGL_HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+void wlEglHistogramMerge(WlEglHistogram *dst, const WlEglHistogram *src)
+{
+    WlEglHistogram snapshot;
+    unsigned int   i;
+
+    wlEglHistogramSnapshot(&snapshot, src);
+
+    dst->count += snapshot.count;
+    dst->sum   += snapshot.sum;
+    if (snapshot.max > dst->max) {
+        dst->max = snapshot.max;
+    }
+    for (i = 0; i < WL_EGL_HISTOGRAM_BUCKETS; i++) {
+        dst->buckets[i] += snapshot.buckets[i];
+    }
+}
+
+uint64_t wlEglHistogramPercentile(const WlEglHistogram *hist, double percentile)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    unsigned int i;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+
+    target = (uint64_t)(percentile * (double)hist->count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    for (i = 0; i < WL_EGL_HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint64_t limit = histogramBucketLimit(i);
+            /* Bucket limits are upper bounds, never report above the max */
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+WlEglSwapStats *wlEglSwapStatsCreate(void)
+{
+    if (!wlEglSwapStatsEnabled()) {
+        return NULL;
+    }
+
+    return calloc(1, sizeof(WlEglSwapStats));
+}
+
+void wlEglSwapStatsDestroy(WlEglSwapStats *stats)
+{
+    free(stats);
+}
+
+void wlEglSwapStatsReport(const WlEglSwapStats *stats,
+                          const void *surface,
+                          int fifoLength,
+                          int swapInterval,
+                          bool dmaBuf,
+                          bool explicitSync,
+                          bool damageThread)
+{
+    FILE *out = stderr;
+    unsigned int i;
+
+    if (!stats || stats->frames == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&statsOutputMutex);
+
+    if (statsOutputPath) {
+        out = fopen(statsOutputPath, "a");
+        if (!out) {
+            pthread_mutex_unlock(&statsOutputMutex);
+            return;
+        }
+    }
+
+    fprintf(out,
+            "{\"surface\":\"%p\",\"mode\":{\"stream\":\"%s\","
+            "\"fifo_length\":%d,\"swap_interval\":%d,"
+            "\"explicit_sync\":%s,\"damage_thread\":%s},"
+            "\"frames\":%llu,\"stages\":{",
+            surface,
+            dmaBuf ? "dmabuf" : "eglstream",
+            fifoLength,
+            swapInterval,
+            explicitSync ? "true" : "false",
+            damageThread ? "true" : "false",
+            (unsigned long long)stats->frames);
+
+    for (i = 0; i < WL_EGL_SWAP_STAGE_COUNT; i++) {
+        const WlEglHistogram *hist = &stats->stages[i];
+
+        fprintf(out,
+                "%s\"%s\":{\"count\":%llu,\"mean_us\":%.3f,"
+                "\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+                "\"max_us\":%.3f}",
+                i ? "," : "",
+                wlEglSwapStageNames[i],
+                (unsigned long long)hist->count,
+                hist->count ? (double)hist->sum / hist->count / 1000.0 : 0.0,
+                wlEglHistogramPercentile(hist, 0.50) / 1000.0,
+                wlEglHistogramPercentile(hist, 0.99) / 1000.0,
+                wlEglHistogramPercentile(hist, 0.999) / 1000.0,
+                hist->max / 1000.0);
+    }
+
+    fprintf(out, "}}\n");
+
+    if (out != stderr) {
+        fclose(out);
+    } else {
+        fflush(out);
+    }
+
+    pthread_mutex_unlock(&statsOutputMutex);
+}
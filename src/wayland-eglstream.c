@@ -26,6 +26,7 @@
 #include "wayland-eglhandle.h"
 #include "wayland-egldisplay.h"
 #include "wayland-eglutils.h"
+#include "wayland-egltrace.h"
 #include "wayland-egl-ext.h"
 #include <unistd.h>
 #include <stdlib.h>
@@ -47,6 +48,8 @@ EGLStreamKHR wlEglCreateStreamAttribHook(EGLDisplay dpy,
     int                          fd          = -1;
     EGLint                       err         = EGL_SUCCESS;
 
+    WL_EGL_TRACE(hook_eglCreateStreamAttribNV, dpy, 0);
+
     /* Parse attribute list and count internal attributes */
     if (attribs) {
         while (attribs[idx] != EGL_NONE) {
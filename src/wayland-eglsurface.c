@@ -29,6 +29,10 @@
 #include "wayland-thread.h"
 #include "wayland-eglutils.h"
 #include "wayland-egl-ext.h"
+#include "wayland-egltrace.h"
+#include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "content-type-v1-client-protocol.h"
 #include <wayland-egl-backend.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -41,18 +45,30 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <errno.h>
+#include <sys/eventfd.h>
 #include <drm_fourcc.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <xf86drm.h>
 #include <stdio.h>
 
 #define WL_EGL_WINDOW_DESTROY_CALLBACK_SINCE 3
-#define MAX_IMAGES 4 /* The swapchain image count */
+/* __NV_WAYLAND_RENDER_SCALE value that renders at the window size */
+#define WL_EGL_RENDER_SCALE_ONE 1000
+/* wp_fractional_scale_v1 scale denominator */
+#define WL_EGL_FRACTIONAL_SCALE_ONE 120
+/* Pending release points from which wlEglSurfaceCheckReleasePoints() blocks */
+#define BLOCKING_RELEASE_POINTS 3
 
 enum BufferReleaseThreadEvents {
     BUFFER_RELEASE_THREAD_EVENT_TERMINATE,
 };
 
+enum ReadyThreadEvents {
+    READY_THREAD_EVENT_TERMINATE,
+    READY_THREAD_EVENT_POLL_RELEASE,
+};
+
 enum BufferReleasePipeEndpoints {
     BUFFER_RELEASE_PIPE_READ  = 0,
     BUFFER_RELEASE_PIPE_WRITE = 1
@@ -65,6 +81,15 @@ static void
 remove_surface_image(WlEglDisplay *display,
                      WlEglSurface *surface,
                      EGLImageKHR eglImage);
+
+static void
+finish_image_consumer_thread(WlEglSurface *surface, WlEglSurfaceCtx *ctx);
+
+static int
+trim_surface_image_buffers(WlEglSurface *surface);
+
+static EGLBoolean
+trim_occluded_surface(WlEglSurface *surface);
                      
 static EGLBoolean
 validateSurfaceAttrib(EGLAttrib attrib,
@@ -78,6 +103,10 @@ EGLBoolean wlEglIsWlEglSurfaceForDisplay(WlEglDisplay *display, WlEglSurface *su
 {
     WlEglSurface *surf;
 
+    if (display->surfaceSetComplete) {
+        return wlEglPointerSetContains(&display->surfaceSet, surface);
+    }
+
     wl_list_for_each(surf, &display->wlEglSurfaceList, link) {
         if (surf == surface) {
             return EGL_TRUE;
@@ -87,6 +116,41 @@ EGLBoolean wlEglIsWlEglSurfaceForDisplay(WlEglDisplay *display, WlEglSurface *su
     return EGL_FALSE;
 }
 
+/*
+ * Refills the surface set from the list after it couldn't be grown, so that
+ * validation goes back to set lookups once memory is available again.
+ */
+static void wlEglRebuildSurfaceSet(WlEglDisplay *display)
+{
+    WlEglSurface *surf;
+
+    wl_list_for_each(surf, &display->wlEglSurfaceList, link) {
+        if (!wlEglPointerSetInsert(&display->surfaceSet, surf)) {
+            return;
+        }
+    }
+
+    display->surfaceSetComplete = EGL_TRUE;
+}
+
+/* Must be called with the display lock held */
+static void wlEglAddSurfaceToDisplay(WlEglDisplay *display, WlEglSurface *surface)
+{
+    wl_list_insert(&display->wlEglSurfaceList, &surface->link);
+    if (!display->surfaceSetComplete) {
+        wlEglRebuildSurfaceSet(display);
+    } else if (!wlEglPointerSetInsert(&display->surfaceSet, surface)) {
+        display->surfaceSetComplete = EGL_FALSE;
+    }
+}
+
+static void wlEglRemoveSurfaceFromDisplay(WlEglDisplay *display,
+                                          WlEglSurface *surface)
+{
+    wl_list_remove(&surface->link);
+    wlEglPointerSetRemove(&display->surfaceSet, surface);
+}
+
 EGLBoolean wlEglIsWaylandWindowValid(struct wl_egl_window *window)
 {
     struct wl_surface *surface = NULL;
@@ -115,11 +179,21 @@ wayland_throttleCallback(void *data,
 
     (void) time;
 
+    WL_EGL_TRACE(frame_done, surface, wlEglSurfaceFrameNumber(surface));
+
     if (surface->throttleCallback != NULL) {
 
         wl_callback_destroy(callback);
         surface->throttleCallback = NULL;
     }
+
+    /* Called from the I/O thread if the display has one */
+    if (surface->wlEglDpy->ioQueue) {
+        __atomic_store_n(&surface->frameSyncPending, 0, __ATOMIC_RELEASE);
+        wlEglFutexWakeAll(&surface->frameSyncPending);
+    }
+
+    wlEglSignalSurfaceReady(surface);
 }
 
 static const struct wl_callback_listener throttle_listener = {
@@ -128,17 +202,29 @@ static const struct wl_callback_listener throttle_listener = {
 
 void wlEglCreateFrameSync(WlEglSurface *surface)
 {
+    WlEglDisplay *display = surface->wlEglDpy;
     struct wl_surface *wrapper = NULL;
 
     assert(surface->wlEventQueue);
     if (surface->swapInterval > 0) {
+        if (display->ioQueue) {
+            /* Keep the I/O thread from dispatching before the listener is set */
+            pthread_mutex_lock(&display->ioMutex);
+            __atomic_store_n(&surface->frameSyncPending, 1, __ATOMIC_RELEASE);
+        }
         wrapper = wl_proxy_create_wrapper(surface->wlSurface);
-        wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlEventQueue);
+        wl_proxy_set_queue((struct wl_proxy *)wrapper,
+                           display->ioQueue ? display->ioQueue :
+                                              surface->wlEventQueue);
         surface->throttleCallback = wl_surface_frame(wrapper);
         wl_proxy_wrapper_destroy(wrapper); /* Done with wrapper */
+        WL_EGL_TRACE(frame_request, surface, wlEglSurfaceFrameNumber(surface));
         if (wl_callback_add_listener(surface->throttleCallback,
                                      &throttle_listener, surface) == -1) {
-            return;
+            __atomic_store_n(&surface->frameSyncPending, 0, __ATOMIC_RELEASE);
+        }
+        if (display->ioQueue) {
+            pthread_mutex_unlock(&display->ioMutex);
         }
     }
 }
@@ -148,32 +234,115 @@ EGLint wlEglWaitFrameSync(WlEglSurface *surface)
 
     WlEglDisplay *display = surface->wlEglDpy;
     struct wl_event_queue *queue = surface->wlEventQueue;
+    uint64_t   trimAt  = wlEglGetTimeNs() + surface->trimIdleMs * 1000000ull;
+    EGLBoolean trimmed = !surface->trimIdleMs;
+    uint64_t   now;
     int ret = 0;
 
+    /*
+     * Compositors stop sending frame callbacks to hidden surfaces, so a long
+     * wait means this one is most likely occluded and can be trimmed. If that
+     * drops the frame, its callback is still pending and waited for by the
+     * next swap instead.
+     */
+    if (display->ioQueue) {
+        /*
+         * The I/O thread delivers the frame callback, just wait for it. Wake
+         * up now and then to notice if the thread is gone because of a
+         * display error, like wl_display_dispatch_queue() would fail below.
+         */
+        while (__atomic_load_n(&surface->frameSyncPending, __ATOMIC_ACQUIRE) &&
+               !__atomic_load_n(&display->ioThreadExited, __ATOMIC_ACQUIRE)) {
+            wlEglFutexWait(&surface->frameSyncPending, 1, 100);
+
+            if (!trimmed && wlEglGetTimeNs() >= trimAt) {
+                trimmed = EGL_TRUE;
+                if (trim_occluded_surface(surface)) {
+                    break;
+                }
+            }
+        }
+        return EGL_SUCCESS;
+    }
+
     assert(queue || surface->throttleCallback == NULL);
     while (ret != -1 && surface->throttleCallback != NULL) {
-        ret = wl_display_dispatch_queue(display->nativeDpy, queue);
+        if (trimmed) {
+            ret = wl_display_dispatch_queue(display->nativeDpy, queue);
+            continue;
+        }
+
+        now = wlEglGetTimeNs();
+        if (now < trimAt) {
+            ret = wlEglDispatchQueueTimeout(display->nativeDpy, queue,
+                                            (int)((trimAt - now + 999999) /
+                                                  1000000));
+        } else {
+            trimmed = EGL_TRUE;
+            if (trim_occluded_surface(surface)) {
+                break;
+            }
+        }
     }
 
     return EGL_SUCCESS;
 }
 
+EGLBoolean wlEglPollFrameSync(WlEglSurface *surface)
+{
+    WlEglDisplay          *display = surface->wlEglDpy;
+    struct wl_display     *dpy     = display->nativeDpy;
+    struct wl_event_queue *queue   = surface->wlEventQueue;
+
+    if (display->ioQueue) {
+        return !__atomic_load_n(&surface->frameSyncPending, __ATOMIC_ACQUIRE) ||
+               __atomic_load_n(&display->ioThreadExited, __ATOMIC_ACQUIRE);
+    }
+
+    /*
+     * Read whatever the compositor has sent so far without blocking. Display
+     * errors count as ready, so the following wlEglWaitFrameSync() returns
+     * right away just as it would have before.
+     */
+    if (surface->throttleCallback == NULL ||
+        wlEglDispatchQueueNonBlocking(dpy, queue) < 0) {
+        return EGL_TRUE;
+    }
+
+    return surface->throttleCallback == NULL;
+}
+
+void wlEglSignalSurfaceReady(WlEglSurface *surface)
+{
+    int      fd  = __atomic_load_n(&surface->readyFd, __ATOMIC_ACQUIRE);
+    uint64_t one = 1;
+
+    /* The counter saturating just means the fd stays readable */
+    if (fd >= 0 && write(fd, &one, sizeof(one)) < 0) {
+        return;
+    }
+}
+
 static bool
 syncobj_import_fd_to_current_point(WlEglDisplay *display, WlEglSurface *surface,
                                    int syncFd)
 {
     bool                ret = false;
     uint32_t            tmpSyncobj;
+    uint64_t            ioctls = 1;
 
     /* Import our syncfd at a new release point */
     if (drmSyncobjCreate(display->drmFd, 0, &tmpSyncobj) != 0) {
+        WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, ioctls);
         return false;
     }
 
+    ioctls++;
     if (drmSyncobjImportSyncFile(display->drmFd, tmpSyncobj, syncFd) != 0) {
         goto end;
     }
 
+    ioctls++;
     if (drmSyncobjTransfer(display->drmFd, surface->drmSyncobjHandle,
                            surface->syncPoint, tmpSyncobj, 0, 0) != 0) {
         goto end;
@@ -183,6 +352,8 @@ syncobj_import_fd_to_current_point(WlEglDisplay *display, WlEglSurface *surface,
 
 end:
     drmSyncobjDestroy(display->drmFd, tmpSyncobj);
+    /* The ones issued above plus the destroy */
+    WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, ioctls + 1);
 
     return ret;
 }
@@ -249,6 +420,9 @@ wlEglSendDamageEvent(WlEglSurface *surface,
 {
     struct wl_display *wlDpy = surface->wlEglDpy->nativeDpy;
     EGLint i;
+    EGLBoolean ret;
+    uint64_t stageStart;
+    uint64_t roundtripStart;
 
     if (surface->ctx.wlStreamResource) {
         /* Attach same buffer to indicate new content for the surface is
@@ -257,18 +431,28 @@ wlEglSendDamageEvent(WlEglSurface *surface,
                           surface->ctx.wlStreamResource,
                           surface->dx,
                           surface->dy);
+        WL_EGL_COUNTER_ADD(surface->counters.framesPresented, 1);
     } else {
         WlEglStreamImage *image;
 
+        stageStart = wlEglSwapStatsBegin(surface->swapStats);
         if (wlEglHandleImageStreamEvents(surface) != EGL_SUCCESS) {
             return EGL_FALSE;
         }
 
+        /* The consumer thread may be adding images to the list */
+        wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
         image = pop_acquired_image(surface);
         if (image) {
             surface->ctx.currentBuffer = image->buffer;
             image->attached = EGL_TRUE;
+            WL_EGL_COUNTER_ADD(surface->counters.framesPresented, 1);
         }
+        wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+        wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_IMAGE_EVENTS,
+                          stageStart);
+        WL_EGL_TRACE(image_events_end, surface,
+                     wlEglSurfaceFrameNumber(surface));
 
         /*
          * Send our explicit sync acquire and release points. This needs to be done
@@ -280,16 +464,23 @@ wlEglSendDamageEvent(WlEglSurface *surface,
          * attach has happened then we are stuck with a protocol error from not
          * specifying the timeline sync points.
          */
+        stageStart = wlEglSwapStatsBegin(surface->swapStats);
         if (!send_explicit_sync_points(surface->wlEglDpy, surface, image)) {
             return EGL_FALSE;
         }
+        wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_EXPLICIT_SYNC,
+                          stageStart);
+        WL_EGL_TRACE(explicit_sync_end, surface,
+                     wlEglSurfaceFrameNumber(surface));
 
         wl_surface_attach(surface->wlSurface,
                           surface->ctx.currentBuffer,
                           surface->dx,
                           surface->dy);
     }
+    WL_EGL_TRACE(attach, surface, wlEglSurfaceFrameNumber(surface));
 
+    stageStart = wlEglSwapStatsBegin(surface->swapStats);
     if (n_rects > 0 &&
         (wl_proxy_get_version((struct wl_proxy *)surface->wlSurface) >=
          WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)) {
@@ -307,9 +498,17 @@ wlEglSendDamageEvent(WlEglSurface *surface,
 
     wl_surface_commit(surface->wlSurface);
     surface->ctx.isAttached = EGL_TRUE;
+    WL_EGL_TRACE(commit, surface, wlEglSurfaceFrameNumber(surface));
 
-    return (wl_display_roundtrip_queue(wlDpy,
-                                       queue) >= 0) ? EGL_TRUE : EGL_FALSE;
+    roundtripStart = wlEglGetTimeNs();
+    ret = (wl_display_roundtrip_queue(wlDpy,
+                                      queue) >= 0) ? EGL_TRUE : EGL_FALSE;
+    wlEglHistogramAddAtomic(&surface->counters.roundtrip,
+                            wlEglGetTimeNs() - roundtripStart);
+    wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_COMMIT, stageStart);
+    WL_EGL_TRACE(roundtrip_end, surface, wlEglSurfaceFrameNumber(surface));
+
+    return ret;
 }
 
 static void*
@@ -372,12 +571,16 @@ damage_thread(void *args)
                                           surface->ctx.eglStream);
                 }
 
+                WL_EGL_TRACE(damage_thread_submit, surface,
+                             surface->ctx.framesProcessed + 1);
+
                 wlEglCreateFrameSync(surface);
 
                 ok = wlEglSendDamageEvent(surface, queue, NULL, 0);
                 surface->ctx.framesProcessed++;
 
                 pthread_cond_signal(&surface->condFrameSync);
+                wlEglSignalSurfaceReady(surface);
 
                 pthread_mutex_unlock(&surface->mutexFrameSync);
             }
@@ -390,6 +593,8 @@ damage_thread(void *args)
                       data->egl.clientWaitSync(display->devDpy->eglDisplay,
                                                surface->ctx.damageThreadSync,
                                                0, EGL_FOREVER_KHR));
+                WL_EGL_TRACE(damage_thread_wake, surface,
+                             surface->ctx.framesProcessed);
             }
         }
     }
@@ -420,8 +625,8 @@ static EGLint setup_wl_eglstream_damage_thread(WlEglSurface *surface)
         return data->egl.getError();
     }
 
-    ret = pthread_create(&surface->ctx.damageThreadId, NULL,
-                         damage_thread, (void*)surface);
+    ret = wlEglCreateHelperThread(&surface->ctx.damageThreadId, "damage",
+                                  damage_thread, (void*)surface);
     if (ret != 0) {
         return EGL_BAD_ALLOC;
     }
@@ -498,7 +703,7 @@ buffer_release_thread(void *args)
         }
 
         if (pfds[1].revents & POLLIN) {
-            if (read(pfds[1].fd, &cmd, sizeof(cmd) != sizeof(cmd))) {
+            if (read(pfds[1].fd, &cmd, sizeof(cmd)) != sizeof(cmd)) {
                 /* Reading an event from the app side failed. Bail. */
                 wl_display_cancel_read(wlDpy);
                 return NULL;
@@ -522,6 +727,8 @@ buffer_release_thread(void *args)
             if (wl_display_read_events(wlDpy) < 0) {
                 return NULL;
             }
+            WL_EGL_TRACE(release_thread_events, surface,
+                         wlEglSurfaceFrameNumber(surface));
         } else {
             wl_display_cancel_read(wlDpy);
         }
@@ -541,8 +748,8 @@ static EGLint setup_wl_buffer_release_thread(WlEglSurface *surface)
     surface->wlBufferEventQueue =
         wl_display_create_queue(surface->wlEglDpy->nativeDpy);
 
-    ret = pthread_create(&surface->bufferReleaseThreadId, NULL,
-                         buffer_release_thread, (void*)surface);
+    ret = wlEglCreateHelperThread(&surface->bufferReleaseThreadId, "release",
+                                  buffer_release_thread, (void*)surface);
     if (ret != 0) {
         close(surface->bufferReleaseThreadPipe[BUFFER_RELEASE_PIPE_WRITE]);
         surface->bufferReleaseThreadPipe[BUFFER_RELEASE_PIPE_WRITE] = -1;
@@ -580,6 +787,169 @@ finish_wl_buffer_release_thread(WlEglSurface *surface)
     }
 }
 
+/* Whether the app has events to dispatch on the queue */
+static bool
+queue_has_events(struct wl_display *wlDpy, struct wl_event_queue *queue)
+{
+    if (wl_display_prepare_read_queue(wlDpy, queue) < 0) {
+        return errno == EAGAIN;
+    }
+    wl_display_cancel_read(wlDpy);
+
+    return false;
+}
+
+/* Whether a release point the app waits for became available */
+static bool
+release_wakeup_ready(WlEglDisplay *display, WlEglSurface *surface)
+{
+    uint32_t firstSignaled;
+    bool     ready = false;
+
+    pthread_mutex_lock(&surface->mutexFrameSync);
+    if (surface->releaseWakeupCount) {
+        /* Errors count as ready too, the app will run into them itself */
+        ready = drmSyncobjTimelineWait(display->drmFd,
+                                       surface->releaseWakeupSyncobjs,
+                                       surface->releaseWakeupPoints,
+                                       surface->releaseWakeupCount, 0,
+                                       DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                       &firstSignaled) != -ETIME;
+        WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, 1);
+        if (ready) {
+            surface->releaseWakeupCount = 0;
+        }
+    }
+    pthread_mutex_unlock(&surface->mutexFrameSync);
+
+    return ready;
+}
+
+/*
+ * Without it, nothing would read the wl_display while the app waits for the
+ * ready fd, unless the display has an I/O thread. The events are left on the
+ * app's queues for it to dispatch, this thread only tells it there are some.
+ */
+static void *
+ready_fd_thread(void *args)
+{
+    WlEglSurface       *surface = (WlEglSurface*)args;
+    WlEglDisplay       *display = surface->wlEglDpy;
+    struct wl_display  *wlDpy = display->nativeDpy;
+    struct pollfd       pfds[2];
+    const int           fd = wl_display_get_fd(wlDpy);
+    int                 res;
+    uint8_t             cmd;
+    bool                ready;
+
+    while (1) {
+        /* The thread's own queue stays empty, so this doesn't fail */
+        if (wl_display_prepare_read_queue(wlDpy,
+                                          surface->readyThreadQueue) < 0) {
+            break;
+        }
+
+        memset(&pfds, 0, sizeof(pfds));
+        pfds[0].fd = fd;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = surface->readyThreadPipe[BUFFER_RELEASE_PIPE_READ];
+        pfds[1].events = POLLIN;
+
+        /* Poll release points the kernel couldn't arm readyFd for */
+        res = poll(&pfds[0], sizeof(pfds) / sizeof(pfds[0]),
+                   __atomic_load_n(&surface->releaseWakeupCount,
+                                   __ATOMIC_RELAXED) ? 1 : 1000);
+
+        if (res < 0) {
+            wl_display_cancel_read(wlDpy);
+            continue;
+        }
+
+        if (pfds[1].revents & POLLIN) {
+            if (read(pfds[1].fd, &cmd, sizeof(cmd)) != sizeof(cmd) ||
+                cmd != READY_THREAD_EVENT_POLL_RELEASE) {
+                wl_display_cancel_read(wlDpy);
+                break;
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            if (wl_display_read_events(wlDpy) < 0) {
+                break;
+            }
+        } else {
+            wl_display_cancel_read(wlDpy);
+        }
+
+        ready = queue_has_events(wlDpy, surface->wlEventQueue);
+        if (!ready &&
+            __atomic_load_n(&surface->swapIntervalSync, __ATOMIC_ACQUIRE)) {
+            ready = queue_has_events(wlDpy, display->wlEventQueue);
+        }
+        if (release_wakeup_ready(display, surface)) {
+            ready = true;
+        }
+        if (ready) {
+            wlEglSignalSurfaceReady(surface);
+        }
+    }
+
+    /* Let the app find out about display errors */
+    wlEglSignalSurfaceReady(surface);
+
+    return NULL;
+}
+
+static EGLint setup_ready_fd_thread(WlEglSurface *surface)
+{
+    int ret;
+
+    if (pipe(surface->readyThreadPipe)) {
+        return EGL_BAD_ALLOC;
+    }
+
+    surface->readyThreadQueue =
+        wl_display_create_queue(surface->wlEglDpy->nativeDpy);
+
+    ret = wlEglCreateHelperThread(&surface->readyThreadId, "ready",
+                                  ready_fd_thread, (void*)surface);
+    if (ret != 0) {
+        close(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE]);
+        surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE] = -1;
+        close(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_READ]);
+        surface->readyThreadPipe[BUFFER_RELEASE_PIPE_READ] = -1;
+        wl_event_queue_destroy(surface->readyThreadQueue);
+        surface->readyThreadQueue = NULL;
+        return EGL_BAD_ALLOC;
+    }
+
+    return EGL_SUCCESS;
+}
+
+static void
+finish_ready_fd_thread(WlEglSurface *surface)
+{
+    uint8_t cmd = READY_THREAD_EVENT_TERMINATE;
+
+    if (surface->readyThreadQueue) {
+        if (write(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE],
+                  &cmd, sizeof(cmd)) != sizeof(cmd)) {
+            /* The thread is not going to terminate gracefully. */
+            pthread_cancel(surface->readyThreadId);
+        }
+        pthread_join(surface->readyThreadId, NULL);
+        surface->readyThreadId = (pthread_t)0;
+
+        close(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE]);
+        surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE] = -1;
+        close(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_READ]);
+        surface->readyThreadPipe[BUFFER_RELEASE_PIPE_READ] = -1;
+
+        wl_event_queue_destroy(surface->readyThreadQueue);
+        surface->readyThreadQueue = NULL;
+    }
+}
+
 static void
 destroy_stream_image(WlEglDisplay *display,
                      WlEglSurface *surface,
@@ -617,6 +987,11 @@ destroy_stream_image(WlEglDisplay *display,
         }
     }
 
+    /* Acquired but never attached: the frame never reached the compositor */
+    if (!wl_list_empty(&image->acquiredLink)) {
+        WL_EGL_COUNTER_ADD(surface->counters.framesDropped, 1);
+    }
+
     wl_list_remove(&image->acquiredLink);
     wl_list_remove(&image->link);
 
@@ -629,11 +1004,14 @@ destroy_surface_context(WlEglSurface *surface, WlEglSurfaceCtx *ctx)
     WlEglDisplay      *display  = surface->wlEglDpy;
     WlEglPlatformData *data     = display->data;
     EGLDisplay         dpy      = display->devDpy->eglDisplay;
-    EGLSurface         surf     = ctx->eglSurface;
+    EGLSurface         surf;
     EGLStreamKHR       stream   = ctx->eglStream;
     void              *resource = ctx->wlStreamResource;
 
     finish_wl_eglstream_damage_thread(surface, ctx, 1);
+    finish_image_consumer_thread(surface, ctx);
+
+    surf = ctx->eglSurface;
 
     ctx->eglSurface       = EGL_NO_SURFACE;
     ctx->eglStream        = EGL_NO_STREAM_KHR;
@@ -656,7 +1034,7 @@ destroy_surface_context(WlEglSurface *surface, WlEglSurfaceCtx *ctx)
         // streamImages list is not valid when wlStreamResource is in use.
         WlEglStreamImage *image, *next;
 
-        pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+        wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
         // Destroy all images. If there are attached images, this will mark
         // them for destruction. Following buffer release event will destroy
@@ -665,12 +1043,90 @@ destroy_surface_context(WlEglSurface *surface, WlEglSurfaceCtx *ctx)
             destroy_stream_image(display, surface, image);
         }
 
-        pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+        wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
     } else {
         wl_buffer_destroy(resource);
     }
 }
 
+/*
+ * Default caps on the contexts kept in oldCtxList, overridden with
+ * __NV_WAYLAND_MAX_OLD_CONTEXTS and __NV_WAYLAND_MAX_OLD_CONTEXT_MB. 0 means
+ * unlimited.
+ */
+#define WL_EGL_DEFAULT_MAX_OLD_CONTEXTS   4
+#define WL_EGL_DEFAULT_MAX_OLD_CONTEXT_MB 256
+
+static unsigned long
+get_old_context_limit(const char *name, unsigned long defaultValue)
+{
+    const char    *str = getenv(name);
+    char          *end;
+    unsigned long  value;
+
+    if (!str || !str[0]) {
+        return defaultValue;
+    }
+
+    value = strtoul(str, &end, 10);
+    return *end ? defaultValue : value;
+}
+
+static void
+init_old_context_limits(WlEglSurface *surface)
+{
+    surface->oldCtxMaxCount =
+        get_old_context_limit("__NV_WAYLAND_MAX_OLD_CONTEXTS",
+                              WL_EGL_DEFAULT_MAX_OLD_CONTEXTS);
+    surface->oldCtxMaxBytes =
+        (size_t)get_old_context_limit("__NV_WAYLAND_MAX_OLD_CONTEXT_MB",
+                                      WL_EGL_DEFAULT_MAX_OLD_CONTEXT_MB) << 20;
+}
+
+static EGLBoolean
+old_surface_contexts_over_limit(const WlEglSurface *surface)
+{
+    return (surface->oldCtxMaxCount &&
+            surface->oldCtxCount > surface->oldCtxMaxCount) ||
+           (surface->oldCtxMaxBytes &&
+            surface->oldCtxBytes > surface->oldCtxMaxBytes);
+}
+
+static void
+free_old_surface_context(WlEglSurface *surface, WlEglSurfaceCtx *ctx)
+{
+    destroy_surface_context(surface, ctx);
+    wl_list_remove(&ctx->link);
+    surface->oldCtxCount--;
+    surface->oldCtxBytes -= ctx->deferredBytes;
+    free(ctx);
+}
+
+/*
+ * Keeps oldCtxList within its caps. The compositor first gets a round trip
+ * to release the streams it's done with, then the oldest contexts are
+ * destroyed regardless. The newest one is never forced out, as it may still
+ * be the one on screen.
+ */
+static void
+reclaim_old_surface_contexts(WlEglSurface *surface)
+{
+    WlEglDisplay    *display = surface->wlEglDpy;
+    WlEglSurfaceCtx *ctx;
+
+    if (!old_surface_contexts_over_limit(surface)) {
+        return;
+    }
+
+    wl_display_roundtrip_queue(display->nativeDpy, surface->wlEventQueue);
+
+    while (surface->oldCtxCount > 1 &&
+           old_surface_contexts_over_limit(surface)) {
+        ctx = wl_container_of(surface->oldCtxList.prev, ctx, link);
+        free_old_surface_context(surface, ctx);
+    }
+}
+
 static void
 discard_surface_context(WlEglSurface *surface)
 {
@@ -683,7 +1139,20 @@ discard_surface_context(WlEglSurface *surface)
         WlEglSurfaceCtx *ctx = malloc(sizeof(WlEglSurfaceCtx));
         if (ctx) {
             memcpy(ctx, &surface->ctx, sizeof(*ctx));
+            ctx->surface = surface;
+            /* Rough estimate: a 32bpp buffer per FIFO entry plus two more */
+            ctx->deferredBytes = (size_t)surface->width * surface->height * 4 *
+                                 (surface->fifoLength + 2);
+
+            /* Lets wl_buffer_release() find the context without a lookup */
+            wl_proxy_set_user_data((struct wl_proxy *)ctx->wlStreamResource,
+                                   ctx);
+
             wl_list_insert(&surface->oldCtxList, &ctx->link);
+            surface->oldCtxCount++;
+            surface->oldCtxBytes += ctx->deferredBytes;
+
+            reclaim_old_surface_contexts(surface);
         }
     } else {
         destroy_surface_context(surface, &surface->ctx);
@@ -693,17 +1162,16 @@ discard_surface_context(WlEglSurface *surface)
 static void
 wl_buffer_release(void *data, struct wl_buffer *buffer)
 {
-    WlEglSurface *surface = (WlEglSurface*)data;
-    WlEglSurfaceCtx *ctx;
+    WlEglSurfaceCtx *ctx = (WlEglSurfaceCtx *)data;
 
-    /* Look for the surface context for the given buffer and destroy it */
-    wl_list_for_each(ctx, &surface->oldCtxList, link) {
-        if (ctx->wlStreamResource == buffer) {
-            destroy_surface_context(surface, ctx);
-            wl_list_remove(&ctx->link);
-            free(ctx);
-            break;
-        }
+    /*
+     * The user data is only set once the context is moved to oldCtxList, the
+     * current context is released when it is discarded.
+     */
+    if (ctx) {
+        (void)buffer; /* In case assert() compiles to nothing */
+        assert(ctx->wlStreamResource == buffer);
+        free_old_surface_context(ctx->surface, ctx);
     }
 }
 
@@ -711,64 +1179,288 @@ static struct wl_buffer_listener wl_buffer_listener = {
     wl_buffer_release
 };
 
-static void *
-create_wl_eglstream(WlEglSurface *surface,
-                    int32_t handle,
-                    int32_t type,
-                    struct wl_array *attribs)
+/*
+ * Computes the buffer size for a window of winWidth x winHeight, taking the
+ * render size and fractional scale attributes
+ * into account. The render scale applies on top of the fractional scale.
+ */
+static void
+get_render_size(const WlEglSurface *surface,
+                int winWidth,
+                int winHeight,
+                int *width,
+                int *height)
 {
-    WlEglDisplay                *display = surface->wlEglDpy;
-    struct wl_egl_window        *window  = surface->wlEglWin;
-    struct wl_eglstream_display *wrapper = NULL;
-    struct wl_buffer            *buffer  = NULL;
-    int32_t                      width;
-    int32_t                      height;
+    *width  = winWidth;
+    *height = winHeight;
 
-    if (!display->wlStreamDpy) {
-        return NULL;
+    /* Without wp_viewporter the compositor couldn't scale the buffers back */
+    if (!surface->wlEglDpy->wpViewporter) {
+        return;
     }
 
-    if (surface->isSurfaceProducer) {
-        assert(window);
-        width  = window->width;
-        height = window->height;
-    } else {
-        width  = surface->width;
-        height = surface->height;
+    if (surface->wpFractionalScale && surface->preferredScale > 0) {
+        /* Round half away from zero, as the protocol recommends */
+        *width  = ((int64_t)*width * surface->preferredScale +
+                   WL_EGL_FRACTIONAL_SCALE_ONE / 2) / WL_EGL_FRACTIONAL_SCALE_ONE;
+        *height = ((int64_t)*height * surface->preferredScale +
+                   WL_EGL_FRACTIONAL_SCALE_ONE / 2) / WL_EGL_FRACTIONAL_SCALE_ONE;
     }
 
-    wrapper = wl_proxy_create_wrapper(display->wlStreamDpy);
-    wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlEventQueue);
-
-    buffer = wl_eglstream_display_create_stream(wrapper,
-                                                width,
-                                                height,
-                                                handle,
-                                                type,
-                                                attribs);
-
-    wl_proxy_wrapper_destroy(wrapper); /* Done with wrapper */
-
-    if (!buffer) {
-        return NULL;
+    if (surface->renderScale > 0 &&
+        surface->renderScale != WL_EGL_RENDER_SCALE_ONE) {
+        *width  = ((int64_t)*width * surface->renderScale +
+                   WL_EGL_RENDER_SCALE_ONE / 2) / WL_EGL_RENDER_SCALE_ONE;
+        *height = ((int64_t)*height * surface->renderScale +
+                   WL_EGL_RENDER_SCALE_ONE / 2) / WL_EGL_RENDER_SCALE_ONE;
     }
 
-    if (wl_buffer_add_listener(buffer, &wl_buffer_listener, surface) == -1) {
-        wl_buffer_destroy(buffer);
-        return NULL;
+    if (*width < 1) {
+        *width = 1;
+    }
+    if (*height < 1) {
+        *height = 1;
     }
-
-    return buffer;
 }
 
-static EGLint create_surface_stream_fd(WlEglSurface *surface)
+static void
+fractional_scale_handle_preferred_scale(void *data,
+                                        struct wp_fractional_scale_v1 *fractionalScale,
+                                        uint32_t scale)
 {
-    WlEglDisplay         *display = surface->wlEglDpy;
-    WlEglPlatformData    *data    = display->data;
-    int                   handle  = EGL_NO_FILE_DESCRIPTOR_KHR;
-    struct wl_array       wlAttribs;
-    EGLint                eglAttribs[] = {
-        EGL_STREAM_FIFO_LENGTH_KHR, surface->fifoLength,
+    WlEglSurface *surface = data;
+    (void) fractionalScale;
+
+    /*
+     * This is dispatched from the surface's event queue with the surface lock
+     * held, so just flag the surface for reallocation at the next swap like a
+     * resize of a non-current surface.
+     */
+    if (surface->preferredScale != scale) {
+        surface->preferredScale = scale;
+        surface->isResized = EGL_TRUE;
+    }
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = fractional_scale_handle_preferred_scale,
+};
+
+/*
+ * Creates the surface's wp_fractional_scale_v1 object if
+ * surface->fractionalScale is set. Does nothing if the compositor doesn't
+ * support fractional scaling or wp_viewporter, which is needed to use it.
+ */
+static EGLint
+update_surface_fractional_scale(WlEglSurface *surface)
+{
+    WlEglDisplay                          *display = surface->wlEglDpy;
+    struct wp_fractional_scale_manager_v1 *wrapper;
+
+    if (!surface->fractionalScale || surface->wpFractionalScale ||
+        !display->wpFractionalScale || !display->wpViewporter) {
+        return EGL_SUCCESS;
+    }
+
+    /* Deliver preferred_scale on the surface queue, see the handler */
+    wrapper = wl_proxy_create_wrapper(display->wpFractionalScale);
+    if (!wrapper) {
+        return EGL_BAD_ALLOC;
+    }
+    wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlEventQueue);
+    surface->wpFractionalScale =
+        wp_fractional_scale_manager_v1_get_fractional_scale(wrapper,
+                                                            surface->wlSurface);
+    wl_proxy_wrapper_destroy(wrapper);
+
+    if (!surface->wpFractionalScale ||
+        wp_fractional_scale_v1_add_listener(surface->wpFractionalScale,
+                                            &fractional_scale_listener,
+                                            surface)) {
+        return EGL_BAD_ALLOC;
+    }
+
+    return EGL_SUCCESS;
+}
+
+/*
+ * Returns the wp_content_type_v1 type of window surfaces, which is set with
+ * __NV_WAYLAND_CONTENT_TYPE.
+ */
+static uint32_t
+get_default_content_type(void)
+{
+    const char *str = getenv("__NV_WAYLAND_CONTENT_TYPE");
+
+    if (str) {
+        if (!strcmp(str, "photo")) {
+            return WP_CONTENT_TYPE_V1_TYPE_PHOTO;
+        }
+        if (!strcmp(str, "video")) {
+            return WP_CONTENT_TYPE_V1_TYPE_VIDEO;
+        }
+        if (!strcmp(str, "game")) {
+            return WP_CONTENT_TYPE_V1_TYPE_GAME;
+        }
+    }
+
+    return WP_CONTENT_TYPE_V1_TYPE_NONE;
+}
+
+/*
+ * Returns the render scale of window surfaces in thousandths, which is set
+ * with __NV_WAYLAND_RENDER_SCALE.
+ */
+static EGLint
+get_default_render_scale(void)
+{
+    const char *str = getenv("__NV_WAYLAND_RENDER_SCALE");
+    long        scale;
+
+    if (str) {
+        scale = strtol(str, NULL, 10);
+        if (scale > 0 && scale <= INT32_MAX) {
+            return (EGLint)scale;
+        }
+    }
+
+    return WL_EGL_RENDER_SCALE_ONE;
+}
+
+/*
+ * Returns whether window surfaces follow the compositor's preferred scale,
+ * which is set with __NV_WAYLAND_FRACTIONAL_SCALE=1.
+ */
+static EGLBoolean
+get_default_fractional_scale(void)
+{
+    const char *str = getenv("__NV_WAYLAND_FRACTIONAL_SCALE");
+
+    return (str && atoi(str) == 1) ? EGL_TRUE : EGL_FALSE;
+}
+
+/*
+ * Sends surface->contentType to the compositor. There can only be one
+ * wp_content_type_v1 object per wl_surface, so it is only created for a type
+ * other than none, and apps setting their own hint are not affected. Like all
+ * wl_surface state, the hint is applied with the next commit.
+ */
+static EGLint
+update_surface_content_type(WlEglSurface *surface)
+{
+    WlEglDisplay *display = surface->wlEglDpy;
+
+    if (surface->contentType == WP_CONTENT_TYPE_V1_TYPE_NONE ||
+        surface->wpContentType || !display->wpContentType) {
+        return EGL_SUCCESS;
+    }
+
+    surface->wpContentType =
+        wp_content_type_manager_v1_get_surface_content_type(display->wpContentType,
+                                                            surface->wlSurface);
+    if (!surface->wpContentType) {
+        return EGL_BAD_ALLOC;
+    }
+
+    wp_content_type_v1_set_content_type(surface->wpContentType,
+                                        surface->contentType);
+
+    return EGL_SUCCESS;
+}
+
+/*
+ * Points the surface's viewport at the window size while the buffers have a
+ * different size. The viewport is only created once render scaling is first
+ * used, so apps that manage their own wp_viewport are not affected. Like all
+ * wl_surface state, the destination is applied with the next commit, together
+ * with the first buffer of the new size.
+ */
+static void
+update_surface_viewport(WlEglSurface *surface)
+{
+    WlEglDisplay *display = surface->wlEglDpy;
+
+    if (!display->wpViewporter) {
+        return;
+    }
+
+    if (surface->width != surface->windowWidth ||
+        surface->height != surface->windowHeight) {
+        if (!surface->wpViewport) {
+            surface->wpViewport =
+                wp_viewporter_get_viewport(display->wpViewporter,
+                                           surface->wlSurface);
+            if (!surface->wpViewport) {
+                return;
+            }
+        }
+        wp_viewport_set_destination(surface->wpViewport,
+                                    surface->windowWidth,
+                                    surface->windowHeight);
+    } else if (surface->wpViewport) {
+        /* Unset the destination, back to 1:1 */
+        wp_viewport_set_destination(surface->wpViewport, -1, -1);
+    }
+}
+
+static void *
+create_wl_eglstream(WlEglSurface *surface,
+                    int32_t handle,
+                    int32_t type,
+                    struct wl_array *attribs)
+{
+    WlEglDisplay                *display = surface->wlEglDpy;
+    struct wl_egl_window        *window  = surface->wlEglWin;
+    struct wl_eglstream_display *wrapper = NULL;
+    struct wl_buffer            *buffer  = NULL;
+    int32_t                      width;
+    int32_t                      height;
+
+    if (!display->wlStreamDpy) {
+        return NULL;
+    }
+
+    if (surface->isSurfaceProducer) {
+        assert(window);
+        get_render_size(surface, window->width, window->height,
+                        &width, &height);
+    } else {
+        width  = surface->width;
+        height = surface->height;
+    }
+
+    wrapper = wl_proxy_create_wrapper(display->wlStreamDpy);
+    wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlEventQueue);
+
+    buffer = wl_eglstream_display_create_stream(wrapper,
+                                                width,
+                                                height,
+                                                handle,
+                                                type,
+                                                attribs);
+
+    wl_proxy_wrapper_destroy(wrapper); /* Done with wrapper */
+
+    if (!buffer) {
+        return NULL;
+    }
+
+    if (wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL) == -1) {
+        wl_buffer_destroy(buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+static EGLint create_surface_stream_fd(WlEglSurface *surface)
+{
+    WlEglDisplay         *display = surface->wlEglDpy;
+    WlEglPlatformData    *data    = display->data;
+    int                   handle  = EGL_NO_FILE_DESCRIPTOR_KHR;
+    struct wl_array       wlAttribs;
+    EGLint                eglAttribs[] = {
+        EGL_STREAM_FIFO_LENGTH_KHR, surface->fifoLength,
         EGL_NONE,                   EGL_NONE,
         EGL_NONE
     };
@@ -1068,7 +1760,9 @@ stream_local_buffer_release_callback(void *ptr, struct wl_buffer *buffer)
     WlEglDisplay       *display = surface->wlEglDpy;
     WlEglPlatformData  *data    = display->data;
 
-    pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    WL_EGL_TRACE(buffer_release, surface, wlEglSurfaceFrameNumber(surface));
 
     (void)buffer; /* In case assert() compiles to nothing */
     assert(image->buffer == NULL || image->buffer == buffer);
@@ -1098,7 +1792,9 @@ stream_local_buffer_release_callback(void *ptr, struct wl_buffer *buffer)
                                      EGL_NO_SYNC_KHR);
     }
 
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    wlEglSignalSurfaceReady(surface);
 }
 
 static const struct wl_buffer_listener stream_local_buffer_listener = {
@@ -1120,19 +1816,24 @@ get_release_sync(WlEglDisplay *display, WlEglStreamImage *image)
     int                 syncFd      = -1;
     uint32_t            tmpSyncobj;
     EGLint              attribs[3];
+    uint64_t            ioctls      = 1;
 
 
     /* Import our acquire syncfd at a new acquire point */
     if (drmSyncobjCreate(display->drmFd, 0, &tmpSyncobj) != 0) {
+        WL_EGL_COUNTER_ADD(image->surface->counters.explicitSyncIoctls,
+                           ioctls);
         return EGL_NO_SYNC_KHR;
     }
 
+    ioctls++;
     if (drmSyncobjTransfer(display->drmFd, tmpSyncobj, 0,
                            image->drmSyncobjHandle, image->releasePoint,
                            0) != 0) {
         goto destroy;
     }
 
+    ioctls++;
     if (drmSyncobjExportSyncFile(display->drmFd, tmpSyncobj,
                                  &syncFd) != 0) {
         goto destroy;
@@ -1145,6 +1846,8 @@ get_release_sync(WlEglDisplay *display, WlEglStreamImage *image)
                                    attribs);
 destroy:
     drmSyncobjDestroy(display->drmFd, tmpSyncobj);
+    /* The ones issued above plus the destroy */
+    WL_EGL_COUNTER_ADD(image->surface->counters.explicitSyncIoctls, ioctls + 1);
 
     return eglSync;
 }
@@ -1158,6 +1861,126 @@ destroy:
  *
  * This will block if no available buffers have been released.
  */
+/*
+ * Records each release point we are waiting on. Must be called with
+ * surface->ctx.streamImagesMutex already locked.
+ */
+static uint32_t
+get_pending_release_points(WlEglSurface *surface,
+                           WlEglStreamImage **streamImages,
+                           uint32_t *syncobjs,
+                           uint64_t *syncPoints)
+{
+    WlEglStreamImage *image;
+    uint32_t          numSyncPoints = 0;
+
+    wl_list_for_each(image, &surface->ctx.streamImages, link) {
+        if (image->releasePending) {
+            if (numSyncPoints >= MAX_IMAGES) {
+                assert(!"The number of the pending sync points is more \
+                         than the expected size of the swapchain");
+                break;
+            }
+
+            if (streamImages) {
+                streamImages[numSyncPoints] = image;
+            }
+            syncobjs[numSyncPoints] = image->drmSyncobjHandle;
+            syncPoints[numSyncPoints] = image->releasePoint;
+
+            numSyncPoints++;
+        }
+    }
+
+    return numSyncPoints;
+}
+
+/*
+ * Has the surface's ready fd signalled once one of the given release points
+ * becomes available. The kernel does it directly if it can, otherwise the
+ * ready fd thread polls them.
+ */
+static void
+arm_release_wakeup(WlEglDisplay *display, WlEglSurface *surface,
+                   const uint32_t *syncobjs, const uint64_t *syncPoints,
+                   uint32_t numSyncPoints)
+{
+    uint8_t  cmd = READY_THREAD_EVENT_POLL_RELEASE;
+    uint32_t i;
+
+    if (!surface->readyThreadQueue) {
+        return;
+    }
+
+#if defined(HAVE_DRMSYNCOBJEVENTFD)
+    for (i = 0; i < numSyncPoints; i++) {
+        if (drmSyncobjEventfd(display->drmFd, syncobjs[i], syncPoints[i],
+                              surface->readyFd,
+                              DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) != 0) {
+            break;
+        }
+        WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, 1);
+    }
+    if (i == numSyncPoints) {
+        return;
+    }
+#else
+    (void) display;
+#endif
+
+    pthread_mutex_lock(&surface->mutexFrameSync);
+    for (i = 0; i < numSyncPoints; i++) {
+        surface->releaseWakeupSyncobjs[i] = syncobjs[i];
+        surface->releaseWakeupPoints[i] = syncPoints[i];
+    }
+    surface->releaseWakeupCount = numSyncPoints;
+    pthread_mutex_unlock(&surface->mutexFrameSync);
+
+    if (write(surface->readyThreadPipe[BUFFER_RELEASE_PIPE_WRITE],
+              &cmd, sizeof(cmd)) != sizeof(cmd)) {
+        /* The thread is gone, wake the app up so it finds out on its own */
+        wlEglSignalSurfaceReady(surface);
+    }
+}
+
+EGLBoolean
+wlEglSurfaceReleasePointsReady(WlEglDisplay *display, WlEglSurface *surface)
+{
+    uint32_t   syncobjs[MAX_IMAGES];
+    uint64_t   syncPoints[MAX_IMAGES];
+    uint32_t   firstSignaled, numSyncPoints;
+    EGLBoolean ret = EGL_TRUE;
+
+    if (!surface->wlSyncobjSurf) {
+        return EGL_TRUE;
+    }
+
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    numSyncPoints = get_pending_release_points(surface, NULL,
+                                               syncobjs, syncPoints);
+
+    if (numSyncPoints >= BLOCKING_RELEASE_POINTS) {
+        if (drmSyncobjTimelineWait(display->drmFd, syncobjs, syncPoints,
+                                   numSyncPoints, 0,
+                                   DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                   &firstSignaled) != 0) {
+            ret = EGL_FALSE;
+        }
+        WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, 1);
+    }
+
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    /* Outside streamImagesMutex, the damage thread nests it the other way */
+    if (!ret) {
+        arm_release_wakeup(display, surface, syncobjs, syncPoints,
+                           numSyncPoints);
+    }
+
+    return ret;
+}
+
 EGLBoolean
 wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface)
 {
@@ -1170,35 +1993,27 @@ wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface)
     uint64_t            syncPoints[MAX_IMAGES];
     uint32_t            firstSignaled, numSyncPoints = 0;
     int64_t             timeout;
+    uint64_t            waitStart;
+    int                 waitRet;
     EGLBoolean          ret = EGL_FALSE;
 
     if (!surface->wlSyncobjSurf) {
         return EGL_TRUE;
     }
 
-    pthread_mutex_lock(&surface->ctx.streamImagesMutex);
-
-    /* record each release point we are waiting on */
-    wl_list_for_each(image, &surface->ctx.streamImages, link) {
-        if (image->releasePending) {
-            if (numSyncPoints >= MAX_IMAGES) {
-                assert(!"The number of the pending sync points is more \
-                         than the expected size of the swapchain");
-                break;
-            }
-
-            streamImages[numSyncPoints] = image;
-            syncobjs[numSyncPoints] = image->drmSyncobjHandle;
-            syncPoints[numSyncPoints] = image->releasePoint;
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
-            numSyncPoints++;
-        }
-    }
+    numSyncPoints = get_pending_release_points(surface, streamImages,
+                                               syncobjs, syncPoints);
 
     if (numSyncPoints == 0) {
         goto end;
     }
 
+    WL_EGL_TRACE(release_points_wait_begin, surface,
+                 wlEglSurfaceFrameNumber(surface));
+    waitStart = wlEglGetTimeNs();
+
     /*
      * Wait for at least one release point to have a fence. We need to block here
      * since the streams internal code expects to have at least one buffer placed
@@ -1214,7 +2029,7 @@ wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface)
      * Not all compositors will hold 3 and 4 indefinitely, although Kwin does
      * at certain times.
      */
-    timeout = numSyncPoints >= 3 ? INT64_MAX : 0;
+    timeout = numSyncPoints >= BLOCKING_RELEASE_POINTS ? INT64_MAX : 0;
 
     /*
      * The Linux docs say that DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE should be
@@ -1222,10 +2037,18 @@ wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface)
      * Note that there are some bugs with older kernels where this may not
      * signal correctly.
      */
-    if (drmSyncobjTimelineWait(display->drmFd, syncobjs, syncPoints,
-                           numSyncPoints, timeout,
-                           DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
-                           &firstSignaled) != 0) {
+    waitRet = drmSyncobjTimelineWait(display->drmFd, syncobjs, syncPoints,
+                                     numSyncPoints, timeout,
+                                     DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                     &firstSignaled);
+
+    WL_EGL_COUNTER_ADD(surface->counters.explicitSyncIoctls, 1);
+    wlEglHistogramAddAtomic(&surface->counters.releaseWait,
+                            wlEglGetTimeNs() - waitStart);
+    WL_EGL_TRACE(release_points_wait_end, surface,
+                 wlEglSurfaceFrameNumber(surface));
+
+    if (waitRet != 0) {
         /* A timeout is the only type of error we expect here */
 #ifdef ETIME
         assert(errno == ETIME);
@@ -1263,18 +2086,25 @@ wlEglSurfaceCheckReleasePoints(WlEglDisplay *display, WlEglSurface *surface)
     }
 
 end:
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
     return ret;
 }
 
+/*
+ * Exports the image as a dma-buf and creates its wl_buffer. With the consumer
+ * thread this is done when the stream adds the image; otherwise, or if that
+ * failed, it is done when the image is first acquired. The linux_dmabuf
+ * requests are only queued, they are sent along with the next commit.
+ */
 static EGLint
-acquire_surface_image(WlEglDisplay *display, WlEglSurface *surface)
+create_surface_image_buffer(WlEglDisplay *display,
+                            WlEglSurface *surface,
+                            WlEglStreamImage *image)
 {
     WlEglPlatformData  *data        = display->data;
     EGLDisplay          dpy         = display->devDpy->eglDisplay;
-    EGLImageKHR         eglImage;
-    WlEglStreamImage   *image = NULL;
+    EGLImageKHR         eglImage    = image->eglImage;
     struct zwp_linux_dmabuf_v1 *wrapper = NULL;
     struct zwp_linux_buffer_params_v1 *params;
     EGLuint64KHR        modifier;
@@ -1283,127 +2113,146 @@ acquire_surface_image(WlEglDisplay *display, WlEglSurface *surface)
     EGLint              stride;
     EGLint              offset;
     int                 fd;
-    EGLSyncKHR          acquireSync = EGL_NO_SYNC_KHR;
-    EGLBoolean          found = EGL_FALSE;
-    const EGLint attribs[] = {
-        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
-        EGL_SYNC_STATUS, EGL_SIGNALED,
-        EGL_NONE,
-    };
 
-    if (surface->wlSyncobjSurf) {
+    if (!data->egl.exportDMABUFImageQuery(dpy,
+                                          eglImage,
+                                          &format,
+                                          &planes,
+                                          &modifier)) {
+        return EGL_BAD_ALLOC;
+    }
+
+    assert(planes == 1); /* XXX support planar formats */
+
+    if (!data->egl.exportDMABUFImage(dpy,
+                                     eglImage,
+                                     &fd,
+                                     &stride,
+                                     &offset)) {
+        return EGL_BAD_ALLOC;
+    }
+
+    wrapper = wl_proxy_create_wrapper(display->wlDmaBuf);
+    wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlBufferEventQueue);
+
+    params = zwp_linux_dmabuf_v1_create_params(wrapper);
+
+    zwp_linux_buffer_params_v1_add(params,
+                                   fd,
+                                   0, /* XXX support planar formats */
+                                   offset,
+                                   stride,
+                                   modifier >> 32,
+                                   modifier & 0xffffffff);
+
+    /*
+     * Before sending the format, check if we are ignoring alpha due to a
+     * surface attribute.
+     */
+    if (surface->presentOpaque) {
         /*
-         * don't flush before acquireImage, we have to pass it in signaled.
+         * We are ignoring alpha, so we need to find a DRM_FORMAT_* that is equivalent to
+         * the current format, but ignores the alpha. i.e. RGBA -> RGBX
          *
-         * acquireImage will reset this, causing the fd to populate.
+         * There is also only one format with alpha that we expose on wayland: ARGB8888. If
+         * the format does not match this, silently ignore it as the app must be mistakenly
+         * using EGL_PRESENT_OPAQUE_EXT on an already opaque surface.
          */
-        acquireSync = data->egl.createSync(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
-                                           attribs);
-        if (acquireSync == EGL_NO_SYNC_KHR) {
-            return EGL_BAD_SURFACE;
+        if (format == DRM_FORMAT_ARGB8888) {
+            format = DRM_FORMAT_XRGB8888;
         }
     }
 
-    if (!data->egl.streamAcquireImage(dpy,
-                                      surface->ctx.eglStream,
-                                      &eglImage,
-                                      acquireSync)) {
-        goto fail_destroy_sync;
-    }
+    image->buffer = zwp_linux_buffer_params_v1_create_immed(params,
+                                                            surface->width,
+                                                            surface->height,
+                                                            format, 0);
 
-    pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+    zwp_linux_buffer_params_v1_destroy(params);
+    wl_proxy_wrapper_destroy(wrapper); /* Done with wrapper */
+    close(fd);
 
-    // Locate the corresponding WlEglStreamImage
-    wl_list_for_each(image, &surface->ctx.streamImages, link) {
-        if (image->eglImage == eglImage) {
-            found = EGL_TRUE;
-            break;
-        }
+    if (!image->buffer) {
+        return EGL_BAD_ALLOC;
     }
 
-    if (!found) {
-        goto fail_release;
+    if (!surface->wlSyncobjSurf &&
+        wl_buffer_add_listener(image->buffer,
+                               &stream_local_buffer_listener,
+                               image) == -1) {
+        wl_buffer_destroy(image->buffer);
+        image->buffer = NULL;
+        return EGL_BAD_ALLOC;
     }
 
-    image->acquireSync = acquireSync;
-
-    if (!image->buffer) {
-        if (!data->egl.exportDMABUFImageQuery(dpy,
-                                              eglImage,
-                                              &format,
-                                              &planes,
-                                              &modifier)) {
-            goto fail_release;
-        }
+    return EGL_SUCCESS;
+}
 
-        assert(planes == 1); /* XXX support planar formats */
+static EGLint
+acquire_surface_image(WlEglDisplay *display, WlEglSurface *surface)
+{
+    WlEglPlatformData  *data        = display->data;
+    EGLDisplay          dpy         = display->devDpy->eglDisplay;
+    EGLImageKHR         eglImage;
+    WlEglStreamImage   *image = NULL;
+    EGLSyncKHR          acquireSync = EGL_NO_SYNC_KHR;
+    EGLBoolean          found = EGL_FALSE;
+    const EGLint attribs[] = {
+        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+        EGL_SYNC_STATUS, EGL_SIGNALED,
+        EGL_NONE,
+    };
 
-        if (!data->egl.exportDMABUFImage(dpy,
-                                         eglImage,
-                                         &fd,
-                                         &stride,
-                                         &offset)) {
-            goto fail_release;
+    if (surface->wlSyncobjSurf) {
+        /*
+         * don't flush before acquireImage, we have to pass it in signaled.
+         *
+         * acquireImage will reset this, causing the fd to populate.
+         */
+        acquireSync = data->egl.createSync(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
+                                           attribs);
+        if (acquireSync == EGL_NO_SYNC_KHR) {
+            return EGL_BAD_SURFACE;
         }
+    }
 
-        wrapper = wl_proxy_create_wrapper(display->wlDmaBuf);
-        wl_proxy_set_queue((struct wl_proxy *)wrapper, surface->wlBufferEventQueue);
+    WL_EGL_TRACE(acquire_image_begin, surface,
+                 wlEglSurfaceFrameNumber(surface));
 
-        params = zwp_linux_dmabuf_v1_create_params(wrapper);
+    if (!data->egl.streamAcquireImage(dpy,
+                                      surface->ctx.eglStream,
+                                      &eglImage,
+                                      acquireSync)) {
+        goto fail_destroy_sync;
+    }
 
-        zwp_linux_buffer_params_v1_add(params,
-                                       fd,
-                                       0, /* XXX support planar formats */
-                                       offset,
-                                       stride,
-                                       modifier >> 32,
-                                       modifier & 0xffffffff);
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
-        /*
-         * Before sending the format, check if we are ignoring alpha due to a
-         * surface attribute.
-         */
-        if (surface->presentOpaque) {
-            /*
-             * We are ignoring alpha, so we need to find a DRM_FORMAT_* that is equivalent to
-             * the current format, but ignores the alpha. i.e. RGBA -> RGBX
-             *
-             * There is also only one format with alpha that we expose on wayland: ARGB8888. If
-             * the format does not match this, silently ignore it as the app must be mistakenly
-             * using EGL_PRESENT_OPAQUE_EXT on an already opaque surface.
-             */
-            if (format == DRM_FORMAT_ARGB8888) {
-                format = DRM_FORMAT_XRGB8888;
-            }
+    // Locate the corresponding WlEglStreamImage
+    wl_list_for_each(image, &surface->ctx.streamImages, link) {
+        if (image->eglImage == eglImage) {
+            found = EGL_TRUE;
+            break;
         }
+    }
 
-        image->buffer = zwp_linux_buffer_params_v1_create_immed(params,
-                                                                surface->width,
-                                                                surface->height,
-                                                                format, 0);
-
-        zwp_linux_buffer_params_v1_destroy(params);
-        wl_proxy_wrapper_destroy(wrapper); /* Done with wrapper */
-        close(fd);
+    if (!found) {
+        goto fail_release;
+    }
 
-        if (!image->buffer) {
-            goto fail_release;
-        }
+    image->acquireSync = acquireSync;
 
-        if (!surface->wlSyncobjSurf &&
-            wl_buffer_add_listener(image->buffer,
-                                   &stream_local_buffer_listener,
-                                   image) == -1) {
-            wl_buffer_destroy(image->buffer);
-            image->buffer = NULL;
-            goto fail_release;
-        }
+    if (!image->buffer &&
+        create_surface_image_buffer(display, surface, image) != EGL_SUCCESS) {
+        goto fail_release;
     }
 
     /* Add image to the end of the acquired images list */
     wl_list_insert(surface->ctx.acquiredImages.prev, &image->acquiredLink);
 
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    WL_EGL_TRACE(acquire_image_end, surface, wlEglSurfaceFrameNumber(surface));
 
     return EGL_SUCCESS;
 
@@ -1423,7 +2272,7 @@ fail_release:
     }
 
     /* Release the image lock */
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
     return EGL_BAD_SURFACE;
 
@@ -1434,6 +2283,45 @@ fail_destroy_sync:
     return EGL_BAD_SURFACE;
 }
 
+/*
+ * Destroys the wl_buffers of images that are neither held by the compositor
+ * nor waiting to be presented, so the compositor can drop its imports of
+ * them. acquire_surface_image() creates them again once the images are
+ * reused. Returns the number of buffers destroyed.
+ */
+static int
+trim_surface_image_buffers(WlEglSurface *surface)
+{
+    WlEglStreamImage *image;
+    int               count = 0;
+
+    if (surface->ctx.isOffscreen || surface->ctx.wlStreamResource) {
+        return 0;
+    }
+
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    wl_list_for_each(image, &surface->ctx.streamImages, link) {
+        if (!image->buffer ||
+            image->destructionPending ||
+            image->buffer == surface->ctx.currentBuffer ||
+            !wl_list_empty(&image->acquiredLink) ||
+            (surface->wlSyncobjSurf ? image->releasePending : image->attached)) {
+            continue;
+        }
+
+        wl_buffer_destroy(image->buffer);
+        image->buffer = NULL;
+        count++;
+    }
+
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    WL_EGL_COUNTER_ADD(surface->counters.buffersTrimmed, count);
+
+    return count;
+}
+
 static void
 remove_surface_image(WlEglDisplay *display,
                      WlEglSurface *surface,
@@ -1441,7 +2329,7 @@ remove_surface_image(WlEglDisplay *display,
 {
     WlEglStreamImage *image;
 
-    pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
     wl_list_for_each(image, &surface->ctx.streamImages, link) {
         /* Safe only because the iteration is aborted by a break statement */
@@ -1451,7 +2339,7 @@ remove_surface_image(WlEglDisplay *display,
         }
     }
 
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 }
 
 static WlEglStreamImage *
@@ -1487,6 +2375,59 @@ create_syncobj_timeline(WlEglDisplay *display, uint32_t *drmSyncobjHandleOut)
     return ret;
 }
 
+/*
+ * Sets up explicit sync for the surface if the compositor supports it: a
+ * per-surface wp_linux_drm_syncobj_surface_v1 and the acquire timeline. Must
+ * be called before create_surface_context(), since the stream images only
+ * get release timelines if the syncobj surface exists.
+ */
+static EGLint
+create_surface_syncobj(WlEglDisplay *display, WlEglSurface *surface)
+{
+    int drmSyncobjFd;
+
+    if (!display->wlDrmSyncobj) {
+        return EGL_SUCCESS;
+    }
+
+    /* Create a DRM timeline and share it with the compositor */
+    drmSyncobjFd = create_syncobj_timeline(display, &surface->drmSyncobjHandle);
+    if (drmSyncobjFd < 0) {
+        return EGL_BAD_ALLOC;
+    }
+
+    /* Get a per-surface explicit sync object, share our DRM syncobj with the compositor */
+    surface->wlSyncobjSurf =
+        wp_linux_drm_syncobj_manager_v1_get_surface(display->wlDrmSyncobj, surface->wlSurface);
+
+    surface->wlAcquireTimeline =
+        wp_linux_drm_syncobj_manager_v1_import_timeline(display->wlDrmSyncobj, drmSyncobjFd);
+    close(drmSyncobjFd);
+
+    if (!surface->wlSyncobjSurf || !surface->wlAcquireTimeline) {
+        return EGL_BAD_ALLOC;
+    }
+
+    return EGL_SUCCESS;
+}
+
+static void
+destroy_surface_syncobj(WlEglDisplay *display, WlEglSurface *surface)
+{
+    if (surface->wlSyncobjSurf) {
+        wp_linux_drm_syncobj_surface_v1_destroy(surface->wlSyncobjSurf);
+        surface->wlSyncobjSurf = NULL;
+    }
+    if (surface->wlAcquireTimeline) {
+        wp_linux_drm_syncobj_timeline_v1_destroy(surface->wlAcquireTimeline);
+        surface->wlAcquireTimeline = NULL;
+    }
+    if (surface->drmSyncobjHandle) {
+        drmSyncobjDestroy(display->drmFd, surface->drmSyncobjHandle);
+        surface->drmSyncobjHandle = 0;
+    }
+}
+
 static EGLint
 init_surface_image(WlEglDisplay *display, WlEglSurface *surface,
                    WlEglStreamImage    *image)
@@ -1546,7 +2487,9 @@ fail:
 }
 
 static EGLint
-add_surface_image(WlEglDisplay *display, WlEglSurface *surface)
+add_surface_image(WlEglDisplay *display,
+                  WlEglSurface *surface,
+                  EGLBoolean createBuffer)
 {
     WlEglStreamImage* const image = calloc(1, sizeof(*image));
     EGLint ret;
@@ -1561,13 +2504,189 @@ add_surface_image(WlEglDisplay *display, WlEglSurface *surface)
         return ret;
     }
 
-    pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+    /*
+     * The consumer thread creates the wl_buffer right away rather than when
+     * the image is first acquired, so the first frames after creating or
+     * resizing the surface don't pay for it in eglSwapBuffers(). Without the
+     * thread, images are added from the swap path itself and creating the
+     * buffer early would gain nothing. If this fails or is skipped, the
+     * buffer is created in acquire_surface_image().
+     */
+    if (createBuffer) {
+        create_surface_image_buffer(display, surface, image);
+    }
+
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
     wl_list_insert(&surface->ctx.streamImages, &image->link);
-    pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
     return EGL_SUCCESS;
 }
 
+/*
+ * How long the consumer thread blocks before checking for shutdown. This is
+ * only a backstop: finish_image_consumer_thread() wakes the thread up by
+ * disconnecting the producer.
+ */
+#define WL_EGL_CONSUMER_THREAD_TIMEOUT_NS 50000000
+
+static void
+publish_consumer_state(WlEglSurfaceCtx *ctx)
+{
+    __atomic_fetch_add(&ctx->consumerSeq, 1, __ATOMIC_RELEASE);
+    wlEglFutexWakeAll(&ctx->consumerSeq);
+}
+
+/*
+ * Handles the consumer side of a local stream in the background: images are
+ * created when they are added, acquired and turned into wl_buffers as soon as
+ * frames are available and destroyed when removed. The swap path then only
+ * needs to wait until the frame it produced has been acquired, see
+ * wait_image_consumer_thread().
+ */
+static void *
+image_consumer_thread(void *args)
+{
+    WlEglSurface      *surface = (WlEglSurface *)args;
+    WlEglSurfaceCtx   *ctx     = &surface->ctx;
+    WlEglDisplay      *display = surface->wlEglDpy;
+    EGLDisplay         dpy     = display->devDpy->eglDisplay;
+    WlEglPlatformData *data    = display->data;
+    EGLAttrib          aux;
+    EGLenum            event;
+    EGLuint64KHR       frame;
+    EGLint             err     = EGL_SUCCESS;
+    EGLint             ret;
+
+    while (!__atomic_load_n(&ctx->consumerShutdown, __ATOMIC_ACQUIRE)) {
+        ret = data->egl.queryStreamConsumerEvent(dpy,
+                                                 ctx->eglStream,
+                                                 WL_EGL_CONSUMER_THREAD_TIMEOUT_NS,
+                                                 &event,
+                                                 &aux);
+        if (ret == EGL_TIMEOUT_EXPIRED) {
+            continue;
+        } else if (ret != EGL_TRUE) {
+            /* XXX Pick the right error code */
+            err = EGL_BAD_SURFACE;
+            break;
+        }
+
+        switch (event) {
+        case EGL_STREAM_IMAGE_AVAILABLE_NV:
+            err = acquire_surface_image(display, surface);
+            if (err == EGL_SUCCESS &&
+                data->egl.queryStreamu64(dpy, ctx->eglStream,
+                                         EGL_CONSUMER_FRAME_KHR, &frame)) {
+                __atomic_store_n(&ctx->consumerFrame, frame, __ATOMIC_RELEASE);
+                publish_consumer_state(ctx);
+            }
+            break;
+        case EGL_STREAM_IMAGE_ADD_NV:
+            err = add_surface_image(display, surface, EGL_TRUE);
+            break;
+
+        case EGL_STREAM_IMAGE_REMOVE_NV:
+            remove_surface_image(display, surface, (EGLImageKHR)aux);
+            break;
+
+        default:
+            assert(!"Unhandled EGLImage stream consumer event");
+        }
+
+        if (err != EGL_SUCCESS) {
+            break;
+        }
+    }
+
+    ctx->consumerError = err;
+    __atomic_store_n(&ctx->consumerExited, 1, __ATOMIC_RELEASE);
+    publish_consumer_state(ctx);
+
+    data->egl.releaseThread();
+
+    return NULL;
+}
+
+/*
+ * Starts the consumer thread if __NV_WAYLAND_CONSUMER_THREAD=1. Failing to
+ * start it is not an error, the swap path then handles the events itself.
+ * The swap path waits for the thread on a futex, so it is Linux only.
+ */
+static void
+setup_image_consumer_thread(WlEglSurface *surface)
+{
+#if defined(__linux__)
+    const char *str = getenv("__NV_WAYLAND_CONSUMER_THREAD");
+#else
+    const char *str = NULL;
+#endif
+
+    if (!str || strcmp(str, "1")) {
+        return;
+    }
+
+    surface->ctx.consumerShutdown = 0;
+    surface->ctx.consumerExited = 0;
+    surface->ctx.consumerError = EGL_SUCCESS;
+    surface->ctx.consumerFrame = 0;
+
+    if (wlEglCreateHelperThread(&surface->ctx.consumerThreadId, "consumer",
+                                image_consumer_thread, surface)) {
+        surface->ctx.consumerThreadId = (pthread_t)0;
+    }
+}
+
+/*
+ * Stops the consumer thread. The producer surface is destroyed first so the
+ * stream gets disconnected and queryStreamConsumerEvent() returns right away
+ * instead of running into its timeout. ctx->eglSurface is reset accordingly.
+ */
+static void
+finish_image_consumer_thread(WlEglSurface *surface, WlEglSurfaceCtx *ctx)
+{
+    WlEglDisplay *display = surface->wlEglDpy;
+
+    if (ctx->consumerThreadId != (pthread_t)0) {
+        __atomic_store_n(&ctx->consumerShutdown, 1, __ATOMIC_RELEASE);
+        if (ctx->eglSurface != EGL_NO_SURFACE) {
+            display->data->egl.destroySurface(display->devDpy->eglDisplay,
+                                              ctx->eglSurface);
+            ctx->eglSurface = EGL_NO_SURFACE;
+        }
+        pthread_join(ctx->consumerThreadId, NULL);
+        ctx->consumerThreadId = (pthread_t)0;
+    }
+}
+
+static EGLint
+wait_image_consumer_thread(WlEglSurface *surface)
+{
+    WlEglSurfaceCtx   *ctx     = &surface->ctx;
+    WlEglDisplay      *display = surface->wlEglDpy;
+    EGLuint64KHR       producerFrame;
+    uint32_t           seq;
+
+    if (!display->data->egl.queryStreamu64(display->devDpy->eglDisplay,
+                                           ctx->eglStream,
+                                           EGL_PRODUCER_FRAME_KHR,
+                                           &producerFrame)) {
+        return EGL_BAD_SURFACE;
+    }
+
+    while (1) {
+        seq = __atomic_load_n(&ctx->consumerSeq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ctx->consumerExited, __ATOMIC_ACQUIRE)) {
+            return ctx->consumerError != EGL_SUCCESS ?
+                   ctx->consumerError : EGL_BAD_SURFACE;
+        }
+        if (__atomic_load_n(&ctx->consumerFrame, __ATOMIC_ACQUIRE) >= producerFrame) {
+            return EGL_SUCCESS;
+        }
+        wlEglFutexWait(&ctx->consumerSeq, seq, -1);
+    }
+}
+
 EGLint wlEglHandleImageStreamEvents(WlEglSurface *surface)
 {
     WlEglDisplay         *display = surface->wlEglDpy;
@@ -1583,6 +2702,10 @@ EGLint wlEglHandleImageStreamEvents(WlEglSurface *surface)
         return err;
     }
 
+    if (surface->ctx.consumerThreadId) {
+        return wait_image_consumer_thread(surface);
+    }
+
     while (1) {
         /*
          * With explicit sync we should block here and not return until we have
@@ -1615,7 +2738,7 @@ EGLint wlEglHandleImageStreamEvents(WlEglSurface *surface)
             timeout = 0;
             break;
         case EGL_STREAM_IMAGE_ADD_NV:
-            err = add_surface_image(display, surface);
+            err = add_surface_image(display, surface, EGL_FALSE);
             break;
 
         case EGL_STREAM_IMAGE_REMOVE_NV:
@@ -1713,6 +2836,246 @@ static uint32_t ConfigToDrmFourCC(WlEglDisplay* display, EGLConfig config)
     }
 }
 
+static const WlEglDmaBufFormat *
+get_dmabuf_format(const WlEglDmaBufFormatSet *formatSet, uint32_t format)
+{
+    if (formatSet) {
+        for (int i = 0; i < (int)formatSet->numFormats; i++) {
+            if (formatSet->dmaBufFormats[i].format == format) {
+                return &formatSet->dmaBufFormats[i];
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Allocates an array for count modifiers followed by room for the sort keys
+ * of rank_modifiers(), so ranking doesn't need an allocation of its own.
+ */
+static uint64_t *
+alloc_modifier_array(size_t count)
+{
+    return malloc(count * (sizeof(uint64_t) + sizeof(int)));
+}
+
+/*
+ * Builds the union of the modifiers the compositor accepts for format on the
+ * render device and on its main device. With PRIME render offload, buffers
+ * from either list can be imported by the compositor, so this gives the
+ * driver the best chance of finding a tiled layout it can share instead of
+ * being limited to one of them. Returns NULL if there is nothing to merge,
+ * otherwise the caller must free the array.
+ */
+static uint64_t *
+get_prime_modifiers(const WlEglDmaBufFormatSet *renderSet,
+                    const WlEglDmaBufFormatSet *mainSet,
+                    uint32_t format,
+                    EGLint *numModifiersOut)
+{
+    const WlEglDmaBufFormat *renderFormat = get_dmabuf_format(renderSet, format);
+    const WlEglDmaBufFormat *mainFormat = get_dmabuf_format(mainSet, format);
+    uint64_t *modifiers;
+    EGLint numModifiers;
+
+    if (!renderFormat || !mainFormat || renderFormat == mainFormat) {
+        return NULL;
+    }
+
+    modifiers = alloc_modifier_array(renderFormat->numModifiers +
+                                     mainFormat->numModifiers);
+    if (!modifiers) {
+        return NULL;
+    }
+
+    memcpy(modifiers, renderFormat->modifiers,
+           renderFormat->numModifiers * sizeof(*modifiers));
+    numModifiers = renderFormat->numModifiers;
+
+    for (int i = 0; i < (int)mainFormat->numModifiers; i++) {
+        int j;
+
+        for (j = 0; j < (int)renderFormat->numModifiers; j++) {
+            if (renderFormat->modifiers[j] == mainFormat->modifiers[i]) {
+                break;
+            }
+        }
+        if (j == (int)renderFormat->numModifiers) {
+            modifiers[numModifiers++] = mainFormat->modifiers[i];
+        }
+    }
+
+    *numModifiersOut = numModifiers;
+    return modifiers;
+}
+
+/*
+ * Returns the position of modifier in the __NV_WAYLAND_MODIFIER_ORDER list
+ * that applies to dev, or -1 if it isn't listed. The variable holds
+ * ';'-separated lists of ','-separated modifiers. A list may be prefixed
+ * with "<major>:<minor>=" to only apply to that DRM device, the first list
+ * matching the device is used.
+ */
+static int
+get_modifier_override(const char *str, dev_t dev, uint64_t modifier)
+{
+    while (str && *str) {
+        const char *end = strchr(str, ';');
+        const char *eq = strchr(str, '=');
+        char *next;
+        int index = 0;
+
+        if (!end) {
+            end = str + strlen(str);
+        }
+
+        if (eq && eq < end) {
+            unsigned long devMajor = strtoul(str, &next, 10);
+            unsigned long devMinor = (*next == ':') ?
+                                     strtoul(next + 1, &next, 10) : ~0ul;
+
+            if (devMajor != major(dev) || devMinor != minor(dev)) {
+                str = *end ? end + 1 : end;
+                continue;
+            }
+            str = eq + 1;
+        }
+
+        while (str < end) {
+            uint64_t listed = strtoull(str, &next, 0);
+
+            if (next == str) {
+                break;
+            }
+            if (listed == modifier) {
+                return index;
+            }
+            index++;
+            str = (*next == ',') ? next + 1 : next;
+        }
+
+        return -1;
+    }
+
+    return -1;
+}
+
+/*
+ * Lower is better. Compressed layouts need the least memory bandwidth, then
+ * uncompressed block-linear, then layouts we know nothing about, and linear
+ * is the most expensive. Compression can't be shared with another GPU, so
+ * when rendering for a different device compressed layouts are only
+ * preferred over linear ones.
+ */
+static int
+get_modifier_bandwidth_rank(uint64_t modifier, EGLBoolean crossDevice)
+{
+    if (modifier == DRM_FORMAT_MOD_LINEAR) {
+        return 3;
+    }
+
+    if ((modifier >> 56) == DRM_FORMAT_MOD_VENDOR_NVIDIA &&
+        (modifier & 0x10)) {
+        /* Bits 23:25 of NVIDIA block-linear modifiers are the compression type */
+        if ((modifier >> 23) & 0x7) {
+            return crossDevice ? 2 : 0;
+        }
+        return 1;
+    }
+
+    return 2;
+}
+
+static EGLBoolean
+is_scanout_modifier(const WlEglDmaBufFeedback *feedback,
+                    uint32_t format,
+                    uint64_t modifier)
+{
+    if (!feedback) {
+        return EGL_FALSE;
+    }
+
+    for (int i = 0; i < feedback->numTranches; i++) {
+        const WlEglDmaBufFormat *dmaBufFormat;
+
+        if (!feedback->tranches[i].supportsScanout) {
+            continue;
+        }
+
+        dmaBufFormat = get_dmabuf_format(&feedback->tranches[i].formatSet, format);
+        if (!dmaBufFormat) {
+            continue;
+        }
+
+        for (int j = 0; j < (int)dmaBufFormat->numModifiers; j++) {
+            if (dmaBufFormat->modifiers[j] == modifier) {
+                return EGL_TRUE;
+            }
+        }
+    }
+
+    return EGL_FALSE;
+}
+
+/*
+ * Sorts the modifiers so the driver picks the cheapest layout the compositor
+ * can import: modifiers listed in __NV_WAYLAND_MODIFIER_ORDER first, then by
+ * get_modifier_bandwidth_rank(), preferring modifiers the compositor can scan
+ * out within the same rank. Otherwise the compositor's order is kept. The
+ * modifiers must come from alloc_modifier_array().
+ */
+static void
+rank_modifiers(WlEglDisplay *display,
+               const WlEglDmaBufFeedback *feedback,
+               uint32_t format,
+               uint64_t *modifiers,
+               EGLint numModifiers)
+{
+    const char *overrides = getenv("__NV_WAYLAND_MODIFIER_ORDER");
+    int        *keys      = (int *)(modifiers + numModifiers);
+
+    for (int i = 0; i < numModifiers; i++) {
+        int override = get_modifier_override(overrides,
+                                             display->devDpy->dev,
+                                             modifiers[i]);
+
+        if (override >= 0) {
+            keys[i] = override - numModifiers;
+        } else {
+            keys[i] = get_modifier_bandwidth_rank(modifiers[i],
+                                                  display->primeRenderOffload) * 2 +
+                      !is_scanout_modifier(feedback, format, modifiers[i]);
+        }
+    }
+
+    /* Insertion sort, which is stable and the lists are short */
+    for (int i = 1; i < numModifiers; i++) {
+        uint64_t modifier = modifiers[i];
+        int key = keys[i];
+        int j;
+
+        for (j = i; j > 0 && keys[j - 1] > key; j--) {
+            modifiers[j] = modifiers[j - 1];
+            keys[j] = keys[j - 1];
+        }
+        modifiers[j] = modifier;
+        keys[j] = key;
+    }
+}
+
+static EGLBoolean
+has_linear_modifier(const uint64_t *modifiers, EGLint numModifiers)
+{
+    for (int i = 0; i < numModifiers; i++) {
+        if (modifiers[i] == DRM_FORMAT_MOD_LINEAR) {
+            return EGL_TRUE;
+        }
+    }
+
+    return EGL_FALSE;
+}
+
 static EGLint create_surface_stream_local(WlEglSurface *surface)
 {
     WlEglDisplay         *display = surface->wlEglDpy;
@@ -1726,9 +3089,13 @@ static EGLint create_surface_stream_local(WlEglSurface *surface)
     EGLint err = EGL_SUCCESS;
     EGLint numModifiers = 0;
     EGLuint64KHR *modifiers = NULL;
+    uint64_t *sortedModifiers = NULL;
+    const uint64_t linearModifier = DRM_FORMAT_MOD_LINEAR;
     uint32_t format;
     WlEglDmaBufFormatSet *formatSet = NULL;
+    WlEglDmaBufFormatSet *mainFormatSet = NULL;
     WlEglDmaBufFeedback *feedback = NULL;
+    const WlEglDmaBufFormat *dmaBufFormat;
 
     /*
      * Vulkan surfaces will not have an eglConfig set. We will need to address them
@@ -1768,24 +3135,39 @@ static EGLint create_surface_stream_local(WlEglSurface *surface)
             }
 
             /*
-             * If we could not find any modifiers for this device, and if we are
-             * in a prime setup, use the main device's format set. This will allow
-             * us to check if the main device supports the linear modifier.
+             * In a prime setup, also look at the main device's format set. If
+             * we could not find any modifiers for this device we use it as is,
+             * which will allow us to check if the main device supports the
+             * linear modifier. Otherwise both lists are merged below.
              */
-            if (!formatSet && display->primeRenderOffload) {
-                formatSet = WlEglGetFormatSetForDev(feedback, feedback->mainDev, format);
+            if (display->primeRenderOffload) {
+                mainFormatSet = WlEglGetFormatSetForDev(feedback, feedback->mainDev, format);
+                if (!formatSet) {
+                    formatSet = mainFormatSet;
+                }
             }
         }
 
         /* grab the modifier array */
-        if (formatSet) {
-            for (int i = 0; i < (int)formatSet->numFormats; i++) {
-                if (formatSet->dmaBufFormats[i].format == format) {
-                    modifiers = formatSet->dmaBufFormats[i].modifiers;
-                    numModifiers = formatSet->dmaBufFormats[i].numModifiers;
-                    break;
-                }
+        sortedModifiers = get_prime_modifiers(formatSet, mainFormatSet, format,
+                                              &numModifiers);
+        if (!sortedModifiers &&
+            (dmaBufFormat = get_dmabuf_format(formatSet, format)) &&
+            dmaBufFormat->numModifiers > 0) {
+            sortedModifiers = alloc_modifier_array(dmaBufFormat->numModifiers);
+            if (!sortedModifiers) {
+                err = EGL_BAD_ALLOC;
+                goto fail;
             }
+            memcpy(sortedModifiers, dmaBufFormat->modifiers,
+                   dmaBufFormat->numModifiers * sizeof(*sortedModifiers));
+            numModifiers = dmaBufFormat->numModifiers;
+        }
+
+        if (sortedModifiers) {
+            rank_modifiers(display, feedback, format,
+                           sortedModifiers, numModifiers);
+            modifiers = sortedModifiers;
         }
     }
 
@@ -1818,9 +3200,39 @@ static EGLint create_surface_stream_local(WlEglSurface *surface)
                                               modifiers,
                                               NULL)) {
         err = data->egl.getError();
-        goto fail;
+
+        /*
+         * With PRIME render offload the driver may not be able to render to
+         * any of the shared layouts. If the compositor takes linear buffers,
+         * ask for those alone, the driver then renders in its own tiled
+         * layout and copies each frame into the linear buffer on present.
+         */
+        if (!display->primeRenderOffload || numModifiers <= 1 ||
+            !has_linear_modifier(modifiers, numModifiers)) {
+            goto fail;
+        }
+
+        data->egl.destroyStream(dpy, surface->ctx.eglStream);
+        surface->ctx.eglStream = data->egl.createStream(dpy, eglAttribs);
+        if (surface->ctx.eglStream == EGL_NO_STREAM_KHR) {
+            err = data->egl.getError();
+            goto fail;
+        }
+
+        if (!data->egl.streamImageConsumerConnect(dpy,
+                                                  surface->ctx.eglStream,
+                                                  1,
+                                                  (EGLuint64KHR *)&linearModifier,
+                                                  NULL)) {
+            err = data->egl.getError();
+            goto fail;
+        }
+        err = EGL_SUCCESS;
     }
 
+    free(sortedModifiers);
+    sortedModifiers = NULL;
+
     wl_list_init(&surface->ctx.acquiredImages);
 
     /*
@@ -1848,6 +3260,7 @@ static EGLint create_surface_stream_local(WlEglSurface *surface)
     return EGL_SUCCESS;
 
 fail:
+    free(sortedModifiers);
     destroy_surface_context(surface, &surface->ctx);
     return err;
 }
@@ -1910,6 +3323,8 @@ create_surface_context(WlEglSurface *surface)
     struct wl_egl_window  *window      = surface->wlEglWin;
     int                    winWidth    = 0;
     int                    winHeight   = 0;
+    int                    bufWidth    = 0;
+    int                    bufHeight   = 0;
     int                    winDx       = 0;
     int                    winDy       = 0;
     EGLint                 synchronous = EGL_FALSE;
@@ -1923,10 +3338,11 @@ create_surface_context(WlEglSurface *surface)
         winHeight = window->height;
         winDx     = window->dx;
         winDy     = window->dy;
+        get_render_size(surface, winWidth, winHeight, &bufWidth, &bufHeight);
 
         /* Width and height are the first and second attributes respectively */
-        surface->attribs[1] = winWidth;
-        surface->attribs[3] = winHeight;
+        surface->attribs[1] = bufWidth;
+        surface->attribs[3] = bufHeight;
     } else {
         winWidth  = surface->width;
         winHeight = surface->height;
@@ -1940,6 +3356,17 @@ create_surface_context(WlEglSurface *surface)
         goto fail;
     }
 
+    /*
+     * A wl_eglstream is not a dmabuf, so compositors reject acquire and
+     * release points for it, and commits without them are protocol errors
+     * once a syncobj surface exists. Frames are already synchronized by the
+     * EGLStream itself, so drop explicit sync, which also lets the damage
+     * thread below be used again.
+     */
+    if (surface->ctx.wlStreamResource && surface->wlSyncobjSurf) {
+        destroy_surface_syncobj(display, surface);
+    }
+
     /* If the stream has a server component, attach the wl_eglstream so the
      * compositor connects a consumer to the EGLStream */
     if (surface->ctx.wlStreamResource) {
@@ -2037,98 +3464,404 @@ create_surface_context(WlEglSurface *surface)
         }
     }
 
-    /* Cache current window size and displacement for future checks */
-    if (surface->isSurfaceProducer) {
-        surface->width = winWidth;
-        surface->height = winHeight;
-        surface->dx = winDx;
-        surface->dy = winDy;
-        window->attached_width = winWidth;
-        window->attached_height = winHeight;
-    }
+    /* Cache current window size and displacement for future checks */
+    if (surface->isSurfaceProducer) {
+        surface->width = bufWidth;
+        surface->height = bufHeight;
+        surface->windowWidth = winWidth;
+        surface->windowHeight = winHeight;
+        surface->dx = winDx;
+        surface->dy = winDy;
+        window->attached_width = winWidth;
+        window->attached_height = winHeight;
+        update_surface_viewport(surface);
+    }
+
+    /*
+     * Started last: the thread creates wl_buffers as soon as the stream adds
+     * images, and those must use the buffer size set above.
+     */
+    if (!surface->ctx.wlStreamResource) {
+        setup_image_consumer_thread(surface);
+    }
+
+    return EGL_SUCCESS;
+
+fail:
+    destroy_surface_context(surface, &surface->ctx);
+    finish_wl_buffer_release_thread(surface);
+    return err;
+}
+
+WL_EXPORT
+EGLStreamKHR wlEglGetSurfaceStreamExport(WlEglSurface *surface)
+{
+    if (!surface)
+        return EGL_NO_STREAM_KHR;
+
+    return surface->ctx.eglStream;
+}
+
+WL_EXPORT
+int wlEglWaitAllPresentationFeedbacksExport(WlEglSurface *surface)
+{
+    int numberOfPresentEvents = 0;
+
+    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    // Destroy all presentation feedback objects in flight
+    if (display->wpPresentation) {
+        assert(surface->landedPresentFeedbackCount == 0);
+
+        while (surface->inFlightPresentFeedbackCount > 0) {
+            const int ret = wl_display_dispatch_queue(display->nativeDpy, surface->presentFeedbackQueue);
+            if (ret < 0) {
+                wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+                wlEglReleaseDisplay(display);
+
+                return ret;
+            }
+        }
+    }
+
+    assert(surface->inFlightPresentFeedbackCount == 0);
+
+    numberOfPresentEvents = surface->landedPresentFeedbackCount;
+    surface->landedPresentFeedbackCount = 0;
+
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+    wlEglReleaseDisplay(display);
+
+    return numberOfPresentEvents;
+}
+
+WL_EXPORT
+int wlEglProcessPresentationFeedbacksExport(WlEglSurface *surface)
+{
+    int numberOfPresentEvents = 0;
+
+    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    if (display->wpPresentation) {
+        int ret = 0;
+
+        assert(surface->landedPresentFeedbackCount == 0);
+        ret = wl_display_dispatch_queue_pending(display->nativeDpy,
+                                                surface->presentFeedbackQueue);
+        if (ret < 0) {
+            wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+            wlEglReleaseDisplay(display);
+
+            return ret;
+        }
+    }
+
+    numberOfPresentEvents = surface->landedPresentFeedbackCount;
+    surface->landedPresentFeedbackCount = 0;
+
+    assert(surface->inFlightPresentFeedbackCount >= 0);
+
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+    wlEglReleaseDisplay(display);
+
+    return numberOfPresentEvents;
+}
+
+static void
+summarizeLatency(WlEglLatencySummary *summary, const WlEglHistogram *hist)
+{
+    WlEglHistogram snapshot;
+
+    wlEglHistogramSnapshot(&snapshot, hist);
+
+    summary->count   = snapshot.count;
+    summary->totalNs = snapshot.sum;
+    summary->p50Ns   = wlEglHistogramPercentile(&snapshot, 0.50);
+    summary->p99Ns   = wlEglHistogramPercentile(&snapshot, 0.99);
+    summary->maxNs   = snapshot.max;
+}
+
+WL_EXPORT
+int wlEglQuerySurfaceCountersExport(WlEglSurface *surface,
+                                    WlEglSurfaceCounters *counters,
+                                    size_t size)
+{
+    WlEglSurfaceCounters snapshot;
+    WlEglStreamImage    *image;
+    WlEglDisplay        *display;
+
+    if (!surface || !counters) {
+        return -1;
+    }
+
+    display = wlEglAcquireSurfaceDisplay(surface);
+    if (!display) {
+        return -1;
+    }
+
+    memset(&snapshot, 0, sizeof(snapshot));
+
+    snapshot.framesPresented =
+        WL_EGL_COUNTER_READ(surface->counters.framesPresented);
+    snapshot.framesDropped =
+        WL_EGL_COUNTER_READ(surface->counters.framesDropped);
+    snapshot.reallocsResize =
+        WL_EGL_COUNTER_READ(surface->counters.reallocsResize);
+    snapshot.reallocsFeedback =
+        WL_EGL_COUNTER_READ(surface->counters.reallocsFeedback);
+    snapshot.explicitSyncIoctls =
+        WL_EGL_COUNTER_READ(surface->counters.explicitSyncIoctls);
+
+    summarizeLatency(&snapshot.frameCallbackWait,
+                     &surface->counters.frameCallbackWait);
+    summarizeLatency(&snapshot.releaseWait, &surface->counters.releaseWait);
+    summarizeLatency(&snapshot.roundtrip, &surface->counters.roundtrip);
+    snapshot.reallocsSkipped =
+        WL_EGL_COUNTER_READ(surface->counters.reallocsSkipped);
+    summarizeLatency(&snapshot.realloc, &surface->counters.realloc);
+    snapshot.reallocsTrim =
+        WL_EGL_COUNTER_READ(surface->counters.reallocsTrim);
+    snapshot.buffersTrimmed =
+        WL_EGL_COUNTER_READ(surface->counters.buffersTrimmed);
+
+    /*
+     * With explicit sync the compositor holds a buffer until its release
+     * point is signaled, otherwise until wl_buffer.release. The context is
+     * only looked at under streamImagesMutex, as a reallocation replaces it.
+     */
+    wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+    if (!surface->ctx.isOffscreen && !surface->ctx.wlStreamResource) {
+        wl_list_for_each(image, &surface->ctx.streamImages, link) {
+            if (surface->wlSyncobjSurf ? image->releasePending : image->attached) {
+                snapshot.buffersHeld++;
+            }
+        }
+    }
+    wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
+
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+    wlEglReleaseDisplay(display);
 
-    return EGL_SUCCESS;
+    memcpy(counters, &snapshot, size < sizeof(snapshot) ? size : sizeof(snapshot));
 
-fail:
-    destroy_surface_context(surface, &surface->ctx);
-    finish_wl_buffer_release_thread(surface);
-    return err;
+    return 0;
 }
 
 WL_EXPORT
-EGLStreamKHR wlEglGetSurfaceStreamExport(WlEglSurface *surface)
+int wlEglGetSurfaceReadyFdExport(WlEglSurface *surface)
 {
-    if (!surface)
-        return EGL_NO_STREAM_KHR;
-
-    return surface->ctx.eglStream;
-}
+    WlEglDisplay *display;
+    int           fd;
 
-WL_EXPORT
-int wlEglWaitAllPresentationFeedbacksExport(WlEglSurface *surface)
-{
-    int numberOfPresentEvents = 0;
+    if (!surface) {
+        return -1;
+    }
 
-    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
-    pthread_mutex_lock(&surface->mutexLock);
+    display = wlEglAcquireSurfaceDisplay(surface);
+    if (!display) {
+        return -1;
+    }
+    if (surface->ctx.isOffscreen || !wlEglSurfaceRef(display, surface)) {
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+        wlEglReleaseDisplay(display);
+        return -1;
+    }
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
-    // Destroy all presentation feedback objects in flight
-    if (display->wpPresentation) {
-        assert(surface->landedPresentFeedbackCount == 0);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
-        while (surface->inFlightPresentFeedbackCount > 0) {
-            const int ret = wl_display_dispatch_queue(display->nativeDpy, surface->presentFeedbackQueue);
-            if (ret < 0) {
-                pthread_mutex_unlock(&surface->mutexLock);
-                wlEglReleaseDisplay(display);
+    fd = -1;
+    if (surface->isDestroyed) {
+        goto done;
+    }
 
-                return ret;
+    fd = surface->readyFd;
+    if (fd < 0) {
+        fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd >= 0) {
+            __atomic_store_n(&surface->readyFd, fd, __ATOMIC_RELEASE);
+            if (setup_ready_fd_thread(surface) != EGL_SUCCESS) {
+                __atomic_store_n(&surface->readyFd, -1, __ATOMIC_RELEASE);
+                close(fd);
+                fd = -1;
+            } else {
+                /* Let the caller check the current state first */
+                wlEglSignalSurfaceReady(surface);
             }
         }
     }
 
-    assert(surface->inFlightPresentFeedbackCount == 0);
-
-    numberOfPresentEvents = surface->landedPresentFeedbackCount;
-    surface->landedPresentFeedbackCount = 0;
+done:
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+    wlEglSurfaceUnref(surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
-    return numberOfPresentEvents;
+    return fd;
 }
 
-WL_EXPORT
-int wlEglProcessPresentationFeedbacksExport(WlEglSurface *surface)
+/*
+ * The driver only frees stream images along with their stream, and replacing
+ * the stream also replaces the surface's producer surface. Like resizes, that
+ * needs the surface to be current on the calling thread.
+ */
+static EGLBoolean
+can_trim_surface_stream(WlEglPlatformData *data, WlEglSurface *surface)
 {
-    int numberOfPresentEvents = 0;
+    return surface->isSurfaceProducer &&
+           wlEglIsWaylandWindowValid(surface->wlEglWin) &&
+           (surface == data->egl.getCurrentSurface(EGL_DRAW) ||
+            surface == data->egl.getCurrentSurface(EGL_READ));
+}
 
-    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
-    pthread_mutex_lock(&surface->mutexLock);
+/*
+ * Gives the stream images back to the driver by reallocating the stream. The
+ * new stream starts out empty and the driver allocates images for it as they
+ * are rendered to, so a surface that stays idle holds one. Images the
+ * compositor still holds are freed once it releases them. Whatever was
+ * rendered and not yet swapped is lost. Must be called with the surface lock
+ * held.
+ */
+static void
+trim_surface_stream(WlEglDisplay *display, WlEglSurface *surface)
+{
+    WL_EGL_COUNTER_ADD(surface->counters.reallocsTrim, 1);
+    surface->trimmed = EGL_TRUE;
+    wlEglReallocSurface(display, display->data, surface);
+}
 
-    if (display->wpPresentation) {
-        int ret = 0;
+/*
+ * Called by wlEglWaitFrameSync() when the frame callback is trimIdleMs late.
+ * The wl_buffers the compositor doesn't hold are always released. The stream
+ * is trimmed too, once per occlusion, if the swap comes from the thread the
+ * surface is current on; the frame being swapped is then dropped, which the
+ * return value tells. The compositor keeps showing the previous one.
+ */
+static EGLBoolean
+trim_occluded_surface(WlEglSurface *surface)
+{
+    WlEglDisplay *display = surface->wlEglDpy;
 
-        assert(surface->landedPresentFeedbackCount == 0);
-        ret = wl_display_dispatch_queue_pending(display->nativeDpy,
-                                                surface->presentFeedbackQueue);
-        if (ret < 0) {
-            pthread_mutex_unlock(&surface->mutexLock);
-            wlEglReleaseDisplay(display);
+    trim_surface_image_buffers(surface);
 
-            return ret;
+    if (surface->trimmed ||
+        !can_trim_surface_stream(display->data, surface)) {
+        return EGL_FALSE;
+    }
+
+    trim_surface_stream(display, surface);
+    surface->trimDroppedFrame = EGL_TRUE;
+
+    return EGL_TRUE;
+}
+
+void wlEglTrimSurfaceAfterSwap(WlEglDisplay *display, WlEglSurface *surface,
+                               EGLBoolean idle)
+{
+    /*
+     * A surface that swaps after being idle is likely to go idle again, and
+     * doesn't need the images a steady stream of frames made the driver
+     * allocate. It is trimmed once, until it presents steadily again: an
+     * occluded surface the compositor still sends the odd frame callback to
+     * isn't trimmed on every frame.
+     */
+    if (surface->trimPending || (idle && !surface->trimmed)) {
+        if (can_trim_surface_stream(display->data, surface)) {
+            trim_surface_stream(display, surface);
         }
+    } else if (!idle) {
+        surface->trimmed = EGL_FALSE;
     }
+}
 
-    numberOfPresentEvents = surface->landedPresentFeedbackCount;
-    surface->landedPresentFeedbackCount = 0;
+WL_EXPORT
+int wlEglTrimSurfaceExport(WlEglSurface *surface)
+{
+    WlEglDisplay *display;
+    int           count;
 
-    assert(surface->inFlightPresentFeedbackCount >= 0);
+    if (!surface) {
+        return -1;
+    }
+
+    display = wlEglAcquireSurfaceDisplay(surface);
+    if (!display) {
+        return -1;
+    }
+    if (!wlEglSurfaceRef(display, surface)) {
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+        wlEglReleaseDisplay(display);
+        return -1;
+    }
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    count = -1;
+    if (surface->isDestroyed) {
+        goto done;
+    }
+
+    count = trim_surface_image_buffers(surface);
+
+    if (can_trim_surface_stream(display->data, surface)) {
+        trim_surface_stream(display, surface);
+    } else if (surface->isSurfaceProducer) {
+        /* Left to the end of the next swap, after its frame is committed */
+        surface->trimPending = EGL_TRUE;
+    }
 
-    pthread_mutex_unlock(&surface->mutexLock);
+done:
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+    wlEglSurfaceUnref(surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
-    return numberOfPresentEvents;
+    return count;
+}
+
+/*
+ * Milliseconds a frame callback may be late, or two swaps apart, before the
+ * surface is considered idle and trimmed, from __NV_WAYLAND_TRIM_IDLE_MS. 0
+ * disables it.
+ */
+static uint32_t
+get_trim_idle_ms(void)
+{
+    const char *str = getenv("__NV_WAYLAND_TRIM_IDLE_MS");
+    long        value;
+
+    if (!str || !str[0]) {
+        return 0;
+    }
+
+    value = strtol(str, NULL, 10);
+    return value > 0 ? (uint32_t)value : 0;
+}
+
+static bool
+wlEglInitializeSurfaceCommon(WlEglDisplay *display,
+                             WlEglSurface *surface,
+                             EGLConfig config)
+{
+    surface->wlEglDpy = display;
+    surface->eglConfig = config;
+    surface->syncPoint = 1;
+    surface->refCount = 1;
+    surface->isDestroyed = EGL_FALSE;
+    surface->trimIdleMs = get_trim_idle_ms();
+    init_old_context_limits(surface);
+    surface->readyFd = -1;
+    wl_list_init(&surface->ctx.streamImages);
+    wl_list_init(&surface->oldCtxList);
+
+    return wlEglInitializeMutex(&surface->ctx.streamImagesMutex);
 }
 
 WL_EXPORT
@@ -2145,14 +3878,18 @@ WlEglSurface *wlEglCreateSurfaceExport(EGLDisplay dpy,
         return NULL;
     }
 
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     surface = calloc(1, sizeof (*surface));
     if (!surface) {
         goto fail;
     }
 
-    surface->wlEglDpy = display;
+    /* Vulkan surfaces have no EGLConfig */
+    if (!wlEglInitializeSurfaceCommon(display, surface, NULL)) {
+        goto fail;
+    }
+
     surface->width = width;
     surface->height = height;
     surface->wlSurface = native_surface;
@@ -2167,25 +3904,26 @@ WlEglSurface *wlEglCreateSurfaceExport(EGLDisplay dpy,
         surface->presentFeedbackQueue = wl_display_create_queue(display->nativeDpy);
     }
 
-    surface->refCount = 1;
-
     if (!wlEglInitializeMutex(&surface->mutexLock)) {
         goto fail;
     }
 
     if (!wlEglInitializeMutex(&surface->mutexFrameSync)) {
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_FALSE;
     }
 
     if (pthread_cond_init(&surface->condFrameSync, NULL)) {
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         wlEglReleaseDisplay(display);
         return EGL_FALSE;
     }
 
-    if (create_surface_context(surface) != EGL_SUCCESS) {
+    /* Explicit sync works the same as for EGL window surfaces */
+    if (create_surface_syncobj(display, surface) != EGL_SUCCESS ||
+        create_surface_context(surface) != EGL_SUCCESS) {
+        destroy_surface_syncobj(display, surface);
         wl_event_queue_destroy(surface->wlEventQueue);
         if (surface->presentFeedbackQueue) {
             wl_event_queue_destroy(surface->presentFeedbackQueue);
@@ -2193,8 +3931,7 @@ WlEglSurface *wlEglCreateSurfaceExport(EGLDisplay dpy,
         goto fail;
     }
 
-    wl_list_insert(&display->wlEglSurfaceList, &surface->link);
-    wl_list_init(&surface->oldCtxList);
+    wlEglAddSurfaceToDisplay(display, surface);
 
     if (surface->ctx.wlStreamResource) {
         /* Set client's pendingSwapIntervalUpdate for updating client's
@@ -2203,12 +3940,12 @@ WlEglSurface *wlEglCreateSurfaceExport(EGLDisplay dpy,
         surface->pendingSwapIntervalUpdate = EGL_TRUE;
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     return surface;
 
 fail:
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     free(surface);
     return NULL;
@@ -2248,6 +3985,9 @@ void
 wlEglReallocSurface(WlEglDisplay *display, WlEglPlatformData *pData, WlEglSurface *surface)
 {
     EGLint err = EGL_SUCCESS;
+    uint64_t start = wlEglGetTimeNs();
+
+    WL_EGL_TRACE(realloc_begin, surface, wlEglSurfaceFrameNumber(surface));
 
     // If a damage thread is in use, wait for it to finish processing all
     //   pending frames
@@ -2255,6 +3995,7 @@ wlEglReallocSurface(WlEglDisplay *display, WlEglPlatformData *pData, WlEglSurfac
 
     discard_surface_context(surface);
     surface->isResized = EGL_FALSE;
+    surface->trimPending = EGL_FALSE;
     surface->ctx.wlStreamResource = NULL;
     surface->ctx.isAttached = EGL_FALSE;
     surface->ctx.eglSurface = EGL_NO_SURFACE;
@@ -2281,6 +4022,61 @@ wlEglReallocSurface(WlEglDisplay *display, WlEglPlatformData *pData, WlEglSurfac
             surface->pendingSwapIntervalUpdate = EGL_TRUE;
         }
     }
+
+    wlEglHistogramAddAtomic(&surface->counters.realloc,
+                            wlEglGetTimeNs() - start);
+    WL_EGL_TRACE(realloc_end, surface,
+                 WL_EGL_TRACE_SIZE(surface->windowWidth, surface->windowHeight));
+}
+
+/*
+ * Reallocates the stream if the window size or render size changed, or
+ * defers that to the next swap if the surface is not current. Must be called
+ * with the surface lock held.
+ */
+static void
+update_surface_size(WlEglDisplay *display,
+                    WlEglPlatformData *pData,
+                    WlEglSurface *surface)
+{
+    struct wl_egl_window *window = surface->wlEglWin;
+    int                   width;
+    int                   height;
+
+    get_render_size(surface, window->width, window->height, &width, &height);
+
+    /*
+     * Resize stream only if the buffer size has changed. The displacement is
+     * only passed to wl_surface.attach and the window size only to the
+     * viewport, so a resize that just moves the surface, changes the window
+     * size of a surface with a fixed render size, or returns it to the size
+     * of the current buffers before a pending reallocation happened keeps the
+     * existing stream.
+     */
+    if ((surface->width != width) ||
+        (surface->height != height)) {
+            if (surface == pData->egl.getCurrentSurface(EGL_DRAW) ||
+                surface == pData->egl.getCurrentSurface(EGL_READ)) {
+                WL_EGL_COUNTER_ADD(surface->counters.reallocsResize, 1);
+                wlEglReallocSurface(display, pData, surface);
+            } else {
+                surface->isResized = EGL_TRUE;
+            }
+    } else if ((surface->dx != window->dx) ||
+               (surface->dy != window->dy) ||
+               (surface->windowWidth != window->width) ||
+               (surface->windowHeight != window->height) ||
+               surface->isResized) {
+        surface->dx = window->dx;
+        surface->dy = window->dy;
+        surface->windowWidth = window->width;
+        surface->windowHeight = window->height;
+        window->attached_width = window->width;
+        window->attached_height = window->height;
+        surface->isResized = EGL_FALSE;
+        update_surface_viewport(surface);
+        WL_EGL_COUNTER_ADD(surface->counters.reallocsSkipped, 1);
+    }
 }
 
 static void
@@ -2302,22 +4098,11 @@ resize_callback(struct wl_egl_window *window, void *data)
 
     pData = display->data;
 
-    pthread_mutex_lock(&surface->mutexLock);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
-    /* Resize stream only if window geometry has changed */
-    if ((surface->width != window->width) ||
-        (surface->height != window->height) ||
-        (surface->dx != window->dx) ||
-        (surface->dy != window->dy)) {
-            if (surface == pData->egl.getCurrentSurface(EGL_DRAW) ||
-                surface == pData->egl.getCurrentSurface(EGL_READ)) {
-                wlEglReallocSurface(display, pData, surface);
-            } else {
-                surface->isResized = EGL_TRUE;
-            }
-    }
+    update_surface_size(display, pData, surface);
     
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 }
 
 static EGLBoolean validateSurfaceAttrib(EGLAttrib attrib, EGLAttrib value)
@@ -2415,6 +4200,8 @@ EGLBoolean wlEglQuerySurfaceHook(EGLDisplay dpy, EGLSurface eglSurface,
     EGLint ret                  = EGL_FALSE;
     EGLint err                  = EGL_SUCCESS;
 
+    WL_EGL_TRACE(hook_eglQuerySurface, eglSurface, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
@@ -2468,11 +4255,36 @@ void wlEglSurfaceUnref(WlEglSurface *surface)
         pthread_cond_destroy(&surface->condFrameSync);
     }
 
+    if (surface->readyFd >= 0) {
+        close(surface->readyFd);
+    }
+
+    wlEglSwapStatsDestroy(surface->swapStats);
     free(surface);
 
     return;
 }
 
+/*
+ * Destroys the viewport, fractional scale and content type objects of the
+ * wl_surface, which the window surface hook may have created before failing.
+ */
+static void destroy_surface_scaling_objects(WlEglSurface *surface)
+{
+    if (surface->wpViewport) {
+        wp_viewport_destroy(surface->wpViewport);
+        surface->wpViewport = NULL;
+    }
+    if (surface->wpFractionalScale) {
+        wp_fractional_scale_v1_destroy(surface->wpFractionalScale);
+        surface->wpFractionalScale = NULL;
+    }
+    if (surface->wpContentType) {
+        wp_content_type_v1_destroy(surface->wpContentType);
+        surface->wpContentType = NULL;
+    }
+}
+
 static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
 {
     WlEglDisplay *display = (WlEglDisplay*)dpy;
@@ -2483,11 +4295,22 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
         return EGL_FALSE;
     }
 
-    wl_list_remove(&surface->link);
+    wlEglRemoveSurfaceFromDisplay(display, surface);
     surface->isDestroyed = EGL_TRUE;
 
     // Acquire WlEglSurface lock.
-    pthread_mutex_lock(&surface->mutexLock);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    /* Stopped first, it looks at the queues and release points below */
+    finish_ready_fd_thread(surface);
+
+    wlEglSwapStatsReport(surface->swapStats,
+                         surface,
+                         surface->fifoLength,
+                         surface->swapInterval,
+                         surface->ctx.wlStreamResource == NULL,
+                         surface->wlSyncobjSurf != NULL,
+                         surface->ctx.useDamageThread);
 
     destroy_surface_context(surface, &surface->ctx);
 
@@ -2508,9 +4331,7 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
         }
 
         wl_list_for_each_safe(ctx, next, &surface->oldCtxList, link) {
-            destroy_surface_context(surface, ctx);
-            wl_list_remove(&ctx->link);
-            free(ctx);
+            free_old_surface_context(surface, ctx);
         }
 
         free(surface->attribs);
@@ -2518,19 +4339,29 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
 
     wlEglDestroyFeedback(&surface->feedback);
 
-    if (surface->wlSyncobjSurf) {
-        wp_linux_drm_syncobj_surface_v1_destroy(surface->wlSyncobjSurf);
-        wp_linux_drm_syncobj_timeline_v1_destroy(surface->wlAcquireTimeline);
-    }
+    destroy_surface_scaling_objects(surface);
+
+    destroy_surface_syncobj(display, surface);
 
     if (surface->presentFeedbackQueue != NULL) {
         wl_event_queue_destroy(surface->presentFeedbackQueue);
         surface->presentFeedbackQueue = NULL;
     }
+    if (display->ioQueue) {
+        pthread_mutex_lock(&display->ioMutex);
+    }
     if (surface->throttleCallback != NULL) {
         wl_callback_destroy(surface->throttleCallback);
         surface->throttleCallback = NULL;
     }
+    if (display->ioQueue) {
+        surface->frameSyncPending = 0;
+        pthread_mutex_unlock(&display->ioMutex);
+    }
+    if (surface->swapIntervalSync != NULL) {
+        wl_callback_destroy(surface->swapIntervalSync);
+        surface->swapIntervalSync = NULL;
+    }
 
     /* all proxies using the queue must be destroyed first! */
     if (surface->wlEventQueue != NULL) {
@@ -2546,7 +4377,7 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
         WlEglStreamImage *image;
         WlEglStreamImage *nextImage;
 
-        pthread_mutex_lock(&surface->ctx.streamImagesMutex);
+        wlEglMutexLock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
         /*
          * Destroy any attached buffers to ensure no further buffer release
          * events are delivered after the buffer release queue and thread are
@@ -2558,13 +4389,18 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
          */
         wl_list_for_each(image, &surface->ctx.streamImages, link) {
             if (image->buffer) {
-                assert(image->attached);
+                /*
+                 * image->buffer does not imply image->attached: with the
+                 * consumer thread the buffer is created when the image is
+                 * added, before it is ever attached. Every buffer must go,
+                 * whether the compositor still holds it or not.
+                 */
                 wl_buffer_destroy(image->buffer);
                 image->buffer = NULL;
                 image->attached = EGL_FALSE;
             }
         }
-        pthread_mutex_unlock(&surface->ctx.streamImagesMutex);
+        wlEglMutexUnlock(&surface->ctx.streamImagesMutex, WL_EGL_LOCK_STREAM_IMAGES);
 
         finish_wl_buffer_release_thread(surface);
 
@@ -2579,7 +4415,7 @@ static EGLBoolean wlEglDestroySurface(EGLDisplay dpy, EGLSurface eglSurface)
     assert(wl_list_empty(&surface->ctx.streamImages));
 
     // Release WlEglSurface lock.
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
     wlEglSurfaceUnref(eglSurface);
 
@@ -2592,16 +4428,16 @@ destroy_callback(void *data)
     WlEglSurface *surface = (WlEglSurface*)data;
     WlEglDisplay *display = surface->wlEglDpy;
 
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     if (!surface || surface->wlEglDpy->initCount == 0) {
-        pthread_mutex_unlock(&display->mutex);
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
         return;
     }
 
     wlEglDestroySurface((EGLDisplay)surface->wlEglDpy,
                         (EGLSurface)surface);
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 }
 
 static void
@@ -2626,22 +4462,6 @@ getWlEglWindowVersionAndSurface(struct wl_egl_window *window,
     }
 }
 
-static bool
-wlEglInitializeSurfaceCommon(WlEglDisplay *display,
-                             WlEglSurface *surface,
-                             EGLConfig config)
-{
-    surface->wlEglDpy = display;
-    surface->eglConfig = config;
-    surface->syncPoint = 1;
-    surface->refCount = 1;
-    surface->isDestroyed = EGL_FALSE;
-    wl_list_init(&surface->ctx.streamImages);
-    wl_list_init(&surface->oldCtxList);
-
-    return wlEglInitializeMutex(&surface->ctx.streamImagesMutex);
-}
-
 EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
                                                 EGLConfig config,
                                                 void *nativeWin,
@@ -2654,12 +4474,13 @@ EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
     EGLBoolean            res     = EGL_FALSE;
     EGLint                err     = EGL_SUCCESS;
     EGLint                surfType;
-    int                   drmSyncobjFd = -1;
+
+    WL_EGL_TRACE(hook_eglCreatePlatformWindowSurface, dpy, 0);
 
     if (!display) {
         return EGL_NO_SURFACE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -2727,6 +4548,10 @@ EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
     surface->ctx.eglSurface = EGL_NO_SURFACE;
     surface->ctx.isOffscreen = EGL_FALSE;
     surface->isSurfaceProducer = EGL_TRUE;
+    surface->renderScale = get_default_render_scale();
+    surface->fractionalScale = get_default_fractional_scale();
+    surface->contentType = get_default_content_type();
+    surface->swapStats = wlEglSwapStatsCreate();
     // FIFO_LENGTH == 1 to set FIFO mode, FIFO_LENGTH == 0 to set MAILBOX mode
     // We set two here however to bump the "swapchain" count to 4 on Wayland.
     // This is done to better match what Mesa does, as apparently 4 is the
@@ -2764,6 +4589,16 @@ EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         goto fail;
     }
 
+    err = update_surface_fractional_scale(surface);
+    if (err != EGL_SUCCESS) {
+        goto fail;
+    }
+
+    err = update_surface_content_type(surface);
+    if (err != EGL_SUCCESS) {
+        goto fail;
+    }
+
     /*
      * If the compositor supports it, then we can request a dmabuf feedback
      * object for this surface. This will let the compositor give us per-surface
@@ -2793,28 +4628,14 @@ EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         surface->feedback.unprocessedFeedback = false;
     }
 
-    if (display->wlDrmSyncobj) {
-        /* Create a DRM timeline and share it with the compositor */
-        drmSyncobjFd = create_syncobj_timeline(display, &surface->drmSyncobjHandle);
-        if (drmSyncobjFd < 0) {
-            goto fail;
-        }
-
-        /* Get a per-surface explicit sync object, share our DRM syncobj with the compositor */
-        surface->wlSyncobjSurf =
-            wp_linux_drm_syncobj_manager_v1_get_surface(display->wlDrmSyncobj, surface->wlSurface);
-
-        surface->wlAcquireTimeline =
-            wp_linux_drm_syncobj_manager_v1_import_timeline(display->wlDrmSyncobj, drmSyncobjFd);
-        close(drmSyncobjFd);
-        drmSyncobjFd = -1;
-
-        if (!surface->wlSyncobjSurf || !surface->wlAcquireTimeline) {
-            err = EGL_BAD_ALLOC;
-            goto fail;
-        }
+    err = create_surface_syncobj(display, surface);
+    if (err != EGL_SUCCESS) {
+        goto fail;
     }
 
+    /* A preferred_scale event received so far is accounted for below */
+    surface->isResized = EGL_FALSE;
+
     err = create_surface_context(surface);
     if (err != EGL_SUCCESS) {
         goto fail;
@@ -2834,26 +4655,27 @@ EGLSurface wlEglCreatePlatformWindowSurfaceHook(EGLDisplay dpy,
         window->destroy_window_callback = destroy_callback;
     }
 
-    wl_list_insert(&display->wlEglSurfaceList, &surface->link);
-    pthread_mutex_unlock(&display->mutex);
+    WL_EGL_TRACE(window_surface_create, surface,
+                 WL_EGL_TRACE_SIZE(surface->windowWidth, surface->windowHeight));
+
+    wlEglAddSurfaceToDisplay(display, surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return surface;
 
 fail:
-    if (surface->drmSyncobjHandle) {
-        drmSyncobjDestroy(display->drmFd, surface->drmSyncobjHandle);
-    }
-
-    if (drmSyncobjFd > 0) {
-        close(drmSyncobjFd);
-    }
-
     if (surface) {
+        /*
+         * wlEglDestroySurface() ignores surfaces that were never added to
+         * the display, so it won't clean these up.
+         */
+        destroy_surface_syncobj(display, surface);
+        destroy_surface_scaling_objects(surface);
         wlEglDestroySurface(display, surface);
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     wlEglSetError(data, err);
@@ -2871,6 +4693,8 @@ EGLSurface wlEglCreatePlatformPixmapSurfaceHook(EGLDisplay dpy,
     (void) nativePixmap;
     (void) attribs;
 
+    WL_EGL_TRACE(hook_eglCreatePlatformPixmapSurface, dpy, 0);
+
     /* Wayland does not support pixmap types. See EGL_EXT_platform_wayland. */
     wlEglSetError(display->data, EGL_BAD_PARAMETER);
     return EGL_NO_SURFACE;
@@ -2886,10 +4710,12 @@ EGLSurface wlEglCreatePbufferSurfaceHook(EGLDisplay dpy,
     EGLSurface         surf    = EGL_NO_SURFACE;
     EGLint             err     = EGL_SUCCESS;
 
+    WL_EGL_TRACE(hook_eglCreatePbufferSurface, dpy, 0);
+
     if (!display) {
         return EGL_NO_SURFACE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -2916,14 +4742,14 @@ EGLSurface wlEglCreatePbufferSurfaceHook(EGLDisplay dpy,
     surface->ctx.eglSurface = surf;
     surface->ctx.isOffscreen = EGL_TRUE;
 
-    wl_list_insert(&display->wlEglSurfaceList, &surface->link);
-    pthread_mutex_unlock(&display->mutex);
+    wlEglAddSurfaceToDisplay(display, surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return surface;
 
 fail:
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     if (err != EGL_SUCCESS) {
@@ -2943,10 +4769,12 @@ EGLSurface wlEglCreateStreamProducerSurfaceHook(EGLDisplay dpy,
     EGLSurface         surf    = EGL_NO_SURFACE;
     EGLint             err     = EGL_SUCCESS;
 
+    WL_EGL_TRACE(hook_eglCreateStreamProducerSurfaceKHR, dpy, 0);
+
     if (!display) {
         return EGL_NO_SURFACE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -2976,16 +4804,17 @@ EGLSurface wlEglCreateStreamProducerSurfaceHook(EGLDisplay dpy,
     surface->ctx.isOffscreen = EGL_TRUE;
     surface->refCount = 1;
     surface->isDestroyed = EGL_FALSE;
+    surface->readyFd = -1;
     wl_list_init(&surface->oldCtxList);
 
-    wl_list_insert(&display->wlEglSurfaceList, &surface->link);
-    pthread_mutex_unlock(&display->mutex);
+    wlEglAddSurfaceToDisplay(display, surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return surface;
 
 fail:
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     if (err != EGL_SUCCESS) {
         wlEglSetError(data, err);
@@ -2998,10 +4827,12 @@ EGLBoolean wlEglDestroySurfaceHook(EGLDisplay dpy, EGLSurface eglSurface)
     WlEglDisplay *display = wlEglAcquireDisplay(dpy);
     EGLint ret = EGL_FALSE;
 
+    WL_EGL_TRACE(hook_eglDestroySurface, eglSurface, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     if (display->initCount == 0) {
         wlEglSetError(display->data, EGL_NOT_INITIALIZED);
@@ -3014,7 +4845,7 @@ EGLBoolean wlEglDestroySurfaceHook(EGLDisplay dpy, EGLSurface eglSurface)
     }
 
 done:
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
     return ret;
 }
@@ -3044,6 +4875,8 @@ EGLBoolean wlEglQueryNativeResourceHook(EGLDisplay dpy,
     EGLBoolean                   res         = EGL_FALSE;
     EGLint                       originY;
 
+    WL_EGL_TRACE(hook_eglQueryWaylandBufferWL, dpy, 0);
+
     wlExternalApiLock();
 
     wlStreamDpy = wl_eglstream_display_get(dpy);
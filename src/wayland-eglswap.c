@@ -28,6 +28,7 @@
 #include "wayland-eglsurface-internal.h"
 #include "wayland-eglhandle.h"
 #include "wayland-eglutils.h"
+#include "wayland-egltrace.h"
 #include <assert.h>
 #include <wayland-egl-backend.h>
 #include <stdlib.h>
@@ -54,11 +55,18 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
     EGLBoolean             isOffscreen = EGL_FALSE;
     EGLBoolean             res;
     EGLint                 err;
+    uint64_t               swapStart   = 0;
+    uint64_t               stageStart;
+    uint64_t               waitTime;
+    EGLBoolean             idle        = EGL_FALSE;
 
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    if (wlEglSwapStatsEnabled()) {
+        swapStart = wlEglGetTimeNs();
+    }
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -91,16 +99,24 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
         surface->pendingSwapIntervalUpdate = EGL_FALSE;
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     // Acquire wlEglSurface lock.
-    pthread_mutex_lock(&surface->mutexLock);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
     if (surface->isDestroyed) {
         err = EGL_BAD_SURFACE;
         goto fail_locked;
     }
 
+    wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_ACQUIRE_DISPLAY,
+                      swapStart);
+
+    WL_EGL_TRACE_ARG(swap_begin, surface,
+                     __atomic_add_fetch(&surface->frameNumber, 1,
+                                        __ATOMIC_RELAXED),
+                     surface->swapInterval);
+
     isOffscreen = surface->ctx.isOffscreen;
     if (!isOffscreen) {
         if (!wlEglIsWaylandWindowValid(surface->wlEglWin)) {
@@ -108,6 +124,14 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
             goto fail_locked;
         }
 
+        /* Measured before any throttling, only the application's pace counts */
+        idle = surface->trimIdleMs && surface->lastSwapNs &&
+               wlEglGetTimeNs() - surface->lastSwapNs >=
+               surface->trimIdleMs * 1000000ull;
+
+        WL_EGL_TRACE(frame_sync_wait_begin, surface,
+                     wlEglSurfaceFrameNumber(surface));
+        stageStart = wlEglGetTimeNs();
         if (surface->ctx.useDamageThread) {
             pthread_mutex_lock(&surface->mutexFrameSync);
             // Wait for damage thread to submit the
@@ -119,6 +143,28 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
         }
 
         wlEglWaitFrameSync(surface);
+
+        waitTime = wlEglGetTimeNs() - stageStart;
+        wlEglHistogramAddAtomic(&surface->counters.frameCallbackWait, waitTime);
+        wlEglSwapStatsAdd(surface->swapStats, WL_EGL_SWAP_STAGE_FRAME_SYNC_WAIT,
+                          waitTime);
+        WL_EGL_TRACE(frame_sync_wait_end, surface,
+                     wlEglSurfaceFrameNumber(surface));
+        if (surface->trimIdleMs &&
+            waitTime >= surface->trimIdleMs * 1000000ull) {
+            idle = EGL_TRUE;
+        }
+
+        /*
+         * The surface was trimmed while occluded, and the frame went away
+         * with its producer surface. Its frame callback is still pending.
+         */
+        if (surface->trimDroppedFrame) {
+            surface->trimDroppedFrame = EGL_FALSE;
+            WL_EGL_COUNTER_ADD(surface->counters.framesDropped, 1);
+            res = EGL_TRUE;
+            goto done;
+        }
     }
 
     /* Save the internal EGLDisplay, EGLSurface and EGLStream handles, as
@@ -130,16 +176,25 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
     /* eglSwapBuffers() is a blocking call. We must release the lock so other
      * threads using the external platform are allowed to progress.
      */
+    WL_EGL_TRACE(driver_swap_begin, surface, wlEglSurfaceFrameNumber(surface));
+    stageStart = wlEglSwapStatsBegin(surface->swapStats);
     if (rects) {
         res = data->egl.swapBuffersWithDamage(eglDisplay, eglSurface, rects, n_rects);
     } else {
         res = data->egl.swapBuffers(eglDisplay, eglSurface);
     }
+    wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_DRIVER_SWAP,
+                      stageStart);
+    WL_EGL_TRACE(driver_swap_end, surface, wlEglSurfaceFrameNumber(surface));
     if (isOffscreen) {
         goto done;
     }
     if (display->devDpy->exts.stream_flush) {
+        stageStart = wlEglSwapStatsBegin(surface->swapStats);
         data->egl.streamFlush(eglDisplay, eglStream);
+        wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_STREAM_FLUSH,
+                          stageStart);
+        WL_EGL_TRACE(stream_flush, surface, wlEglSurfaceFrameNumber(surface));
     }
 
     if (res) {
@@ -148,38 +203,57 @@ EGLBoolean wlEglSwapBuffersWithDamageHook(EGLDisplay eglDisplay, EGLSurface eglS
         } else {
             wlEglCreateFrameSync(surface);
             res = wlEglSendDamageEvent(surface, surface->wlEventQueue, rects, n_rects);
+
+            stageStart = wlEglSwapStatsBegin(surface->swapStats);
             wlEglSurfaceCheckReleasePoints(display, surface);
+            wlEglSwapStatsEnd(surface->swapStats, WL_EGL_SWAP_STAGE_RELEASE_POINTS,
+                              stageStart);
+        }
+        if (surface->swapStats) {
+            surface->swapStats->frames++;
         }
+    } else {
+        WL_EGL_COUNTER_ADD(surface->counters.framesDropped, 1);
     }
 
     /* Resize stream if window geometry or available modifiers have changed */
     if (surface->isResized ||
         surface->feedback.unprocessedFeedback ||
         display->defaultFeedback.unprocessedFeedback) {
+        if (surface->isResized) {
+            WL_EGL_COUNTER_ADD(surface->counters.reallocsResize, 1);
+        } else {
+            WL_EGL_COUNTER_ADD(surface->counters.reallocsFeedback, 1);
+        }
         wlEglReallocSurface(display, data, surface);
+    } else {
+        wlEglTrimSurfaceAfterSwap(display, surface, idle);
     }
 
 done:
+    surface->lastSwapNs = wlEglGetTimeNs();
+    WL_EGL_TRACE(swap_end, surface, wlEglSurfaceFrameNumber(surface));
+
     // Release wlEglSurface lock.
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
     /* reacquire display lock */
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglSurfaceUnref(surface);
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return res;
 
 fail_locked:
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
     /* reacquire display lock */
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 fail:
     if (surface != NULL) {
         wlEglSurfaceUnref(surface);
     }
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     wlEglSetError(data, err);
@@ -194,10 +268,12 @@ EGLBoolean wlEglSwapIntervalHook(EGLDisplay eglDisplay, EGLint interval)
     EGLBoolean         ret     = EGL_TRUE;
     EGLint             state;
 
+    WL_EGL_TRACE(hook_eglSwapInterval, eglDisplay, 0);
+
     if (!display) {
         return EGL_FALSE;
     }
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     data = display->data;
 
@@ -211,7 +287,7 @@ EGLBoolean wlEglSwapIntervalHook(EGLDisplay eglDisplay, EGLint interval)
      * eglSwapInterval() call */
     eglDisplay = display->devDpy->eglDisplay;
 
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     if (!(data->egl.swapInterval(eglDisplay, interval))) {
         wlEglReleaseDisplay(display);
@@ -220,7 +296,7 @@ EGLBoolean wlEglSwapIntervalHook(EGLDisplay eglDisplay, EGLint interval)
 
     surface = (WlEglSurface *)data->egl.getCurrentSurface(EGL_DRAW);
 
-    pthread_mutex_lock(&display->mutex);
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     /* Check this is a valid wayland EGL surface */
     if (display->initCount == 0 ||
@@ -246,21 +322,34 @@ EGLBoolean wlEglSwapIntervalHook(EGLDisplay eglDisplay, EGLint interval)
     }
 
 done:
-    pthread_mutex_unlock(&display->mutex);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
     wlEglReleaseDisplay(display);
 
     return ret;
 }
 
-WL_EXPORT
-EGLBoolean wlEglPrePresentExport(WlEglSurface *surface) {
-    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
-    if (!display) {
-        return EGL_FALSE;
-    }
+static void
+swap_interval_sync_done(void *data, struct wl_callback *callback, uint32_t serial)
+{
+    WlEglSurface *surface = (WlEglSurface *)data;
 
-    pthread_mutex_lock(&display->mutex);
+    (void) serial;
 
+    wl_callback_destroy(callback);
+    __atomic_store_n(&surface->swapIntervalSync, NULL, __ATOMIC_RELEASE);
+}
+
+static const struct wl_callback_listener swap_interval_sync_listener = {
+    swap_interval_sync_done
+};
+
+/*
+ * Sends a pending swap interval override to the compositor and waits for any
+ * event it causes. Must be called with the display lock held.
+ */
+static EGLBoolean
+update_pending_swap_interval(WlEglDisplay *display, WlEglSurface *surface)
+{
     if (surface->pendingSwapIntervalUpdate == EGL_TRUE) {
         /* Send request from client to override swapinterval value based on
          * server's swapinterval for overlay compositing
@@ -271,17 +360,86 @@ EGLBoolean wlEglPrePresentExport(WlEglSurface *surface) {
         /* For receiving any event in case of override */
         if (wl_display_roundtrip_queue(display->nativeDpy,
                                        display->wlEventQueue) < 0) {
-            pthread_mutex_unlock(&display->mutex);
-            wlEglReleaseDisplay(display);
             return EGL_FALSE;
         }
         surface->pendingSwapIntervalUpdate = EGL_FALSE;
     }
 
-    pthread_mutex_unlock(&display->mutex);
+    /* Finish an update started by wlEglTryPrePresentExport() */
+    while (surface->swapIntervalSync != NULL) {
+        if (wl_display_dispatch_queue(display->nativeDpy,
+                                      display->wlEventQueue) < 0) {
+            return EGL_FALSE;
+        }
+    }
+
+    return EGL_TRUE;
+}
+
+/*
+ * Non-blocking update_pending_swap_interval(): sends the override along with
+ * a wl_display.sync instead of doing a roundtrip, and returns
+ * EGL_TIMEOUT_EXPIRED_KHR until the compositor has answered it. Must be called
+ * with the display lock held.
+ */
+static EGLint
+try_update_pending_swap_interval(WlEglDisplay *display, WlEglSurface *surface)
+{
+    struct wl_display *wrapper;
+
+    /* Pick up whatever the compositor already answered */
+    if (surface->swapIntervalSync != NULL &&
+        wlEglDispatchQueueNonBlocking(display->nativeDpy,
+                                      display->wlEventQueue) < 0) {
+        return EGL_FALSE;
+    }
+
+    /* A later change waits for the sync in flight, which doesn't cover it */
+    if (surface->swapIntervalSync == NULL &&
+        surface->pendingSwapIntervalUpdate == EGL_TRUE) {
+        wl_eglstream_display_swap_interval(display->wlStreamDpy,
+                                           surface->ctx.wlStreamResource,
+                                           surface->swapInterval);
+
+        wrapper = wl_proxy_create_wrapper(display->nativeDpy);
+        if (!wrapper) {
+            return EGL_FALSE;
+        }
+        wl_proxy_set_queue((struct wl_proxy *)wrapper, display->wlEventQueue);
+        surface->swapIntervalSync = wl_display_sync(wrapper);
+        wl_proxy_wrapper_destroy(wrapper);
+        if (!surface->swapIntervalSync) {
+            return EGL_FALSE;
+        }
+        wl_callback_add_listener(surface->swapIntervalSync,
+                                 &swap_interval_sync_listener, surface);
+        wl_display_flush(display->nativeDpy);
+        surface->pendingSwapIntervalUpdate = EGL_FALSE;
+    }
+
+    return surface->swapIntervalSync == NULL ? EGL_CONDITION_SATISFIED_KHR :
+                                               EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+WL_EXPORT
+EGLBoolean wlEglPrePresentExport(WlEglSurface *surface) {
+    WlEglDisplay *display = wlEglAcquireDisplay((WlEglDisplay *)surface->wlEglDpy);
+    if (!display) {
+        return EGL_FALSE;
+    }
+
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+
+    if (!update_pending_swap_interval(display, surface)) {
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+        wlEglReleaseDisplay(display);
+        return EGL_FALSE;
+    }
+
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
 
     // Acquire wlEglSurface lock.
-    pthread_mutex_lock(&surface->mutexLock);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
     if (surface->ctx.useDamageThread) {
         pthread_mutex_lock(&surface->mutexFrameSync);
@@ -296,12 +454,74 @@ EGLBoolean wlEglPrePresentExport(WlEglSurface *surface) {
     wlEglWaitFrameSync(surface);
 
     // Release wlEglSurface lock.
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
     wlEglReleaseDisplay(display);
 
     return EGL_TRUE;
 }
 
+WL_EXPORT
+EGLint wlEglTryPrePresentExport(WlEglSurface *surface) {
+    WlEglDisplay *display;
+    EGLint        ret;
+
+    /* The handle comes from the application, it may be stale */
+    display = surface ? wlEglAcquireSurfaceDisplay(surface) : NULL;
+    if (!display) {
+        return EGL_FALSE;
+    }
+
+    if (surface->ctx.isOffscreen || !wlEglSurfaceRef(display, surface)) {
+        wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+        wlEglReleaseDisplay(display);
+        return EGL_FALSE;
+    }
+
+    ret = try_update_pending_swap_interval(display, surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+
+    // Acquire wlEglSurface lock.
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    if (surface->isDestroyed) {
+        ret = EGL_FALSE;
+    }
+
+    if (ret == EGL_CONDITION_SATISFIED_KHR && surface->ctx.useDamageThread) {
+        pthread_mutex_lock(&surface->mutexFrameSync);
+        // The damage thread hasn't submitted the previous frame yet
+        if (surface->ctx.framesProduced != surface->ctx.framesProcessed) {
+            ret = EGL_TIMEOUT_EXPIRED_KHR;
+        }
+        pthread_mutex_unlock(&surface->mutexFrameSync);
+    }
+
+    if (ret == EGL_CONDITION_SATISFIED_KHR && !wlEglPollFrameSync(surface)) {
+        ret = EGL_TIMEOUT_EXPIRED_KHR;
+    }
+
+    /*
+     * wlEglPostPresentExport2() would block in
+     * wlEglSurfaceCheckReleasePoints() until the compositor gives a buffer
+     * back.
+     */
+    if (ret == EGL_CONDITION_SATISFIED_KHR &&
+        !wlEglSurfaceReleasePointsReady(display, surface)) {
+        ret = EGL_TIMEOUT_EXPIRED_KHR;
+    }
+
+    // Release wlEglSurface lock.
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
+
+    /* reacquire display lock */
+    wlEglMutexLock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+    wlEglSurfaceUnref(surface);
+    wlEglMutexUnlock(&display->mutex, WL_EGL_LOCK_DISPLAY);
+    wlEglReleaseDisplay(display);
+
+    return ret;
+}
+
 WL_EXPORT
 EGLBoolean wlEglPostPresentExport(WlEglSurface *surface) {
     return wlEglPostPresentExport2(surface, 0, NULL);
@@ -389,10 +609,10 @@ EGLBoolean wlEglPostPresentExport2(WlEglSurface *surface,
     data = display->data;
 
     // Acquire wlEglSurface lock.
-    pthread_mutex_lock(&surface->mutexLock);
+    wlEglMutexLock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
 
     if (display->devDpy->exts.stream_flush) {
-        data->egl.streamFlush((EGLDisplay) display, surface->ctx.eglStream);
+        data->egl.streamFlush(display->devDpy->eglDisplay, surface->ctx.eglStream);
     }
 
     if (presentInfo)
@@ -415,7 +635,7 @@ EGLBoolean wlEglPostPresentExport2(WlEglSurface *surface,
             if (wp_presentation_feedback_add_listener(presentationFeedback,
                                                       &present_feedback_listener,
                                                       eventItem) == -1) {
-                pthread_mutex_unlock(&surface->mutexLock);
+                wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
                 wlEglReleaseDisplay(display);
                 return EGL_FALSE;
             }
@@ -435,10 +655,11 @@ EGLBoolean wlEglPostPresentExport2(WlEglSurface *surface,
     } else {
         wlEglCreateFrameSync(surface);
         res = wlEglSendDamageEvent(surface, surface->wlEventQueue, NULL, 0);
+        wlEglSurfaceCheckReleasePoints(display, surface);
     }
 
     // Release wlEglSurface lock.
-    pthread_mutex_unlock(&surface->mutexLock);
+    wlEglMutexUnlock(&surface->mutexLock, WL_EGL_LOCK_SURFACE);
     wlEglReleaseDisplay(display);
 
     return res;
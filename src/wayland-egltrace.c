@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "wayland-egltrace.h"
+#include "wayland-eglstats.h"
+#include "wayland-thread.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#define WL_EGL_TRACE_MAX_NAMES            1024
+#define WL_EGL_TRACE_DEFAULT_RING_RECORDS 65536
+/* 2 GiB of records, well past anything worth keeping in memory */
+#define WL_EGL_TRACE_MAX_RING_RECORDS     (1ull << 26)
+
+int wlEglTraceSinks = 0;
+
+static pthread_once_t traceOnceControl = PTHREAD_ONCE_INIT;
+static int            traceMarkerFd    = -1;
+
+/*
+ * Recorder state. The name table is append-only and nameCount is published
+ * after the entry is written, so the dump can read both from a signal handler
+ * without taking recorderNameMutex.
+ */
+static pthread_mutex_t   recorderNameMutex = PTHREAD_MUTEX_INITIALIZER;
+static const char       *recorderNames[WL_EGL_TRACE_MAX_NAMES];
+static uint32_t          recorderNameCount = 0;
+static WlEglTraceRecord *recorderRing      = NULL;
+static uint64_t          recorderRingMask  = 0;
+static uint64_t          recorderHead      = 0;
+static const char       *recorderPath      = NULL;
+
+static __thread uint32_t recorderTid = 0;
+
+static void traceMarkerInit(void)
+{
+    const char *str = getenv("__NV_WAYLAND_TRACE_MARKER");
+    int fd;
+
+    if (!str || strcmp(str, "1")) {
+        return;
+    }
+
+    fd = open("/sys/kernel/tracing/trace_marker", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fd = open("/sys/kernel/debug/tracing/trace_marker",
+                  O_WRONLY | O_CLOEXEC);
+    }
+
+    if (fd >= 0) {
+        traceMarkerFd = fd;
+        wlEglTraceSinks |= WL_EGL_TRACE_SINK_MARKER;
+    }
+}
+
+static void traceMarkerWrite(const char *name, const void *surface,
+                             uint64_t frame, uint16_t arg)
+{
+    char buf[128];
+    int len;
+
+    len = snprintf(buf, sizeof(buf),
+                   "egl_wayland:%s surface=%p frame=%llu arg=%u\n",
+                   name, surface, (unsigned long long)frame, arg);
+    if (len <= 0) {
+        return;
+    }
+    if (len >= (int)sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+
+    /* A single write() per marker; nothing useful to do on failure */
+    if (write(traceMarkerFd, buf, len) < 0) {
+        return;
+    }
+}
+
+static int writeAll(int fd, const void *data, size_t size)
+{
+    const char *ptr = data;
+
+    while (size > 0) {
+        ssize_t ret = write(fd, ptr, size);
+        if (ret <= 0) {
+            return -1;
+        }
+        ptr  += ret;
+        size -= ret;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the ring to recorderPath. Only uses async-signal-safe calls so it
+ * can run from the dump signal handler. Records being written concurrently
+ * by other threads may come out torn, which a reader can spot by a timestamp
+ * going backwards.
+ */
+static void recorderDump(void)
+{
+    WlEglTraceFileHeader header;
+    uint64_t head = __atomic_load_n(&recorderHead, __ATOMIC_ACQUIRE);
+    uint64_t capacity = recorderRingMask + 1;
+    uint64_t count = head < capacity ? head : capacity;
+    uint64_t first = (head - count) & recorderRingMask;
+    uint64_t firstCount = capacity - first < count ? capacity - first : count;
+    uint32_t nameCount = __atomic_load_n(&recorderNameCount, __ATOMIC_ACQUIRE);
+    uint32_t i;
+    int fd;
+
+    fd = open(recorderPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WL_EGL_TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version     = WL_EGL_TRACE_FILE_VERSION;
+    header.recordSize  = sizeof(WlEglTraceRecord);
+    header.nameCount   = nameCount;
+    header.pid         = (uint32_t)getpid();
+    header.recordCount = count;
+    header.dropped     = head - count;
+
+    if (writeAll(fd, &header, sizeof(header))) {
+        goto done;
+    }
+
+    for (i = 0; i < nameCount; i++) {
+        uint16_t len = (uint16_t)strlen(recorderNames[i]);
+
+        if (writeAll(fd, &len, sizeof(len)) ||
+            writeAll(fd, recorderNames[i], len)) {
+            goto done;
+        }
+    }
+
+    if (writeAll(fd, &recorderRing[first],
+                 firstCount * sizeof(WlEglTraceRecord))) {
+        goto done;
+    }
+    writeAll(fd, &recorderRing[0],
+             (count - firstCount) * sizeof(WlEglTraceRecord));
+
+done:
+    close(fd);
+}
+
+static void recorderSignalHandler(int signum)
+{
+    (void)signum;
+    recorderDump();
+}
+
+WL_EGL_ATTRIBUTE_DESTRUCTOR
+static void recorderAtExit(void)
+{
+    if (wlEglTraceSinks & WL_EGL_TRACE_SINK_RECORDER) {
+        recorderDump();
+    }
+}
+
+static void recorderInit(void)
+{
+    const char *path = getenv("__NV_WAYLAND_RECORD");
+    const char *sizeStr = getenv("__NV_WAYLAND_RECORD_SIZE");
+    const char *sigStr = getenv("__NV_WAYLAND_RECORD_SIGNAL");
+    uint64_t records = WL_EGL_TRACE_DEFAULT_RING_RECORDS;
+
+    if (!path || !path[0]) {
+        return;
+    }
+
+    if (sizeStr && sizeStr[0]) {
+        long long size = atoll(sizeStr);
+        if (size > 0) {
+            records = (uint64_t)size;
+        }
+    }
+    if (records > WL_EGL_TRACE_MAX_RING_RECORDS) {
+        records = WL_EGL_TRACE_MAX_RING_RECORDS;
+    }
+
+    /* Round up to a power of two so the ring index is a mask */
+    if (records & (records - 1)) {
+        records = 1ull << (64 - __builtin_clzll(records));
+    }
+
+    recorderRing = calloc(records, sizeof(WlEglTraceRecord));
+    if (!recorderRing) {
+        return;
+    }
+    recorderRingMask = records - 1;
+    recorderPath = path;
+
+    if (sigStr && sigStr[0]) {
+        int signum = atoi(sigStr);
+        if (signum > 0) {
+            struct sigaction sa;
+
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = recorderSignalHandler;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(signum, &sa, NULL);
+        }
+    }
+
+    if (WL_EGL_ATEXIT(recorderAtExit)) {
+        assert(!"failed to register the trace recorder dump");
+    }
+
+    wlEglTraceSinks |= WL_EGL_TRACE_SINK_RECORDER;
+}
+
+static void wlEglTraceInitOnce(void)
+{
+    traceMarkerInit();
+    recorderInit();
+}
+
+void wlEglTraceInit(void)
+{
+    pthread_once(&traceOnceControl, wlEglTraceInitOnce);
+}
+
+static int recorderRegisterName(const char *name)
+{
+    uint32_t i;
+    int id = -1;
+
+    pthread_mutex_lock(&recorderNameMutex);
+
+    /* The same tracepoint name may be used from several call sites */
+    for (i = 0; i < recorderNameCount; i++) {
+        if (!strcmp(recorderNames[i], name)) {
+            id = (int)i;
+            goto done;
+        }
+    }
+
+    if (recorderNameCount < WL_EGL_TRACE_MAX_NAMES) {
+        recorderNames[recorderNameCount] = name;
+        id = (int)recorderNameCount;
+        __atomic_store_n(&recorderNameCount, recorderNameCount + 1,
+                         __ATOMIC_RELEASE);
+    }
+
+done:
+    pthread_mutex_unlock(&recorderNameMutex);
+    return id;
+}
+
+static void recorderWrite(int *nameId, const char *name,
+                          const void *surface, uint64_t frame, uint16_t arg)
+{
+    WlEglTraceRecord *record;
+    int id = __atomic_load_n(nameId, __ATOMIC_RELAXED);
+    uint64_t index;
+
+    if (id < 0) {
+        id = recorderRegisterName(name);
+        if (id < 0) {
+            return;
+        }
+        __atomic_store_n(nameId, id, __ATOMIC_RELAXED);
+    }
+
+    if (recorderTid == 0) {
+#if defined(__linux__)
+        recorderTid = (uint32_t)syscall(SYS_gettid);
+#else
+        recorderTid = (uint32_t)(uintptr_t)pthread_self();
+#endif
+    }
+
+    index = __atomic_fetch_add(&recorderHead, 1, __ATOMIC_ACQ_REL);
+    record = &recorderRing[index & recorderRingMask];
+
+    record->timestamp = wlEglGetTimeNs();
+    record->surface   = (uint64_t)(uintptr_t)surface;
+    record->frame     = frame;
+    record->tid       = recorderTid;
+    record->name      = (uint16_t)id;
+    record->arg       = arg;
+}
+
+void wlEglTraceEmit(int *nameId, const char *name,
+                    const void *surface, uint64_t frame, uint16_t arg)
+{
+    if (wlEglTraceSinks & WL_EGL_TRACE_SINK_MARKER) {
+        traceMarkerWrite(name, surface, frame, arg);
+    }
+    if (wlEglTraceSinks & WL_EGL_TRACE_SINK_RECORDER) {
+        recorderWrite(nameId, name, surface, frame, arg);
+    }
+}
@@ -34,6 +34,13 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <limits.h>
+#include <poll.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 EGLBoolean wlEglFindExtension(const char *extension, const char *extensions)
 {
@@ -58,6 +65,232 @@ EGLBoolean wlEglFindExtension(const char *extension, const char *extensions)
     return EGL_FALSE;
 }
 
+#define WL_EGL_POINTER_SET_MIN_CAPACITY 16
+
+static uint32_t pointerSetHash(const WlEglPointerSet *set, const void *ptr)
+{
+    /* Fibonacci hashing; the low bits of heap pointers carry no entropy */
+    uint64_t h = ((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ull;
+
+    return (uint32_t)(h >> 32) & (set->capacity - 1);
+}
+
+static void pointerSetPlace(WlEglPointerSet *set, void *ptr)
+{
+    uint32_t i = pointerSetHash(set, ptr);
+
+    while (set->slots[i]) {
+        i = (i + 1) & (set->capacity - 1);
+    }
+    set->slots[i] = ptr;
+}
+
+static EGLBoolean pointerSetResize(WlEglPointerSet *set, uint32_t capacity)
+{
+    void     **oldSlots = set->slots;
+    uint32_t   oldCapacity = set->capacity;
+    uint32_t   i;
+
+    set->slots = calloc(capacity, sizeof(void *));
+    if (!set->slots) {
+        set->slots = oldSlots;
+        return EGL_FALSE;
+    }
+    set->capacity = capacity;
+
+    for (i = 0; i < oldCapacity; i++) {
+        if (oldSlots[i]) {
+            pointerSetPlace(set, oldSlots[i]);
+        }
+    }
+    free(oldSlots);
+
+    return EGL_TRUE;
+}
+
+EGLBoolean wlEglPointerSetInsert(WlEglPointerSet *set, void *ptr)
+{
+    assert(ptr);
+
+    if (wlEglPointerSetContains(set, ptr)) {
+        return EGL_TRUE;
+    }
+
+    /* Keep the load factor at or below 1/2 so probe sequences stay short */
+    if ((set->count + 1) * 2 > set->capacity) {
+        uint32_t capacity = set->capacity ?
+                            set->capacity * 2 : WL_EGL_POINTER_SET_MIN_CAPACITY;
+        if (!pointerSetResize(set, capacity)) {
+            return EGL_FALSE;
+        }
+    }
+
+    pointerSetPlace(set, ptr);
+    set->count++;
+
+    return EGL_TRUE;
+}
+
+void wlEglPointerSetRemove(WlEglPointerSet *set, const void *ptr)
+{
+    uint32_t mask = set->capacity - 1;
+    uint32_t i, j;
+
+    if (!set->count) {
+        return;
+    }
+
+    for (i = pointerSetHash(set, ptr); set->slots[i] != ptr; i = (i + 1) & mask) {
+        if (!set->slots[i]) {
+            return;
+        }
+    }
+
+    /*
+     * Backward-shift deletion: move later entries of the probe sequence into
+     * the hole so no tombstones are needed.
+     */
+    set->slots[i] = NULL;
+    set->count--;
+    for (j = (i + 1) & mask; set->slots[j]; j = (j + 1) & mask) {
+        uint32_t home = pointerSetHash(set, set->slots[j]);
+
+        /* Move the entry if the hole lies between its home slot and j */
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            set->slots[i] = set->slots[j];
+            set->slots[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+EGLBoolean wlEglPointerSetContains(const WlEglPointerSet *set, const void *ptr)
+{
+    uint32_t i;
+
+    if (!set->count || !ptr) {
+        return EGL_FALSE;
+    }
+
+    for (i = pointerSetHash(set, ptr); set->slots[i];
+         i = (i + 1) & (set->capacity - 1)) {
+        if (set->slots[i] == ptr) {
+            return EGL_TRUE;
+        }
+    }
+
+    return EGL_FALSE;
+}
+
+void wlEglPointerSetFree(WlEglPointerSet *set)
+{
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+#if defined(__linux__)
+
+void wlEglFutexWait(uint32_t *addr, uint32_t val, int timeoutMs)
+{
+    struct timespec timeout;
+
+    if (timeoutMs >= 0) {
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    }
+
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val,
+            timeoutMs >= 0 ? &timeout : NULL, NULL, 0);
+}
+
+void wlEglFutexWakeAll(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#else
+
+/*
+ * Without futexes, waiters sleep for a millisecond at most and check again.
+ * The helper threads that would rely on fast wakeups are Linux only.
+ */
+void wlEglFutexWait(uint32_t *addr, uint32_t val, int timeoutMs)
+{
+    struct timespec timeout = { 0, 1000000L };
+
+    if (timeoutMs == 0 || __atomic_load_n(addr, __ATOMIC_ACQUIRE) != val) {
+        return;
+    }
+
+    nanosleep(&timeout, NULL);
+}
+
+void wlEglFutexWakeAll(uint32_t *addr)
+{
+    (void)addr;
+}
+
+#endif
+
+int wlEglDispatchQueueNonBlocking(struct wl_display *dpy,
+                                  struct wl_event_queue *queue)
+{
+    struct pollfd pfd;
+
+    if (wl_display_prepare_read_queue(dpy, queue) == 0) {
+        wl_display_flush(dpy);
+
+        pfd.fd = wl_display_get_fd(dpy);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, 0) > 0) {
+            if (wl_display_read_events(dpy) < 0) {
+                return -1;
+            }
+        } else {
+            wl_display_cancel_read(dpy);
+        }
+    }
+
+    return wl_display_dispatch_queue_pending(dpy, queue);
+}
+
+int wlEglDispatchQueueTimeout(struct wl_display *dpy,
+                              struct wl_event_queue *queue,
+                              int timeoutMs)
+{
+    struct pollfd pfd;
+    int           ret;
+
+    if (wl_display_prepare_read_queue(dpy, queue) < 0) {
+        return wl_display_dispatch_queue_pending(dpy, queue);
+    }
+
+    if (wl_display_flush(dpy) < 0 && errno != EAGAIN) {
+        wl_display_cancel_read(dpy);
+        return -1;
+    }
+
+    pfd.fd = wl_display_get_fd(dpy);
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    ret = poll(&pfd, 1, timeoutMs);
+    if (ret <= 0) {
+        wl_display_cancel_read(dpy);
+        return (ret < 0 && errno != EINTR) ? -1 : 0;
+    }
+
+    if (wl_display_read_events(dpy) < 0) {
+        return -1;
+    }
+
+    return wl_display_dispatch_queue_pending(dpy, queue);
+}
+
 EGLBoolean wlEglMemoryIsReadable(const void *p, size_t len)
 {
     int fds[2], result = -1;
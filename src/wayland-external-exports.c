@@ -28,6 +28,7 @@
 #include "wayland-eglswap.h"
 #include "wayland-eglutils.h"
 #include "wayland-eglhandle.h"
+#include "wayland-egltrace.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -112,6 +113,8 @@ EGLBoolean loadEGLExternalPlatform(int major, int minor,
         return EGL_FALSE;
     }
 
+    wlEglTraceInit();
+
     platform->exports.unloadEGLExternalPlatform = wlEglUnloadPlatformExport;
 
     platform->exports.getHookAddress       = wlEglGetHookAddressExport;
@@ -29,13 +29,19 @@
 #include "wayland-egldisplay.h"
 #include <stdlib.h>
 #include <assert.h>
-
-#if defined(__QNX__)
-#define WL_EGL_ATTRIBUTE_DESTRUCTOR
-#define WL_EGL_ATEXIT(func) atexit(func)
-#else
-#define WL_EGL_ATTRIBUTE_DESTRUCTOR __attribute__((destructor))
-#define WL_EGL_ATEXIT(func) 0
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(WL_EGL_LOCK_PROFILING)
+#include "wayland-eglstats.h"
+#include <signal.h>
+#endif
+#if defined(__linux__)
+#include <limits.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #endif
 
 static pthread_mutex_t wlMutex;
@@ -76,14 +82,246 @@ void wlExternalApiDestroyLock(void)
     }
 }
 
+#if defined(WL_EGL_LOCK_PROFILING)
+
+#define WL_EGL_LOCK_MAX_HELD 16
+
+typedef struct WlEglHeldLockRec {
+    pthread_mutex_t *mutex;
+    WlEglLockSite   *site;
+    uint64_t         start;
+} WlEglHeldLock;
+
+static const char *lockClassNames[WL_EGL_LOCK_CLASS_COUNT] = {
+    [WL_EGL_LOCK_API]           = "wlExternalApiLock",
+    [WL_EGL_LOCK_DISPLAY]       = "display->mutex",
+    [WL_EGL_LOCK_SURFACE]       = "surface->mutexLock",
+    [WL_EGL_LOCK_STREAM_IMAGES] = "ctx.streamImagesMutex",
+};
+
+static WlEglLockSite *lockSiteList = NULL;
+
+static __thread WlEglHeldLock heldLocks[WL_EGL_LOCK_MAX_HELD];
+static __thread int           heldLockCount = 0;
+
+static pthread_once_t         lockProfileOnceControl = PTHREAD_ONCE_INIT;
+static pthread_mutex_t        lockProfileDumpMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t  lockProfileDumpRequested = 0;
+
+static void lockProfileSignalHandler(int signum)
+{
+    (void) signum;
+    lockProfileDumpRequested = 1;
+}
+
+static void lockProfileDumpHistograms(FILE *out, const WlEglHistogram *wait,
+                                      const WlEglHistogram *hold)
+{
+    fprintf(out, " %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f",
+            (unsigned long long)wait->count,
+            wait->sum / 1000.0,
+            wlEglHistogramPercentile(wait, 0.5) / 1000.0,
+            wlEglHistogramPercentile(wait, 0.99) / 1000.0,
+            wait->max / 1000.0,
+            hold->sum / 1000.0,
+            wlEglHistogramPercentile(hold, 0.99) / 1000.0,
+            hold->max / 1000.0);
+}
+
+static void lockProfileDump(void)
+{
+    static WlEglHistogram classWait[WL_EGL_LOCK_CLASS_COUNT];
+    static WlEglHistogram classHold[WL_EGL_LOCK_CLASS_COUNT];
+    const char    *path = getenv("__NV_WAYLAND_LOCK_PROFILE");
+    FILE          *out  = stderr;
+    WlEglLockSite *site;
+    WlEglHistogram wait, hold;
+    int            i;
+
+    pthread_mutex_lock(&lockProfileDumpMutex);
+
+    if (path && path[0]) {
+        out = fopen(path, "a");
+        if (!out) {
+            pthread_mutex_unlock(&lockProfileDumpMutex);
+            return;
+        }
+    }
+
+    /* The class totals are only used here, under lockProfileDumpMutex */
+    memset(classWait, 0, sizeof(classWait));
+    memset(classHold, 0, sizeof(classHold));
+    for (site = __atomic_load_n(&lockSiteList, __ATOMIC_ACQUIRE);
+         site != NULL;
+         site = site->next) {
+        wlEglHistogramMerge(&classWait[site->lockClass], &site->wait);
+        wlEglHistogramMerge(&classHold[site->lockClass], &site->hold);
+    }
+
+    fprintf(out, "egl-wayland lock profile (pid %d)\n", (int)getpid());
+    fprintf(out, "%-24s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+            "class", "acquires", "wait_us", "wait_p50", "wait_p99",
+            "wait_max", "hold_us", "hold_p99", "hold_max");
+
+    for (i = 0; i < WL_EGL_LOCK_CLASS_COUNT; i++) {
+        fprintf(out, "%-24s", lockClassNames[i]);
+        lockProfileDumpHistograms(out, &classWait[i], &classHold[i]);
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\n%-24s %10s %10s %10s %10s %10s %10s %10s %10s %10s  %s\n",
+            "class", "contended", "acquires", "wait_us", "wait_p50",
+            "wait_p99", "wait_max", "hold_us", "hold_p99", "hold_max", "site");
+
+    for (site = __atomic_load_n(&lockSiteList, __ATOMIC_ACQUIRE);
+         site != NULL;
+         site = site->next) {
+        wlEglHistogramSnapshot(&wait, &site->wait);
+        wlEglHistogramSnapshot(&hold, &site->hold);
+
+        fprintf(out, "%-24s %10llu", lockClassNames[site->lockClass],
+                (unsigned long long)__atomic_load_n(&site->contended,
+                                                    __ATOMIC_RELAXED));
+        lockProfileDumpHistograms(out, &wait, &hold);
+        fprintf(out, "  %s:%d\n", site->file, site->line);
+    }
+
+    if (out != stderr) {
+        fclose(out);
+    } else {
+        fflush(out);
+    }
+
+    pthread_mutex_unlock(&lockProfileDumpMutex);
+}
+
+WL_EGL_ATTRIBUTE_DESTRUCTOR
+static void lockProfileAtExit(void)
+{
+    lockProfileDump();
+}
+
+static void lockProfileInitialize(void)
+{
+    const char *sigStr = getenv("__NV_WAYLAND_LOCK_PROFILE_SIGNAL");
+
+    if (sigStr && sigStr[0]) {
+        int signum = atoi(sigStr);
+        if (signum > 0) {
+            struct sigaction sa;
+
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = lockProfileSignalHandler;
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(signum, &sa, NULL);
+        }
+    }
+
+    if (WL_EGL_ATEXIT(lockProfileAtExit)) {
+        assert(!"failed to register the lock profile dump");
+    }
+}
+
+static int profiledMutexLock(pthread_mutex_t *mutex, WlEglLockSite *site,
+                             int tryOnly)
+{
+    uint64_t start = wlEglGetTimeNs();
+    uint64_t wait;
+    int      contended = 0;
+    int      ret;
+
+    pthread_once(&lockProfileOnceControl, lockProfileInitialize);
+
+    if (!__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) {
+        site->next = __atomic_load_n(&lockSiteList, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&lockSiteList, &site->next, site,
+                                            true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED)) {
+        }
+    }
+
+    ret = pthread_mutex_trylock(mutex);
+    if (ret == EBUSY && !tryOnly) {
+        contended = 1;
+        ret = pthread_mutex_lock(mutex);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    wait = wlEglGetTimeNs() - start;
+
+    __atomic_fetch_add(&site->contended, contended, __ATOMIC_RELAXED);
+    wlEglHistogramAddAtomic(&site->wait, wait);
+
+    if (heldLockCount < WL_EGL_LOCK_MAX_HELD) {
+        heldLocks[heldLockCount].mutex = mutex;
+        heldLocks[heldLockCount].site  = site;
+        heldLocks[heldLockCount].start = start + wait;
+        heldLockCount++;
+    }
+
+    return 0;
+}
+
+int wlEglProfiledMutexLock(pthread_mutex_t *mutex, WlEglLockSite *site)
+{
+    return profiledMutexLock(mutex, site, 0);
+}
+
+int wlEglProfiledMutexTryLock(pthread_mutex_t *mutex, WlEglLockSite *site)
+{
+    return profiledMutexLock(mutex, site, 1);
+}
+
+int wlEglProfiledMutexUnlock(pthread_mutex_t *mutex)
+{
+    int i;
+
+    /* Locks are not always released in LIFO order, search from the top */
+    for (i = heldLockCount - 1; i >= 0; i--) {
+        if (heldLocks[i].mutex == mutex) {
+            WlEglLockSite *site = heldLocks[i].site;
+            uint64_t       hold = wlEglGetTimeNs() - heldLocks[i].start;
+
+            wlEglHistogramAddAtomic(&site->hold, hold);
+
+            memmove(&heldLocks[i], &heldLocks[i + 1],
+                    (heldLockCount - i - 1) * sizeof(heldLocks[0]));
+            heldLockCount--;
+            break;
+        }
+    }
+
+    i = pthread_mutex_unlock(mutex);
+
+    if (lockProfileDumpRequested) {
+        lockProfileDumpRequested = 0;
+        lockProfileDump();
+    }
+
+    return i;
+}
+
+#endif
+
+#if defined(WL_EGL_LOCK_PROFILING)
+int wlExternalApiLockAt(WlEglLockSite *site)
+#else
 int wlExternalApiLock(void)
+#endif
 {
     if (pthread_once(&wlMutexOnceControl, wlExternalApiInitializeLock)) {
         assert(!"pthread once failed");
         return -1;
     }
 
+#if defined(WL_EGL_LOCK_PROFILING)
+    if (!wlMutexInitialized || wlEglProfiledMutexLock(&wlMutex, site)) {
+#else
     if (!wlMutexInitialized || pthread_mutex_lock(&wlMutex)) {
+#endif
         assert(!"failed to lock pthread mutex");
         return -1;
     }
@@ -93,7 +331,7 @@ int wlExternalApiLock(void)
 
 int wlExternalApiUnlock(void)
 {
-    if (!wlMutexInitialized || pthread_mutex_unlock(&wlMutex)) {
+    if (!wlMutexInitialized || wlEglMutexUnlock(&wlMutex, WL_EGL_LOCK_API)) {
         assert(!"failed to unlock pthread mutex");
         return -1;
     }
@@ -129,3 +367,284 @@ void wlEglMutexDestroy(pthread_mutex_t *mutex)
 {
     pthread_mutex_destroy(mutex);
 }
+
+#if !defined(__linux__)
+
+int wlEglCreateHelperThread(pthread_t *thread,
+                            const char *name,
+                            void *(*func)(void *),
+                            void *arg)
+{
+    (void)name;
+    return pthread_create(thread, NULL, func, arg);
+}
+
+#else
+
+typedef struct WlEglHelperThreadConfigRec {
+    int       policy;       /* SCHED_OTHER unless a realtime policy is set */
+    int       priority;
+    int       nice;
+    bool      setNice;
+    bool      near;
+    bool      setAffinity;
+    cpu_set_t affinity;
+    size_t    stackSize;    /* 0 keeps the default */
+} WlEglHelperThreadConfig;
+
+typedef struct WlEglHelperThreadStartRec {
+    void *(*func)(void *);
+    void   *arg;
+    char    name[16];
+    int     nice;
+    bool    setNice;
+} WlEglHelperThreadStart;
+
+static pthread_once_t          helperThreadOnceControl = PTHREAD_ONCE_INIT;
+static WlEglHelperThreadConfig helperThreadConfig;
+
+static bool parseCpuList(const char *str, cpu_set_t *set)
+{
+    char *end;
+    long  first;
+    long  last;
+
+    CPU_ZERO(set);
+
+    while (*str) {
+        first = strtol(str, &end, 10);
+        if (end == str || first < 0) {
+            return false;
+        }
+        last = first;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first) {
+                return false;
+            }
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++) {
+            CPU_SET(first, set);
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return false;
+        }
+        str = end;
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+static bool readCpuList(const char *path, cpu_set_t *set)
+{
+    char  buf[256];
+    FILE *file = fopen(path, "r");
+    bool  ret = false;
+
+    CPU_ZERO(set);
+
+    if (!file) {
+        return false;
+    }
+
+    if (fgets(buf, sizeof(buf), file)) {
+        buf[strcspn(buf, "\n")] = '\0';
+        ret = parseCpuList(buf, set);
+    }
+
+    fclose(file);
+
+    return ret;
+}
+
+/*
+ * Returns the CPUs close to the given one, but not the CPU itself: its SMT
+ * siblings if it has any, otherwise the CPUs sharing its last level cache.
+ * Only CPUs the process may run on are returned.
+ */
+static bool getNearCpus(int cpu, cpu_set_t *set)
+{
+    char      path[128];
+    char      level[16];
+    cpu_set_t cache;
+    cpu_set_t allowed;
+    FILE     *file;
+    int       maxLevel = 0;
+    int       i;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+             cpu);
+    readCpuList(path, set);
+    CPU_CLR(cpu, set);
+
+    if (CPU_COUNT(set) == 0) {
+        /* Pick the highest cache level, the LLC */
+        for (i = 0; i < 16; i++) {
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+                     cpu, i);
+            file = fopen(path, "r");
+            if (!file) {
+                break;
+            }
+            if (fgets(level, sizeof(level), file) &&
+                atoi(level) > maxLevel) {
+                snprintf(path, sizeof(path),
+                         "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                         cpu, i);
+                if (readCpuList(path, &cache)) {
+                    maxLevel = atoi(level);
+                    *set = cache;
+                }
+            }
+            fclose(file);
+        }
+
+        CPU_CLR(cpu, set);
+    }
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        CPU_AND(set, set, &allowed);
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+static void helperThreadInitialize(void)
+{
+    WlEglHelperThreadConfig *config = &helperThreadConfig;
+    const char *sched    = getenv("__NV_WAYLAND_THREAD_SCHED");
+    const char *affinity = getenv("__NV_WAYLAND_THREAD_AFFINITY");
+    const char *stack    = getenv("__NV_WAYLAND_THREAD_STACK_KB");
+
+    config->policy = SCHED_OTHER;
+
+    if (sched) {
+        if (!strncmp(sched, "fifo:", 5)) {
+            config->policy = SCHED_FIFO;
+            config->priority = atoi(sched + 5);
+        } else if (!strncmp(sched, "rr:", 3)) {
+            config->policy = SCHED_RR;
+            config->priority = atoi(sched + 3);
+        } else if (!strncmp(sched, "nice:", 5)) {
+            config->nice = atoi(sched + 5);
+            config->setNice = true;
+        }
+
+        if (config->policy != SCHED_OTHER &&
+            (config->priority < sched_get_priority_min(config->policy) ||
+             config->priority > sched_get_priority_max(config->policy))) {
+            config->policy = SCHED_OTHER;
+        }
+    }
+
+    if (affinity && affinity[0] && strcmp(affinity, "inherit")) {
+        if (!strcmp(affinity, "near")) {
+            config->near = true;
+        } else {
+            config->setAffinity = parseCpuList(affinity,
+                                               &config->affinity);
+        }
+    }
+
+    if (stack) {
+        size_t size = strtoul(stack, NULL, 10) * 1024;
+
+        if (size) {
+            config->stackSize = size < PTHREAD_STACK_MIN ?
+                                PTHREAD_STACK_MIN : size;
+        }
+    }
+}
+
+static void *helperThreadMain(void *arg)
+{
+    WlEglHelperThreadStart  start = *(WlEglHelperThreadStart *)arg;
+
+    free(arg);
+
+    pthread_setname_np(pthread_self(), start.name);
+
+    /* Nice values are per thread on Linux */
+    if (start.setNice) {
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), start.nice);
+    }
+
+    return start.func(start.arg);
+}
+
+int wlEglCreateHelperThread(pthread_t *thread,
+                            const char *name,
+                            void *(*func)(void *),
+                            void *arg)
+{
+    const WlEglHelperThreadConfig *config = &helperThreadConfig;
+    WlEglHelperThreadStart        *start;
+    pthread_attr_t                 attr;
+    struct sched_param             param;
+    cpu_set_t                      cpus;
+    int                            cpu;
+    int                            ret;
+
+    pthread_once(&helperThreadOnceControl, helperThreadInitialize);
+
+    start = malloc(sizeof(*start));
+    if (!start) {
+        return ENOMEM;
+    }
+    start->func = func;
+    start->arg = arg;
+    start->nice = config->nice;
+    start->setNice = config->setNice;
+    snprintf(start->name, sizeof(start->name), "nvwl-%s", name);
+
+    if (pthread_attr_init(&attr)) {
+        free(start);
+        return pthread_create(thread, NULL, func, arg);
+    }
+
+    if (config->stackSize) {
+        pthread_attr_setstacksize(&attr, config->stackSize);
+    }
+
+    if (config->policy != SCHED_OTHER) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, config->policy);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    if (config->near) {
+        /* Without topology information the thread keeps the inherited mask */
+        if ((cpu = sched_getcpu()) >= 0 && getNearCpus(cpu, &cpus)) {
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+    } else if (config->setAffinity) {
+        pthread_attr_setaffinity_np(&attr, sizeof(config->affinity),
+                                    &config->affinity);
+    }
+
+    ret = pthread_create(thread, &attr, helperThreadMain, start);
+    pthread_attr_destroy(&attr);
+
+    /*
+     * Realtime policies need privileges and the CPU list may not intersect
+     * the allowed ones. Fall back to the default attributes.
+     */
+    if (ret == EPERM || ret == EINVAL) {
+        ret = pthread_create(thread, NULL, helperThreadMain, start);
+    }
+
+    if (ret) {
+        free(start);
+    }
+
+    return ret;
+}
+
+#endif
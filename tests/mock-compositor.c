@@ -0,0 +1,1948 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mock-compositor.h"
+
+#include <wayland-server.h>
+#include <wayland-client.h>
+#include "wayland-egl-ext.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+#include "presentation-time-server-protocol.h"
+#include "linux-drm-syncobj-v1-server-protocol.h"
+#include "wayland-eglstream-controller-server-protocol.h"
+
+#include <xf86drm.h>
+#include <drm_fourcc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+/* Formats offered over zwp_linux_dmabuf_v1, all with the linear modifier */
+static const uint32_t mockFormats[] = {
+    DRM_FORMAT_ARGB8888,
+    DRM_FORMAT_XRGB8888,
+    DRM_FORMAT_RGB565,
+    DRM_FORMAT_ARGB2101010,
+    DRM_FORMAT_XRGB2101010,
+};
+
+#define MOCK_NUM_FORMATS (sizeof(mockFormats) / sizeof(mockFormats[0]))
+
+typedef struct MockFormatTableEntryRec {
+    uint32_t format;
+    uint32_t pad;
+    uint64_t modifier;
+} MockFormatTableEntry;
+
+/*
+ * Objects
+ */
+
+/* A reference to a wl_buffer that goes away with the buffer */
+typedef struct MockBufferRefRec {
+    struct wl_resource *resource;
+    struct wl_listener  destroyListener;
+} MockBufferRef;
+
+typedef struct MockTimelineRec {
+    int      refCount;
+    uint32_t handle;
+} MockTimeline;
+
+typedef struct MockSyncPointRec {
+    MockTimeline *timeline;
+    uint64_t      point;
+} MockSyncPoint;
+
+/* Double-buffered state, committed and then latched on a refresh */
+typedef struct MockFrameRec {
+    EGLBoolean     hasBuffer;       /* wl_surface.attach was sent */
+    MockBufferRef  buffer;
+    MockSyncPoint  acquire;
+    MockSyncPoint  release;
+    struct wl_list frameCallbacks;
+    struct wl_list presentationFeedbacks;
+} MockFrame;
+
+/* A buffer the compositor is done with, waiting to be given back */
+typedef struct MockReleaseRec {
+    MockBufferRef  buffer;
+    MockSyncPoint  release;
+    uint64_t       dueNs;
+    struct wl_list link;
+} MockRelease;
+
+typedef struct MockSurfaceRec {
+    MockCompositor     *comp;
+    struct wl_resource *resource;
+    struct wl_resource *syncobj;
+
+    MockFrame           pending;
+    MockFrame           committed;
+    EGLBoolean          hasCommitted;
+
+    MockBufferRef       current;
+    MockSyncPoint       currentRelease;
+    struct wl_list      frameCallbacks;  /* Sent on the next refresh */
+
+    struct wl_list      held;            /* Replaced, not released yet */
+    int                 numHeld;
+
+    EGLStreamKHR        eglStream;
+
+    struct wl_list      link;
+} MockSurface;
+
+typedef struct MockDmabufRec {
+    MockCompositor     *comp;
+    int                 fd;
+    uint64_t            size;
+} MockDmabuf;
+
+typedef struct MockDmabufParamsRec {
+    MockCompositor     *comp;
+    int                 fd;
+    uint32_t            offset;
+    uint32_t            stride;
+    uint64_t            modifier;
+    EGLBoolean          used;
+} MockDmabufParams;
+
+typedef enum {
+    MOCK_COMMAND_CONNECT,
+    MOCK_COMMAND_SET_REFRESH,
+    MOCK_COMMAND_SET_RELEASE_DELAY,
+    MOCK_COMMAND_SET_HELD_BUFFERS,
+    MOCK_COMMAND_RESEND_FEEDBACK,
+    MOCK_COMMAND_GET_STATS,
+    MOCK_COMMAND_STOP,
+} MockCommandType;
+
+typedef struct MockCommandRec {
+    MockCommandType type;
+    uint64_t        value;
+    void           *data;
+    EGLBoolean      done;
+    struct wl_list  link;
+} MockCommand;
+
+struct MockCompositorRec {
+    MockCompositorOptions    options;
+    MockEgl                 *egl;
+    EGLDisplay               eglDisplay;
+    EGLBoolean               eglBound;
+
+    PFNEGLSTREAMCONSUMERGLTEXTUREEXTERNALKHRPROC streamConsumerGLTexture;
+    PFNEGLSTREAMCONSUMERACQUIREKHRPROC           streamConsumerAcquire;
+    PFNEGLDESTROYSTREAMKHRPROC                   destroyStream;
+
+    struct wl_display       *display;
+    struct wl_event_loop    *loop;
+    struct wl_protocol_logger *logger;
+    pthread_t                thread;
+    EGLBoolean               running;
+
+    /* Commands from other threads */
+    pthread_mutex_t          mutex;
+    pthread_cond_t           cond;
+    struct wl_list           commands;
+    int                      commandFd;
+    struct wl_event_source  *commandSource;
+
+    int                      refreshFd;
+    struct wl_event_source  *refreshSource;
+    uint64_t                 refreshNs;
+    uint64_t                 seq;
+
+    int                      releaseFd;
+    struct wl_event_source  *releaseSource;
+    struct wl_list           releases;       /* Sorted by dueNs */
+
+    int                      formatTableFd;
+    uint32_t                 formatTableSize;
+    dev_t                    mainDevice;
+
+    struct wl_list           surfaces;
+    struct wl_list           feedbacks;      /* zwp_linux_dmabuf_feedback_v1 */
+
+    MockCompositorStats      stats;
+};
+
+static uint64_t getTimeNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void postError(MockCompositor *comp, struct wl_resource *resource,
+                      uint32_t code, const char *msg)
+{
+    comp->stats.protocolErrors++;
+    wl_resource_post_error(resource, code, "%s", msg);
+}
+
+/* Destructor for resources kept in a list through their link */
+static void unlinkResource(struct wl_resource *resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void destroyResource(struct wl_client *client,
+                            struct wl_resource *resource)
+{
+    (void) client;
+
+    wl_resource_destroy(resource);
+}
+
+/*
+ * Buffer references
+ */
+
+static void bufferRefDestroyed(struct wl_listener *listener, void *data)
+{
+    MockBufferRef *ref = wl_container_of(listener, ref, destroyListener);
+
+    (void) data;
+
+    wl_list_remove(&ref->destroyListener.link);
+    ref->resource = NULL;
+}
+
+static void clearBufferRef(MockBufferRef *ref)
+{
+    if (ref->resource) {
+        wl_list_remove(&ref->destroyListener.link);
+        ref->resource = NULL;
+    }
+}
+
+static void setBufferRef(MockBufferRef *ref, struct wl_resource *resource)
+{
+    clearBufferRef(ref);
+    if (resource) {
+        ref->resource = resource;
+        ref->destroyListener.notify = bufferRefDestroyed;
+        wl_resource_add_destroy_listener(resource, &ref->destroyListener);
+    }
+}
+
+static void moveBufferRef(MockBufferRef *dst, MockBufferRef *src)
+{
+    setBufferRef(dst, src->resource);
+    clearBufferRef(src);
+}
+
+/*
+ * Sync points
+ */
+
+static void setSyncPoint(MockSyncPoint *sp, MockTimeline *timeline,
+                         uint64_t point)
+{
+    if (timeline) {
+        timeline->refCount++;
+    }
+    if (sp->timeline && --sp->timeline->refCount == 0) {
+        drmSyncobjDestroy(-1, sp->timeline->handle);
+        free(sp->timeline);
+    }
+    sp->timeline = timeline;
+    sp->point = point;
+}
+
+static void moveSyncPoint(MockSyncPoint *dst, MockSyncPoint *src)
+{
+    setSyncPoint(dst, src->timeline, src->point);
+    setSyncPoint(src, NULL, 0);
+}
+
+static EGLBoolean isSyncPointSignaled(MockSyncPoint *sp)
+{
+    /* An absolute timeout of 0 has expired already */
+    return drmSyncobjTimelineWait(-1, &sp->timeline->handle, &sp->point, 1,
+                                  0, 0, NULL) == 0;
+}
+
+/*
+ * Releases
+ */
+
+static void releaseNow(MockCompositor *comp, MockRelease *release)
+{
+    if (release->release.timeline) {
+        drmSyncobjTimelineSignal(-1, &release->release.timeline->handle,
+                                 &release->release.point, 1);
+    } else if (release->buffer.resource) {
+        wl_buffer_send_release(release->buffer.resource);
+    }
+    comp->stats.buffersReleased++;
+
+    clearBufferRef(&release->buffer);
+    setSyncPoint(&release->release, NULL, 0);
+    free(release);
+}
+
+static void armReleaseTimer(MockCompositor *comp)
+{
+    struct itimerspec its;
+    MockRelease *first;
+
+    memset(&its, 0, sizeof(its));
+    if (!wl_list_empty(&comp->releases)) {
+        first = wl_container_of(comp->releases.next, first, link);
+        its.it_value.tv_sec  = first->dueNs / 1000000000ull;
+        its.it_value.tv_nsec = first->dueNs % 1000000000ull;
+    }
+    timerfd_settime(comp->releaseFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void scheduleRelease(MockCompositor *comp, MockRelease *release,
+                            uint64_t now)
+{
+    MockRelease *other;
+
+    if (comp->options.releaseDelayUs == 0) {
+        releaseNow(comp, release);
+        return;
+    }
+
+    release->dueNs = now + comp->options.releaseDelayUs * 1000ull;
+
+    /* Delays only change between refreshes, so this is nearly always last */
+    wl_list_for_each_reverse(other, &comp->releases, link) {
+        if (other->dueNs <= release->dueNs) {
+            break;
+        }
+    }
+    wl_list_insert(&other->link, &release->link);
+
+    if (comp->releases.next == &release->link) {
+        armReleaseTimer(comp);
+    }
+}
+
+static void processReleases(MockCompositor *comp, uint64_t now)
+{
+    MockRelease *release, *tmp;
+
+    wl_list_for_each_safe(release, tmp, &comp->releases, link) {
+        if (release->dueNs > now) {
+            break;
+        }
+        wl_list_remove(&release->link);
+        releaseNow(comp, release);
+    }
+    armReleaseTimer(comp);
+}
+
+static int handleReleaseTimer(int fd, uint32_t mask, void *data)
+{
+    MockCompositor *comp = data;
+    uint64_t expirations;
+
+    (void) mask;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return 0;
+    }
+    processReleases(comp, getTimeNs());
+
+    return 0;
+}
+
+/* Hands the surface's buffer over to the compositor's held list */
+static void holdBuffer(MockSurface *surface, MockBufferRef *buffer,
+                       MockSyncPoint *release, uint64_t now)
+{
+    MockCompositor *comp = surface->comp;
+    MockRelease *entry;
+
+    if (!buffer->resource && !release->timeline) {
+        return;
+    }
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        return;
+    }
+    moveBufferRef(&entry->buffer, buffer);
+    moveSyncPoint(&entry->release, release);
+    wl_list_insert(surface->held.prev, &entry->link);
+    surface->numHeld++;
+
+    while (surface->numHeld > comp->options.heldBuffers) {
+        entry = wl_container_of(surface->held.next, entry, link);
+        wl_list_remove(&entry->link);
+        surface->numHeld--;
+        scheduleRelease(comp, entry, now);
+    }
+}
+
+/*
+ * Frames
+ */
+
+static void initFrame(MockFrame *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    wl_list_init(&frame->frameCallbacks);
+    wl_list_init(&frame->presentationFeedbacks);
+}
+
+static void discardFeedbacks(struct wl_list *feedbacks)
+{
+    struct wl_resource *resource, *tmp;
+
+    wl_resource_for_each_safe(resource, tmp, feedbacks) {
+        wp_presentation_feedback_send_discarded(resource);
+        wl_resource_destroy(resource);
+    }
+}
+
+static void destroyResources(struct wl_list *resources)
+{
+    struct wl_resource *resource, *tmp;
+
+    wl_resource_for_each_safe(resource, tmp, resources) {
+        wl_resource_destroy(resource);
+    }
+}
+
+/*
+ * Gives the buffer of a frame that was never shown back right away. An
+ * EGLStream buffer that is also the current one stays in use.
+ */
+static void discardFrame(MockSurface *surface, MockFrame *frame)
+{
+    MockRelease *entry;
+
+    if ((frame->buffer.resource &&
+         frame->buffer.resource != surface->current.resource) ||
+        frame->release.timeline) {
+        entry = calloc(1, sizeof(*entry));
+        if (entry) {
+            moveBufferRef(&entry->buffer, &frame->buffer);
+            moveSyncPoint(&entry->release, &frame->release);
+            releaseNow(surface->comp, entry);
+        }
+    }
+    clearBufferRef(&frame->buffer);
+    setSyncPoint(&frame->acquire, NULL, 0);
+    setSyncPoint(&frame->release, NULL, 0);
+    frame->hasBuffer = EGL_FALSE;
+
+    discardFeedbacks(&frame->presentationFeedbacks);
+}
+
+/* Drops state the client never committed */
+static void clearFrame(MockFrame *frame)
+{
+    clearBufferRef(&frame->buffer);
+    setSyncPoint(&frame->acquire, NULL, 0);
+    setSyncPoint(&frame->release, NULL, 0);
+    frame->hasBuffer = EGL_FALSE;
+
+    discardFeedbacks(&frame->presentationFeedbacks);
+    destroyResources(&frame->frameCallbacks);
+}
+
+/*
+ * Refresh
+ */
+
+static void sendPresented(MockCompositor *comp, struct wl_list *feedbacks,
+                          uint64_t now)
+{
+    struct wl_resource *resource, *tmp;
+    uint64_t sec  = now / 1000000000ull;
+    uint32_t nsec = now % 1000000000ull;
+
+    wl_resource_for_each_safe(resource, tmp, feedbacks) {
+        wp_presentation_feedback_send_presented(resource,
+            sec >> 32, sec & 0xffffffff, nsec,
+            comp->refreshNs,
+            comp->seq >> 32, comp->seq & 0xffffffff,
+            WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+            WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+            WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION);
+        wl_resource_destroy(resource);
+    }
+}
+
+static void latchFrame(MockSurface *surface, uint64_t now)
+{
+    MockCompositor *comp = surface->comp;
+    MockFrame *frame = &surface->committed;
+
+    if (frame->hasBuffer) {
+        if (frame->acquire.timeline && !isSyncPointSignaled(&frame->acquire)) {
+            comp->stats.unsignaledAcquires++;
+        }
+        setSyncPoint(&frame->acquire, NULL, 0);
+
+        /* EGLStream clients attach the same buffer for every frame */
+        if (frame->buffer.resource != surface->current.resource ||
+            frame->release.timeline) {
+            holdBuffer(surface, &surface->current, &surface->currentRelease,
+                       now);
+            moveBufferRef(&surface->current, &frame->buffer);
+            moveSyncPoint(&surface->currentRelease, &frame->release);
+        } else {
+            clearBufferRef(&frame->buffer);
+        }
+        frame->hasBuffer = EGL_FALSE;
+
+        if (surface->eglStream != EGL_NO_STREAM_KHR &&
+            surface->current.resource &&
+            comp->streamConsumerAcquire(comp->eglDisplay, surface->eglStream)) {
+            comp->stats.eglstreamFrames++;
+        }
+
+        if (surface->current.resource) {
+            comp->stats.framesPresented++;
+        }
+    }
+
+    sendPresented(comp, &frame->presentationFeedbacks, now);
+    wl_list_insert_list(&surface->frameCallbacks, &frame->frameCallbacks);
+    wl_list_init(&frame->frameCallbacks);
+
+    surface->hasCommitted = EGL_FALSE;
+}
+
+static void sendFeedback(MockCompositor *comp, struct wl_resource *resource)
+{
+    struct wl_array device, indices;
+    uint16_t *index;
+    uint16_t i;
+
+    wl_array_init(&device);
+    wl_array_init(&indices);
+
+    if (!wl_array_add(&device, sizeof(comp->mainDevice)) ||
+        !wl_array_add(&indices, MOCK_NUM_FORMATS * sizeof(uint16_t))) {
+        wl_resource_post_no_memory(resource);
+        goto done;
+    }
+    memcpy(device.data, &comp->mainDevice, sizeof(comp->mainDevice));
+    index = indices.data;
+    for (i = 0; i < MOCK_NUM_FORMATS; i++) {
+        index[i] = i;
+    }
+
+    zwp_linux_dmabuf_feedback_v1_send_format_table(resource,
+                                                   comp->formatTableFd,
+                                                   comp->formatTableSize);
+    zwp_linux_dmabuf_feedback_v1_send_main_device(resource, &device);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_target_device(resource, &device);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_formats(resource, &indices);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_flags(resource, 0);
+    zwp_linux_dmabuf_feedback_v1_send_tranche_done(resource);
+    zwp_linux_dmabuf_feedback_v1_send_done(resource);
+    comp->stats.feedbackSends++;
+
+done:
+    wl_array_release(&device);
+    wl_array_release(&indices);
+}
+
+static void resendFeedback(MockCompositor *comp)
+{
+    struct wl_resource *resource;
+
+    wl_resource_for_each(resource, &comp->feedbacks) {
+        sendFeedback(comp, resource);
+    }
+}
+
+static void sendFrameCallbacks(MockSurface *surface, uint64_t now)
+{
+    struct wl_resource *resource, *tmp;
+
+    wl_resource_for_each_safe(resource, tmp, &surface->frameCallbacks) {
+        wl_callback_send_done(resource, now / 1000000);
+        wl_resource_destroy(resource);
+        surface->comp->stats.frameCallbacks++;
+    }
+}
+
+static void refresh(MockCompositor *comp)
+{
+    MockSurface *surface;
+    uint64_t now = getTimeNs();
+
+    comp->seq++;
+    comp->stats.refreshes++;
+
+    wl_list_for_each(surface, &comp->surfaces, link) {
+        if (surface->hasCommitted) {
+            latchFrame(surface, now);
+        }
+    }
+
+    wl_list_for_each(surface, &comp->surfaces, link) {
+        sendFrameCallbacks(surface, now);
+    }
+
+    if (comp->options.feedbackInterval > 0 &&
+        comp->seq % comp->options.feedbackInterval == 0) {
+        resendFeedback(comp);
+    }
+
+    processReleases(comp, now);
+}
+
+static int handleRefreshTimer(int fd, uint32_t mask, void *data)
+{
+    MockCompositor *comp = data;
+    uint64_t expirations;
+
+    (void) mask;
+
+    /* Missed refreshes are skipped, as a display would */
+    if (read(fd, &expirations, sizeof(expirations)) < 0) {
+        return 0;
+    }
+    refresh(comp);
+
+    return 0;
+}
+
+static void setRefresh(MockCompositor *comp, uint32_t refreshMhz)
+{
+    struct itimerspec its;
+
+    comp->options.refreshMhz = refreshMhz;
+    comp->refreshNs = refreshMhz ? 1000000000000ull / refreshMhz : 0;
+
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_sec  = comp->refreshNs / 1000000000ull;
+    its.it_interval.tv_nsec = comp->refreshNs % 1000000000ull;
+    its.it_value = its.it_interval;
+    timerfd_settime(comp->refreshFd, 0, &its, NULL);
+}
+
+/*
+ * wl_surface
+ */
+
+static void surfaceAttach(struct wl_client *client,
+                          struct wl_resource *resource,
+                          struct wl_resource *buffer,
+                          int32_t x, int32_t y)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+
+    (void) client;
+    (void) x;
+    (void) y;
+
+    setBufferRef(&surface->pending.buffer, buffer);
+    surface->pending.hasBuffer = EGL_TRUE;
+}
+
+static void surfaceDamage(struct wl_client *client,
+                          struct wl_resource *resource,
+                          int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+    (void) width;
+    (void) height;
+}
+
+static void surfaceFrame(struct wl_client *client,
+                         struct wl_resource *resource,
+                         uint32_t id)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+    struct wl_resource *callback;
+
+    callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+    if (!callback) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(callback, NULL, NULL, unlinkResource);
+    wl_list_insert(surface->pending.frameCallbacks.prev,
+                   wl_resource_get_link(callback));
+}
+
+static void surfaceSetRegion(struct wl_client *client,
+                             struct wl_resource *resource,
+                             struct wl_resource *region)
+{
+    (void) client;
+    (void) resource;
+    (void) region;
+}
+
+static void surfaceSetInt(struct wl_client *client,
+                          struct wl_resource *resource,
+                          int32_t value)
+{
+    (void) client;
+    (void) resource;
+    (void) value;
+}
+
+static EGLBoolean isDmabuf(struct wl_resource *buffer);
+
+static EGLBoolean checkSyncPoints(MockSurface *surface)
+{
+    MockCompositor *comp = surface->comp;
+    MockFrame *pending = &surface->pending;
+    struct wl_resource *buffer = pending->buffer.resource;
+
+    if (!surface->syncobj) {
+        return EGL_TRUE;
+    }
+
+    if (pending->hasBuffer && buffer) {
+        if (!isDmabuf(buffer)) {
+            postError(comp, surface->syncobj,
+                      WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_UNSUPPORTED_BUFFER,
+                      "explicit sync needs a dma-buf");
+            return EGL_FALSE;
+        }
+        if (!pending->acquire.timeline) {
+            postError(comp, surface->syncobj,
+                      WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT,
+                      "no acquire point");
+            return EGL_FALSE;
+        }
+        if (!pending->release.timeline) {
+            postError(comp, surface->syncobj,
+                      WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT,
+                      "no release point");
+            return EGL_FALSE;
+        }
+        if (pending->acquire.timeline == pending->release.timeline &&
+            pending->acquire.point >= pending->release.point) {
+            postError(comp, surface->syncobj,
+                      WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS,
+                      "release point not after the acquire point");
+            return EGL_FALSE;
+        }
+    } else if (pending->acquire.timeline || pending->release.timeline) {
+        postError(comp, surface->syncobj,
+                  WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER,
+                  "sync points without a buffer");
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+static void surfaceCommit(struct wl_client *client,
+                          struct wl_resource *resource)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+    MockCompositor *comp = surface->comp;
+    MockFrame *pending = &surface->pending;
+    MockFrame *committed = &surface->committed;
+
+    (void) client;
+
+    if (!checkSyncPoints(surface)) {
+        return;
+    }
+    comp->stats.commits++;
+
+    if (pending->hasBuffer) {
+        /* Replaces a frame that never made it to the screen */
+        if (committed->hasBuffer) {
+            discardFrame(surface, committed);
+            comp->stats.framesDiscarded++;
+        }
+        moveBufferRef(&committed->buffer, &pending->buffer);
+        moveSyncPoint(&committed->acquire, &pending->acquire);
+        moveSyncPoint(&committed->release, &pending->release);
+        committed->hasBuffer = EGL_TRUE;
+        pending->hasBuffer = EGL_FALSE;
+    }
+
+    wl_list_insert_list(committed->frameCallbacks.prev,
+                        &pending->frameCallbacks);
+    wl_list_init(&pending->frameCallbacks);
+    wl_list_insert_list(committed->presentationFeedbacks.prev,
+                        &pending->presentationFeedbacks);
+    wl_list_init(&pending->presentationFeedbacks);
+
+    surface->hasCommitted = EGL_TRUE;
+
+    /* Without a refresh rate, every commit is shown right away */
+    if (comp->options.refreshMhz == 0) {
+        uint64_t now = getTimeNs();
+
+        comp->seq++;
+        latchFrame(surface, now);
+        sendFrameCallbacks(surface, now);
+        processReleases(comp, now);
+    }
+}
+
+static void surfaceOffset(struct wl_client *client,
+                          struct wl_resource *resource,
+                          int32_t x, int32_t y)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+}
+
+static const struct wl_surface_interface surfaceImpl = {
+    .destroy              = destroyResource,
+    .attach               = surfaceAttach,
+    .damage               = surfaceDamage,
+    .frame                = surfaceFrame,
+    .set_opaque_region    = surfaceSetRegion,
+    .set_input_region     = surfaceSetRegion,
+    .commit               = surfaceCommit,
+    .set_buffer_transform = surfaceSetInt,
+    .set_buffer_scale     = surfaceSetInt,
+    .damage_buffer        = surfaceDamage,
+    .offset               = surfaceOffset,
+};
+
+static void destroySurface(struct wl_resource *resource)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+    MockCompositor *comp = surface->comp;
+    MockRelease *entry, *tmp;
+
+    /* Nothing is on screen anymore, so everything is released right away */
+    clearFrame(&surface->pending);
+    discardFrame(surface, &surface->committed);
+    destroyResources(&surface->committed.frameCallbacks);
+    holdBuffer(surface, &surface->current, &surface->currentRelease,
+               getTimeNs());
+    wl_list_for_each_safe(entry, tmp, &surface->held, link) {
+        wl_list_remove(&entry->link);
+        releaseNow(comp, entry);
+    }
+    destroyResources(&surface->frameCallbacks);
+
+    if (surface->syncobj) {
+        wl_resource_set_user_data(surface->syncobj, NULL);
+    }
+    if (surface->eglStream != EGL_NO_STREAM_KHR) {
+        comp->destroyStream(comp->eglDisplay, surface->eglStream);
+    }
+
+    wl_list_remove(&surface->link);
+    free(surface);
+}
+
+/*
+ * wl_compositor
+ */
+
+static void regionModify(struct wl_client *client,
+                         struct wl_resource *resource,
+                         int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    (void) client;
+    (void) resource;
+    (void) x;
+    (void) y;
+    (void) width;
+    (void) height;
+}
+
+static const struct wl_region_interface regionImpl = {
+    .destroy  = destroyResource,
+    .add      = regionModify,
+    .subtract = regionModify,
+};
+
+static void compositorCreateSurface(struct wl_client *client,
+                                    struct wl_resource *resource,
+                                    uint32_t id)
+{
+    MockCompositor *comp = wl_resource_get_user_data(resource);
+    MockSurface *surface;
+
+    surface = calloc(1, sizeof(*surface));
+    if (!surface) {
+        goto fail;
+    }
+
+    surface->resource = wl_resource_create(client, &wl_surface_interface,
+                                           wl_resource_get_version(resource),
+                                           id);
+    if (!surface->resource) {
+        goto fail;
+    }
+
+    surface->comp = comp;
+    surface->eglStream = EGL_NO_STREAM_KHR;
+    initFrame(&surface->pending);
+    initFrame(&surface->committed);
+    wl_list_init(&surface->frameCallbacks);
+    wl_list_init(&surface->held);
+    wl_list_insert(&comp->surfaces, &surface->link);
+
+    wl_resource_set_implementation(surface->resource, &surfaceImpl, surface,
+                                   destroySurface);
+    return;
+
+fail:
+    free(surface);
+    wl_resource_post_no_memory(resource);
+}
+
+static void compositorCreateRegion(struct wl_client *client,
+                                   struct wl_resource *resource,
+                                   uint32_t id)
+{
+    struct wl_resource *region;
+
+    region = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(region, &regionImpl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositorImpl = {
+    .create_surface = compositorCreateSurface,
+    .create_region  = compositorCreateRegion,
+};
+
+static void bindCompositor(struct wl_client *client, void *data,
+                           uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource;
+
+    resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositorImpl, data, NULL);
+}
+
+/*
+ * zwp_linux_dmabuf_v1
+ */
+
+static const struct wl_buffer_interface dmabufBufferImpl = {
+    .destroy = destroyResource,
+};
+
+static EGLBoolean isDmabuf(struct wl_resource *buffer)
+{
+    return wl_resource_instance_of(buffer, &wl_buffer_interface,
+                                   &dmabufBufferImpl);
+}
+
+static void destroyDmabuf(struct wl_resource *resource)
+{
+    MockDmabuf *dmabuf = wl_resource_get_user_data(resource);
+
+    dmabuf->comp->stats.buffersAlive--;
+    dmabuf->comp->stats.bufferBytes -= dmabuf->size;
+    close(dmabuf->fd);
+    free(dmabuf);
+}
+
+static void destroyParams(struct wl_resource *resource)
+{
+    MockDmabufParams *params = wl_resource_get_user_data(resource);
+
+    if (params->fd >= 0) {
+        close(params->fd);
+    }
+    free(params);
+}
+
+static void paramsAdd(struct wl_client *client,
+                      struct wl_resource *resource,
+                      int32_t fd,
+                      uint32_t planeIdx,
+                      uint32_t offset,
+                      uint32_t stride,
+                      uint32_t modifierHi,
+                      uint32_t modifierLo)
+{
+    MockDmabufParams *params = wl_resource_get_user_data(resource);
+
+    (void) client;
+
+    if (params->used) {
+        postError(params->comp, resource,
+                  ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                  "params already used");
+    } else if (planeIdx != 0) {
+        postError(params->comp, resource,
+                  ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+                  "only single-plane formats are supported");
+    } else if (params->fd >= 0) {
+        postError(params->comp, resource,
+                  ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+                  "plane already set");
+    } else {
+        params->fd = fd;
+        params->offset = offset;
+        params->stride = stride;
+        params->modifier = ((uint64_t)modifierHi << 32) | modifierLo;
+        return;
+    }
+    close(fd);
+}
+
+static EGLBoolean isFormatSupported(uint32_t format, uint64_t modifier)
+{
+    size_t i;
+
+    if (modifier != DRM_FORMAT_MOD_LINEAR) {
+        return EGL_FALSE;
+    }
+    for (i = 0; i < MOCK_NUM_FORMATS; i++) {
+        if (mockFormats[i] == format) {
+            return EGL_TRUE;
+        }
+    }
+    return EGL_FALSE;
+}
+
+/*
+ * Creates the wl_buffer, with id 0 for a create request. Errors are posted
+ * for create_immed, and turned into a failed event for create.
+ */
+static void paramsCreateBuffer(struct wl_client *client,
+                               struct wl_resource *resource,
+                               uint32_t id,
+                               int32_t width,
+                               int32_t height,
+                               uint32_t format)
+{
+    MockDmabufParams *params = wl_resource_get_user_data(resource);
+    MockCompositor *comp = params->comp;
+    MockDmabuf *dmabuf = NULL;
+    struct wl_resource *buffer;
+    uint32_t error;
+    off_t size;
+
+    if (params->used) {
+        postError(comp, resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                  "params already used");
+        return;
+    }
+    params->used = EGL_TRUE;
+
+    if (params->fd < 0) {
+        error = ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE;
+        goto fail;
+    }
+    if (!isFormatSupported(format, params->modifier)) {
+        error = ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT;
+        goto fail;
+    }
+    if (width <= 0 || height <= 0) {
+        error = ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS;
+        goto fail;
+    }
+    size = lseek(params->fd, 0, SEEK_END);
+    if (size < 0 ||
+        (uint64_t)params->offset + (uint64_t)params->stride * height >
+            (uint64_t)size) {
+        error = ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS;
+        goto fail;
+    }
+
+    dmabuf = calloc(1, sizeof(*dmabuf));
+    if (!dmabuf) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    buffer = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if (!buffer) {
+        free(dmabuf);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    dmabuf->comp = comp;
+    dmabuf->fd = params->fd;
+    dmabuf->size = size;
+    params->fd = -1;
+    wl_resource_set_implementation(buffer, &dmabufBufferImpl, dmabuf,
+                                   destroyDmabuf);
+
+    comp->stats.buffersCreated++;
+    comp->stats.buffersAlive++;
+    comp->stats.bufferBytes += dmabuf->size;
+    if (comp->stats.bufferBytes > comp->stats.peakBufferBytes) {
+        comp->stats.peakBufferBytes = comp->stats.bufferBytes;
+    }
+
+    if (id == 0) {
+        zwp_linux_buffer_params_v1_send_created(resource, buffer);
+    }
+    return;
+
+fail:
+    if (id == 0) {
+        zwp_linux_buffer_params_v1_send_failed(resource);
+    } else {
+        postError(comp, resource, error, "invalid buffer");
+    }
+}
+
+static void paramsCreate(struct wl_client *client,
+                         struct wl_resource *resource,
+                         int32_t width,
+                         int32_t height,
+                         uint32_t format,
+                         uint32_t flags)
+{
+    (void) flags;
+
+    paramsCreateBuffer(client, resource, 0, width, height, format);
+}
+
+static void paramsCreateImmed(struct wl_client *client,
+                              struct wl_resource *resource,
+                              uint32_t id,
+                              int32_t width,
+                              int32_t height,
+                              uint32_t format,
+                              uint32_t flags)
+{
+    (void) flags;
+
+    paramsCreateBuffer(client, resource, id, width, height, format);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface paramsImpl = {
+    .destroy      = destroyResource,
+    .add          = paramsAdd,
+    .create       = paramsCreate,
+    .create_immed = paramsCreateImmed,
+};
+
+static void dmabufCreateParams(struct wl_client *client,
+                               struct wl_resource *resource,
+                               uint32_t id)
+{
+    MockDmabufParams *params;
+    struct wl_resource *paramsResource;
+
+    params = calloc(1, sizeof(*params));
+    if (!params) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    paramsResource = wl_resource_create(client,
+                                        &zwp_linux_buffer_params_v1_interface,
+                                        wl_resource_get_version(resource), id);
+    if (!paramsResource) {
+        free(params);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    params->comp = wl_resource_get_user_data(resource);
+    params->fd = -1;
+    wl_resource_set_implementation(paramsResource, &paramsImpl, params,
+                                   destroyParams);
+}
+
+static const struct zwp_linux_dmabuf_feedback_v1_interface feedbackImpl = {
+    .destroy = destroyResource,
+};
+
+static void dmabufGetFeedback(struct wl_client *client,
+                              struct wl_resource *resource,
+                              uint32_t id)
+{
+    MockCompositor *comp = wl_resource_get_user_data(resource);
+    struct wl_resource *feedback;
+
+    feedback = wl_resource_create(client,
+                                  &zwp_linux_dmabuf_feedback_v1_interface,
+                                  wl_resource_get_version(resource), id);
+    if (!feedback) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(feedback, &feedbackImpl, comp,
+                                   unlinkResource);
+    wl_list_insert(&comp->feedbacks, wl_resource_get_link(feedback));
+
+    sendFeedback(comp, feedback);
+}
+
+/* Every surface gets the default feedback */
+static void dmabufGetSurfaceFeedback(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     uint32_t id,
+                                     struct wl_resource *surface)
+{
+    (void) surface;
+
+    dmabufGetFeedback(client, resource, id);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface dmabufImpl = {
+    .destroy              = destroyResource,
+    .create_params        = dmabufCreateParams,
+    .get_default_feedback = dmabufGetFeedback,
+    .get_surface_feedback = dmabufGetSurfaceFeedback,
+};
+
+static void bindDmabuf(struct wl_client *client, void *data,
+                       uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource;
+    size_t i;
+
+    resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface,
+                                  version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &dmabufImpl, data, NULL);
+
+    /* Version 4 clients get formats from the feedback instead */
+    if (version < ZWP_LINUX_DMABUF_V1_GET_DEFAULT_FEEDBACK_SINCE_VERSION) {
+        for (i = 0; i < MOCK_NUM_FORMATS; i++) {
+            zwp_linux_dmabuf_v1_send_format(resource, mockFormats[i]);
+            zwp_linux_dmabuf_v1_send_modifier(resource, mockFormats[i],
+                                              DRM_FORMAT_MOD_LINEAR >> 32,
+                                              DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+        }
+    }
+}
+
+static int createFormatTable(MockCompositor *comp)
+{
+    MockFormatTableEntry table[MOCK_NUM_FORMATS];
+    size_t i;
+
+    memset(table, 0, sizeof(table));
+    for (i = 0; i < MOCK_NUM_FORMATS; i++) {
+        table[i].format = mockFormats[i];
+        table[i].modifier = DRM_FORMAT_MOD_LINEAR;
+    }
+
+    comp->formatTableFd = memfd_create("mock-format-table", MFD_CLOEXEC);
+    if (comp->formatTableFd < 0) {
+        return -1;
+    }
+    comp->formatTableSize = sizeof(table);
+    if (write(comp->formatTableFd, table, sizeof(table)) !=
+        (ssize_t)sizeof(table)) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * wp_presentation
+ */
+
+static void presentationFeedback(struct wl_client *client,
+                                 struct wl_resource *resource,
+                                 struct wl_resource *surfaceResource,
+                                 uint32_t id)
+{
+    MockSurface *surface = wl_resource_get_user_data(surfaceResource);
+    struct wl_resource *feedback;
+
+    feedback = wl_resource_create(client, &wp_presentation_feedback_interface,
+                                  1, id);
+    if (!feedback) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(feedback, NULL, NULL, unlinkResource);
+    wl_list_insert(surface->pending.presentationFeedbacks.prev,
+                   wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentationImpl = {
+    .destroy  = destroyResource,
+    .feedback = presentationFeedback,
+};
+
+static void bindPresentation(struct wl_client *client, void *data,
+                             uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource;
+
+    resource = wl_resource_create(client, &wp_presentation_interface,
+                                  version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &presentationImpl, data, NULL);
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+/*
+ * wp_linux_drm_syncobj_manager_v1
+ */
+
+static void destroyTimeline(struct wl_resource *resource)
+{
+    MockSyncPoint sp = { wl_resource_get_user_data(resource), 0 };
+
+    /* Drops the resource's reference */
+    setSyncPoint(&sp, NULL, 0);
+}
+
+static const struct wp_linux_drm_syncobj_timeline_v1_interface timelineImpl = {
+    .destroy = destroyResource,
+};
+
+static void setSurfacePoint(struct wl_resource *resource,
+                            struct wl_resource *timeline,
+                            uint32_t pointHi, uint32_t pointLo,
+                            EGLBoolean acquire)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+    MockSyncPoint *sp;
+
+    if (!surface) {
+        wl_resource_post_error(resource,
+                               WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE,
+                               "surface destroyed");
+        return;
+    }
+
+    sp = acquire ? &surface->pending.acquire : &surface->pending.release;
+    setSyncPoint(sp, wl_resource_get_user_data(timeline),
+                 ((uint64_t)pointHi << 32) | pointLo);
+}
+
+static void syncobjSurfaceSetAcquirePoint(struct wl_client *client,
+                                          struct wl_resource *resource,
+                                          struct wl_resource *timeline,
+                                          uint32_t pointHi, uint32_t pointLo)
+{
+    (void) client;
+
+    setSurfacePoint(resource, timeline, pointHi, pointLo, EGL_TRUE);
+}
+
+static void syncobjSurfaceSetReleasePoint(struct wl_client *client,
+                                          struct wl_resource *resource,
+                                          struct wl_resource *timeline,
+                                          uint32_t pointHi, uint32_t pointLo)
+{
+    (void) client;
+
+    setSurfacePoint(resource, timeline, pointHi, pointLo, EGL_FALSE);
+}
+
+static const struct wp_linux_drm_syncobj_surface_v1_interface syncobjSurfaceImpl = {
+    .destroy           = destroyResource,
+    .set_acquire_point = syncobjSurfaceSetAcquirePoint,
+    .set_release_point = syncobjSurfaceSetReleasePoint,
+};
+
+static void destroySyncobjSurface(struct wl_resource *resource)
+{
+    MockSurface *surface = wl_resource_get_user_data(resource);
+
+    if (surface) {
+        surface->syncobj = NULL;
+        setSyncPoint(&surface->pending.acquire, NULL, 0);
+        setSyncPoint(&surface->pending.release, NULL, 0);
+    }
+}
+
+static void syncobjGetSurface(struct wl_client *client,
+                              struct wl_resource *resource,
+                              uint32_t id,
+                              struct wl_resource *surfaceResource)
+{
+    MockCompositor *comp = wl_resource_get_user_data(resource);
+    MockSurface *surface = wl_resource_get_user_data(surfaceResource);
+    struct wl_resource *syncobj;
+
+    if (surface->syncobj) {
+        postError(comp, resource,
+                  WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS,
+                  "surface already has a syncobj surface");
+        return;
+    }
+
+    syncobj = wl_resource_create(client,
+                                 &wp_linux_drm_syncobj_surface_v1_interface,
+                                 wl_resource_get_version(resource), id);
+    if (!syncobj) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(syncobj, &syncobjSurfaceImpl, surface,
+                                   destroySyncobjSurface);
+    surface->syncobj = syncobj;
+}
+
+static void syncobjImportTimeline(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  uint32_t id,
+                                  int32_t fd)
+{
+    MockCompositor *comp = wl_resource_get_user_data(resource);
+    MockTimeline *timeline;
+    struct wl_resource *timelineResource;
+    uint32_t handle;
+    int ret;
+
+    ret = drmSyncobjFDToHandle(-1, fd, &handle);
+    close(fd);
+    if (ret) {
+        postError(comp, resource,
+                  WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE,
+                  "not a syncobj");
+        return;
+    }
+
+    timeline = calloc(1, sizeof(*timeline));
+    timelineResource = wl_resource_create(client,
+                                          &wp_linux_drm_syncobj_timeline_v1_interface,
+                                          wl_resource_get_version(resource),
+                                          id);
+    if (!timeline || !timelineResource) {
+        free(timeline);
+        drmSyncobjDestroy(-1, handle);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    timeline->refCount = 1;
+    timeline->handle = handle;
+    wl_resource_set_implementation(timelineResource, &timelineImpl, timeline,
+                                   destroyTimeline);
+}
+
+static const struct wp_linux_drm_syncobj_manager_v1_interface syncobjManagerImpl = {
+    .destroy         = destroyResource,
+    .get_surface     = syncobjGetSurface,
+    .import_timeline = syncobjImportTimeline,
+};
+
+static void bindSyncobjManager(struct wl_client *client, void *data,
+                               uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource;
+
+    resource = wl_resource_create(client,
+                                  &wp_linux_drm_syncobj_manager_v1_interface,
+                                  version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &syncobjManagerImpl, data, NULL);
+}
+
+/*
+ * wl_eglstream_controller
+ */
+
+static void controllerAttach(struct wl_client *client,
+                             struct wl_resource *resource,
+                             struct wl_resource *surfaceResource,
+                             struct wl_resource *buffer,
+                             struct wl_array *attribs)
+{
+    MockCompositor *comp = wl_resource_get_user_data(resource);
+    MockSurface *surface = wl_resource_get_user_data(surfaceResource);
+    EGLAttrib streamAttribs[] = {
+        EGL_WAYLAND_EGLSTREAM_WL, (EGLAttrib)buffer,
+        EGL_NONE
+    };
+    EGLStreamKHR stream;
+
+    (void) client;
+    (void) attribs; /* The present mode is up to the producer in the mock */
+
+    /* The platform turns the wl_eglstream into a stream, as in a compositor */
+    stream = comp->egl->createStreamAttrib(comp->eglDisplay, streamAttribs);
+    if (stream == EGL_NO_STREAM_KHR) {
+        return;
+    }
+    if (!comp->streamConsumerGLTexture(comp->eglDisplay, stream)) {
+        comp->destroyStream(comp->eglDisplay, stream);
+        return;
+    }
+
+    if (surface->eglStream != EGL_NO_STREAM_KHR) {
+        comp->destroyStream(comp->eglDisplay, surface->eglStream);
+    }
+    surface->eglStream = stream;
+}
+
+static void controllerAttachConsumer(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     struct wl_resource *surface,
+                                     struct wl_resource *buffer)
+{
+    controllerAttach(client, resource, surface, buffer, NULL);
+}
+
+static const struct wl_eglstream_controller_interface controllerImpl = {
+    .attach_eglstream_consumer        = controllerAttachConsumer,
+    .attach_eglstream_consumer_attribs = controllerAttach,
+};
+
+static void bindController(struct wl_client *client, void *data,
+                           uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource;
+
+    resource = wl_resource_create(client, &wl_eglstream_controller_interface,
+                                  version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &controllerImpl, data, NULL);
+}
+
+static EGLBoolean initEGLStream(MockCompositor *comp)
+{
+    PFNEGLINITIALIZEPROC initialize;
+
+    if (!comp->egl || !comp->egl->bindWaylandDisplay ||
+        !comp->egl->createStreamAttrib) {
+        return EGL_FALSE;
+    }
+
+    initialize = (PFNEGLINITIALIZEPROC)mockEglGetProcAddress("eglInitialize");
+    comp->streamConsumerGLTexture =
+        (PFNEGLSTREAMCONSUMERGLTEXTUREEXTERNALKHRPROC)
+        mockEglGetProcAddress("eglStreamConsumerGLTextureExternalKHR");
+    comp->streamConsumerAcquire =
+        (PFNEGLSTREAMCONSUMERACQUIREKHRPROC)
+        mockEglGetProcAddress("eglStreamConsumerAcquireKHR");
+    comp->destroyStream =
+        (PFNEGLDESTROYSTREAMKHRPROC)
+        mockEglGetProcAddress("eglDestroyStreamKHR");
+
+    /* The compositor renders on the device, like the client */
+    comp->eglDisplay = mockEglGetDeviceDisplay();
+    if (!initialize(comp->eglDisplay, NULL, NULL) ||
+        !comp->egl->bindWaylandDisplay(comp->egl->platform.data,
+                                       comp->eglDisplay, comp->display)) {
+        return EGL_FALSE;
+    }
+    comp->eglBound = EGL_TRUE;
+
+    return wl_global_create(comp->display, &wl_eglstream_controller_interface,
+                            2, comp, bindController) != NULL;
+}
+
+/*
+ * Commands
+ */
+
+static void runCommand(MockCompositor *comp, MockCommand *cmd)
+{
+    switch (cmd->type) {
+    case MOCK_COMMAND_CONNECT:
+        cmd->data = wl_client_create(comp->display, (int)cmd->value);
+        if (!cmd->data) {
+            close((int)cmd->value);
+        }
+        break;
+    case MOCK_COMMAND_SET_REFRESH:
+        setRefresh(comp, (uint32_t)cmd->value);
+        break;
+    case MOCK_COMMAND_SET_RELEASE_DELAY:
+        comp->options.releaseDelayUs = cmd->value;
+        break;
+    case MOCK_COMMAND_SET_HELD_BUFFERS:
+        comp->options.heldBuffers = (int)cmd->value;
+        break;
+    case MOCK_COMMAND_RESEND_FEEDBACK:
+        resendFeedback(comp);
+        break;
+    case MOCK_COMMAND_GET_STATS:
+        memcpy(cmd->data, &comp->stats, sizeof(comp->stats));
+        break;
+    case MOCK_COMMAND_STOP:
+        comp->running = EGL_FALSE;
+        break;
+    }
+}
+
+static int handleCommands(int fd, uint32_t mask, void *data)
+{
+    MockCompositor *comp = data;
+    MockCommand *cmd, *tmp;
+    uint64_t count;
+
+    (void) mask;
+
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&comp->mutex);
+    wl_list_for_each_safe(cmd, tmp, &comp->commands, link) {
+        wl_list_remove(&cmd->link);
+        runCommand(comp, cmd);
+        cmd->done = EGL_TRUE;
+    }
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->mutex);
+
+    return 0;
+}
+
+static void postCommand(MockCompositor *comp, MockCommand *cmd)
+{
+    uint64_t one = 1;
+
+    cmd->done = EGL_FALSE;
+
+    pthread_mutex_lock(&comp->mutex);
+    wl_list_insert(comp->commands.prev, &cmd->link);
+    if (write(comp->commandFd, &one, sizeof(one)) == sizeof(one)) {
+        while (!cmd->done) {
+            pthread_cond_wait(&comp->cond, &comp->mutex);
+        }
+    } else {
+        wl_list_remove(&cmd->link);
+    }
+    pthread_mutex_unlock(&comp->mutex);
+}
+
+static void *compositorThread(void *data)
+{
+    MockCompositor *comp = data;
+
+    while (comp->running) {
+        wl_display_flush_clients(comp->display);
+        if (wl_event_loop_dispatch(comp->loop, -1) < 0 && errno != EINTR) {
+            break;
+        }
+    }
+    wl_display_flush_clients(comp->display);
+
+    return NULL;
+}
+
+/*
+ * Public API
+ */
+
+static uint64_t getEnvU64(const char *name, uint64_t defaultValue)
+{
+    const char *str = getenv(name);
+
+    return str ? strtoull(str, NULL, 10) : defaultValue;
+}
+
+void mockCompositorGetDefaultOptions(MockCompositorOptions *options)
+{
+    options->refreshMhz       = getEnvU64("MOCK_COMPOSITOR_REFRESH_MHZ", 60000);
+    options->releaseDelayUs   = getEnvU64("MOCK_COMPOSITOR_RELEASE_DELAY_US", 0);
+    options->heldBuffers      = getEnvU64("MOCK_COMPOSITOR_HELD_BUFFERS", 0);
+    options->dmabufVersion    = getEnvU64("MOCK_COMPOSITOR_DMABUF_VERSION", 4);
+    options->feedbackInterval = getEnvU64("MOCK_COMPOSITOR_FEEDBACK_INTERVAL", 0);
+    options->presentation     = !!getEnvU64("MOCK_COMPOSITOR_PRESENTATION", 1);
+    options->explicitSync     = !!getEnvU64("MOCK_COMPOSITOR_EXPLICIT_SYNC", 1);
+    options->eglstream        = !!getEnvU64("MOCK_COMPOSITOR_EGLSTREAM", 0);
+    options->roundtripDelayUs = getEnvU64("MOCK_COMPOSITOR_ROUNDTRIP_DELAY_US", 0);
+}
+
+/*
+ * Counts the traffic. Stalling here delays the wl_display.sync callback, and
+ * so the client's roundtrip, by as much.
+ */
+static void logProtocol(void *data, enum wl_protocol_logger_type direction,
+                        const struct wl_protocol_logger_message *message)
+{
+    MockCompositor *comp = data;
+
+    if (direction == WL_PROTOCOL_LOGGER_EVENT) {
+        comp->stats.events++;
+        return;
+    }
+
+    comp->stats.requests++;
+    if (!strcmp(wl_resource_get_class(message->resource), "wl_display") &&
+        !strcmp(message->message->name, "sync")) {
+        comp->stats.roundtrips++;
+        if (comp->options.roundtripDelayUs) {
+            usleep(comp->options.roundtripDelayUs);
+        }
+    }
+}
+
+static EGLBoolean addGlobals(MockCompositor *comp)
+{
+    struct stat st;
+
+    if (!wl_global_create(comp->display, &wl_compositor_interface, 4, comp,
+                          bindCompositor)) {
+        return EGL_FALSE;
+    }
+
+    if (comp->options.dmabufVersion) {
+        if (stat(mockEglGetOptions()->drmNode, &st) < 0 ||
+            createFormatTable(comp) < 0) {
+            return EGL_FALSE;
+        }
+        comp->mainDevice = st.st_rdev;
+
+        if (!wl_global_create(comp->display, &zwp_linux_dmabuf_v1_interface,
+                              comp->options.dmabufVersion, comp, bindDmabuf)) {
+            return EGL_FALSE;
+        }
+    }
+
+    if (comp->options.presentation &&
+        !wl_global_create(comp->display, &wp_presentation_interface, 1, comp,
+                          bindPresentation)) {
+        return EGL_FALSE;
+    }
+
+    if (comp->options.explicitSync &&
+        !wl_global_create(comp->display,
+                          &wp_linux_drm_syncobj_manager_v1_interface, 1, comp,
+                          bindSyncobjManager)) {
+        return EGL_FALSE;
+    }
+
+    if (comp->options.eglstream && !initEGLStream(comp)) {
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+MockCompositor *mockCompositorCreate(const MockCompositorOptions *options,
+                                     MockEgl *egl)
+{
+    MockCompositor *comp;
+
+    comp = calloc(1, sizeof(*comp));
+    if (!comp) {
+        return NULL;
+    }
+
+    comp->options = *options;
+    comp->egl = egl;
+    comp->eglDisplay = EGL_NO_DISPLAY;
+    comp->commandFd = -1;
+    comp->refreshFd = -1;
+    comp->releaseFd = -1;
+    comp->formatTableFd = -1;
+    pthread_mutex_init(&comp->mutex, NULL);
+    pthread_cond_init(&comp->cond, NULL);
+    wl_list_init(&comp->commands);
+    wl_list_init(&comp->releases);
+    wl_list_init(&comp->surfaces);
+    wl_list_init(&comp->feedbacks);
+
+    comp->display = wl_display_create();
+    if (!comp->display) {
+        goto fail;
+    }
+    comp->loop = wl_display_get_event_loop(comp->display);
+
+    comp->logger = wl_display_add_protocol_logger(comp->display, logProtocol,
+                                                  comp);
+    if (!comp->logger) {
+        goto fail;
+    }
+
+    comp->commandFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    comp->refreshFd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_CLOEXEC | TFD_NONBLOCK);
+    comp->releaseFd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_CLOEXEC | TFD_NONBLOCK);
+    if (comp->commandFd < 0 || comp->refreshFd < 0 || comp->releaseFd < 0) {
+        goto fail;
+    }
+
+    comp->commandSource = wl_event_loop_add_fd(comp->loop, comp->commandFd,
+                                               WL_EVENT_READABLE,
+                                               handleCommands, comp);
+    comp->refreshSource = wl_event_loop_add_fd(comp->loop, comp->refreshFd,
+                                               WL_EVENT_READABLE,
+                                               handleRefreshTimer, comp);
+    comp->releaseSource = wl_event_loop_add_fd(comp->loop, comp->releaseFd,
+                                               WL_EVENT_READABLE,
+                                               handleReleaseTimer, comp);
+    if (!comp->commandSource || !comp->refreshSource || !comp->releaseSource) {
+        goto fail;
+    }
+
+    if (!addGlobals(comp)) {
+        goto fail;
+    }
+    setRefresh(comp, comp->options.refreshMhz);
+
+    comp->running = EGL_TRUE;
+    if (pthread_create(&comp->thread, NULL, compositorThread, comp)) {
+        comp->running = EGL_FALSE;
+        goto fail;
+    }
+
+    return comp;
+
+fail:
+    mockCompositorDestroy(comp);
+    return NULL;
+}
+
+void mockCompositorDestroy(MockCompositor *comp)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_STOP };
+    MockRelease *release, *tmp;
+
+    if (!comp) {
+        return;
+    }
+
+    if (comp->running) {
+        postCommand(comp, &cmd);
+        pthread_join(comp->thread, NULL);
+    }
+
+    if (comp->display) {
+        /* Surfaces go with their clients, and release their buffers */
+        wl_display_destroy_clients(comp->display);
+        wl_list_for_each_safe(release, tmp, &comp->releases, link) {
+            wl_list_remove(&release->link);
+            releaseNow(comp, release);
+        }
+        if (comp->eglBound) {
+            comp->egl->unbindWaylandDisplay(comp->eglDisplay, comp->display);
+        }
+        if (comp->commandSource) {
+            wl_event_source_remove(comp->commandSource);
+        }
+        if (comp->refreshSource) {
+            wl_event_source_remove(comp->refreshSource);
+        }
+        if (comp->releaseSource) {
+            wl_event_source_remove(comp->releaseSource);
+        }
+        if (comp->logger) {
+            wl_protocol_logger_destroy(comp->logger);
+        }
+        wl_display_destroy(comp->display);
+    }
+
+    if (comp->commandFd >= 0) {
+        close(comp->commandFd);
+    }
+    if (comp->refreshFd >= 0) {
+        close(comp->refreshFd);
+    }
+    if (comp->releaseFd >= 0) {
+        close(comp->releaseFd);
+    }
+    if (comp->formatTableFd >= 0) {
+        close(comp->formatTableFd);
+    }
+    pthread_mutex_destroy(&comp->mutex);
+    pthread_cond_destroy(&comp->cond);
+    free(comp);
+}
+
+struct wl_display *mockCompositorConnect(MockCompositor *comp)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_CONNECT };
+    struct wl_display *display;
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        return NULL;
+    }
+
+    cmd.value = fds[0];
+    postCommand(comp, &cmd);
+    if (!cmd.data) {
+        close(fds[1]);
+        return NULL;
+    }
+
+    display = wl_display_connect_to_fd(fds[1]);
+    if (!display) {
+        close(fds[1]);
+    }
+    return display;
+}
+
+void mockCompositorSetRefresh(MockCompositor *comp, uint32_t refreshMhz)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_SET_REFRESH, .value = refreshMhz };
+
+    postCommand(comp, &cmd);
+}
+
+void mockCompositorSetReleaseDelay(MockCompositor *comp, uint64_t delayUs)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_SET_RELEASE_DELAY, .value = delayUs };
+
+    postCommand(comp, &cmd);
+}
+
+void mockCompositorSetHeldBuffers(MockCompositor *comp, int heldBuffers)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_SET_HELD_BUFFERS, .value = heldBuffers };
+
+    postCommand(comp, &cmd);
+}
+
+void mockCompositorResendFeedback(MockCompositor *comp)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_RESEND_FEEDBACK };
+
+    postCommand(comp, &cmd);
+}
+
+void mockCompositorGetStats(MockCompositor *comp, MockCompositorStats *stats)
+{
+    MockCommand cmd = { .type = MOCK_COMMAND_GET_STATS, .data = stats };
+
+    postCommand(comp, &cmd);
+}
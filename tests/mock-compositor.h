@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOCK_COMPOSITOR_H
+#define MOCK_COMPOSITOR_H
+
+#include <stdint.h>
+#include <EGL/egl.h>
+
+#include "mock-egl-driver.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Headless stand-in compositor
+ *
+ * A libwayland-server compositor running on its own thread, in the same
+ * process as the client, so the whole platform can be exercised against the
+ * mock EGL driver. It implements what the platform talks to:
+ *
+ *  - wl_compositor, with frame callbacks sent on every refresh
+ *  - zwp_linux_dmabuf_v1 version 3 or 4, with default and surface feedback
+ *  - wp_presentation
+ *  - wp_linux_drm_syncobj_manager_v1, signalling release points through
+ *    mock-drm
+ *  - wl_eglstream_display, bound through the platform's
+ *    eglBindWaylandDisplayWL, and wl_eglstream_controller
+ *
+ * Buffers are latched on the next refresh after they are committed, or right
+ * away when refreshMhz is 0. The buffer they replace is kept for heldBuffers
+ * more replacements, as KWin does, and released releaseDelayUs after that.
+ * Protocol errors the compositor posts are counted in the stats, and so are
+ * the requests and events it sees and the roundtrips clients make, which can
+ * be slowed down by roundtripDelayUs to stand in for a busy or remote
+ * compositor.
+ *
+ * Every option can also be set from the environment, see
+ * mockCompositorGetDefaultOptions(), and changed while running with the
+ * setters below.
+ */
+
+typedef struct MockCompositorRec MockCompositor;
+
+typedef struct MockCompositorOptionsRec {
+    uint32_t   refreshMhz;       /* MOCK_COMPOSITOR_REFRESH_MHZ */
+    uint64_t   releaseDelayUs;   /* MOCK_COMPOSITOR_RELEASE_DELAY_US */
+    int        heldBuffers;      /* MOCK_COMPOSITOR_HELD_BUFFERS */
+    int        dmabufVersion;    /* MOCK_COMPOSITOR_DMABUF_VERSION: 0, 3 or 4 */
+    int        feedbackInterval; /* MOCK_COMPOSITOR_FEEDBACK_INTERVAL: re-send every N refreshes */
+    EGLBoolean presentation;     /* MOCK_COMPOSITOR_PRESENTATION */
+    EGLBoolean explicitSync;     /* MOCK_COMPOSITOR_EXPLICIT_SYNC */
+    EGLBoolean eglstream;        /* MOCK_COMPOSITOR_EGLSTREAM: needs a loaded platform */
+    uint64_t   roundtripDelayUs; /* MOCK_COMPOSITOR_ROUNDTRIP_DELAY_US: before answering wl_display.sync */
+} MockCompositorOptions;
+
+typedef struct MockCompositorStatsRec {
+    uint64_t refreshes;
+    uint64_t commits;
+    uint64_t framesPresented;
+    uint64_t framesDiscarded;   /* Replaced before being latched */
+    uint64_t frameCallbacks;
+    uint64_t buffersCreated;
+    uint64_t buffersReleased;
+    uint64_t buffersAlive;
+    uint64_t bufferBytes;       /* Size of the live dma-bufs */
+    uint64_t peakBufferBytes;
+    uint64_t feedbackSends;
+    uint64_t unsignaledAcquires; /* Latched before the acquire point signalled */
+    uint64_t protocolErrors;
+    uint64_t eglstreamFrames;
+    uint64_t requests;
+    uint64_t events;
+    uint64_t roundtrips;        /* wl_display.sync requests */
+} MockCompositorStats;
+
+/* Defaults, overridden by the MOCK_COMPOSITOR_* environment variables */
+void mockCompositorGetDefaultOptions(MockCompositorOptions *options);
+
+/*
+ * Starts the compositor thread. egl is the platform loaded on the mock
+ * driver, and is only used for wl_eglstream support. Returns NULL on
+ * failure.
+ */
+MockCompositor *mockCompositorCreate(const MockCompositorOptions *options,
+                                     MockEgl *egl);
+void mockCompositorDestroy(MockCompositor *comp);
+
+/*
+ * The calls below are carried out on the compositor thread, and return once
+ * it has done so.
+ */
+
+/* Connects a new client, to be disconnected with wl_display_disconnect() */
+struct wl_display *mockCompositorConnect(MockCompositor *comp);
+
+void mockCompositorSetRefresh(MockCompositor *comp, uint32_t refreshMhz);
+void mockCompositorSetReleaseDelay(MockCompositor *comp, uint64_t delayUs);
+void mockCompositorSetHeldBuffers(MockCompositor *comp, int heldBuffers);
+
+/* Sends every dma-buf feedback object its feedback again */
+void mockCompositorResendFeedback(MockCompositor *comp);
+
+void mockCompositorGetStats(MockCompositor *comp, MockCompositorStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,673 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mock-drm.h"
+
+#include <xf86drm.h>
+#include <wayland-util.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MOCK_DRM_DEFAULT_NODE "/dev/null"
+
+/*
+ * A syncobj. Point 0 is the binary payload, any other point is a timeline
+ * point. Since every fence is signalled when attached, a point becomes
+ * available and signalled at the same time.
+ */
+typedef struct MockDrmSyncobjRec {
+    int             refCount;
+    int             fd;          /* memfd standing in for the syncobj file */
+    dev_t           dev;
+    ino_t           ino;
+    int             binarySignaled;
+    uint64_t        value;       /* Highest signalled timeline point */
+} MockDrmSyncobj;
+
+typedef struct MockDrmEventfdRec {
+    MockDrmSyncobj *syncobj;
+    uint64_t        point;
+    int             fd;
+    struct wl_list  link;
+} MockDrmEventfd;
+
+static struct {
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;
+    pthread_once_t   once;
+
+    MockDrmSyncobj **handles;    /* Indexed by handle - 1 */
+    uint32_t         numHandles;
+    struct wl_list   eventfds;
+
+    char            *node;
+    MockDrmStats     stats;
+} mockDrm = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .once  = PTHREAD_ONCE_INIT,
+};
+
+static void mockDrmInit(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&mockDrm.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    wl_list_init(&mockDrm.eventfds);
+}
+
+/* Takes the lock and counts the call as an ioctl */
+static void mockDrmLock(void)
+{
+    pthread_once(&mockDrm.once, mockDrmInit);
+    pthread_mutex_lock(&mockDrm.mutex);
+    mockDrm.stats.ioctls++;
+}
+
+static void mockDrmUnlock(void)
+{
+    pthread_mutex_unlock(&mockDrm.mutex);
+}
+
+/* libdrm returns -1 and sets errno for everything but the waits */
+static int mockDrmFail(int err)
+{
+    errno = err;
+    return -1;
+}
+
+void mockDrmSetDeviceNode(const char *node)
+{
+    pthread_once(&mockDrm.once, mockDrmInit);
+    pthread_mutex_lock(&mockDrm.mutex);
+    free(mockDrm.node);
+    mockDrm.node = node ? strdup(node) : NULL;
+    pthread_mutex_unlock(&mockDrm.mutex);
+}
+
+void mockDrmGetStats(MockDrmStats *stats)
+{
+    pthread_once(&mockDrm.once, mockDrmInit);
+    pthread_mutex_lock(&mockDrm.mutex);
+    *stats = mockDrm.stats;
+    pthread_mutex_unlock(&mockDrm.mutex);
+}
+
+/*
+ * Device queries
+ */
+
+static int mockDrmCreateDevice(drmDevicePtr *device)
+{
+    const char         *node;
+    drmDevicePtr        dev;
+    drmPciBusInfoPtr    busInfo;
+    drmPciDeviceInfoPtr devInfo;
+    char              **nodes;
+    char               *name;
+    size_t              len;
+
+    pthread_mutex_lock(&mockDrm.mutex);
+    node = mockDrm.node ? mockDrm.node : MOCK_DRM_DEFAULT_NODE;
+    len = strlen(node) + 1;
+
+    /* Single allocation, the way libdrm does it, so drmFreeDevice() is free() */
+    dev = calloc(1, sizeof(*dev) + DRM_NODE_MAX * sizeof(*nodes) +
+                    sizeof(*busInfo) + sizeof(*devInfo) + len);
+    if (!dev) {
+        pthread_mutex_unlock(&mockDrm.mutex);
+        return -ENOMEM;
+    }
+
+    nodes   = (char **)(dev + 1);
+    busInfo = (drmPciBusInfoPtr)(nodes + DRM_NODE_MAX);
+    devInfo = (drmPciDeviceInfoPtr)(busInfo + 1);
+    name    = (char *)(devInfo + 1);
+    memcpy(name, node, len);
+    pthread_mutex_unlock(&mockDrm.mutex);
+
+    nodes[DRM_NODE_PRIMARY] = name;
+    nodes[DRM_NODE_RENDER]  = name;
+
+    devInfo->vendor_id = 0x10de;
+    devInfo->device_id = 0xffff;
+
+    dev->nodes              = nodes;
+    dev->available_nodes    = (1 << DRM_NODE_PRIMARY) | (1 << DRM_NODE_RENDER);
+    dev->bustype            = DRM_BUS_PCI;
+    dev->businfo.pci        = busInfo;
+    dev->deviceinfo.pci     = devInfo;
+
+    *device = dev;
+    return 0;
+}
+
+WL_EXPORT int drmGetDevice(int fd, drmDevicePtr *device)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        return -errno;
+    }
+
+    pthread_once(&mockDrm.once, mockDrmInit);
+    return mockDrmCreateDevice(device);
+}
+
+WL_EXPORT int drmGetDeviceFromDevId(dev_t devId, uint32_t flags,
+                                    drmDevicePtr *device)
+{
+    struct stat st;
+    int         ret;
+
+    (void) flags;
+
+    pthread_once(&mockDrm.once, mockDrmInit);
+
+    pthread_mutex_lock(&mockDrm.mutex);
+    ret = stat(mockDrm.node ? mockDrm.node : MOCK_DRM_DEFAULT_NODE, &st);
+    pthread_mutex_unlock(&mockDrm.mutex);
+
+    if (ret != 0 || st.st_rdev != devId) {
+        return -ENODEV;
+    }
+
+    return mockDrmCreateDevice(device);
+}
+
+WL_EXPORT void drmFreeDevice(drmDevicePtr *device)
+{
+    if (device) {
+        free(*device);
+        *device = NULL;
+    }
+}
+
+WL_EXPORT drmVersionPtr drmGetVersion(int fd)
+{
+    static const char name[] = "nvidia-drm";
+    static const char date[] = "20160202";
+    static const char desc[] = "Mock NVIDIA DRM driver";
+    drmVersionPtr     version;
+    char             *str;
+    struct stat       st;
+
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+
+    version = calloc(1, sizeof(*version) + sizeof(name) + sizeof(date) +
+                        sizeof(desc));
+    if (!version) {
+        return NULL;
+    }
+
+    str = (char *)(version + 1);
+
+    version->version_major      = 0;
+    version->version_minor      = 0;
+    version->version_patchlevel = 0;
+
+    version->name_len = sizeof(name) - 1;
+    version->name     = memcpy(str, name, sizeof(name));
+    str += sizeof(name);
+    version->date_len = sizeof(date) - 1;
+    version->date     = memcpy(str, date, sizeof(date));
+    str += sizeof(date);
+    version->desc_len = sizeof(desc) - 1;
+    version->desc     = memcpy(str, desc, sizeof(desc));
+
+    return version;
+}
+
+WL_EXPORT void drmFreeVersion(drmVersionPtr version)
+{
+    free(version);
+}
+
+/*
+ * Syncobjs. All of these must be called with the lock held.
+ */
+
+static MockDrmSyncobj *lookupSyncobj(uint32_t handle)
+{
+    if (handle == 0 || handle > mockDrm.numHandles) {
+        return NULL;
+    }
+    return mockDrm.handles[handle - 1];
+}
+
+static int addHandle(MockDrmSyncobj *syncobj, uint32_t *handle)
+{
+    MockDrmSyncobj **handles;
+    uint32_t         i;
+
+    for (i = 0; i < mockDrm.numHandles; i++) {
+        if (!mockDrm.handles[i]) {
+            break;
+        }
+    }
+
+    if (i == mockDrm.numHandles) {
+        handles = realloc(mockDrm.handles,
+                          (mockDrm.numHandles + 16) * sizeof(*handles));
+        if (!handles) {
+            return -ENOMEM;
+        }
+        memset(handles + mockDrm.numHandles, 0, 16 * sizeof(*handles));
+        mockDrm.handles = handles;
+        mockDrm.numHandles += 16;
+    }
+
+    mockDrm.handles[i] = syncobj;
+    syncobj->refCount++;
+    mockDrm.stats.syncobjs++;
+    *handle = i + 1;
+
+    return 0;
+}
+
+static void unrefSyncobj(MockDrmSyncobj *syncobj)
+{
+    MockDrmEventfd *eventfd, *next;
+
+    if (--syncobj->refCount > 0) {
+        return;
+    }
+
+    /* Nothing can signal these anymore */
+    wl_list_for_each_safe(eventfd, next, &mockDrm.eventfds, link) {
+        if (eventfd->syncobj == syncobj) {
+            wl_list_remove(&eventfd->link);
+            close(eventfd->fd);
+            free(eventfd);
+        }
+    }
+
+    close(syncobj->fd);
+    free(syncobj);
+}
+
+static int isSignaled(const MockDrmSyncobj *syncobj, uint64_t point)
+{
+    return point ? syncobj->value >= point : syncobj->binarySignaled;
+}
+
+static void signalEventfd(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0) {
+        /* The counter saturating just means the fd stays readable */
+    }
+}
+
+static void signalSyncobj(MockDrmSyncobj *syncobj, uint64_t point)
+{
+    MockDrmEventfd *eventfd, *next;
+
+    if (point == 0) {
+        syncobj->binarySignaled = 1;
+    } else if (point > syncobj->value) {
+        syncobj->value = point;
+    }
+
+    wl_list_for_each_safe(eventfd, next, &mockDrm.eventfds, link) {
+        if (eventfd->syncobj == syncobj &&
+            isSignaled(syncobj, eventfd->point)) {
+            signalEventfd(eventfd->fd);
+            wl_list_remove(&eventfd->link);
+            close(eventfd->fd);
+            free(eventfd);
+        }
+    }
+
+    pthread_cond_broadcast(&mockDrm.cond);
+}
+
+WL_EXPORT int drmSyncobjCreate(int fd, uint32_t flags, uint32_t *handle)
+{
+    MockDrmSyncobj *syncobj;
+    struct stat     st;
+    int             ret;
+
+    (void) fd;
+
+    syncobj = calloc(1, sizeof(*syncobj));
+    if (!syncobj) {
+        return mockDrmFail(ENOMEM);
+    }
+
+    /* Gives the syncobj an identity that survives passing it around as fd */
+    syncobj->fd = memfd_create("mock-drm-syncobj", MFD_CLOEXEC);
+    if (syncobj->fd < 0 || fstat(syncobj->fd, &st) != 0) {
+        ret = errno;
+        if (syncobj->fd >= 0) {
+            close(syncobj->fd);
+        }
+        free(syncobj);
+        return mockDrmFail(ret);
+    }
+    syncobj->dev = st.st_dev;
+    syncobj->ino = st.st_ino;
+    syncobj->binarySignaled = !!(flags & DRM_SYNCOBJ_CREATE_SIGNALED);
+
+    mockDrmLock();
+    ret = addHandle(syncobj, handle);
+    mockDrmUnlock();
+
+    if (ret) {
+        close(syncobj->fd);
+        free(syncobj);
+        return mockDrmFail(-ret);
+    }
+
+    return 0;
+}
+
+WL_EXPORT int drmSyncobjDestroy(int fd, uint32_t handle)
+{
+    MockDrmSyncobj *syncobj;
+
+    (void) fd;
+
+    mockDrmLock();
+    syncobj = lookupSyncobj(handle);
+    if (syncobj) {
+        mockDrm.handles[handle - 1] = NULL;
+        mockDrm.stats.syncobjs--;
+        unrefSyncobj(syncobj);
+    }
+    mockDrmUnlock();
+
+    return syncobj ? 0 : mockDrmFail(EINVAL);
+}
+
+WL_EXPORT int drmSyncobjHandleToFD(int fd, uint32_t handle, int *objFd)
+{
+    MockDrmSyncobj *syncobj;
+    int             ret = 0;
+
+    (void) fd;
+
+    mockDrmLock();
+    syncobj = lookupSyncobj(handle);
+    if (!syncobj) {
+        ret = mockDrmFail(EINVAL);
+    } else if ((*objFd = fcntl(syncobj->fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        ret = -1;
+    }
+    mockDrmUnlock();
+
+    return ret;
+}
+
+WL_EXPORT int drmSyncobjFDToHandle(int fd, int objFd, uint32_t *handle)
+{
+    MockDrmSyncobj *syncobj = NULL;
+    struct stat     st;
+    uint32_t        i;
+    int             ret;
+
+    (void) fd;
+
+    if (fstat(objFd, &st) != 0) {
+        return -1;
+    }
+
+    mockDrmLock();
+    for (i = 0; i < mockDrm.numHandles; i++) {
+        if (mockDrm.handles[i] &&
+            mockDrm.handles[i]->dev == st.st_dev &&
+            mockDrm.handles[i]->ino == st.st_ino) {
+            syncobj = mockDrm.handles[i];
+            break;
+        }
+    }
+    ret = syncobj ? addHandle(syncobj, handle) : -EINVAL;
+    mockDrmUnlock();
+
+    return ret ? mockDrmFail(-ret) : 0;
+}
+
+WL_EXPORT int drmSyncobjImportSyncFile(int fd, uint32_t handle, int syncFileFd)
+{
+    MockDrmSyncobj *syncobj;
+
+    (void) fd;
+
+    if (fcntl(syncFileFd, F_GETFD) < 0) {
+        return mockDrmFail(EINVAL);
+    }
+
+    mockDrmLock();
+    syncobj = lookupSyncobj(handle);
+    if (syncobj) {
+        signalSyncobj(syncobj, 0);
+    }
+    mockDrmUnlock();
+
+    return syncobj ? 0 : mockDrmFail(EINVAL);
+}
+
+WL_EXPORT int drmSyncobjExportSyncFile(int fd, uint32_t handle, int *syncFileFd)
+{
+    MockDrmSyncobj *syncobj;
+    int             ret = 0;
+
+    (void) fd;
+
+    mockDrmLock();
+    syncobj = lookupSyncobj(handle);
+    if (!syncobj || !syncobj->binarySignaled) {
+        /* No fence to export */
+        ret = mockDrmFail(EINVAL);
+    } else if ((*syncFileFd = eventfd(1, EFD_CLOEXEC)) < 0) {
+        ret = -1;
+    }
+    mockDrmUnlock();
+
+    return ret;
+}
+
+WL_EXPORT int drmSyncobjTransfer(int fd,
+                                 uint32_t dstHandle, uint64_t dstPoint,
+                                 uint32_t srcHandle, uint64_t srcPoint,
+                                 uint32_t flags)
+{
+    MockDrmSyncobj *dst, *src;
+    int             ret = 0;
+
+    (void) fd;
+    (void) flags;
+
+    mockDrmLock();
+    dst = lookupSyncobj(dstHandle);
+    src = lookupSyncobj(srcHandle);
+    if (!dst || !src || !isSignaled(src, srcPoint)) {
+        /* The kernel has no fence to transfer either */
+        ret = mockDrmFail(EINVAL);
+    } else {
+        signalSyncobj(dst, dstPoint);
+    }
+    mockDrmUnlock();
+
+    return ret;
+}
+
+WL_EXPORT int drmSyncobjTimelineSignal(int fd, const uint32_t *handles,
+                                       uint64_t *points, uint32_t count)
+{
+    MockDrmSyncobj *syncobj;
+    uint32_t        i;
+    int             ret = 0;
+
+    (void) fd;
+
+    mockDrmLock();
+    for (i = 0; i < count; i++) {
+        if (!lookupSyncobj(handles[i])) {
+            ret = mockDrmFail(EINVAL);
+            goto done;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        syncobj = lookupSyncobj(handles[i]);
+        signalSyncobj(syncobj, points ? points[i] : 0);
+    }
+
+done:
+    mockDrmUnlock();
+    return ret;
+}
+
+WL_EXPORT int drmSyncobjQuery(int fd, uint32_t *handles, uint64_t *points,
+                              uint32_t count)
+{
+    MockDrmSyncobj *syncobj;
+    uint32_t        i;
+    int             ret = 0;
+
+    (void) fd;
+
+    mockDrmLock();
+    for (i = 0; i < count; i++) {
+        syncobj = lookupSyncobj(handles[i]);
+        if (!syncobj) {
+            ret = mockDrmFail(EINVAL);
+            break;
+        }
+        points[i] = syncobj->value;
+    }
+    mockDrmUnlock();
+
+    return ret;
+}
+
+/*
+ * Follows the kernel: the timeout is absolute on CLOCK_MONOTONIC, and errors
+ * come back as -errno with errno set as well.
+ */
+WL_EXPORT int drmSyncobjTimelineWait(int fd, uint32_t *handles,
+                                     uint64_t *points, unsigned numHandles,
+                                     int64_t timeoutNs, unsigned flags,
+                                     uint32_t *firstSignaled)
+{
+    MockDrmSyncobj *syncobj;
+    struct timespec ts;
+    unsigned        i, signaled, first;
+    int             ret = 0;
+
+    (void) fd;
+
+    ts.tv_sec  = timeoutNs / 1000000000;
+    ts.tv_nsec = timeoutNs % 1000000000;
+
+    mockDrmLock();
+    while (1) {
+        signaled = 0;
+        first = numHandles;
+
+        for (i = 0; i < numHandles; i++) {
+            syncobj = lookupSyncobj(handles[i]);
+            if (!syncobj) {
+                ret = -EINVAL;
+                goto done;
+            }
+            if (isSignaled(syncobj, points ? points[i] : 0)) {
+                signaled++;
+                if (first == numHandles) {
+                    first = i;
+                }
+            }
+        }
+
+        if ((flags & DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL) ?
+                signaled == numHandles : signaled > 0) {
+            if (firstSignaled) {
+                *firstSignaled = first;
+            }
+            break;
+        }
+
+        if (timeoutNs == INT64_MAX) {
+            pthread_cond_wait(&mockDrm.cond, &mockDrm.mutex);
+        } else if (pthread_cond_timedwait(&mockDrm.cond, &mockDrm.mutex,
+                                          &ts) == ETIMEDOUT) {
+            ret = -ETIME;
+            break;
+        }
+    }
+
+done:
+    mockDrmUnlock();
+
+    if (ret) {
+        errno = -ret;
+    }
+    return ret;
+}
+
+#if defined(HAVE_DRMSYNCOBJEVENTFD)
+WL_EXPORT int drmSyncobjEventfd(int fd, uint32_t handle, uint64_t point,
+                                int evFd, uint32_t flags)
+{
+    MockDrmSyncobj *syncobj;
+    MockDrmEventfd *eventfd;
+    int             ret = 0;
+
+    (void) fd;
+    (void) flags;
+
+    mockDrmLock();
+    syncobj = lookupSyncobj(handle);
+    if (!syncobj) {
+        ret = mockDrmFail(EINVAL);
+    } else if (isSignaled(syncobj, point)) {
+        signalEventfd(evFd);
+    } else if (!(eventfd = calloc(1, sizeof(*eventfd)))) {
+        ret = mockDrmFail(ENOMEM);
+    } else if ((eventfd->fd = fcntl(evFd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        free(eventfd);
+        ret = -1;
+    } else {
+        /* The kernel keeps a reference on the eventfd, not on the syncobj */
+        eventfd->syncobj = syncobj;
+        eventfd->point = point;
+        wl_list_insert(&mockDrm.eventfds, &eventfd->link);
+    }
+    mockDrmUnlock();
+
+    return ret;
+}
+#endif
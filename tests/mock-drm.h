@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOCK_DRM_H
+#define MOCK_DRM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-process stand-in for the libdrm calls made by the platform
+ *
+ * mock-drm.c defines the libdrm functions the platform uses. Executables are
+ * linked with -export-dynamic, so the platform library binds to these instead
+ * of the real ones. The device queries describe an NVIDIA PCI device whose
+ * primary and render nodes are both the configured node, and syncobjs live
+ * in a process-wide table, shared by the client and a compositor running in
+ * the same process. Every fence attached to a syncobj is already signalled,
+ * which matches what the mock EGL driver hands out.
+ */
+
+typedef struct MockDrmStatsRec {
+    uint64_t ioctls;            /* Syncobj calls, as they'd hit the kernel */
+    uint64_t syncobjs;          /* Currently alive handles */
+} MockDrmStats;
+
+/* The node the device queries report, "/dev/null" by default */
+void mockDrmSetDeviceNode(const char *node);
+
+void mockDrmGetStats(MockDrmStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
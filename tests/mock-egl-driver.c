@@ -0,0 +1,2272 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mock-egl-driver.h"
+#include "mock-drm.h"
+
+#include <wayland-util.h>
+#include <drm_fourcc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MOCK_EGL_MAGIC_SURFACE  0x4d4b5346 /* MKSF */
+#define MOCK_EGL_MAGIC_STREAM   0x4d4b5354 /* MKST */
+#define MOCK_EGL_MAGIC_SYNC     0x4d4b5359 /* MKSY */
+#define MOCK_EGL_MAGIC_IMAGE    0x4d4b494d /* MKIM */
+
+#define MOCK_EGL_CLIENT_EXTENSIONS      \
+    "EGL_EXT_client_extensions "        \
+    "EGL_EXT_platform_base "            \
+    "EGL_EXT_platform_device "          \
+    "EGL_EXT_device_base "              \
+    "EGL_EXT_device_query "             \
+    "EGL_EXT_device_enumeration "       \
+    "EGL_KHR_display_reference"
+
+#define MOCK_EGL_DEVICE_EXTENSIONS      \
+    "EGL_EXT_device_drm "               \
+    "EGL_EXT_device_drm_render_node"
+
+/*
+ * Objects
+ */
+
+typedef struct MockEglConfigRec {
+    EGLint id;
+    EGLint red, green, blue, alpha;
+} MockEglConfig;
+
+static const MockEglConfig mockConfigs[] = {
+    { 1,  8,  8,  8, 8 },
+    { 2,  8,  8,  8, 0 },
+    { 3,  5,  6,  5, 0 },
+    { 4, 10, 10, 10, 2 },
+};
+
+#define MOCK_EGL_NUM_CONFIGS (sizeof(mockConfigs) / sizeof(mockConfigs[0]))
+
+#define MOCK_EGL_SURFACE_TYPE (EGL_PBUFFER_BIT | EGL_STREAM_BIT_KHR)
+#define MOCK_EGL_RENDERABLE_TYPE \
+    (EGL_OPENGL_ES2_BIT | EGL_OPENGL_ES3_BIT | EGL_OPENGL_BIT)
+
+typedef enum {
+    MOCK_EGL_SLOT_FREE,
+    MOCK_EGL_SLOT_BACK,         /* Being rendered by the producer */
+    MOCK_EGL_SLOT_QUEUED,       /* Waiting in the stream for the consumer */
+    MOCK_EGL_SLOT_ACQUIRED,     /* Held by the consumer */
+    MOCK_EGL_SLOT_RELEASING,    /* Released, waiting for the release fence */
+} MockEglSlotState;
+
+typedef enum {
+    MOCK_EGL_CONSUMER_NONE,
+    MOCK_EGL_CONSUMER_IMAGE,
+    MOCK_EGL_CONSUMER_GL_TEXTURE,
+} MockEglConsumer;
+
+typedef struct MockEglImageRec MockEglImage;
+
+typedef struct MockEglSlotRec {
+    MockEglSlotState  state;
+    int               releaseFd;
+    EGLuint64KHR      frame;
+    MockEglImage     *image;
+} MockEglSlot;
+
+/*
+ * A stream and its buffers. EGLStreamKHR handles point to MockEglStreamHandle
+ * so that eglCreateStreamFromFileDescriptorKHR() can give the consumer its
+ * own handle to the same stream, as it would in another process.
+ */
+typedef struct MockEglStreamRec {
+    int               refCount;
+    pthread_mutex_t   mutex;
+    pthread_cond_t    cond;     /* Any change of the stream state */
+
+    EGLBoolean        disconnected;
+    EGLBoolean        hasProducer;
+    MockEglConsumer   consumer;
+    EGLint            fifoLength;
+    EGLBoolean        fifoSynchronous;
+    EGLuint64KHR      modifier;
+
+    EGLint            width;
+    EGLint            height;
+    EGLint            cpp;
+    int               fourcc;
+    uint64_t          imageBytes;
+
+    MockEglSlot       slots[MOCK_EGL_MAX_IMAGES];
+    int               numSlots;
+    int               back;
+    int               queue[MOCK_EGL_MAX_IMAGES];
+    int               queueLength;
+    int               held;             /* GL texture consumer's frame */
+    int               addedImages;      /* EGL_STREAM_IMAGE_ADD_NV sent */
+    int               boundImages;      /* Got an EGLImage since */
+    int               announcedFrames;  /* Queued with AVAILABLE sent */
+
+    EGLuint64KHR      producerFrame;
+    EGLuint64KHR      consumerFrame;
+
+    struct wl_list    syncs;            /* EGL_SYNC_NEW_FRAME_NV */
+
+    int               fd;               /* For cross-process handles */
+    dev_t             dev;
+    ino_t             ino;
+    struct wl_list    link;
+} MockEglStream;
+
+typedef struct MockEglStreamHandleRec {
+    uint32_t          magic;
+    MockEglStream    *stream;
+} MockEglStreamHandle;
+
+typedef struct MockEglSurfaceRec {
+    uint32_t              magic;
+    const MockEglConfig  *config;
+    EGLint                width;
+    EGLint                height;
+    MockEglStream        *stream;   /* NULL for pbuffers */
+} MockEglSurface;
+
+typedef struct MockEglSyncRec {
+    uint32_t          magic;
+    EGLenum           type;
+    EGLint            status;
+    int               fd;
+    MockEglStream    *stream;       /* EGL_SYNC_NEW_FRAME_NV only */
+    struct wl_list    link;
+} MockEglSync;
+
+struct MockEglImageRec {
+    uint32_t          magic;
+    MockEglStream    *stream;
+    int               slot;
+};
+
+static struct {
+    pthread_mutex_t   mutex;
+    MockEglOptions    options;
+    char              displayExtensions[512];
+    int               initCount;
+    struct wl_list    exportedStreams;
+    MockEglStats      stats;
+} mockEgl = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Never dereferenced, there's only one of each */
+static int mockDevice;
+static int mockDisplay;
+
+#define MOCK_EGL_DEVICE  ((EGLDeviceEXT)&mockDevice)
+#define MOCK_EGL_DISPLAY ((EGLDisplay)&mockDisplay)
+
+static __thread struct {
+    EGLint     error;
+    EGLDisplay dpy;
+    EGLSurface draw;
+    EGLSurface read;
+    EGLContext ctx;
+    EGLint     interval;
+} mockTls = {
+    .error    = EGL_SUCCESS,
+    .interval = 1,
+};
+
+/*
+ * Helpers
+ */
+
+static void setError(EGLint error)
+{
+    mockTls.error = error;
+}
+
+static uint64_t getTimeNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleepNs(uint64_t ns)
+{
+    struct timespec ts;
+
+    if (ns == 0) {
+        return;
+    }
+
+    ts.tv_sec  = ns / 1000000000ull;
+    ts.tv_nsec = ns % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR) {
+    }
+}
+
+/* Returns false if there's no deadline */
+static EGLBoolean getDeadline(EGLuint64KHR timeout, struct timespec *ts)
+{
+    uint64_t deadline;
+
+    if (timeout == EGL_FOREVER) {
+        return EGL_FALSE;
+    }
+
+    deadline = getTimeNs() + timeout;
+    ts->tv_sec  = deadline / 1000000000ull;
+    ts->tv_nsec = deadline % 1000000000ull;
+    return EGL_TRUE;
+}
+
+static void statsAdd(uint64_t *counter, int64_t value)
+{
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+static void statsAddImageBytes(int64_t bytes)
+{
+    uint64_t total = __atomic_add_fetch(&mockEgl.stats.imageBytes, bytes,
+                                        __ATOMIC_RELAXED);
+    uint64_t peak  = __atomic_load_n(&mockEgl.stats.peakImageBytes,
+                                     __ATOMIC_RELAXED);
+
+    while (total > peak &&
+           !__atomic_compare_exchange_n(&mockEgl.stats.peakImageBytes,
+                                        &peak, total, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static EGLBoolean checkDisplay(EGLDisplay dpy)
+{
+    if (dpy != MOCK_EGL_DISPLAY) {
+        setError(EGL_BAD_DISPLAY);
+        return EGL_FALSE;
+    }
+    if (__atomic_load_n(&mockEgl.initCount, __ATOMIC_ACQUIRE) == 0) {
+        setError(EGL_NOT_INITIALIZED);
+        return EGL_FALSE;
+    }
+    return EGL_TRUE;
+}
+
+static const MockEglConfig *getConfig(EGLConfig config)
+{
+    const MockEglConfig *cfg = (const MockEglConfig *)config;
+
+    if (cfg < mockConfigs || cfg >= mockConfigs + MOCK_EGL_NUM_CONFIGS) {
+        setError(EGL_BAD_CONFIG);
+        return NULL;
+    }
+    return cfg;
+}
+
+static MockEglSurface *getSurface(EGLSurface surface)
+{
+    MockEglSurface *surf = (MockEglSurface *)surface;
+
+    if (!surf || surf->magic != MOCK_EGL_MAGIC_SURFACE) {
+        setError(EGL_BAD_SURFACE);
+        return NULL;
+    }
+    return surf;
+}
+
+static MockEglStream *getStream(EGLStreamKHR stream)
+{
+    MockEglStreamHandle *handle = (MockEglStreamHandle *)stream;
+
+    if (!handle || handle->magic != MOCK_EGL_MAGIC_STREAM) {
+        setError(EGL_BAD_STREAM_KHR);
+        return NULL;
+    }
+    return handle->stream;
+}
+
+static MockEglSync *getSync(EGLSyncKHR sync)
+{
+    MockEglSync *s = (MockEglSync *)sync;
+
+    if (!s || s->magic != MOCK_EGL_MAGIC_SYNC) {
+        setError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+    return s;
+}
+
+static MockEglImage *getImage(EGLImageKHR image)
+{
+    MockEglImage *img = (MockEglImage *)image;
+
+    if (!img || img->magic != MOCK_EGL_MAGIC_IMAGE) {
+        setError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+    return img;
+}
+
+/* Waits for a change of the stream with stream->mutex held */
+static int waitStream(MockEglStream *stream, const struct timespec *deadline)
+{
+    if (!deadline) {
+        return pthread_cond_wait(&stream->cond, &stream->mutex);
+    }
+    return pthread_cond_timedwait(&stream->cond, &stream->mutex, deadline);
+}
+
+static void refStream(MockEglStream *stream)
+{
+    __atomic_add_fetch(&stream->refCount, 1, __ATOMIC_RELAXED);
+}
+
+static void unrefStream(MockEglStream *stream)
+{
+    int i;
+
+    if (__atomic_sub_fetch(&stream->refCount, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    /* Exported streams are looked up by fd, so this must not race with that */
+    pthread_mutex_lock(&mockEgl.mutex);
+    if (stream->fd >= 0) {
+        wl_list_remove(&stream->link);
+    }
+    pthread_mutex_unlock(&mockEgl.mutex);
+
+    for (i = 0; i < stream->numSlots; i++) {
+        if (stream->slots[i].releaseFd >= 0) {
+            close(stream->slots[i].releaseFd);
+        }
+    }
+    if (stream->fd >= 0) {
+        close(stream->fd);
+    }
+
+    statsAddImageBytes(-(int64_t)stream->imageBytes);
+    statsAdd(&mockEgl.stats.streams, -1);
+
+    pthread_mutex_destroy(&stream->mutex);
+    pthread_cond_destroy(&stream->cond);
+    free(stream);
+}
+
+static EGLStreamKHR createStreamHandle(MockEglStream *stream)
+{
+    MockEglStreamHandle *handle = calloc(1, sizeof(*handle));
+
+    if (!handle) {
+        setError(EGL_BAD_ALLOC);
+        return EGL_NO_STREAM_KHR;
+    }
+
+    handle->magic = MOCK_EGL_MAGIC_STREAM;
+    handle->stream = stream;
+    refStream(stream);
+
+    return (EGLStreamKHR)handle;
+}
+
+/* Wakes up everything waiting on the stream. Call with stream->mutex held. */
+static void signalNewFrame(MockEglStream *stream)
+{
+    MockEglSync *sync;
+
+    wl_list_for_each(sync, &stream->syncs, link) {
+        sync->status = EGL_SIGNALED_KHR;
+    }
+    pthread_cond_broadcast(&stream->cond);
+}
+
+static void disconnectStream(MockEglStream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    stream->disconnected = EGL_TRUE;
+    signalNewFrame(stream);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+/*
+ * Frees released slots whose release fence signalled. Returns a free slot
+ * for the producer, or -1. Call with stream->mutex held.
+ */
+static int findFreeSlot(MockEglStream *stream)
+{
+    struct pollfd pfd;
+    int           i;
+
+    for (i = 0; i < stream->numSlots; i++) {
+        MockEglSlot *slot = &stream->slots[i];
+
+        if (slot->state == MOCK_EGL_SLOT_RELEASING) {
+            pfd.fd = slot->releaseFd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, 0) == 1) {
+                close(slot->releaseFd);
+                slot->releaseFd = -1;
+                slot->state = MOCK_EGL_SLOT_FREE;
+            }
+        }
+        if (slot->state == MOCK_EGL_SLOT_FREE) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static EGLBoolean hasReleasingSlot(MockEglStream *stream)
+{
+    int i;
+
+    for (i = 0; i < stream->numSlots; i++) {
+        if (stream->slots[i].state == MOCK_EGL_SLOT_RELEASING) {
+            return EGL_TRUE;
+        }
+    }
+    return EGL_FALSE;
+}
+
+/* Pops the oldest queued frame and gives it to the consumer */
+static int popFrame(MockEglStream *stream)
+{
+    int slot = stream->queue[0];
+
+    stream->queueLength--;
+    memmove(stream->queue, stream->queue + 1,
+            stream->queueLength * sizeof(stream->queue[0]));
+    if (stream->announcedFrames > 0) {
+        stream->announcedFrames--;
+    }
+
+    stream->slots[slot].state = MOCK_EGL_SLOT_ACQUIRED;
+    stream->consumerFrame = stream->slots[slot].frame;
+    statsAdd(&mockEgl.stats.framesAcquired, 1);
+
+    /* A producer may be waiting for room in the FIFO */
+    pthread_cond_broadcast(&stream->cond);
+
+    return slot;
+}
+
+static int getConfigFourcc(const MockEglConfig *cfg)
+{
+    if (cfg->red == 10) {
+        return cfg->alpha ? DRM_FORMAT_ARGB2101010 : DRM_FORMAT_XRGB2101010;
+    }
+    if (cfg->red == 5) {
+        return DRM_FORMAT_RGB565;
+    }
+    return cfg->alpha ? DRM_FORMAT_ARGB8888 : DRM_FORMAT_XRGB8888;
+}
+
+/*
+ * Display and device
+ */
+
+static const char *mockQueryString(EGLDisplay dpy, EGLint name)
+{
+    if (dpy == EGL_NO_DISPLAY) {
+        if (name == EGL_EXTENSIONS) {
+            return MOCK_EGL_CLIENT_EXTENSIONS;
+        }
+        if (name == EGL_VERSION) {
+            return "1.5";
+        }
+        setError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+
+    if (!checkDisplay(dpy)) {
+        return NULL;
+    }
+
+    switch (name) {
+    case EGL_EXTENSIONS:
+        return mockEgl.displayExtensions;
+    case EGL_VENDOR:
+        return "Mock";
+    case EGL_VERSION:
+        return "1.5 Mock";
+    case EGL_CLIENT_APIS:
+        return "OpenGL_ES OpenGL";
+    default:
+        setError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+}
+
+static EGLBoolean mockQueryDevices(EGLint maxDevices, EGLDeviceEXT *devices,
+                                   EGLint *numDevices)
+{
+    if (!numDevices || (devices && maxDevices <= 0)) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_FALSE;
+    }
+
+    if (devices) {
+        devices[0] = MOCK_EGL_DEVICE;
+    }
+    *numDevices = 1;
+
+    return EGL_TRUE;
+}
+
+static const char *mockQueryDeviceString(EGLDeviceEXT device, EGLint name)
+{
+    if (device != MOCK_EGL_DEVICE) {
+        setError(EGL_BAD_DEVICE_EXT);
+        return NULL;
+    }
+
+    switch (name) {
+    case EGL_EXTENSIONS:
+        return MOCK_EGL_DEVICE_EXTENSIONS;
+    case EGL_DRM_DEVICE_FILE_EXT:
+    case EGL_DRM_RENDER_NODE_FILE_EXT:
+        return mockEgl.options.drmNode;
+    default:
+        setError(EGL_BAD_PARAMETER);
+        return NULL;
+    }
+}
+
+static EGLDisplay mockGetPlatformDisplay(EGLenum platform, void *nativeDpy,
+                                         const EGLint *attribs)
+{
+    int i;
+
+    if (platform != EGL_PLATFORM_DEVICE_EXT || nativeDpy != MOCK_EGL_DEVICE) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_NO_DISPLAY;
+    }
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i] != EGL_TRACK_REFERENCES_KHR) {
+            setError(EGL_BAD_ATTRIBUTE);
+            return EGL_NO_DISPLAY;
+        }
+    }
+
+    return MOCK_EGL_DISPLAY;
+}
+
+/* Initialization is always reference counted, as with EGL_TRACK_REFERENCES */
+static EGLBoolean mockInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+    if (dpy != MOCK_EGL_DISPLAY) {
+        setError(EGL_BAD_DISPLAY);
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&mockEgl.mutex);
+    if (mockEgl.initCount == 0) {
+        sleepNs(mockEgl.options.initNs);
+    }
+    __atomic_add_fetch(&mockEgl.initCount, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mockEgl.mutex);
+
+    if (major) {
+        *major = 1;
+    }
+    if (minor) {
+        *minor = 5;
+    }
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockTerminate(EGLDisplay dpy)
+{
+    if (dpy != MOCK_EGL_DISPLAY) {
+        setError(EGL_BAD_DISPLAY);
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&mockEgl.mutex);
+    if (mockEgl.initCount > 0) {
+        __atomic_sub_fetch(&mockEgl.initCount, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&mockEgl.mutex);
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockQueryDisplayAttrib(EGLDisplay dpy, EGLint attribute,
+                                         EGLAttrib *value)
+{
+    if (!checkDisplay(dpy)) {
+        return EGL_FALSE;
+    }
+
+    switch (attribute) {
+    case EGL_DEVICE_EXT:
+        *value = (EGLAttrib)MOCK_EGL_DEVICE;
+        return EGL_TRUE;
+    case EGL_TRACK_REFERENCES_KHR:
+        *value = EGL_TRUE;
+        return EGL_TRUE;
+    default:
+        setError(EGL_BAD_ATTRIBUTE);
+        return EGL_FALSE;
+    }
+}
+
+/*
+ * Configs
+ */
+
+static EGLBoolean getConfigValue(const MockEglConfig *cfg, EGLint attribute,
+                                 EGLint *value)
+{
+    switch (attribute) {
+    case EGL_CONFIG_ID:        *value = cfg->id;                                  break;
+    case EGL_RED_SIZE:         *value = cfg->red;                                 break;
+    case EGL_GREEN_SIZE:       *value = cfg->green;                               break;
+    case EGL_BLUE_SIZE:        *value = cfg->blue;                                break;
+    case EGL_ALPHA_SIZE:       *value = cfg->alpha;                               break;
+    case EGL_BUFFER_SIZE:      *value = cfg->red + cfg->green + cfg->blue +
+                                        cfg->alpha;                               break;
+    case EGL_DEPTH_SIZE:       *value = 24;                                       break;
+    case EGL_STENCIL_SIZE:     *value = 8;                                        break;
+    case EGL_SURFACE_TYPE:     *value = MOCK_EGL_SURFACE_TYPE;                    break;
+    case EGL_RENDERABLE_TYPE:
+    case EGL_CONFORMANT:       *value = MOCK_EGL_RENDERABLE_TYPE;                 break;
+    case EGL_COLOR_BUFFER_TYPE: *value = EGL_RGB_BUFFER;                          break;
+    case EGL_CONFIG_CAVEAT:    *value = EGL_NONE;                                 break;
+    case EGL_NATIVE_RENDERABLE: *value = EGL_FALSE;                               break;
+    case EGL_NATIVE_VISUAL_ID:
+    case EGL_NATIVE_VISUAL_TYPE:
+    case EGL_LEVEL:
+    case EGL_SAMPLES:
+    case EGL_SAMPLE_BUFFERS:
+    case EGL_LUMINANCE_SIZE:
+    case EGL_ALPHA_MASK_SIZE:
+    case EGL_MIN_SWAP_INTERVAL:
+    case EGL_BIND_TO_TEXTURE_RGB:
+    case EGL_BIND_TO_TEXTURE_RGBA:
+    case EGL_TRANSPARENT_TYPE:  *value = 0;                                       break;
+    case EGL_MAX_SWAP_INTERVAL: *value = 1;                                       break;
+    case EGL_MAX_PBUFFER_WIDTH:
+    case EGL_MAX_PBUFFER_HEIGHT: *value = 16384;                                  break;
+    case EGL_MAX_PBUFFER_PIXELS: *value = 16384 * 16384;                          break;
+    default:
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean configMatches(const MockEglConfig *cfg, const EGLint *attribs)
+{
+    EGLint value;
+    int    i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (attribs[i + 1] == EGL_DONT_CARE ||
+            !getConfigValue(cfg, attribs[i], &value)) {
+            continue;
+        }
+
+        switch (attribs[i]) {
+        case EGL_SURFACE_TYPE:
+        case EGL_RENDERABLE_TYPE:
+        case EGL_CONFORMANT:
+            if ((value & attribs[i + 1]) != attribs[i + 1]) {
+                return EGL_FALSE;
+            }
+            break;
+        case EGL_CONFIG_ID:
+        case EGL_COLOR_BUFFER_TYPE:
+        case EGL_CONFIG_CAVEAT:
+        case EGL_NATIVE_RENDERABLE:
+        case EGL_TRANSPARENT_TYPE:
+            if (value != attribs[i + 1]) {
+                return EGL_FALSE;
+            }
+            break;
+        default:
+            if (value < attribs[i + 1]) {
+                return EGL_FALSE;
+            }
+            break;
+        }
+    }
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockChooseConfig(EGLDisplay dpy, const EGLint *attribs,
+                                   EGLConfig *configs, EGLint configSize,
+                                   EGLint *numConfig)
+{
+    EGLint   count = 0;
+    unsigned i;
+
+    if (!checkDisplay(dpy)) {
+        return EGL_FALSE;
+    }
+    if (!numConfig) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_FALSE;
+    }
+
+    for (i = 0; i < MOCK_EGL_NUM_CONFIGS; i++) {
+        if (!configMatches(&mockConfigs[i], attribs)) {
+            continue;
+        }
+        if (configs) {
+            if (count >= configSize) {
+                break;
+            }
+            configs[count] = (EGLConfig)&mockConfigs[i];
+        }
+        count++;
+    }
+
+    *numConfig = count;
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockGetConfigAttrib(EGLDisplay dpy, EGLConfig config,
+                                      EGLint attribute, EGLint *value)
+{
+    const MockEglConfig *cfg;
+
+    if (!checkDisplay(dpy) || !(cfg = getConfig(config))) {
+        return EGL_FALSE;
+    }
+
+    if (!getConfigValue(cfg, attribute, value)) {
+        setError(EGL_BAD_ATTRIBUTE);
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+/*
+ * Current context handling. The driver has no contexts, so it only keeps
+ * whatever handles it's given.
+ */
+
+static EGLContext mockGetCurrentContext(void)
+{
+    return mockTls.ctx;
+}
+
+static EGLSurface mockGetCurrentSurface(EGLint readdraw)
+{
+    return readdraw == EGL_READ ? mockTls.read : mockTls.draw;
+}
+
+EGLBoolean mockEglMakeCurrent(EGLDisplay dpy, EGLSurface draw,
+                              EGLSurface read, EGLContext ctx)
+{
+    if ((ctx == EGL_NO_CONTEXT) !=
+        (draw == EGL_NO_SURFACE && read == EGL_NO_SURFACE)) {
+        setError(EGL_BAD_MATCH);
+        return EGL_FALSE;
+    }
+
+    mockTls.dpy  = ctx == EGL_NO_CONTEXT ? EGL_NO_DISPLAY : dpy;
+    mockTls.draw = draw;
+    mockTls.read = read;
+    mockTls.ctx  = ctx;
+
+    return EGL_TRUE;
+}
+
+static EGLint mockGetError(void)
+{
+    EGLint error = mockTls.error;
+
+    mockTls.error = EGL_SUCCESS;
+    return error;
+}
+
+static EGLBoolean mockReleaseThread(void)
+{
+    mockTls.dpy  = EGL_NO_DISPLAY;
+    mockTls.draw = EGL_NO_SURFACE;
+    mockTls.read = EGL_NO_SURFACE;
+    mockTls.ctx  = EGL_NO_CONTEXT;
+    mockTls.error = EGL_SUCCESS;
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockSwapInterval(EGLDisplay dpy, EGLint interval)
+{
+    (void) dpy;
+
+    mockTls.interval = interval;
+    return EGL_TRUE;
+}
+
+/*
+ * Streams
+ */
+
+static EGLStreamKHR createStream(EGLDisplay dpy, const EGLAttrib *attribs)
+{
+    MockEglStream      *stream;
+    pthread_condattr_t  condAttr;
+    EGLStreamKHR        handle;
+    int                 i;
+
+    if (!checkDisplay(dpy)) {
+        return EGL_NO_STREAM_KHR;
+    }
+
+    stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        setError(EGL_BAD_ALLOC);
+        return EGL_NO_STREAM_KHR;
+    }
+
+    stream->back = -1;
+    stream->held = -1;
+    stream->fd = -1;
+    stream->modifier = DRM_FORMAT_MOD_LINEAR;
+    for (i = 0; i < MOCK_EGL_MAX_IMAGES; i++) {
+        stream->slots[i].releaseFd = -1;
+    }
+    wl_list_init(&stream->syncs);
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        switch (attribs[i]) {
+        case EGL_STREAM_FIFO_LENGTH_KHR:
+            if (attribs[i + 1] < 0 ||
+                attribs[i + 1] > mockEgl.options.numImages - 1) {
+                goto bad_attribute;
+            }
+            stream->fifoLength = (EGLint)attribs[i + 1];
+            break;
+        case EGL_STREAM_FIFO_SYNCHRONOUS_NV:
+            if (!mockEgl.options.fifoSynchronous) {
+                goto bad_attribute;
+            }
+            stream->fifoSynchronous = !!attribs[i + 1];
+            break;
+        case EGL_CONSUMER_LATENCY_USEC_KHR:
+        case EGL_CONSUMER_ACQUIRE_TIMEOUT_USEC_KHR:
+            break;
+        default:
+            goto bad_attribute;
+        }
+    }
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&stream->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    /* The handle holds the only reference until something else takes one */
+    handle = createStreamHandle(stream);
+    if (handle == EGL_NO_STREAM_KHR) {
+        pthread_mutex_destroy(&stream->mutex);
+        pthread_cond_destroy(&stream->cond);
+        free(stream);
+        return EGL_NO_STREAM_KHR;
+    }
+    statsAdd(&mockEgl.stats.streams, 1);
+
+    return handle;
+
+bad_attribute:
+    free(stream);
+    setError(EGL_BAD_ATTRIBUTE);
+    return EGL_NO_STREAM_KHR;
+}
+
+static EGLStreamKHR mockCreateStream(EGLDisplay dpy, const EGLint *attribs)
+{
+    EGLAttrib attribs2[32];
+    int       i;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (i + 2 >= (int)(sizeof(attribs2) / sizeof(attribs2[0]))) {
+            setError(EGL_BAD_ATTRIBUTE);
+            return EGL_NO_STREAM_KHR;
+        }
+        attribs2[i]     = attribs[i];
+        attribs2[i + 1] = attribs[i + 1];
+    }
+    attribs2[i] = EGL_NONE;
+
+    return createStream(dpy, attribs2);
+}
+
+static EGLStreamKHR mockCreateStreamAttrib(EGLDisplay dpy,
+                                          const EGLAttrib *attribs)
+{
+    return createStream(dpy, attribs);
+}
+
+static EGLBoolean mockDestroyStream(EGLDisplay dpy, EGLStreamKHR handle)
+{
+    MockEglStreamHandle *h = (MockEglStreamHandle *)handle;
+    MockEglStream       *stream;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    /* Destroying either end disconnects the stream */
+    disconnectStream(stream);
+
+    h->magic = 0;
+    free(h);
+    unrefStream(stream);
+
+    return EGL_TRUE;
+}
+
+static EGLNativeFileDescriptorKHR mockGetStreamFileDescriptor(EGLDisplay dpy,
+                                                              EGLStreamKHR handle)
+{
+    MockEglStream *stream;
+    struct stat    st;
+    int            fd = EGL_NO_FILE_DESCRIPTOR_KHR;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_NO_FILE_DESCRIPTOR_KHR;
+    }
+
+    pthread_mutex_lock(&mockEgl.mutex);
+    if (stream->fd < 0) {
+        /* The memfd gives the stream an identity another handle can find */
+        stream->fd = memfd_create("mock-egl-stream", MFD_CLOEXEC);
+        if (stream->fd >= 0 && fstat(stream->fd, &st) == 0) {
+            stream->dev = st.st_dev;
+            stream->ino = st.st_ino;
+            wl_list_insert(&mockEgl.exportedStreams, &stream->link);
+        } else if (stream->fd >= 0) {
+            close(stream->fd);
+            stream->fd = -1;
+        }
+    }
+    if (stream->fd >= 0) {
+        fd = fcntl(stream->fd, F_DUPFD_CLOEXEC, 0);
+    }
+    pthread_mutex_unlock(&mockEgl.mutex);
+
+    if (fd < 0) {
+        setError(EGL_BAD_ALLOC);
+        return EGL_NO_FILE_DESCRIPTOR_KHR;
+    }
+
+    return fd;
+}
+
+static EGLStreamKHR mockCreateStreamFromFileDescriptor(EGLDisplay dpy,
+                                                       EGLNativeFileDescriptorKHR fd)
+{
+    MockEglStream *stream, *found = NULL;
+    EGLStreamKHR   handle;
+    struct stat    st;
+
+    if (!checkDisplay(dpy)) {
+        return EGL_NO_STREAM_KHR;
+    }
+    if (fstat(fd, &st) != 0) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_NO_STREAM_KHR;
+    }
+
+    pthread_mutex_lock(&mockEgl.mutex);
+    wl_list_for_each(stream, &mockEgl.exportedStreams, link) {
+        if (stream->dev == st.st_dev && stream->ino == st.st_ino &&
+            __atomic_load_n(&stream->refCount, __ATOMIC_RELAXED) > 0) {
+            found = stream;
+            break;
+        }
+    }
+    handle = found ? createStreamHandle(found) : EGL_NO_STREAM_KHR;
+    pthread_mutex_unlock(&mockEgl.mutex);
+
+    if (!found) {
+        setError(EGL_BAD_STREAM_KHR);
+    }
+
+    return handle;
+}
+
+static EGLint getStreamState(MockEglStream *stream)
+{
+    if (stream->disconnected) {
+        return EGL_STREAM_STATE_DISCONNECTED_KHR;
+    }
+    if (stream->consumer == MOCK_EGL_CONSUMER_NONE) {
+        return EGL_STREAM_STATE_CREATED_KHR;
+    }
+    if (!stream->hasProducer) {
+        return EGL_STREAM_STATE_CONNECTING_KHR;
+    }
+    if (stream->queueLength > 0) {
+        return EGL_STREAM_STATE_NEW_FRAME_AVAILABLE_KHR;
+    }
+    if (stream->consumerFrame > 0) {
+        return EGL_STREAM_STATE_OLD_FRAME_AVAILABLE_KHR;
+    }
+    return EGL_STREAM_STATE_EMPTY_KHR;
+}
+
+static EGLBoolean mockQueryStream(EGLDisplay dpy, EGLStreamKHR handle,
+                                  EGLenum attribute, EGLint *value)
+{
+    MockEglStream *stream;
+    EGLBoolean     ret = EGL_TRUE;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    switch (attribute) {
+    case EGL_STREAM_STATE_KHR:
+        *value = getStreamState(stream);
+        break;
+    case EGL_STREAM_FIFO_LENGTH_KHR:
+        *value = stream->fifoLength;
+        break;
+    case EGL_STREAM_FIFO_SYNCHRONOUS_NV:
+        *value = stream->fifoSynchronous;
+        break;
+    case EGL_CONSUMER_LATENCY_USEC_KHR:
+    case EGL_CONSUMER_ACQUIRE_TIMEOUT_USEC_KHR:
+        *value = 0;
+        break;
+    default:
+        setError(EGL_BAD_ATTRIBUTE);
+        ret = EGL_FALSE;
+        break;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockQueryStreamu64(EGLDisplay dpy, EGLStreamKHR handle,
+                                     EGLenum attribute, EGLuint64KHR *value)
+{
+    MockEglStream *stream;
+    EGLBoolean     ret = EGL_TRUE;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    switch (attribute) {
+    case EGL_PRODUCER_FRAME_KHR:
+        *value = stream->producerFrame;
+        break;
+    case EGL_CONSUMER_FRAME_KHR:
+        *value = stream->consumerFrame;
+        break;
+    default:
+        setError(EGL_BAD_ATTRIBUTE);
+        ret = EGL_FALSE;
+        break;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockStreamFlush(EGLDisplay dpy, EGLStreamKHR handle)
+{
+    if (!checkDisplay(dpy) || !getStream(handle)) {
+        return EGL_FALSE;
+    }
+
+    sleepNs(mockEgl.options.flushNs);
+    return EGL_TRUE;
+}
+
+static EGLBoolean connectConsumer(EGLDisplay dpy, EGLStreamKHR handle,
+                                  MockEglConsumer consumer,
+                                  EGLint numModifiers,
+                                  const EGLuint64KHR *modifiers)
+{
+    MockEglStream *stream;
+    EGLBoolean     ret = EGL_TRUE;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->disconnected || stream->consumer != MOCK_EGL_CONSUMER_NONE) {
+        setError(EGL_BAD_STATE_KHR);
+        ret = EGL_FALSE;
+    } else {
+        stream->consumer = consumer;
+        /* Pretend the first, and most preferred, modifier works */
+        if (numModifiers > 0 && modifiers) {
+            stream->modifier = modifiers[0];
+        }
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockStreamConsumerGLTextureExternal(EGLDisplay dpy,
+                                                      EGLStreamKHR handle)
+{
+    return connectConsumer(dpy, handle, MOCK_EGL_CONSUMER_GL_TEXTURE, 0, NULL);
+}
+
+static EGLBoolean mockStreamImageConsumerConnect(EGLDisplay dpy,
+                                                 EGLStreamKHR handle,
+                                                 EGLint numModifiers,
+                                                 const EGLuint64KHR *modifiers,
+                                                 const EGLAttrib *attribs)
+{
+    (void) attribs;
+
+    return connectConsumer(dpy, handle, MOCK_EGL_CONSUMER_IMAGE,
+                           numModifiers, modifiers);
+}
+
+/* Latches the newest frame, like a compositor texturing from the stream */
+static EGLBoolean mockStreamConsumerAcquire(EGLDisplay dpy, EGLStreamKHR handle)
+{
+    MockEglStream *stream;
+    EGLBoolean     ret = EGL_TRUE;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->consumer != MOCK_EGL_CONSUMER_GL_TEXTURE) {
+        setError(EGL_BAD_STATE_KHR);
+        ret = EGL_FALSE;
+    } else if (stream->queueLength > 0) {
+        if (stream->held >= 0) {
+            stream->slots[stream->held].state = MOCK_EGL_SLOT_FREE;
+        }
+        stream->held = popFrame(stream);
+    } else if (stream->held < 0) {
+        setError(EGL_BAD_STATE_KHR);
+        ret = EGL_FALSE;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockStreamConsumerRelease(EGLDisplay dpy, EGLStreamKHR handle)
+{
+    MockEglStream *stream;
+    EGLBoolean     ret = EGL_TRUE;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->consumer != MOCK_EGL_CONSUMER_GL_TEXTURE || stream->held < 0) {
+        setError(EGL_BAD_STATE_KHR);
+        ret = EGL_FALSE;
+    } else {
+        stream->slots[stream->held].state = MOCK_EGL_SLOT_FREE;
+        stream->held = -1;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+/*
+ * Image stream consumer. Events come in the order the consumer needs them:
+ * new images first, then frames.
+ */
+static EGLint mockQueryStreamConsumerEvent(EGLDisplay dpy, EGLStreamKHR handle,
+                                           EGLTime timeout, EGLenum *event,
+                                           EGLAttrib *aux)
+{
+    MockEglStream   *stream;
+    struct timespec  deadline;
+    EGLBoolean       hasDeadline;
+    EGLint           ret;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_FALSE;
+    }
+
+    hasDeadline = getDeadline(timeout, &deadline);
+
+    pthread_mutex_lock(&stream->mutex);
+    while (1) {
+        if (stream->disconnected ||
+            stream->consumer != MOCK_EGL_CONSUMER_IMAGE) {
+            setError(EGL_BAD_STATE_KHR);
+            ret = EGL_FALSE;
+            break;
+        }
+
+        if (stream->addedImages < stream->numSlots) {
+            stream->addedImages++;
+            *event = EGL_STREAM_IMAGE_ADD_NV;
+            *aux = 0;
+            ret = EGL_TRUE;
+            break;
+        }
+
+        if (stream->announcedFrames < stream->queueLength) {
+            stream->announcedFrames++;
+            *event = EGL_STREAM_IMAGE_AVAILABLE_NV;
+            *aux = 0;
+            ret = EGL_TRUE;
+            break;
+        }
+
+        if (timeout == 0 ||
+            waitStream(stream, hasDeadline ? &deadline : NULL) == ETIMEDOUT) {
+            ret = EGL_TIMEOUT_EXPIRED;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockStreamAcquireImage(EGLDisplay dpy, EGLStreamKHR handle,
+                                         EGLImage *image, EGLSync sync)
+{
+    MockEglStream *stream;
+    MockEglSync   *s = NULL;
+    EGLBoolean     ret = EGL_TRUE;
+    int            slot;
+    int            fd = -1;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle)) ||
+        (sync != EGL_NO_SYNC && !(s = getSync(sync)))) {
+        return EGL_FALSE;
+    }
+
+    if (s) {
+        if (s->type != EGL_SYNC_NATIVE_FENCE_ANDROID) {
+            setError(EGL_BAD_PARAMETER);
+            return EGL_FALSE;
+        }
+        /* The sync now tracks the frame being ready, which it already is */
+        fd = eventfd(1, EFD_CLOEXEC);
+        if (fd < 0) {
+            setError(EGL_BAD_ALLOC);
+            return EGL_FALSE;
+        }
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->consumer != MOCK_EGL_CONSUMER_IMAGE ||
+        stream->queueLength == 0) {
+        setError(EGL_BAD_STATE_KHR);
+        ret = EGL_FALSE;
+    } else if (!stream->slots[stream->queue[0]].image) {
+        /* The consumer never created an image for this buffer */
+        setError(EGL_BAD_ACCESS);
+        ret = EGL_FALSE;
+    } else {
+        slot = popFrame(stream);
+        *image = (EGLImage)stream->slots[slot].image;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    if (s && ret) {
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        s->fd = fd;
+        s->status = EGL_SIGNALED_KHR;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+static EGLBoolean mockStreamReleaseImage(EGLDisplay dpy, EGLStreamKHR handle,
+                                         EGLImage image, EGLSync sync)
+{
+    MockEglStream *stream;
+    MockEglImage  *img;
+    MockEglSync   *s = NULL;
+    MockEglSlot   *slot;
+    EGLBoolean     ret = EGL_TRUE;
+    int            fd = -1;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle)) ||
+        !(img = getImage(image)) ||
+        (sync != EGL_NO_SYNC && !(s = getSync(sync)))) {
+        return EGL_FALSE;
+    }
+
+    /* The stream keeps its own copy of the fence */
+    if (s && s->fd >= 0) {
+        fd = fcntl(s->fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0) {
+            setError(EGL_BAD_ALLOC);
+            return EGL_FALSE;
+        }
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    slot = &stream->slots[img->slot];
+    if (img->stream != stream || slot->state != MOCK_EGL_SLOT_ACQUIRED) {
+        setError(EGL_BAD_PARAMETER);
+        ret = EGL_FALSE;
+    } else if (fd >= 0) {
+        slot->state = MOCK_EGL_SLOT_RELEASING;
+        slot->releaseFd = fd;
+        fd = -1;
+    } else {
+        slot->state = MOCK_EGL_SLOT_FREE;
+    }
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return ret;
+}
+
+static EGLImageKHR mockCreateImage(EGLDisplay dpy, EGLContext ctx,
+                                   EGLenum target, EGLClientBuffer buffer,
+                                   const EGLint *attribs)
+{
+    MockEglStream *stream;
+    MockEglImage  *img;
+
+    (void) attribs;
+
+    if (!checkDisplay(dpy)) {
+        return EGL_NO_IMAGE_KHR;
+    }
+    if (target != EGL_STREAM_CONSUMER_IMAGE_NV || ctx != EGL_NO_CONTEXT) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_NO_IMAGE_KHR;
+    }
+    if (!(stream = getStream((EGLStreamKHR)buffer))) {
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    img = calloc(1, sizeof(*img));
+    if (!img) {
+        setError(EGL_BAD_ALLOC);
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    /* Binds the oldest buffer announced with EGL_STREAM_IMAGE_ADD_NV */
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->boundImages >= stream->addedImages) {
+        pthread_mutex_unlock(&stream->mutex);
+        free(img);
+        setError(EGL_BAD_ACCESS);
+        return EGL_NO_IMAGE_KHR;
+    }
+    img->magic = MOCK_EGL_MAGIC_IMAGE;
+    img->stream = stream;
+    img->slot = stream->boundImages++;
+    stream->slots[img->slot].image = img;
+    pthread_mutex_unlock(&stream->mutex);
+
+    refStream(stream);
+
+    return (EGLImageKHR)img;
+}
+
+static EGLBoolean mockDestroyImage(EGLDisplay dpy, EGLImageKHR image)
+{
+    MockEglImage  *img;
+    MockEglStream *stream;
+
+    if (!checkDisplay(dpy) || !(img = getImage(image))) {
+        return EGL_FALSE;
+    }
+
+    stream = img->stream;
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->slots[img->slot].image == img) {
+        stream->slots[img->slot].image = NULL;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    img->magic = 0;
+    free(img);
+    unrefStream(stream);
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockExportDMABUFImageQuery(EGLDisplay dpy, EGLImageKHR image,
+                                             int *fourcc, int *numPlanes,
+                                             EGLuint64KHR *modifiers)
+{
+    MockEglImage *img;
+
+    if (!checkDisplay(dpy) || !(img = getImage(image))) {
+        return EGL_FALSE;
+    }
+
+    if (fourcc) {
+        *fourcc = img->stream->fourcc;
+    }
+    if (numPlanes) {
+        *numPlanes = 1;
+    }
+    if (modifiers) {
+        modifiers[0] = img->stream->modifier;
+    }
+
+    return EGL_TRUE;
+}
+
+/* The dma-buf is a memfd of the size the image would take */
+static EGLBoolean mockExportDMABUFImage(EGLDisplay dpy, EGLImageKHR image,
+                                        int *fds, EGLint *strides,
+                                        EGLint *offsets)
+{
+    MockEglImage  *img;
+    MockEglStream *stream;
+    EGLint         stride;
+    int            fd;
+
+    if (!checkDisplay(dpy) || !(img = getImage(image))) {
+        return EGL_FALSE;
+    }
+
+    stream = img->stream;
+    stride = stream->width * stream->cpp;
+
+    sleepNs(mockEgl.options.exportNs);
+
+    fd = memfd_create("mock-egl-dmabuf", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)stride * stream->height) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        setError(EGL_BAD_ALLOC);
+        return EGL_FALSE;
+    }
+
+    if (fds) {
+        fds[0] = fd;
+    } else {
+        close(fd);
+    }
+    if (strides) {
+        strides[0] = stride;
+    }
+    if (offsets) {
+        offsets[0] = 0;
+    }
+
+    statsAdd(&mockEgl.stats.exports, 1);
+
+    return EGL_TRUE;
+}
+
+/*
+ * Surfaces
+ */
+
+static EGLBoolean parseSurfaceSize(const EGLint *attribs,
+                                   EGLint *width, EGLint *height)
+{
+    int i;
+
+    *width = 0;
+    *height = 0;
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        switch (attribs[i]) {
+        case EGL_WIDTH:
+            *width = attribs[i + 1];
+            break;
+        case EGL_HEIGHT:
+            *height = attribs[i + 1];
+            break;
+        default:
+            /* Colorspace, present opaque, etc. don't change anything here */
+            break;
+        }
+    }
+
+    if (*width < 0 || *height < 0) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+static MockEglSurface *createSurface(EGLConfig config, const EGLint *attribs)
+{
+    const MockEglConfig *cfg;
+    MockEglSurface      *surf;
+    EGLint               width, height;
+
+    if (!(cfg = getConfig(config)) ||
+        !parseSurfaceSize(attribs, &width, &height)) {
+        return NULL;
+    }
+
+    surf = calloc(1, sizeof(*surf));
+    if (!surf) {
+        setError(EGL_BAD_ALLOC);
+        return NULL;
+    }
+
+    surf->magic = MOCK_EGL_MAGIC_SURFACE;
+    surf->config = cfg;
+    surf->width = width;
+    surf->height = height;
+
+    return surf;
+}
+
+static EGLSurface mockCreatePbufferSurface(EGLDisplay dpy, EGLConfig config,
+                                           const EGLint *attribs)
+{
+    if (!checkDisplay(dpy)) {
+        return EGL_NO_SURFACE;
+    }
+
+    return (EGLSurface)createSurface(config, attribs);
+}
+
+static EGLSurface mockCreateStreamProducerSurface(EGLDisplay dpy,
+                                                  EGLConfig config,
+                                                  EGLStreamKHR handle,
+                                                  const EGLint *attribs)
+{
+    MockEglStream  *stream;
+    MockEglSurface *surf;
+    int             i;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle)) ||
+        !(surf = createSurface(config, attribs))) {
+        return EGL_NO_SURFACE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    if (stream->disconnected || stream->hasProducer ||
+        stream->consumer == MOCK_EGL_CONSUMER_NONE) {
+        pthread_mutex_unlock(&stream->mutex);
+        free(surf);
+        setError(EGL_BAD_STATE_KHR);
+        return EGL_NO_SURFACE;
+    }
+
+    stream->hasProducer = EGL_TRUE;
+    stream->width = surf->width;
+    stream->height = surf->height;
+    stream->cpp = surf->config->red == 5 ? 2 : 4;
+    stream->fourcc = getConfigFourcc(surf->config);
+
+    /* The image consumer learns about these through ADD events */
+    stream->numSlots = mockEgl.options.numImages;
+    for (i = 0; i < stream->numSlots; i++) {
+        stream->slots[i].state = MOCK_EGL_SLOT_FREE;
+    }
+    stream->back = 0;
+    stream->slots[0].state = MOCK_EGL_SLOT_BACK;
+
+    stream->imageBytes = (uint64_t)stream->numSlots * stream->cpp *
+                         stream->width * stream->height;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    statsAddImageBytes(stream->imageBytes);
+
+    refStream(stream);
+    surf->stream = stream;
+
+    return (EGLSurface)surf;
+}
+
+static EGLBoolean mockDestroySurface(EGLDisplay dpy, EGLSurface surface)
+{
+    MockEglSurface *surf;
+
+    if (!checkDisplay(dpy) || !(surf = getSurface(surface))) {
+        return EGL_FALSE;
+    }
+
+    if (surf->stream) {
+        /* Wakes up the consumer and anything waiting for a frame */
+        disconnectStream(surf->stream);
+        unrefStream(surf->stream);
+    }
+
+    surf->magic = 0;
+    free(surf);
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockQuerySurface(EGLDisplay dpy, EGLSurface surface,
+                                   EGLint attribute, EGLint *value)
+{
+    MockEglSurface *surf;
+
+    if (!checkDisplay(dpy) || !(surf = getSurface(surface))) {
+        return EGL_FALSE;
+    }
+
+    switch (attribute) {
+    case EGL_WIDTH:
+        *value = surf->width;
+        break;
+    case EGL_HEIGHT:
+        *value = surf->height;
+        break;
+    case EGL_CONFIG_ID:
+        *value = surf->config->id;
+        break;
+    case EGL_RENDER_BUFFER:
+        *value = EGL_BACK_BUFFER;
+        break;
+    case EGL_SWAP_BEHAVIOR:
+        *value = EGL_BUFFER_DESTROYED;
+        break;
+    case EGL_MULTISAMPLE_RESOLVE:
+        *value = EGL_MULTISAMPLE_RESOLVE_DEFAULT;
+        break;
+    default:
+        setError(EGL_BAD_ATTRIBUTE);
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+static EGLBoolean mockSurfaceAttrib(EGLDisplay dpy, EGLSurface surface,
+                                    EGLint attribute, EGLint value)
+{
+    (void) value;
+
+    if (!checkDisplay(dpy) || !getSurface(surface)) {
+        return EGL_FALSE;
+    }
+
+    switch (attribute) {
+    case EGL_SWAP_BEHAVIOR:
+    case EGL_MULTISAMPLE_RESOLVE:
+        return EGL_TRUE;
+    default:
+        setError(EGL_BAD_ATTRIBUTE);
+        return EGL_FALSE;
+    }
+}
+
+/*
+ * Presents the back buffer. Waiting for a free back buffer is done first,
+ * as the driver does before rendering to it. In FIFO mode the frame waits
+ * for room in the FIFO, in mailbox mode it replaces the queued frame.
+ */
+static EGLBoolean mockSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+    MockEglSurface *surf;
+    MockEglStream  *stream;
+    EGLBoolean      ret = EGL_TRUE;
+    int             slot;
+
+    if (!checkDisplay(dpy) || !(surf = getSurface(surface))) {
+        return EGL_FALSE;
+    }
+
+    stream = surf->stream;
+    if (!stream) {
+        sleepNs(mockEgl.options.swapNs);
+        statsAdd(&mockEgl.stats.swaps, 1);
+        return EGL_TRUE;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->back < 0 && !stream->disconnected) {
+        stream->back = findFreeSlot(stream);
+        if (stream->back >= 0) {
+            stream->slots[stream->back].state = MOCK_EGL_SLOT_BACK;
+        } else if (hasReleasingSlot(stream)) {
+            /* Nothing signals the condition for fences, poll them */
+            pthread_mutex_unlock(&stream->mutex);
+            sleepNs(100000);
+            pthread_mutex_lock(&stream->mutex);
+        } else {
+            waitStream(stream, NULL);
+        }
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    sleepNs(mockEgl.options.swapNs);
+
+    pthread_mutex_lock(&stream->mutex);
+    while (stream->fifoLength > 0 &&
+           stream->queueLength >= stream->fifoLength &&
+           !stream->disconnected) {
+        waitStream(stream, NULL);
+    }
+
+    if (stream->disconnected) {
+        setError(EGL_BAD_STREAM_KHR);
+        ret = EGL_FALSE;
+        goto done;
+    }
+
+    if (stream->fifoLength == 0 && stream->queueLength > 0) {
+        slot = stream->queue[--stream->queueLength];
+        stream->slots[slot].state = MOCK_EGL_SLOT_FREE;
+        statsAdd(&mockEgl.stats.framesDropped, 1);
+    }
+
+    slot = stream->back;
+    stream->slots[slot].state = MOCK_EGL_SLOT_QUEUED;
+    stream->slots[slot].frame = ++stream->producerFrame;
+    stream->queue[stream->queueLength++] = slot;
+
+    /* Take the next back buffer now if one is free */
+    stream->back = findFreeSlot(stream);
+    if (stream->back >= 0) {
+        stream->slots[stream->back].state = MOCK_EGL_SLOT_BACK;
+    }
+
+    signalNewFrame(stream);
+    statsAdd(&mockEgl.stats.swaps, 1);
+
+done:
+    pthread_mutex_unlock(&stream->mutex);
+
+    return ret;
+}
+
+static EGLBoolean mockSwapBuffersWithDamage(EGLDisplay dpy, EGLSurface surface,
+                                            EGLint *rects, EGLint numRects)
+{
+    if (numRects < 0 || (numRects > 0 && !rects)) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_FALSE;
+    }
+
+    return mockSwapBuffers(dpy, surface);
+}
+
+/*
+ * Syncs
+ */
+
+static MockEglSync *allocSync(EGLenum type, EGLint status, int fd)
+{
+    MockEglSync *s = calloc(1, sizeof(*s));
+
+    if (!s) {
+        setError(EGL_BAD_ALLOC);
+        return NULL;
+    }
+
+    s->magic = MOCK_EGL_MAGIC_SYNC;
+    s->type = type;
+    s->status = status;
+    s->fd = fd;
+    wl_list_init(&s->link);
+
+    return s;
+}
+
+static EGLSyncKHR mockCreateSync(EGLDisplay dpy, EGLenum type,
+                                 const EGLint *attribs)
+{
+    EGLint       fd = EGL_NO_NATIVE_FENCE_FD_ANDROID;
+    EGLBoolean   hasStatus = EGL_FALSE;
+    int          i;
+
+    if (!checkDisplay(dpy)) {
+        return EGL_NO_SYNC_KHR;
+    }
+
+    for (i = 0; attribs && attribs[i] != EGL_NONE; i += 2) {
+        if (type == EGL_SYNC_NATIVE_FENCE_ANDROID &&
+            attribs[i] == EGL_SYNC_NATIVE_FENCE_FD_ANDROID) {
+            fd = attribs[i + 1];
+        } else if (type == EGL_SYNC_NATIVE_FENCE_ANDROID &&
+                   attribs[i] == EGL_SYNC_STATUS_KHR) {
+            hasStatus = EGL_TRUE;
+        } else {
+            setError(EGL_BAD_ATTRIBUTE);
+            return EGL_NO_SYNC_KHR;
+        }
+    }
+
+    switch (type) {
+    case EGL_SYNC_FENCE_KHR:
+        return (EGLSyncKHR)allocSync(type, EGL_SIGNALED_KHR, -1);
+
+    case EGL_SYNC_NATIVE_FENCE_ANDROID:
+        /*
+         * Drivers with explicit sync support reject a status along with a
+         * fence fd. The platform probes for exactly that.
+         */
+        if (fd != EGL_NO_NATIVE_FENCE_FD_ANDROID && hasStatus &&
+            mockEgl.options.explicitSync) {
+            setError(EGL_BAD_ATTRIBUTE);
+            return EGL_NO_SYNC_KHR;
+        }
+        /* The sync takes ownership of the fd */
+        return (EGLSyncKHR)allocSync(type, EGL_SIGNALED_KHR, fd);
+
+    default:
+        setError(EGL_BAD_PARAMETER);
+        return EGL_NO_SYNC_KHR;
+    }
+}
+
+static EGLSyncKHR mockCreateStreamSync(EGLDisplay dpy, EGLStreamKHR handle,
+                                       EGLenum type, const EGLint *attribs)
+{
+    MockEglStream *stream;
+    MockEglSync   *s;
+
+    if (!checkDisplay(dpy) || !(stream = getStream(handle))) {
+        return EGL_NO_SYNC_KHR;
+    }
+    if (type != EGL_SYNC_NEW_FRAME_NV ||
+        (attribs && attribs[0] != EGL_NONE)) {
+        setError(EGL_BAD_ATTRIBUTE);
+        return EGL_NO_SYNC_KHR;
+    }
+
+    s = allocSync(type, EGL_UNSIGNALED_KHR, -1);
+    if (!s) {
+        return EGL_NO_SYNC_KHR;
+    }
+
+    refStream(stream);
+    s->stream = stream;
+
+    pthread_mutex_lock(&stream->mutex);
+    wl_list_insert(&stream->syncs, &s->link);
+    pthread_mutex_unlock(&stream->mutex);
+
+    return (EGLSyncKHR)s;
+}
+
+static EGLBoolean mockDestroySync(EGLDisplay dpy, EGLSyncKHR sync)
+{
+    MockEglSync *s;
+
+    if (!checkDisplay(dpy) || !(s = getSync(sync))) {
+        return EGL_FALSE;
+    }
+
+    if (s->stream) {
+        pthread_mutex_lock(&s->stream->mutex);
+        wl_list_remove(&s->link);
+        pthread_mutex_unlock(&s->stream->mutex);
+        unrefStream(s->stream);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+
+    s->magic = 0;
+    free(s);
+
+    return EGL_TRUE;
+}
+
+/* Only the stream syncs are reusable */
+static EGLBoolean mockSignalSync(EGLDisplay dpy, EGLSyncKHR sync, EGLenum mode)
+{
+    MockEglSync *s;
+
+    if (!checkDisplay(dpy) || !(s = getSync(sync))) {
+        return EGL_FALSE;
+    }
+    if (!s->stream) {
+        setError(EGL_BAD_MATCH);
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&s->stream->mutex);
+    s->status = mode;
+    if (mode == EGL_SIGNALED_KHR) {
+        pthread_cond_broadcast(&s->stream->cond);
+    }
+    pthread_mutex_unlock(&s->stream->mutex);
+
+    return EGL_TRUE;
+}
+
+static EGLint mockClientWaitSync(EGLDisplay dpy, EGLSyncKHR sync,
+                                 EGLint flags, EGLTimeKHR timeout)
+{
+    MockEglSync     *s;
+    struct timespec  deadline;
+    struct pollfd    pfd;
+    EGLBoolean       hasDeadline;
+    EGLint           ret = EGL_CONDITION_SATISFIED_KHR;
+    int              ms;
+
+    (void) flags;
+
+    if (!checkDisplay(dpy) || !(s = getSync(sync))) {
+        return EGL_FALSE;
+    }
+
+    if (s->stream) {
+        hasDeadline = getDeadline(timeout, &deadline);
+
+        pthread_mutex_lock(&s->stream->mutex);
+        while (s->status != EGL_SIGNALED_KHR) {
+            if (timeout == 0 ||
+                waitStream(s->stream,
+                           hasDeadline ? &deadline : NULL) == ETIMEDOUT) {
+                ret = EGL_TIMEOUT_EXPIRED_KHR;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&s->stream->mutex);
+    } else if (s->fd >= 0) {
+        pfd.fd = s->fd;
+        pfd.events = POLLIN;
+        ms = timeout == EGL_FOREVER_KHR ? -1 :
+             (int)((timeout + 999999) / 1000000);
+        if (poll(&pfd, 1, ms) != 1) {
+            ret = EGL_TIMEOUT_EXPIRED_KHR;
+        }
+    }
+
+    return ret;
+}
+
+static EGLint mockDupNativeFenceFD(EGLDisplay dpy, EGLSyncKHR sync)
+{
+    MockEglSync *s;
+    int          fd;
+
+    if (!checkDisplay(dpy) || !(s = getSync(sync))) {
+        return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+    }
+    if (s->type != EGL_SYNC_NATIVE_FENCE_ANDROID || s->fd < 0) {
+        setError(EGL_BAD_PARAMETER);
+        return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+    }
+
+    fd = fcntl(s->fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        setError(EGL_BAD_ALLOC);
+        return EGL_NO_NATIVE_FENCE_FD_ANDROID;
+    }
+
+    return fd;
+}
+
+/*
+ * Driver interface
+ */
+
+typedef struct MockEglProcRec {
+    const char *name;
+    void       *func;
+} MockEglProc;
+
+static const MockEglProc mockEglProcs[] = {
+    /* Keep names in ascending order */
+    { "eglChooseConfig",                      mockChooseConfig },
+    { "eglClientWaitSyncKHR",                 mockClientWaitSync },
+    { "eglCreateImageKHR",                    mockCreateImage },
+    { "eglCreatePbufferSurface",              mockCreatePbufferSurface },
+    { "eglCreateStreamAttribNV",              mockCreateStreamAttrib },
+    { "eglCreateStreamFromFileDescriptorKHR", mockCreateStreamFromFileDescriptor },
+    { "eglCreateStreamKHR",                   mockCreateStream },
+    { "eglCreateStreamProducerSurfaceKHR",    mockCreateStreamProducerSurface },
+    { "eglCreateStreamSyncNV",                mockCreateStreamSync },
+    { "eglCreateSyncKHR",                     mockCreateSync },
+    { "eglDestroyImageKHR",                   mockDestroyImage },
+    { "eglDestroyStreamKHR",                  mockDestroyStream },
+    { "eglDestroySurface",                    mockDestroySurface },
+    { "eglDestroySyncKHR",                    mockDestroySync },
+    { "eglDupNativeFenceFDANDROID",           mockDupNativeFenceFD },
+    { "eglExportDMABUFImageMESA",             mockExportDMABUFImage },
+    { "eglExportDMABUFImageQueryMESA",        mockExportDMABUFImageQuery },
+    { "eglGetConfigAttrib",                   mockGetConfigAttrib },
+    { "eglGetCurrentContext",                 mockGetCurrentContext },
+    { "eglGetCurrentSurface",                 mockGetCurrentSurface },
+    { "eglGetError",                          mockGetError },
+    { "eglGetPlatformDisplayEXT",             mockGetPlatformDisplay },
+    { "eglGetStreamFileDescriptorKHR",        mockGetStreamFileDescriptor },
+    { "eglInitialize",                        mockInitialize },
+    { "eglMakeCurrent",                       mockEglMakeCurrent },
+    { "eglQueryDeviceStringEXT",              mockQueryDeviceString },
+    { "eglQueryDevicesEXT",                   mockQueryDevices },
+    { "eglQueryDisplayAttribEXT",             mockQueryDisplayAttrib },
+    { "eglQueryStreamConsumerEventNV",        mockQueryStreamConsumerEvent },
+    { "eglQueryStreamKHR",                    mockQueryStream },
+    { "eglQueryStreamu64KHR",                 mockQueryStreamu64 },
+    { "eglQueryString",                       mockQueryString },
+    { "eglQuerySurface",                      mockQuerySurface },
+    { "eglReleaseThread",                     mockReleaseThread },
+    { "eglSignalSyncKHR",                     mockSignalSync },
+    { "eglStreamAcquireImageNV",              mockStreamAcquireImage },
+    { "eglStreamConsumerAcquireKHR",          mockStreamConsumerAcquire },
+    { "eglStreamConsumerGLTextureExternalKHR", mockStreamConsumerGLTextureExternal },
+    { "eglStreamConsumerReleaseKHR",          mockStreamConsumerRelease },
+    { "eglStreamFlushNV",                     mockStreamFlush },
+    { "eglStreamImageConsumerConnectNV",      mockStreamImageConsumerConnect },
+    { "eglStreamReleaseImageNV",              mockStreamReleaseImage },
+    { "eglSurfaceAttrib",                     mockSurfaceAttrib },
+    { "eglSwapBuffers",                       mockSwapBuffers },
+    { "eglSwapBuffersWithDamageKHR",          mockSwapBuffersWithDamage },
+    { "eglSwapInterval",                      mockSwapInterval },
+    { "eglTerminate",                         mockTerminate },
+};
+
+static int procCmp(const void *elemA, const void *elemB)
+{
+    const char *key = (const char *)elemA;
+    const MockEglProc *proc = (const MockEglProc *)elemB;
+    return strcmp(key, proc->name);
+}
+
+void *mockEglGetProcAddress(const char *name)
+{
+    const MockEglProc *proc;
+
+    /* What isn't advertised isn't there, like on older drivers */
+    if ((!mockEgl.options.streamFlush &&
+         !strcmp(name, "eglStreamFlushNV")) ||
+        (!mockEgl.options.imageConsumer &&
+         (!strcmp(name, "eglStreamImageConsumerConnectNV") ||
+          !strcmp(name, "eglExportDMABUFImageMESA")))) {
+        return NULL;
+    }
+
+    proc = bsearch(name, mockEglProcs,
+                   sizeof(mockEglProcs) / sizeof(mockEglProcs[0]),
+                   sizeof(MockEglProc), procCmp);
+
+    return proc ? proc->func : NULL;
+}
+
+static EGLBoolean mockSetError(EGLint error, EGLint msgType, const char *msg)
+{
+    (void) msgType;
+    (void) msg;
+
+    setError(error);
+    return EGL_TRUE;
+}
+
+static EGLint mockStreamSwapInterval(EGLStreamKHR stream, int *interval)
+{
+    (void) stream;
+    (void) interval;
+
+    return EGL_SUCCESS;
+}
+
+static const EGLExtDriver mockEglDriver = {
+    .getProcAddress     = mockEglGetProcAddress,
+    .setError           = mockSetError,
+    .streamSwapInterval = mockStreamSwapInterval,
+#if EGL_EXTERNAL_PLATFORM_HAS(DRIVER_VERSION)
+    .major              = 1,
+    .minor              = 5,
+#endif
+};
+
+static uint64_t getEnvUs(const char *name, uint64_t defaultNs)
+{
+    const char *str = getenv(name);
+
+    return str ? strtoull(str, NULL, 10) * 1000ull : defaultNs;
+}
+
+static EGLBoolean getEnvBool(const char *name, EGLBoolean defaultValue)
+{
+    const char *str = getenv(name);
+
+    return str ? !!atoi(str) : defaultValue;
+}
+
+void mockEglGetDefaultOptions(MockEglOptions *options)
+{
+    const char *str;
+
+    memset(options, 0, sizeof(*options));
+
+    options->initNs          = getEnvUs("MOCK_EGL_INIT_US", 0);
+    options->swapNs          = getEnvUs("MOCK_EGL_SWAP_US", 0);
+    options->flushNs         = getEnvUs("MOCK_EGL_FLUSH_US", 0);
+    options->exportNs        = getEnvUs("MOCK_EGL_EXPORT_US", 0);
+    options->explicitSync    = getEnvBool("MOCK_EGL_EXPLICIT_SYNC", EGL_TRUE);
+    options->fifoSynchronous = getEnvBool("MOCK_EGL_FIFO_SYNCHRONOUS", EGL_TRUE);
+    options->streamFlush     = getEnvBool("MOCK_EGL_STREAM_FLUSH", EGL_TRUE);
+    options->imageConsumer   = getEnvBool("MOCK_EGL_IMAGE_CONSUMER", EGL_TRUE);
+
+    str = getenv("MOCK_EGL_IMAGES");
+    options->numImages = str ? atoi(str) : MOCK_EGL_MAX_IMAGES;
+
+    str = getenv("MOCK_EGL_DRM_NODE");
+    options->drmNode = str ? str : "/dev/null";
+}
+
+const MockEglOptions *mockEglGetOptions(void)
+{
+    return &mockEgl.options;
+}
+
+static void buildDisplayExtensions(const MockEglOptions *options)
+{
+    char *exts = mockEgl.displayExtensions;
+
+    strcpy(exts,
+           "EGL_KHR_stream "
+           "EGL_NV_stream_attrib "
+           "EGL_KHR_stream_cross_process_fd "
+           "EGL_KHR_stream_producer_eglsurface "
+           "EGL_KHR_stream_consumer_gltexture "
+           "EGL_NV_stream_sync "
+           "EGL_KHR_fence_sync "
+           "EGL_KHR_reusable_sync "
+           "EGL_KHR_image_base "
+           "EGL_ANDROID_native_fence_sync");
+
+    if (options->fifoSynchronous) {
+        strcat(exts, " EGL_NV_stream_fifo_synchronous");
+    }
+    if (options->streamFlush) {
+        strcat(exts, " EGL_NV_stream_flush");
+    }
+    if (options->imageConsumer) {
+        strcat(exts, " EGL_NV_stream_consumer_eglimage"
+                     " EGL_MESA_image_dma_buf_export");
+    }
+}
+
+EGLBoolean mockEglLoad(MockEgl *egl, const MockEglOptions *options)
+{
+    MockEglOptions defaults;
+
+    if (!options) {
+        mockEglGetDefaultOptions(&defaults);
+        options = &defaults;
+    }
+
+    memset(egl, 0, sizeof(*egl));
+
+    mockEgl.options = *options;
+    if (mockEgl.options.numImages < 2) {
+        mockEgl.options.numImages = 2;
+    } else if (mockEgl.options.numImages > MOCK_EGL_MAX_IMAGES) {
+        mockEgl.options.numImages = MOCK_EGL_MAX_IMAGES;
+    }
+    if (!mockEgl.options.drmNode) {
+        mockEgl.options.drmNode = "/dev/null";
+    }
+    wl_list_init(&mockEgl.exportedStreams);
+    buildDisplayExtensions(&mockEgl.options);
+    mockDrmSetDeviceNode(mockEgl.options.drmNode);
+
+    if (!loadEGLExternalPlatform(WAYLAND_EXTERNAL_VERSION_MAJOR,
+                                 WAYLAND_EXTERNAL_VERSION_MINOR,
+                                 &mockEglDriver, &egl->platform)) {
+        return EGL_FALSE;
+    }
+
+#define GET_HOOK(_FIELD_, _NAME_)                                          \
+    egl->_FIELD_ = egl->platform.exports.getHookAddress(egl->platform.data, \
+                                                        #_NAME_)
+
+    GET_HOOK(initialize,                  eglInitialize);
+    GET_HOOK(terminate,                   eglTerminate);
+    GET_HOOK(chooseConfig,                eglChooseConfig);
+    GET_HOOK(getConfigAttrib,             eglGetConfigAttrib);
+    GET_HOOK(createPlatformWindowSurface, eglCreatePlatformWindowSurface);
+    GET_HOOK(destroySurface,              eglDestroySurface);
+    GET_HOOK(querySurface,                eglQuerySurface);
+    GET_HOOK(swapBuffers,                 eglSwapBuffers);
+    GET_HOOK(swapBuffersWithDamage,       eglSwapBuffersWithDamageKHR);
+    GET_HOOK(swapInterval,                eglSwapInterval);
+    GET_HOOK(createStreamAttrib,          eglCreateStreamAttribNV);
+    GET_HOOK(bindWaylandDisplay,          eglBindWaylandDisplayWL);
+    GET_HOOK(unbindWaylandDisplay,        eglUnbindWaylandDisplayWL);
+
+#undef GET_HOOK
+
+    return EGL_TRUE;
+}
+
+void mockEglUnload(MockEgl *egl)
+{
+    if (egl->platform.exports.unloadEGLExternalPlatform) {
+        egl->platform.exports.unloadEGLExternalPlatform(egl->platform.data);
+    }
+    memset(egl, 0, sizeof(*egl));
+}
+
+EGLDisplay mockEglGetDisplay(MockEgl *egl, void *nativeDpy,
+                             const EGLAttrib *attribs)
+{
+    return egl->platform.exports.getPlatformDisplay(egl->platform.data,
+                                                    EGL_PLATFORM_WAYLAND_EXT,
+                                                    nativeDpy, attribs);
+}
+
+EGLDisplay mockEglGetDeviceDisplay(void)
+{
+    return MOCK_EGL_DISPLAY;
+}
+
+void mockEglGetStats(MockEglStats *stats)
+{
+    stats->swaps          = __atomic_load_n(&mockEgl.stats.swaps, __ATOMIC_RELAXED);
+    stats->framesAcquired = __atomic_load_n(&mockEgl.stats.framesAcquired, __ATOMIC_RELAXED);
+    stats->framesDropped  = __atomic_load_n(&mockEgl.stats.framesDropped, __ATOMIC_RELAXED);
+    stats->exports        = __atomic_load_n(&mockEgl.stats.exports, __ATOMIC_RELAXED);
+    stats->streams        = __atomic_load_n(&mockEgl.stats.streams, __ATOMIC_RELAXED);
+    stats->imageBytes     = __atomic_load_n(&mockEgl.stats.imageBytes, __ATOMIC_RELAXED);
+    stats->peakImageBytes = __atomic_load_n(&mockEgl.stats.peakImageBytes, __ATOMIC_RELAXED);
+}
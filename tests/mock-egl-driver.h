@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MOCK_EGL_DRIVER_H
+#define MOCK_EGL_DRIVER_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdint.h>
+
+#include "wayland-external-exports.h"
+#include "wayland-egl-ext.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * GPU-free EGL driver for tests and benchmarks
+ *
+ * The mock implements every entry point the platform fetches through
+ * EGLExtDriver::getProcAddress, plus the EGLStream consumer functions a
+ * compositor needs, without touching a GPU. The platform is loaded on top of
+ * it through loadEGLExternalPlatform(), the same way the vendor EGL library
+ * does, and mockEglLoad() looks up the hooks an application would end up in.
+ *
+ * Stream images are bookkeeping only: dma-bufs exported from them are
+ * memfds of the right size, and every fence the driver hands out is already
+ * signalled. The GPU is modelled by the latencies below. Executables linking
+ * the mock also get mock-drm.c, which interposes the libdrm calls the
+ * platform makes, so explicit sync works against the mock's DRM node too.
+ *
+ * Every option can also be set from the environment, see
+ * mockEglGetDefaultOptions().
+ */
+
+/* The platform's swapchain image count, see MAX_IMAGES */
+#define MOCK_EGL_MAX_IMAGES 4
+
+typedef struct MockEglOptionsRec {
+    uint64_t    initNs;          /* MOCK_EGL_INIT_US: eglInitialize() */
+    uint64_t    swapNs;          /* MOCK_EGL_SWAP_US: CPU time in eglSwapBuffers() */
+    uint64_t    flushNs;         /* MOCK_EGL_FLUSH_US: eglStreamFlushNV() */
+    uint64_t    exportNs;        /* MOCK_EGL_EXPORT_US: eglExportDMABUFImageMESA() */
+    int         numImages;       /* MOCK_EGL_IMAGES: images per stream */
+    EGLBoolean  explicitSync;    /* MOCK_EGL_EXPLICIT_SYNC: pass the sync probe */
+    EGLBoolean  fifoSynchronous; /* MOCK_EGL_FIFO_SYNCHRONOUS: EGL_NV_stream_fifo_synchronous */
+    EGLBoolean  streamFlush;     /* MOCK_EGL_STREAM_FLUSH: EGL_NV_stream_flush */
+    EGLBoolean  imageConsumer;   /* MOCK_EGL_IMAGE_CONSUMER: local streams with dma-buf */
+    const char *drmNode;         /* MOCK_EGL_DRM_NODE: node reported for the device */
+} MockEglOptions;
+
+/* Counters kept by the driver, see mockEglGetStats() */
+typedef struct MockEglStatsRec {
+    uint64_t swaps;
+    uint64_t framesAcquired;
+    uint64_t framesDropped;      /* Replaced in mailbox mode before being acquired */
+    uint64_t exports;
+    uint64_t streams;            /* Currently alive */
+    uint64_t imageBytes;         /* Currently allocated in stream images */
+    uint64_t peakImageBytes;
+} MockEglStats;
+
+/* Application-facing entry points of the platform */
+typedef EGLBoolean (*MockEglBindWaylandDisplayHook)(void *data,
+                                                    EGLDisplay dpy,
+                                                    void *nativeDpy);
+typedef EGLBoolean (*MockEglUnbindWaylandDisplayHook)(EGLDisplay dpy,
+                                                      void *nativeDpy);
+
+typedef struct MockEglRec {
+    EGLExtPlatform                        platform;
+
+    PFNEGLINITIALIZEPROC                  initialize;
+    PFNEGLTERMINATEPROC                   terminate;
+    PFNEGLCHOOSECONFIGPROC                chooseConfig;
+    PFNEGLGETCONFIGATTRIBPROC             getConfigAttrib;
+    PFNEGLCREATEPLATFORMWINDOWSURFACEPROC createPlatformWindowSurface;
+    PFNEGLDESTROYSURFACEPROC              destroySurface;
+    PFNEGLQUERYSURFACEPROC                querySurface;
+    PFNEGLSWAPBUFFERSPROC                 swapBuffers;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC    swapBuffersWithDamage;
+    PFNEGLSWAPINTERVALPROC                swapInterval;
+    PFNEGLCREATESTREAMATTRIBNVPROC        createStreamAttrib;
+    MockEglBindWaylandDisplayHook         bindWaylandDisplay;
+    MockEglUnbindWaylandDisplayHook       unbindWaylandDisplay;
+} MockEgl;
+
+/* Defaults, overridden by the MOCK_EGL_* environment variables */
+void mockEglGetDefaultOptions(MockEglOptions *options);
+
+/*
+ * Loads the platform on top of the mock driver. Only one platform can be
+ * loaded at a time. Returns EGL_FALSE if the platform refuses the driver.
+ */
+EGLBoolean mockEglLoad(MockEgl *egl, const MockEglOptions *options);
+void mockEglUnload(MockEgl *egl);
+
+/* The options the driver was loaded with */
+const MockEglOptions *mockEglGetOptions(void);
+
+/* eglGetPlatformDisplay(EGL_PLATFORM_WAYLAND_EXT, nativeDpy, attribs) */
+EGLDisplay mockEglGetDisplay(MockEgl *egl, void *nativeDpy,
+                             const EGLAttrib *attribs);
+
+/*
+ * Driver entry points, for what the platform doesn't hook: current context
+ * handling, and the EGLStream consumer side used by a compositor.
+ */
+void *mockEglGetProcAddress(const char *name);
+
+/*
+ * The driver's own EGLDisplay on its only device, as a compositor gets it
+ * through eglGetPlatformDisplay(EGL_PLATFORM_DEVICE_EXT).
+ */
+EGLDisplay mockEglGetDeviceDisplay(void);
+
+/* Never dereferenced, the driver has no contexts of its own */
+#define MOCK_EGL_CONTEXT ((EGLContext)(uintptr_t)0x1)
+
+EGLBoolean mockEglMakeCurrent(EGLDisplay dpy, EGLSurface draw,
+                              EGLSurface read, EGLContext ctx);
+
+void mockEglGetStats(MockEglStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
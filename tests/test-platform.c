@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the mock driver behaves the way the platform expects a driver to,
+ * and that the platform loads on top of it.
+ */
+
+#include "mock-egl-driver.h"
+#include "mock-drm.h"
+
+#include <wayland-client.h>
+#include <xf86drm.h>
+#include <drm_fourcc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define CHECK(_COND_)                                                   \
+    do {                                                                \
+        if (!(_COND_)) {                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #_COND_);                       \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+static struct {
+    PFNEGLINITIALIZEPROC                       initialize;
+    PFNEGLTERMINATEPROC                        terminate;
+    PFNEGLQUERYSTRINGPROC                      queryString;
+    PFNEGLGETERRORPROC                         getError;
+    PFNEGLCHOOSECONFIGPROC                     chooseConfig;
+    PFNEGLCREATESTREAMATTRIBNVPROC             createStreamAttrib;
+    PFNEGLDESTROYSTREAMKHRPROC                 destroyStream;
+    PFNEGLQUERYSTREAMKHRPROC                   queryStream;
+    PFNEGLSTREAMIMAGECONSUMERCONNECTNVPROC     streamImageConsumerConnect;
+    PFNEGLCREATESTREAMPRODUCERSURFACEKHRPROC   createStreamProducerSurface;
+    PFNEGLDESTROYSURFACEPROC                   destroySurface;
+    PFNEGLSWAPBUFFERSPROC                      swapBuffers;
+    PFNEGLQUERYSTREAMCONSUMEREVENTNVPROC       queryStreamConsumerEvent;
+    PFNEGLCREATEIMAGEKHRPROC                   createImage;
+    PFNEGLDESTROYIMAGEKHRPROC                  destroyImage;
+    PFNEGLSTREAMACQUIREIMAGENVPROC             streamAcquireImage;
+    PFNEGLSTREAMRELEASEIMAGENVPROC             streamReleaseImage;
+    PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC       exportDMABUFImageQuery;
+    PFNEGLEXPORTDMABUFIMAGEMESAPROC            exportDMABUFImage;
+    PFNEGLCREATESYNCKHRPROC                    createSync;
+    PFNEGLDESTROYSYNCKHRPROC                   destroySync;
+    PFNEGLDUPNATIVEFENCEFDANDROIDPROC          dupNativeFenceFD;
+} egl;
+
+static void getProcs(void)
+{
+#define GET_PROC(_FIELD_, _NAME_)                       \
+    do {                                                \
+        egl._FIELD_ = mockEglGetProcAddress(#_NAME_);   \
+        CHECK(egl._FIELD_ != NULL);                     \
+    } while (0)
+
+    GET_PROC(initialize,                  eglInitialize);
+    GET_PROC(terminate,                   eglTerminate);
+    GET_PROC(queryString,                 eglQueryString);
+    GET_PROC(getError,                    eglGetError);
+    GET_PROC(chooseConfig,                eglChooseConfig);
+    GET_PROC(createStreamAttrib,          eglCreateStreamAttribNV);
+    GET_PROC(destroyStream,               eglDestroyStreamKHR);
+    GET_PROC(queryStream,                 eglQueryStreamKHR);
+    GET_PROC(streamImageConsumerConnect,  eglStreamImageConsumerConnectNV);
+    GET_PROC(createStreamProducerSurface, eglCreateStreamProducerSurfaceKHR);
+    GET_PROC(destroySurface,              eglDestroySurface);
+    GET_PROC(swapBuffers,                 eglSwapBuffers);
+    GET_PROC(queryStreamConsumerEvent,    eglQueryStreamConsumerEventNV);
+    GET_PROC(createImage,                 eglCreateImageKHR);
+    GET_PROC(destroyImage,                eglDestroyImageKHR);
+    GET_PROC(streamAcquireImage,          eglStreamAcquireImageNV);
+    GET_PROC(streamReleaseImage,          eglStreamReleaseImageNV);
+    GET_PROC(exportDMABUFImageQuery,      eglExportDMABUFImageQueryMESA);
+    GET_PROC(exportDMABUFImage,           eglExportDMABUFImageMESA);
+    GET_PROC(createSync,                  eglCreateSyncKHR);
+    GET_PROC(destroySync,                 eglDestroySyncKHR);
+    GET_PROC(dupNativeFenceFD,            eglDupNativeFenceFDANDROID);
+
+#undef GET_PROC
+}
+
+typedef struct TestStreamRec {
+    EGLDisplay   dpy;
+    EGLStreamKHR stream;
+    EGLSurface   surface;
+    EGLImage     images[MOCK_EGL_MAX_IMAGES];
+    int          numImages;
+} TestStream;
+
+/* Sets up a local stream the way the platform does for dma-buf surfaces */
+static void createTestStream(TestStream *ts, EGLint fifoLength)
+{
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_STREAM_BIT_KHR,
+        EGL_ALPHA_SIZE,   8,
+        EGL_NONE,
+    };
+    const EGLAttrib streamAttribs[] = {
+        EGL_STREAM_FIFO_LENGTH_KHR, fifoLength,
+        EGL_NONE,
+    };
+    static const EGLint surfaceAttribs[] = {
+        EGL_WIDTH,  64,
+        EGL_HEIGHT, 32,
+        EGL_NONE,
+    };
+    const EGLuint64KHR modifier = DRM_FORMAT_MOD_LINEAR;
+    EGLConfig config;
+    EGLint    numConfigs;
+    EGLenum   event;
+    EGLAttrib aux;
+
+    memset(ts, 0, sizeof(*ts));
+    ts->dpy = mockEglGetDeviceDisplay();
+
+    CHECK(egl.chooseConfig(ts->dpy, configAttribs, &config, 1, &numConfigs));
+    CHECK(numConfigs == 1);
+
+    ts->stream = egl.createStreamAttrib(ts->dpy, streamAttribs);
+    CHECK(ts->stream != EGL_NO_STREAM_KHR);
+
+    /* No consumer yet */
+    CHECK(egl.createStreamProducerSurface(ts->dpy, config, ts->stream,
+                                          surfaceAttribs) == EGL_NO_SURFACE);
+    CHECK(egl.getError() == EGL_BAD_STATE_KHR);
+
+    CHECK(egl.streamImageConsumerConnect(ts->dpy, ts->stream, 1, &modifier,
+                                         NULL));
+    ts->surface = egl.createStreamProducerSurface(ts->dpy, config, ts->stream,
+                                                  surfaceAttribs);
+    CHECK(ts->surface != EGL_NO_SURFACE);
+
+    /* Every image is announced before any frame */
+    while (egl.queryStreamConsumerEvent(ts->dpy, ts->stream, 0,
+                                        &event, &aux) == EGL_TRUE) {
+        CHECK(event == EGL_STREAM_IMAGE_ADD_NV);
+        CHECK(ts->numImages < MOCK_EGL_MAX_IMAGES);
+        ts->images[ts->numImages] =
+            egl.createImage(ts->dpy, EGL_NO_CONTEXT,
+                            EGL_STREAM_CONSUMER_IMAGE_NV,
+                            (EGLClientBuffer)ts->stream, NULL);
+        CHECK(ts->images[ts->numImages] != EGL_NO_IMAGE_KHR);
+        ts->numImages++;
+    }
+    CHECK(ts->numImages == mockEglGetOptions()->numImages);
+}
+
+static void destroyTestStream(TestStream *ts)
+{
+    int i;
+
+    CHECK(egl.destroySurface(ts->dpy, ts->surface));
+    for (i = 0; i < ts->numImages; i++) {
+        CHECK(egl.destroyImage(ts->dpy, ts->images[i]));
+    }
+    CHECK(egl.destroyStream(ts->dpy, ts->stream));
+}
+
+static EGLImage acquireFrame(TestStream *ts, EGLSync sync)
+{
+    EGLImage  image = EGL_NO_IMAGE;
+    EGLenum   event;
+    EGLAttrib aux;
+
+    CHECK(egl.queryStreamConsumerEvent(ts->dpy, ts->stream, 0,
+                                       &event, &aux) == EGL_TRUE);
+    CHECK(event == EGL_STREAM_IMAGE_AVAILABLE_NV);
+    CHECK(egl.streamAcquireImage(ts->dpy, ts->stream, &image, sync));
+
+    return image;
+}
+
+static void testDriverLoad(void)
+{
+    const char *exts;
+
+    CHECK(egl.initialize(mockEglGetDeviceDisplay(), NULL, NULL));
+
+    exts = egl.queryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    CHECK(exts && strstr(exts, "EGL_EXT_platform_device"));
+
+    exts = egl.queryString(mockEglGetDeviceDisplay(), EGL_EXTENSIONS);
+    CHECK(exts && strstr(exts, "EGL_NV_stream_consumer_eglimage"));
+    CHECK(strstr(exts, "EGL_ANDROID_native_fence_sync"));
+}
+
+static void testImageStream(void)
+{
+    TestStream  ts;
+    EGLImage    image;
+    EGLSync     sync;
+    EGLint      attribs[] = {
+        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+        EGL_NONE,
+    };
+    EGLuint64KHR modifier;
+    EGLint      stride, offset, state;
+    EGLenum     event;
+    EGLAttrib   aux;
+    struct stat st;
+    int         fourcc, planes, fd;
+
+    createTestStream(&ts, 1);
+
+    CHECK(egl.queryStream(ts.dpy, ts.stream, EGL_STREAM_STATE_KHR, &state));
+    CHECK(state == EGL_STREAM_STATE_EMPTY_KHR);
+
+    CHECK(egl.swapBuffers(ts.dpy, ts.surface));
+
+    sync = egl.createSync(ts.dpy, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+    CHECK(sync != EGL_NO_SYNC);
+    image = acquireFrame(&ts, sync);
+
+    /* The acquire fence comes with the frame */
+    fd = egl.dupNativeFenceFD(ts.dpy, sync);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(egl.destroySync(ts.dpy, sync));
+
+    CHECK(egl.exportDMABUFImageQuery(ts.dpy, image, &fourcc, &planes,
+                                     &modifier));
+    CHECK(fourcc == DRM_FORMAT_ARGB8888);
+    CHECK(planes == 1);
+    CHECK(modifier == DRM_FORMAT_MOD_LINEAR);
+
+    CHECK(egl.exportDMABUFImage(ts.dpy, image, &fd, &stride, &offset));
+    CHECK(stride == 64 * 4 && offset == 0);
+    CHECK(fstat(fd, &st) == 0 && st.st_size == stride * 32);
+    close(fd);
+
+    CHECK(egl.streamReleaseImage(ts.dpy, ts.stream, image, EGL_NO_SYNC));
+
+    /* Nothing new */
+    CHECK(egl.queryStreamConsumerEvent(ts.dpy, ts.stream, 0, &event,
+                                       &aux) == EGL_TIMEOUT_EXPIRED);
+
+    destroyTestStream(&ts);
+}
+
+static void testMailbox(void)
+{
+    MockEglStats before, after;
+    TestStream   ts;
+    EGLImage     image;
+    EGLenum      event;
+    EGLAttrib    aux;
+
+    createTestStream(&ts, 0);
+    mockEglGetStats(&before);
+
+    /* The second frame replaces the first one */
+    CHECK(egl.swapBuffers(ts.dpy, ts.surface));
+    CHECK(egl.swapBuffers(ts.dpy, ts.surface));
+
+    mockEglGetStats(&after);
+    CHECK(after.framesDropped - before.framesDropped == 1);
+
+    image = acquireFrame(&ts, EGL_NO_SYNC);
+    CHECK(egl.queryStreamConsumerEvent(ts.dpy, ts.stream, 0, &event,
+                                       &aux) == EGL_TIMEOUT_EXPIRED);
+    CHECK(egl.streamReleaseImage(ts.dpy, ts.stream, image, EGL_NO_SYNC));
+
+    destroyTestStream(&ts);
+}
+
+static void *waitForEvent(void *data)
+{
+    TestStream *ts = data;
+    EGLenum     event;
+    EGLAttrib   aux;
+    EGLint      ret;
+
+    ret = egl.queryStreamConsumerEvent(ts->dpy, ts->stream, EGL_FOREVER,
+                                       &event, &aux);
+
+    return (void *)(intptr_t)ret;
+}
+
+/* Destroying the producer must wake up a consumer waiting for frames */
+static void testDisconnect(void)
+{
+    TestStream ts;
+    pthread_t  thread;
+    void      *ret;
+    EGLint     state;
+    int        i;
+
+    createTestStream(&ts, 1);
+
+    CHECK(pthread_create(&thread, NULL, waitForEvent, &ts) == 0);
+    usleep(10000);
+    CHECK(egl.destroySurface(ts.dpy, ts.surface));
+    CHECK(pthread_join(thread, &ret) == 0);
+    CHECK((intptr_t)ret == EGL_FALSE);
+
+    CHECK(egl.queryStream(ts.dpy, ts.stream, EGL_STREAM_STATE_KHR, &state));
+    CHECK(state == EGL_STREAM_STATE_DISCONNECTED_KHR);
+
+    for (i = 0; i < ts.numImages; i++) {
+        CHECK(egl.destroyImage(ts.dpy, ts.images[i]));
+    }
+    CHECK(egl.destroyStream(ts.dpy, ts.stream));
+}
+
+/* The platform's explicit sync probe, see wlEglInitializeExplicitSync() */
+static void testExplicitSyncProbe(void)
+{
+    EGLDisplay dpy = mockEglGetDeviceDisplay();
+    uint32_t   handle;
+    int        fd;
+    EGLint     attribs[] = {
+        EGL_SYNC_NATIVE_FENCE_FD_ANDROID, -1,
+        EGL_SYNC_STATUS_KHR,              EGL_SIGNALED_KHR,
+        EGL_NONE,
+    };
+
+    CHECK(drmSyncobjCreate(-1, 0, &handle) == 0);
+    CHECK(drmSyncobjHandleToFD(-1, handle, &fd) == 0);
+
+    attribs[1] = fd;
+    CHECK(egl.createSync(dpy, EGL_SYNC_NATIVE_FENCE_ANDROID,
+                         attribs) == EGL_NO_SYNC);
+    CHECK(egl.getError() == EGL_BAD_ATTRIBUTE);
+
+    close(fd);
+    CHECK(drmSyncobjDestroy(-1, handle) == 0);
+}
+
+static void testSyncobjTimeline(void)
+{
+    MockDrmStats stats;
+    uint32_t     handle, imported;
+    uint64_t     point = 2;
+    int          fd, eventFd;
+    struct pollfd pfd;
+
+    CHECK(drmSyncobjCreate(-1, 0, &handle) == 0);
+
+    /* A compositor gets the same syncobj back from the fd */
+    CHECK(drmSyncobjHandleToFD(-1, handle, &fd) == 0);
+    CHECK(drmSyncobjFDToHandle(-1, fd, &imported) == 0);
+    close(fd);
+
+    CHECK(drmSyncobjTimelineWait(-1, &handle, &point, 1, 0,
+                                 DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                 NULL) == -ETIME);
+    CHECK(errno == ETIME);
+
+    eventFd = eventfd(0, EFD_CLOEXEC);
+    CHECK(eventFd >= 0);
+#if defined(HAVE_DRMSYNCOBJEVENTFD)
+    CHECK(drmSyncobjEventfd(-1, handle, point, eventFd,
+                            DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) == 0);
+#endif
+
+    CHECK(drmSyncobjTimelineSignal(-1, &imported, &point, 1) == 0);
+    CHECK(drmSyncobjTimelineWait(-1, &handle, &point, 1, 0,
+                                 DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE,
+                                 NULL) == 0);
+
+#if defined(HAVE_DRMSYNCOBJEVENTFD)
+    pfd.fd = eventFd;
+    pfd.events = POLLIN;
+    CHECK(poll(&pfd, 1, 0) == 1);
+#else
+    (void) pfd;
+#endif
+    close(eventFd);
+
+    CHECK(drmSyncobjDestroy(-1, imported) == 0);
+    CHECK(drmSyncobjDestroy(-1, handle) == 0);
+
+    mockDrmGetStats(&stats);
+    CHECK(stats.syncobjs == 0);
+}
+
+static void testPlatform(MockEgl *platform)
+{
+    EGLDisplay  dpy;
+    const char *exts;
+    struct wl_display *wlDpy;
+    int         fds[2];
+
+    CHECK(platform->initialize && platform->terminate);
+    CHECK(platform->chooseConfig && platform->getConfigAttrib);
+    CHECK(platform->createPlatformWindowSurface && platform->destroySurface);
+    CHECK(platform->swapBuffers && platform->swapBuffersWithDamage);
+    CHECK(platform->swapInterval && platform->querySurface);
+    CHECK(platform->createStreamAttrib);
+    CHECK(platform->bindWaylandDisplay && platform->unbindWaylandDisplay);
+
+    exts = platform->platform.exports.queryString(platform->platform.data,
+                                                  EGL_NO_DISPLAY,
+                                                  EGL_EXT_PLATFORM_PLATFORM_CLIENT_EXTENSIONS);
+    CHECK(exts && strstr(exts, "EGL_KHR_platform_wayland"));
+
+    /* A compositor that went away mustn't take the platform down with it */
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0);
+    close(fds[1]);
+    wlDpy = wl_display_connect_to_fd(fds[0]);
+    CHECK(wlDpy != NULL);
+
+    dpy = mockEglGetDisplay(platform, wlDpy, NULL);
+    CHECK(dpy == EGL_NO_DISPLAY);
+
+    wl_display_disconnect(wlDpy);
+}
+
+int main(void)
+{
+    MockEglOptions options;
+    MockEgl        platform;
+
+    /* The environment is for benchmarks, tests want the defaults */
+    memset(&options, 0, sizeof(options));
+    options.numImages       = MOCK_EGL_MAX_IMAGES;
+    options.explicitSync    = EGL_TRUE;
+    options.fifoSynchronous = EGL_TRUE;
+    options.streamFlush     = EGL_TRUE;
+    options.imageConsumer   = EGL_TRUE;
+
+    CHECK(mockEglLoad(&platform, &options));
+    getProcs();
+
+    testDriverLoad();
+    testImageStream();
+    testMailbox();
+    testDisconnect();
+    testExplicitSyncProbe();
+    testSyncobjTimeline();
+    testPlatform(&platform);
+
+    CHECK(egl.terminate(mockEglGetDeviceDisplay()));
+    mockEglUnload(&platform);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2024, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Runs window surfaces end to end, from the platform on the mock driver to
+ * the mock compositor, over dma-buf with and without explicit sync, and over
+ * EGLStream, as well as with the optional helper threads.
+ */
+
+#include "mock-egl-driver.h"
+#include "mock-compositor.h"
+#include "wayland-eglsurface.h"
+#include "wayland-eglswap.h"
+
+#include <wayland-client.h>
+#include <wayland-egl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK(_COND_)                                                   \
+    do {                                                                \
+        if (!(_COND_)) {                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #_COND_);                       \
+            exit(EXIT_FAILURE);                                         \
+        }                                                               \
+    } while (0)
+
+/* Fast enough for the tests not to wait on it for long */
+#define TEST_REFRESH_MHZ 1000000
+
+#define TEST_FRAMES 30
+
+typedef struct TestClientRec {
+    MockEgl              *platform;
+    MockCompositor       *comp;
+    struct wl_display    *wlDpy;
+    struct wl_compositor *wlCompositor;
+    struct wl_surface    *wlSurface;
+    struct wl_egl_window *window;
+    EGLDisplay            dpy;
+    EGLSurface            surface;
+} TestClient;
+
+static void registryGlobal(void *data, struct wl_registry *registry,
+                           uint32_t name, const char *interface,
+                           uint32_t version)
+{
+    TestClient *client = data;
+
+    (void) version;
+
+    if (!strcmp(interface, wl_compositor_interface.name)) {
+        client->wlCompositor = wl_registry_bind(registry, name,
+                                                &wl_compositor_interface, 4);
+    }
+}
+
+static void registryGlobalRemove(void *data, struct wl_registry *registry,
+                                 uint32_t name)
+{
+    (void) data;
+    (void) registry;
+    (void) name;
+}
+
+static const struct wl_registry_listener registryListener = {
+    registryGlobal,
+    registryGlobalRemove,
+};
+
+static void startClient(TestClient *client, MockEgl *platform,
+                        const MockCompositorOptions *options)
+{
+    static const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_ALPHA_SIZE,   8,
+        EGL_NONE,
+    };
+    struct wl_registry *registry;
+    EGLConfig config;
+    EGLint    numConfigs;
+
+    memset(client, 0, sizeof(*client));
+    client->platform = platform;
+
+    client->comp = mockCompositorCreate(options, platform);
+    CHECK(client->comp != NULL);
+    client->wlDpy = mockCompositorConnect(client->comp);
+    CHECK(client->wlDpy != NULL);
+
+    registry = wl_display_get_registry(client->wlDpy);
+    CHECK(registry != NULL);
+    wl_registry_add_listener(registry, &registryListener, client);
+    CHECK(wl_display_roundtrip(client->wlDpy) >= 0);
+    wl_registry_destroy(registry);
+    CHECK(client->wlCompositor != NULL);
+
+    client->dpy = mockEglGetDisplay(platform, client->wlDpy, NULL);
+    CHECK(client->dpy != EGL_NO_DISPLAY);
+    CHECK(platform->initialize(client->dpy, NULL, NULL));
+    CHECK(platform->chooseConfig(client->dpy, configAttribs, &config, 1,
+                                 &numConfigs));
+    CHECK(numConfigs == 1);
+
+    client->wlSurface = wl_compositor_create_surface(client->wlCompositor);
+    CHECK(client->wlSurface != NULL);
+    client->window = wl_egl_window_create(client->wlSurface, 64, 32);
+    CHECK(client->window != NULL);
+
+    client->surface = platform->createPlatformWindowSurface(client->dpy,
+                                                            config,
+                                                            client->window,
+                                                            NULL);
+    CHECK(client->surface != EGL_NO_SURFACE);
+    CHECK(mockEglMakeCurrent(client->dpy, client->surface, client->surface,
+                             MOCK_EGL_CONTEXT));
+}
+
+static void stopClient(TestClient *client)
+{
+    CHECK(mockEglMakeCurrent(client->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                             EGL_NO_CONTEXT));
+    CHECK(client->platform->destroySurface(client->dpy, client->surface));
+    CHECK(client->platform->terminate(client->dpy));
+
+    wl_egl_window_destroy(client->window);
+    wl_surface_destroy(client->wlSurface);
+    wl_compositor_destroy(client->wlCompositor);
+    wl_display_disconnect(client->wlDpy);
+
+    mockCompositorDestroy(client->comp);
+}
+
+static void swapFrames(TestClient *client, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        CHECK(client->platform->swapBuffers(client->dpy, client->surface));
+    }
+}
+
+/* Counts the threads of this process that go by name, e.g. "nvwl-io" */
+static int countThreads(const char *name)
+{
+    struct dirent *entry;
+    char           path[64];
+    char           comm[32];
+    FILE          *file;
+    DIR           *dir;
+    int            count = 0;
+
+    dir = opendir("/proc/self/task");
+    CHECK(dir != NULL);
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", entry->d_name);
+        file = fopen(path, "r");
+        if (!file) {
+            continue;
+        }
+        if (fgets(comm, sizeof(comm), file)) {
+            comm[strcspn(comm, "\n")] = '\0';
+            if (!strcmp(comm, name)) {
+                count++;
+            }
+        }
+        fclose(file);
+    }
+    closedir(dir);
+
+    return count;
+}
+
+static void getOptions(MockCompositorOptions *options)
+{
+    /* The environment is for benchmarks, tests want the defaults */
+    memset(options, 0, sizeof(*options));
+    options->refreshMhz    = TEST_REFRESH_MHZ;
+    options->dmabufVersion = 4;
+    options->presentation  = EGL_TRUE;
+}
+
+static void testDmabuf(MockEgl *platform, EGLBoolean explicitSync)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    TestClient            client;
+    uint64_t              created;
+
+    getOptions(&options);
+    options.explicitSync = explicitSync;
+    startClient(&client, platform, &options);
+
+    swapFrames(&client, TEST_FRAMES);
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.commits >= TEST_FRAMES);
+    CHECK(stats.framesPresented > 0);
+    CHECK(stats.frameCallbacks > 0);
+    CHECK(stats.buffersReleased > 0);
+    CHECK(stats.unsignaledAcquires == 0);
+    CHECK(stats.buffersAlive <= MOCK_EGL_MAX_IMAGES);
+
+    /* A resize gets new buffers */
+    created = stats.buffersCreated;
+    wl_egl_window_resize(client.window, 128, 64, 0, 0);
+    swapFrames(&client, TEST_FRAMES);
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.buffersCreated > created);
+    CHECK(stats.peakBufferBytes >= 128 * 64 * 4);
+
+    /* Moving the window without changing its size keeps them */
+    created = stats.buffersCreated;
+    wl_egl_window_resize(client.window, 128, 64, 8, 8);
+    swapFrames(&client, TEST_FRAMES);
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.buffersCreated == created);
+
+    /* So does new feedback */
+    created = stats.buffersCreated;
+    mockCompositorResendFeedback(client.comp);
+    swapFrames(&client, TEST_FRAMES);
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.feedbackSends >= 2);
+    CHECK(stats.buffersCreated > created);
+
+    stopClient(&client);
+}
+
+/* A compositor that holds on to buffers, as KWin does, must not stall us */
+static void testHeldBuffers(MockEgl *platform)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    TestClient            client;
+
+    getOptions(&options);
+    options.explicitSync   = EGL_TRUE;
+    options.heldBuffers    = 1;
+    options.releaseDelayUs = 2000;
+    startClient(&client, platform, &options);
+
+    swapFrames(&client, TEST_FRAMES);
+
+    /* And picks up again at full speed once they come back right away */
+    mockCompositorSetHeldBuffers(client.comp, 0);
+    mockCompositorSetReleaseDelay(client.comp, 0);
+    swapFrames(&client, TEST_FRAMES);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.framesPresented > 0);
+    CHECK(stats.buffersReleased > 0);
+
+    stopClient(&client);
+}
+
+static void getCounters(TestClient *client, WlEglSurfaceCounters *counters)
+{
+    CHECK(wlEglQuerySurfaceCountersExport((WlEglSurface *)client->surface,
+                                          counters, sizeof(*counters)) == 0);
+}
+
+/* Idle and occluded surfaces give their stream images back */
+static void testTrim(MockEgl *platform)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    WlEglSurfaceCounters  before, counters;
+    TestClient            client;
+
+    getOptions(&options);
+    setenv("__NV_WAYLAND_TRIM_IDLE_MS", "50", 1);
+    startClient(&client, platform, &options);
+    unsetenv("__NV_WAYLAND_TRIM_IDLE_MS");
+
+    swapFrames(&client, TEST_FRAMES);
+    getCounters(&client, &before);
+    CHECK(before.reallocsTrim == 0);
+
+    /* Frame callbacks as late as a hidden surface's drop a frame, once */
+    mockCompositorSetRefresh(client.comp, 5000);
+    swapFrames(&client, 3);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 1);
+    CHECK(counters.framesDropped > before.framesDropped);
+
+    /* Presenting steadily again doesn't trim */
+    mockCompositorSetRefresh(client.comp, TEST_REFRESH_MHZ);
+    swapFrames(&client, TEST_FRAMES);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 1);
+
+    /* A swap long after the previous one trims once its frame is out */
+    usleep(100000);
+    swapFrames(&client, 1);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 2);
+    swapFrames(&client, TEST_FRAMES);
+
+    /* The export trims right away on the thread the surface is current on */
+    CHECK(wlEglTrimSurfaceExport((WlEglSurface *)client.surface) >= 0);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 3);
+
+    /* And defers it to the next swap otherwise */
+    CHECK(mockEglMakeCurrent(client.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                             EGL_NO_CONTEXT));
+    CHECK(wlEglTrimSurfaceExport((WlEglSurface *)client.surface) >= 0);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 3);
+    CHECK(mockEglMakeCurrent(client.dpy, client.surface, client.surface,
+                             MOCK_EGL_CONTEXT));
+    swapFrames(&client, 1);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsTrim == 4);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+
+    stopClient(&client);
+}
+
+/* Stream events handled on __NV_WAYLAND_CONSUMER_THREAD=1 */
+static void testConsumerThread(MockEgl *platform, EGLBoolean explicitSync)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    WlEglSurfaceCounters  counters;
+    TestClient            client;
+    int                   i;
+
+    getOptions(&options);
+    options.explicitSync = explicitSync;
+    setenv("__NV_WAYLAND_CONSUMER_THREAD", "1", 1);
+    startClient(&client, platform, &options);
+    CHECK(countThreads("nvwl-consumer") == 1);
+
+    /* Every swap waits for the thread to have acquired its frame */
+    swapFrames(&client, TEST_FRAMES);
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.commits >= TEST_FRAMES);
+    CHECK(stats.framesPresented > 0);
+    CHECK(stats.buffersReleased > 0);
+    CHECK(stats.unsignaledAcquires == 0);
+
+    /*
+     * Each resize stops the thread and starts a new one on the new stream.
+     * Disconnecting the stream wakes the old thread up, so reallocating
+     * doesn't wait out its 50ms timeout.
+     */
+    for (i = 0; i < 8; i++) {
+        wl_egl_window_resize(client.window, 64 + (i + 1) * 16, 32, 0, 0);
+        swapFrames(&client, 2);
+    }
+    /* The new threads check the environment too */
+    unsetenv("__NV_WAYLAND_CONSUMER_THREAD");
+    CHECK(countThreads("nvwl-consumer") == 1);
+    getCounters(&client, &counters);
+    CHECK(counters.reallocsResize >= 8);
+    CHECK(counters.realloc.maxNs < 25000000);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.commits >= TEST_FRAMES + 16);
+
+    stopClient(&client);
+    CHECK(countThreads("nvwl-consumer") == 0);
+}
+
+/* Frame callbacks read and dispatched by __NV_WAYLAND_IO_THREAD=1 */
+static void testIoThread(MockEgl *platform)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    TestClient            client;
+
+    getOptions(&options);
+    setenv("__NV_WAYLAND_IO_THREAD", "1", 1);
+    startClient(&client, platform, &options);
+    unsetenv("__NV_WAYLAND_IO_THREAD");
+
+    /* The wl_display is the test's, the thread runs all the same */
+    CHECK(countThreads("nvwl-io") == 1);
+
+    swapFrames(&client, TEST_FRAMES);
+
+    /* Swaps that have to wait for their frame callback get woken up */
+    mockCompositorSetRefresh(client.comp, 200000);
+    swapFrames(&client, 5);
+    mockCompositorSetRefresh(client.comp, TEST_REFRESH_MHZ);
+
+    wl_egl_window_resize(client.window, 128, 64, 0, 0);
+    swapFrames(&client, TEST_FRAMES);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.commits >= 2 * TEST_FRAMES + 5);
+    CHECK(stats.frameCallbacks > 0);
+    CHECK(stats.framesPresented > 0);
+
+    /* Terminating an app's display joins the thread */
+    stopClient(&client);
+    CHECK(countThreads("nvwl-io") == 0);
+}
+
+/* Presenting without blocking, waiting on the ready fd in between */
+static void testReadyFd(MockEgl *platform)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    TestClient            client;
+    WlEglSurface         *surface;
+    struct pollfd         pfd;
+    uint64_t              value;
+    EGLint                ret;
+    int                   fd, i;
+
+    getOptions(&options);
+    options.explicitSync = EGL_TRUE;
+    startClient(&client, platform, &options);
+    surface = (WlEglSurface *)client.surface;
+
+    CHECK(wlEglTryPrePresentExport(NULL) == EGL_FALSE);
+
+    fd = wlEglGetSurfaceReadyFdExport(surface);
+    CHECK(fd >= 0);
+    CHECK(wlEglGetSurfaceReadyFdExport(surface) == fd);
+    CHECK(countThreads("nvwl-ready") == 1);
+
+    /* At 5Hz the next frame callback is a good while off after a swap */
+    mockCompositorSetRefresh(client.comp, 5000);
+    swapFrames(&client, 2);
+    CHECK(wlEglTryPrePresentExport(surface) == EGL_TIMEOUT_EXPIRED_KHR);
+
+    /* The fd wakes us up for it, possibly more than once */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (i = 0; i < 10; i++) {
+        CHECK(poll(&pfd, 1, 1000) == 1);
+        CHECK(read(fd, &value, sizeof(value)) == sizeof(value));
+        ret = wlEglTryPrePresentExport(surface);
+        if (ret != EGL_TIMEOUT_EXPIRED_KHR) {
+            break;
+        }
+    }
+    CHECK(ret == EGL_CONDITION_SATISFIED_KHR);
+
+    /* And the swap it said was ready goes through */
+    swapFrames(&client, 1);
+    mockCompositorSetRefresh(client.comp, TEST_REFRESH_MHZ);
+    swapFrames(&client, TEST_FRAMES);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.framesPresented > 0);
+
+    stopClient(&client);
+    CHECK(countThreads("nvwl-ready") == 0);
+}
+
+static void testEGLStream(MockEgl *platform)
+{
+    MockCompositorOptions options;
+    MockCompositorStats   stats;
+    TestClient            client;
+
+    getOptions(&options);
+    options.dmabufVersion = 0;
+    options.eglstream     = EGL_TRUE;
+    startClient(&client, platform, &options);
+
+    swapFrames(&client, TEST_FRAMES);
+    wl_egl_window_resize(client.window, 128, 64, 0, 0);
+    swapFrames(&client, TEST_FRAMES);
+
+    mockCompositorGetStats(client.comp, &stats);
+    CHECK(stats.protocolErrors == 0);
+    CHECK(stats.commits >= 2 * TEST_FRAMES);
+    CHECK(stats.eglstreamFrames > 0);
+    CHECK(stats.buffersCreated == 0);
+
+    stopClient(&client);
+}
+
+int main(void)
+{
+    MockEglOptions      options;
+    MockEgl             platform;
+    PFNEGLTERMINATEPROC terminate;
+
+    memset(&options, 0, sizeof(options));
+    options.numImages       = MOCK_EGL_MAX_IMAGES;
+    options.explicitSync    = EGL_TRUE;
+    options.fifoSynchronous = EGL_TRUE;
+    options.streamFlush     = EGL_TRUE;
+    options.imageConsumer   = EGL_TRUE;
+
+    /* A hang is a failure too */
+    alarm(60);
+
+    CHECK(mockEglLoad(&platform, &options));
+
+    testDmabuf(&platform, EGL_TRUE);
+    testDmabuf(&platform, EGL_FALSE);
+    testHeldBuffers(&platform);
+    testTrim(&platform);
+    testConsumerThread(&platform, EGL_TRUE);
+    testConsumerThread(&platform, EGL_FALSE);
+    testIoThread(&platform);
+    testReadyFd(&platform);
+    testEGLStream(&platform);
+
+    /* The EGLStream compositor initialized the device display */
+    terminate = (PFNEGLTERMINATEPROC)mockEglGetProcAddress("eglTerminate");
+    CHECK(terminate(mockEglGetDeviceDisplay()));
+    mockEglUnload(&platform);
+
+    return EXIT_SUCCESS;
+}